@@ -0,0 +1,16 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_CPU_FLAGS_H_
+#define CRAS_CPU_FLAGS_H_
+
+/* SIMD optimisation flags, used to pick the mixer and DSP implementations at
+ * runtime. */
+#define CPU_X86_SSE4_2 1
+#define CPU_X86_AVX 2
+#define CPU_X86_AVX2 4
+#define CPU_X86_FMA 8
+
+#endif /* CRAS_CPU_FLAGS_H_ */
@@ -58,6 +58,7 @@ enum CRAS_SERVER_MESSAGE_ID {
 	CRAS_SERVER_DUMP_BT,
 	CRAS_SERVER_SET_BT_WBS_ENABLED,
 	CRAS_SERVER_GET_ATLOG_FD,
+	CRAS_SERVER_SET_ATLOG_TRACE,
 };
 
 enum CRAS_CLIENT_MESSAGE_ID {
@@ -79,6 +80,7 @@ enum CRAS_CLIENT_MESSAGE_ID {
 	CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED,
 	/* Server -> Client */
 	CRAS_CLIENT_ATLOG_FD_READY,
+	CRAS_CLIENT_ATLOG_TRACE_READY,
 };
 
 /* Messages that control the server. These are sent from the client to affect
@@ -352,6 +354,22 @@ static inline void cras_fill_get_atlog_fd(struct cras_get_atlog_fd *m)
 	m->header.length = sizeof(*m);
 }
 
+/* Starts or stops streaming the audio thread events to a trace ring.
+ *    num_events - The requested size of the ring, 0 to stop the trace.
+ */
+struct __attribute__((__packed__)) cras_set_atlog_trace {
+	struct cras_server_message header;
+	uint32_t num_events;
+};
+
+static inline void cras_fill_set_atlog_trace(struct cras_set_atlog_trace *m,
+					     uint32_t num_events)
+{
+	m->header.id = CRAS_SERVER_SET_ATLOG_TRACE;
+	m->header.length = sizeof(*m);
+	m->num_events = num_events;
+}
+
 /* Dump bluetooth events and state changes. */
 struct __attribute__((__packed__)) cras_dump_bt {
 	struct cras_server_message header;
@@ -602,6 +620,22 @@ cras_fill_client_atlog_fd_ready(struct cras_client_atlog_fd_ready *m)
 	m->header.length = sizeof(*m);
 }
 
+/* Reply to starting an atlog trace. The fd of the ring is attached when err
+ * is 0, otherwise err is the negative error code. */
+struct __attribute__((__packed__)) cras_client_atlog_trace_ready {
+	struct cras_client_message header;
+	int32_t err;
+};
+
+static inline void
+cras_fill_client_atlog_trace_ready(struct cras_client_atlog_trace_ready *m,
+				   int32_t err)
+{
+	m->header.id = CRAS_CLIENT_ATLOG_TRACE_READY;
+	m->header.length = sizeof(*m);
+	m->err = err;
+}
+
 /* Sent from server to client when hotword models info is ready. */
 struct __attribute__((__packed__)) cras_client_get_hotword_models_ready {
 	struct cras_client_message header;
@@ -3,6 +3,11 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For memfd_create() */
+#endif
+
+#include <fcntl.h>
 #include <sys/cdefs.h>
 #include <sys/mman.h>
 #ifdef __BIONIC__
@@ -18,6 +23,10 @@
 
 #include "cras_shm.h"
 
+/* Samples areas at least this large are mapped with transparent huge pages
+ * where the kernel allows it for shmem. */
+#define CRAS_SHM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 int cras_shm_info_init(const char *stream_name, uint32_t length,
 		       struct cras_shm_info *info_out)
 {
@@ -29,7 +38,13 @@ int cras_shm_info_init(const char *stream_name, uint32_t length,
 	strncpy(info.name, stream_name, sizeof(info.name) - 1);
 	info.name[sizeof(info.name) - 1] = '\0';
 	info.length = length;
-	info.fd = cras_shm_open_rw(info.name, info.length);
+	info.fd = cras_shm_open_sealed(info.name, info.length);
+	if (info.fd >= 0) {
+		/* Nothing to unlink. */
+		info.name[0] = '\0';
+	} else {
+		info.fd = cras_shm_open_rw(info.name, info.length);
+	}
 	if (info.fd < 0)
 		return info.fd;
 
@@ -87,6 +102,30 @@ void cras_shm_info_cleanup(struct cras_shm_info *info)
 	info->name[0] = '\0';
 }
 
+/* Makes the pages of a mapping resident, locked in memory when the memlock
+ * limit allows it, otherwise just faulted in. */
+static void prefault_range(void *addr, size_t length, int prot)
+{
+	volatile const uint8_t *p = (volatile const uint8_t *)addr;
+	size_t page_size, i;
+
+	if (mlock(addr, length) == 0)
+		return;
+
+#ifdef MADV_POPULATE_READ
+	if (madvise(addr, length,
+		    (prot & PROT_WRITE) ? MADV_POPULATE_WRITE :
+					  MADV_POPULATE_READ) == 0)
+		return;
+#endif
+
+	if (!(prot & PROT_READ))
+		return;
+	page_size = sysconf(_SC_PAGESIZE);
+	for (i = 0; i < length; i += page_size)
+		(void)p[i];
+}
+
 int cras_audio_shm_create(struct cras_shm_info *header_info,
 			  struct cras_shm_info *samples_info, int samples_prot,
 			  struct cras_audio_shm **shm_out)
@@ -142,6 +181,11 @@ int cras_audio_shm_create(struct cras_shm_info *header_info,
 		       "cras_shm: mmap failed to map shm for samples.");
 		goto free_shm;
 	}
+	/* Large multichannel areas span many pages, ask for huge pages to
+	 * save TLB misses on every period. Best effort, shmem THP may be
+	 * disabled. */
+	if (shm->samples_info.length >= CRAS_SHM_HUGE_PAGE_SIZE)
+		madvise(shm->samples, shm->samples_info.length, MADV_HUGEPAGE);
 
 	cras_shm_set_volume_scaler(shm, 1.0);
 
@@ -156,6 +200,13 @@ cleanup_info:
 	return ret;
 }
 
+void cras_audio_shm_prefault(struct cras_audio_shm *shm, int samples_prot)
+{
+	prefault_range(shm->header, shm->header_info.length,
+		       PROT_READ | PROT_WRITE);
+	prefault_range(shm->samples, shm->samples_info.length, samples_prot);
+}
+
 void cras_audio_shm_destroy(struct cras_audio_shm *shm)
 {
 	if (!shm)
@@ -236,6 +287,11 @@ void cras_shm_close_unlink(const char *name, int fd)
 	close(fd);
 }
 
+int cras_shm_open_sealed(const char *name, size_t size)
+{
+	return -ENOSYS;
+}
+
 #else
 
 int cras_shm_open_rw(const char *name, size_t size)
@@ -282,6 +338,39 @@ void cras_shm_close_unlink(const char *name, int fd)
 	close(fd);
 }
 
+int cras_shm_open_sealed(const char *name, size_t size)
+{
+	int fd;
+	int rc;
+
+	/* Eliminate the / in the shm_name, it's only a debugging label. */
+	if (name[0] == '/')
+		name++;
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	rc = posix_fallocate(fd, 0, size);
+	if (rc) {
+		syslog(LOG_ERR, "failed to set size of memfd %s: %s\n", name,
+		       strerror(rc));
+		close(fd);
+		return -rc;
+	}
+
+	/* The peer can't truncate the area under the other end's mapping. */
+	if (fcntl(fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		rc = -errno;
+		syslog(LOG_ERR, "failed to seal memfd %s: %s\n", name,
+		       strerror(-rc));
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
 #endif
 
 void *cras_shm_setup(const char *name, size_t mmap_size, int *rw_fd_out,
@@ -7,9 +7,13 @@
 #define CRAS_SHM_H_
 
 #include <assert.h>
+#include <linux/futex.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "cras_types.h"
 #include "cras_util.h"
@@ -27,6 +31,74 @@ struct __attribute__((__packed__)) cras_audio_shm_config {
 	uint32_t frame_bytes;
 };
 
+/* Words used instead of audio messages to signal requests and replies on
+ * streams connected with the SHM_WAKEUP flag. The server fills in a request
+ * and wakes the client audio thread through |futex|. The client fills in the
+ * reply and writes to the eventfd of the stream.
+ *
+ *  futex - Incremented for each request, and by the client to stop its audio
+ *    thread. The client audio thread sleeps on it with FUTEX_WAIT.
+ *  client_waiting - Non-zero while the client audio thread may be sleeping on
+ *    |futex|. FUTEX_WAKE is skipped when it is zero.
+ *  request_seq - Incremented by the server once a request is filled in.
+ *  request_id - The CRAS_AUDIO_MESSAGE_ID of the request.
+ *  request_frames - The number of frames requested or captured.
+ *  reply_seq - Set to request_seq by the client once the request is handled.
+ *  reply_frames - The number of frames written or read by the client.
+ *  reply_error - Negative error code from the client, 0 on success.
+ */
+struct __attribute__((__packed__)) cras_shm_wake {
+	uint32_t futex;
+	uint32_t client_waiting;
+	uint32_t request_seq;
+	uint32_t request_id;
+	uint32_t request_frames;
+	uint32_t reply_seq;
+	uint32_t reply_frames;
+	int32_t reply_error;
+};
+
+/* Layouts of the samples area.
+ *
+ *  CRAS_SHM_LAYOUT_DOUBLE_BUFFER - Two buffers of used_size bytes that the
+ *    writer fills and the reader drains in turn. Used unless both ends agree
+ *    on another layout, since old peers leave the layout word zeroed.
+ *  CRAS_SHM_LAYOUT_RING - A single-producer single-consumer ring of
+ *    ring.size frames, a power of two. The writer can queue any amount that
+ *    fits and the reader can consume any part of it, see struct
+ *    cras_shm_ring.
+ */
+enum CRAS_SHM_LAYOUT {
+	CRAS_SHM_LAYOUT_DOUBLE_BUFFER = 0,
+	CRAS_SHM_LAYOUT_RING = 1,
+};
+
+/* Position of the reader and writer in a CRAS_SHM_LAYOUT_RING samples area.
+ * The counters only increase and are allowed to wrap, so the number of frames
+ * queued is always write - read and the position of a counter in the ring is
+ * its value modulo size. The size is a power of two so that position stays
+ * the same when a counter wraps at 2^32.
+ *
+ *  size - The number of frames in the ring, a power of two. Set by the
+ *    server.
+ *  read - Frames consumed by the reader so far.
+ *  write - Frames published by the writer so far.
+ *  low_watermark - For PULL_MODE streams, the server notifies the client when
+ *    the frames queued drop to this level. Zero disables the notification.
+ *  underruns - For PULL_MODE streams, the number of times the server played
+ *    silence because the ring didn't have enough frames.
+ *  underrun_frames - The number of device frames of silence played for those
+ *    underruns.
+ */
+struct __attribute__((__packed__)) cras_shm_ring {
+	uint32_t size;
+	uint32_t read;
+	uint32_t write;
+	uint32_t low_watermark;
+	uint32_t underruns;
+	uint32_t underrun_frames;
+};
+
 /* Structure containing stream metadata shared between client and server.
  *
  *  config - Size config data.  A copy of the config shared with clients.
@@ -46,6 +118,10 @@ struct __attribute__((__packed__)) cras_audio_shm_config {
  *    This is only valid in audio callbacks.
  *  buffer_offset - Offset of each buffer from start of samples area.
  *                  Valid range: 0 <= buffer_offset <= shm->samples_info.length
+ *  wake - Requests and replies of a SHM_WAKEUP stream.
+ *  layout - The CRAS_SHM_LAYOUT of the samples area. The buffer fields above
+ *    are unused with CRAS_SHM_LAYOUT_RING.
+ *  ring - Read and write counters of a CRAS_SHM_LAYOUT_RING samples area.
  */
 struct __attribute__((__packed__)) cras_audio_shm_header {
 	struct cras_audio_shm_config config;
@@ -60,6 +136,9 @@ struct __attribute__((__packed__)) cras_audio_shm_header {
 	uint32_t num_overruns;
 	struct cras_timespec ts;
 	uint64_t buffer_offset[CRAS_NUM_SHM_BUFFERS];
+	struct cras_shm_wake wake;
+	uint32_t layout;
+	struct cras_shm_ring ring;
 };
 
 /* Returns the number of bytes needed to hold a cras_audio_shm_header. */
@@ -89,7 +168,8 @@ struct cras_shm_info {
 };
 
 /* Initializes a cras_shm_info to be used as the backing shared memory for a
- * cras_audio_shm.
+ * cras_audio_shm. Uses a sealed memfd where available, see
+ * cras_shm_open_sealed(), and a named shm area otherwise.
  *
  * shm_name - the name of the shm area to create.
  * length - the length of the shm area to create.
@@ -123,6 +203,9 @@ void cras_shm_info_cleanup(struct cras_shm_info *info);
  *  header - Shm region containing audio metadata
  *  samples_info - fd, name, and length of shm containing samples.
  *  samples - Shm region containing audio data.
+ *  layout - The CRAS_SHM_LAYOUT of the samples area.
+ *  ring_frames - Size of the ring in frames with CRAS_SHM_LAYOUT_RING. Like
+ *    config, kept separate from the header so it can be trusted.
  */
 struct cras_audio_shm {
 	struct cras_audio_shm_config config;
@@ -130,9 +213,13 @@ struct cras_audio_shm {
 	struct cras_audio_shm_header *header;
 	struct cras_shm_info samples_info;
 	uint8_t *samples;
+	uint32_t layout;
+	uint32_t ring_frames;
 };
 
-/* Sets up a cras_audio_shm given info about the shared memory to use
+/* Sets up a cras_audio_shm given info about the shared memory to use. Both
+ * areas are faulted in, and locked in memory if the memlock limit allows it,
+ * so the first periods of a stream don't page fault on an audio thread.
  *
  * header_info - the underlying shm area to use for the header. The shm
  *               will be managed by the created cras_audio_shm object.
@@ -153,6 +240,15 @@ int cras_audio_shm_create(struct cras_shm_info *header_info,
 			  struct cras_shm_info *samples_info, int samples_prot,
 			  struct cras_audio_shm **shm_out);
 
+/* Makes the pages of |shm| resident so the audio thread doesn't fault on them
+ * when the stream starts, locking them in memory if the memlock limit allows.
+ * Only meant for the server, clients keep their memory pageable.
+ *
+ * shm - the cras_audio_shm to prefault.
+ * samples_prot - the protections the samples were mapped with.
+ */
+void cras_audio_shm_prefault(struct cras_audio_shm *shm, int samples_prot);
+
 /* Destroys a cras_audio_shm returned from cras_audio_shm_create.
  *
  * shm - the cras_audio_shm to destroy.
@@ -220,6 +316,38 @@ cras_shm_get_checked_write_offset(const struct cras_audio_shm *shm,
 	return write_offset;
 }
 
+/* Returns non-zero if the samples area is laid out as a ring. */
+static inline int cras_shm_is_ring(const struct cras_audio_shm *shm)
+{
+	return shm->layout == CRAS_SHM_LAYOUT_RING;
+}
+
+/* Returns the number of frames queued in the ring, limited to its size in
+ * case the counters were corrupted by the other end. */
+static inline uint32_t cras_shm_ring_queued(const struct cras_audio_shm *shm)
+{
+	uint32_t write, read;
+
+	write = __atomic_load_n(&shm->header->ring.write, __ATOMIC_ACQUIRE);
+	read = __atomic_load_n(&shm->header->ring.read, __ATOMIC_ACQUIRE);
+	return MIN(write - read, shm->ring_frames);
+}
+
+/* Returns the number of frames that can be written to the ring, possibly
+ * wrapping around its end. */
+static inline uint32_t cras_shm_ring_free(const struct cras_audio_shm *shm)
+{
+	return shm->ring_frames - cras_shm_ring_queued(shm);
+}
+
+/* Returns a pointer to the frame at |counter| in the ring. */
+static inline uint8_t *cras_shm_ring_frame(const struct cras_audio_shm *shm,
+					   uint32_t counter)
+{
+	return shm->samples +
+	       (size_t)(counter % shm->ring_frames) * shm->config.frame_bytes;
+}
+
 /* Get the number of frames readable in current read buffer */
 static inline unsigned
 cras_shm_get_curr_read_frames(const struct cras_audio_shm *shm)
@@ -244,12 +372,16 @@ cras_shm_get_read_buffer_base(const struct cras_audio_shm *shm)
 	return cras_shm_buff_for_idx(shm, i);
 }
 
-/* Get the base of the current write buffer. */
+/* Get the base of the current write buffer. With a ring this is the position
+ * of the write counter. */
 static inline uint8_t *
 cras_shm_get_write_buffer_base(const struct cras_audio_shm *shm)
 {
 	unsigned i = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	if (cras_shm_is_ring(shm))
+		return cras_shm_ring_frame(shm, shm->header->ring.write);
+
 	return cras_shm_buff_for_idx(shm, i);
 }
 
@@ -288,6 +420,19 @@ cras_shm_get_readable_frames(const struct cras_audio_shm *shm, size_t offset,
 
 	assert(frames != NULL);
 
+	if (cras_shm_is_ring(shm)) {
+		uint32_t queued = cras_shm_ring_queued(shm);
+		uint32_t pos;
+
+		if (offset >= queued) {
+			*frames = 0;
+			return NULL;
+		}
+		pos = (shm->header->ring.read + offset) % shm->ring_frames;
+		*frames = MIN(queued - offset, shm->ring_frames - pos);
+		return cras_shm_ring_frame(shm, pos);
+	}
+
 	read_offset = cras_shm_get_checked_read_offset(shm, buf_idx);
 	write_offset = cras_shm_get_checked_write_offset(shm, buf_idx);
 	final_offset = read_offset + offset * shm->config.frame_bytes;
@@ -312,6 +457,9 @@ static inline size_t cras_shm_get_bytes_queued(const struct cras_audio_shm *shm)
 	size_t total, i;
 	const unsigned used_size = shm->config.used_size;
 
+	if (cras_shm_is_ring(shm))
+		return cras_shm_ring_queued(shm) * shm->config.frame_bytes;
+
 	total = 0;
 	for (i = 0; i < CRAS_NUM_SHM_BUFFERS; i++) {
 		unsigned read_offset, write_offset;
@@ -353,18 +501,31 @@ cras_shm_get_frames_in_curr_buffer(const struct cras_audio_shm *shm)
 	return (write_offset - read_offset) / shm->config.frame_bytes;
 }
 
-/* Return 1 if there is an empty buffer in the list. */
+/* Return 1 if there is an empty buffer in the list. A ring counts as having
+ * one while at most half of it is queued, the same amount of data a double
+ * buffer holds when its write buffer is empty. */
 static inline int cras_shm_is_buffer_available(const struct cras_audio_shm *shm)
 {
 	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	if (cras_shm_is_ring(shm))
+		return cras_shm_ring_queued(shm) <= shm->ring_frames / 2;
+
 	return (shm->header->write_offset[buf_idx] == 0);
 }
 
-/* How many are available to be written? */
+/* How many are available to be written? With a ring, the number of frames
+ * that can be written contiguously from cras_shm_get_write_buffer_base(). */
 static inline size_t
 cras_shm_get_num_writeable(const struct cras_audio_shm *shm)
 {
+	if (cras_shm_is_ring(shm)) {
+		uint32_t pos = shm->header->ring.write % shm->ring_frames;
+
+		return MIN(shm->ring_frames - cras_shm_ring_queued(shm),
+			   shm->ring_frames - pos);
+	}
+
 	/* Not allowed to write to a buffer twice. */
 	if (!cras_shm_is_buffer_available(shm))
 		return 0;
@@ -430,19 +591,28 @@ static inline void cras_shm_buffer_write_complete(struct cras_audio_shm *shm)
 	shm->header->write_buf_idx = buf_idx;
 }
 
-/* Set the write pointer for the current buffer and complete the write. */
+/* Set the write pointer for the current buffer and complete the write. With a
+ * ring, publishes |frames| written at cras_shm_get_write_buffer_base(). */
 static inline void cras_shm_buffer_written_start(struct cras_audio_shm *shm,
 						 size_t frames)
 {
 	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	if (cras_shm_is_ring(shm)) {
+		__atomic_store_n(&shm->header->ring.write,
+				 shm->header->ring.write + frames,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+
 	shm->header->write_offset[buf_idx] = frames * shm->config.frame_bytes;
 	shm->header->read_offset[buf_idx] = 0;
 	cras_shm_buffer_write_complete(shm);
 }
 
 /* Increment the read pointer.  If it goes past the write pointer for this
- * buffer, move to the next buffer. */
+ * buffer, move to the next buffer. A ring only advances its read counter,
+ * by at most the number of frames queued. */
 static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
 					size_t frames)
 {
@@ -454,6 +624,13 @@ static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
 	if (frames == 0)
 		return;
 
+	if (cras_shm_is_ring(shm)) {
+		frames = MIN(frames, cras_shm_ring_queued(shm));
+		__atomic_store_n(&header->ring.read, header->ring.read + frames,
+				 __ATOMIC_RELEASE);
+		return;
+	}
+
 	header->read_offset[buf_idx] += frames * config->frame_bytes;
 	if (header->read_offset[buf_idx] >= header->write_offset[buf_idx]) {
 		remainder = header->read_offset[buf_idx] -
@@ -546,6 +723,129 @@ static inline int cras_shm_callback_pending(const struct cras_audio_shm *shm)
 	return shm->header->callback_pending;
 }
 
+/* Wakes the client audio thread if it is sleeping in cras_shm_wake_wait().
+ * Args:
+ *    shm - The shm area of the stream.
+ *    force - Call FUTEX_WAKE even if the thread doesn't look asleep. Used by
+ *        the client itself, which doesn't publish a request first.
+ */
+static inline void cras_shm_wake_client(struct cras_audio_shm *shm, int force)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	/* The futex must be 4-byte aligned in the mapping. */
+	assert_on_compile(offsetof(struct cras_audio_shm_header, wake) % 4 ==
+			  0);
+
+	__atomic_add_fetch(&header->wake.futex, 1, __ATOMIC_SEQ_CST);
+	if (force ||
+	    __atomic_load_n(&header->wake.client_waiting, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &header->wake.futex, FUTEX_WAKE, 1, NULL,
+			NULL, 0);
+}
+
+/* Sends a request to the client of a SHM_WAKEUP stream. */
+static inline void cras_shm_wake_request(struct cras_audio_shm *shm,
+					 uint32_t id, uint32_t frames)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	header->wake.request_id = id;
+	header->wake.request_frames = frames;
+	__atomic_add_fetch(&header->wake.request_seq, 1, __ATOMIC_RELEASE);
+	cras_shm_wake_client(shm, 0);
+}
+
+/* Checks if the client replied to the last request of a SHM_WAKEUP stream.
+ * Args:
+ *    shm - The shm area of the stream.
+ *    frames - Filled with the frames in the reply.
+ * Returns:
+ *    0 if there is no reply yet, 1 if there is, or the negative error code
+ *    the client replied with.
+ */
+static inline int cras_shm_wake_get_reply(const struct cras_audio_shm *shm,
+					  uint32_t *frames)
+{
+	const struct cras_audio_shm_header *header = shm->header;
+
+	if (__atomic_load_n(&header->wake.reply_seq, __ATOMIC_ACQUIRE) !=
+	    header->wake.request_seq)
+		return 0;
+	*frames = header->wake.reply_frames;
+	return header->wake.reply_error < 0 ? header->wake.reply_error : 1;
+}
+
+/* Gets the request the client of a SHM_WAKEUP stream hasn't handled yet.
+ * Args:
+ *    shm - The shm area of the stream.
+ *    seq - The sequence number of the last request handled, updated to the
+ *        returned request.
+ *    id - Filled with the CRAS_AUDIO_MESSAGE_ID of the request.
+ *    frames - Filled with the frames of the request.
+ * Returns:
+ *    1 if there is a new request, 0 otherwise.
+ */
+static inline int cras_shm_wake_next_request(const struct cras_audio_shm *shm,
+					     uint32_t *seq, uint32_t *id,
+					     uint32_t *frames)
+{
+	const struct cras_audio_shm_header *header = shm->header;
+	uint32_t request_seq;
+
+	request_seq =
+		__atomic_load_n(&header->wake.request_seq, __ATOMIC_ACQUIRE);
+	if (request_seq == *seq)
+		return 0;
+	*seq = request_seq;
+	*id = header->wake.request_id;
+	*frames = header->wake.request_frames;
+	return 1;
+}
+
+/* Replies to request |seq| of a SHM_WAKEUP stream. The caller then signals
+ * the eventfd of the stream to wake the server. */
+static inline void cras_shm_wake_reply(struct cras_audio_shm *shm,
+				       uint32_t seq, uint32_t frames,
+				       int32_t error)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	header->wake.reply_frames = frames;
+	header->wake.reply_error = error;
+	__atomic_store_n(&header->wake.reply_seq, seq, __ATOMIC_RELEASE);
+}
+
+/* Marks the client audio thread as about to sleep. Must be called before
+ * checking for requests, so a request published after the check either
+ * changes the returned futex value or sees the thread waiting.
+ * Returns:
+ *    The futex value to pass to cras_shm_wake_wait().
+ */
+static inline uint32_t cras_shm_wake_begin_wait(struct cras_audio_shm *shm)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	__atomic_store_n(&header->wake.client_waiting, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&header->wake.futex, __ATOMIC_SEQ_CST);
+}
+
+/* Sleeps until the futex moves past |futex|, or returns right away if it
+ * already has. */
+static inline void cras_shm_wake_wait(struct cras_audio_shm *shm,
+				      uint32_t futex)
+{
+	syscall(SYS_futex, &shm->header->wake.futex, FUTEX_WAIT, futex, NULL,
+		NULL, 0);
+}
+
+/* Marks the client audio thread as awake. */
+static inline void cras_shm_wake_end_wait(struct cras_audio_shm *shm)
+{
+	__atomic_store_n(&shm->header->wake.client_waiting, 0,
+			 __ATOMIC_RELAXED);
+}
+
 /* Sets the starting offset of a buffer */
 static inline void cras_shm_set_buffer_offset(struct cras_audio_shm *shm,
 					      uint32_t buf_idx, uint32_t offset)
@@ -595,12 +895,77 @@ static inline unsigned cras_shm_num_overruns(const struct cras_audio_shm *shm)
 	return shm->header->num_overruns;
 }
 
+/* Lays the samples area out as a ring of |frames| frames and resets its
+ * counters. Used by the server before handing the shm to the client.
+ * Args:
+ *    shm - The shm area, with frame_bytes already set.
+ *    frames - Size of the ring, a power of two that fits in the samples
+ *      area.
+ * Returns:
+ *    0 on success, -EINVAL if the size isn't a power of two or doesn't fit.
+ */
+static inline int cras_shm_set_ring(struct cras_audio_shm *shm,
+				    uint32_t frames)
+{
+	if (frames == 0 || (frames & (frames - 1)) ||
+	    (uint64_t)frames * shm->config.frame_bytes >
+		    shm->samples_info.length)
+		return -EINVAL;
+
+	shm->layout = CRAS_SHM_LAYOUT_RING;
+	shm->ring_frames = frames;
+	shm->header->layout = CRAS_SHM_LAYOUT_RING;
+	shm->header->ring.size = frames;
+	shm->header->ring.read = 0;
+	shm->header->ring.write = 0;
+	shm->header->ring.low_watermark = 0;
+	shm->header->ring.underruns = 0;
+	shm->header->ring.underrun_frames = 0;
+	return 0;
+}
+
+/* Returns the low watermark of the ring, limited to its size in case it was
+ * corrupted by the client. */
+static inline uint32_t
+cras_shm_ring_low_watermark(const struct cras_audio_shm *shm)
+{
+	return MIN(shm->header->ring.low_watermark, shm->ring_frames);
+}
+
+/* Sets the low watermark of the ring. */
+static inline void cras_shm_ring_set_low_watermark(struct cras_audio_shm *shm,
+						   uint32_t frames)
+{
+	shm->header->ring.low_watermark = frames;
+}
+
+/* Records that |frames| frames of silence were played in place of the ring
+ * contents. */
+static inline void cras_shm_ring_underrun(struct cras_audio_shm *shm,
+					  uint32_t frames)
+{
+	shm->header->ring.underruns++;
+	shm->header->ring.underrun_frames += frames;
+}
+
 /* Copy the config from the shm region to the local config.  Used by clients
- * when initially setting up the region.
+ * when initially setting up the region. A ring layout that isn't a power of
+ * two or doesn't fit in the samples area is ignored.
  */
 static inline void cras_shm_copy_shared_config(struct cras_audio_shm *shm)
 {
+	uint32_t frames = shm->header->ring.size;
+
 	memcpy(&shm->config, &shm->header->config, sizeof(shm->config));
+	shm->layout = CRAS_SHM_LAYOUT_DOUBLE_BUFFER;
+	shm->ring_frames = 0;
+	if (shm->header->layout == CRAS_SHM_LAYOUT_RING && frames &&
+	    !(frames & (frames - 1)) &&
+	    (uint64_t)frames * shm->config.frame_bytes <=
+		    shm->samples_info.length) {
+		shm->layout = CRAS_SHM_LAYOUT_RING;
+		shm->ring_frames = frames;
+	}
 }
 
 /* Open a read/write shared memory area with the given name.
@@ -612,6 +977,17 @@ static inline void cras_shm_copy_shared_config(struct cras_audio_shm *shm)
  */
 int cras_shm_open_rw(const char *name, size_t size);
 
+/* Create an anonymous memfd of the given size and seal it against resizing,
+ * so neither end can truncate the area under the other's mapping.
+ * Args:
+ *    name - Label of the area, only used for debugging.
+ *    size - Size of the area.
+ * Returns:
+ *    >= 0 file descriptor value, or negative errno value on error, for
+ *    example -ENOSYS where memfds aren't supported.
+ */
+int cras_shm_open_sealed(const char *name, size_t size);
+
 /* Reopen an existing shared memory area read-only.
  * Args:
  *    name - Name of the shared-memory area.
@@ -105,6 +105,16 @@ cras_stream_direction_mask(const enum CRAS_STREAM_DIRECTION dir)
  *      and does not want to receive data. Used with HOTWORD_STREAM.
  *  SERVER_ONLY - This stream doesn't associate to a client. It's used mainly
  *      for audio data to flow from hardware through iodev's dsp pipeline.
+ *  SHM_WAKEUP - Signal audio requests and replies through the shm header, a
+ *      futex and an eventfd instead of audio messages. The server accepts it
+ *      by sending the eventfd along with the stream connected message.
+ *  SHM_RING - Lay the playback samples area out as a ring with free running
+ *      read and write counters instead of two buffers. The server accepts it
+ *      by setting the layout in the shm header.
+ *  PULL_MODE - The client writes playback samples into the shm ring at its
+ *      own pace, and the server plays whatever is queued. There is no reply
+ *      per period, the client is only notified when the ring drops to its low
+ *      watermark. Needs SHM_RING, the server clears it without a ring.
  */
 enum CRAS_INPUT_STREAM_FLAG {
 	BULK_AUDIO_OK = 0x01,
@@ -112,6 +122,9 @@ enum CRAS_INPUT_STREAM_FLAG {
 	HOTWORD_STREAM = BULK_AUDIO_OK | USE_DEV_TIMING,
 	TRIGGER_ONLY = 0x04,
 	SERVER_ONLY = 0x08,
+	SHM_WAKEUP = 0x10,
+	SHM_RING = 0x20,
+	PULL_MODE = 0x40,
 };
 
 /*
@@ -206,6 +219,44 @@ cras_client_type_str(enum CRAS_CLIENT_TYPE client_type)
 	// clang-format on
 }
 
+/* Stages of the output path timed separately on each device.
+ * CRAS_OUTPUT_STAGE_MIX - Mixing the streams, including their format
+ *     conversion.
+ * CRAS_OUTPUT_STAGE_FMT_CONV - Converting the mix to the sample format and
+ *     channels of the device.
+ * CRAS_OUTPUT_STAGE_DSP - The DSP pipeline of the device.
+ * CRAS_OUTPUT_STAGE_VOLUME - Mute, ramping and software volume, and checking
+ *     whether the output is silent.
+ * CRAS_OUTPUT_STAGE_LOOPBACK - Copying the samples to loopback devices.
+ * CRAS_OUTPUT_STAGE_HW_WRITE - Committing the samples to the hardware.
+ */
+enum CRAS_OUTPUT_STAGE {
+	CRAS_OUTPUT_STAGE_MIX,
+	CRAS_OUTPUT_STAGE_FMT_CONV,
+	CRAS_OUTPUT_STAGE_DSP,
+	CRAS_OUTPUT_STAGE_VOLUME,
+	CRAS_OUTPUT_STAGE_LOOPBACK,
+	CRAS_OUTPUT_STAGE_HW_WRITE,
+	CRAS_NUM_OUTPUT_STAGES,
+};
+
+static inline const char *
+cras_output_stage_str(enum CRAS_OUTPUT_STAGE stage)
+{
+	// clang-format off
+	switch (stage) {
+	ENUM_STR(CRAS_OUTPUT_STAGE_MIX)
+	ENUM_STR(CRAS_OUTPUT_STAGE_FMT_CONV)
+	ENUM_STR(CRAS_OUTPUT_STAGE_DSP)
+	ENUM_STR(CRAS_OUTPUT_STAGE_VOLUME)
+	ENUM_STR(CRAS_OUTPUT_STAGE_LOOPBACK)
+	ENUM_STR(CRAS_OUTPUT_STAGE_HW_WRITE)
+	default:
+		return "INVALID_OUTPUT_STAGE";
+	}
+	// clang-format on
+}
+
 /* Effects that can be enabled for a CRAS stream. */
 enum CRAS_STREAM_EFFECT {
 	APM_ECHO_CANCELLATION = (1 << 0),
@@ -299,6 +350,7 @@ enum AUDIO_THREAD_LOG_EVENTS {
 	AUDIO_THREAD_SEVERE_UNDERRUN,
 	AUDIO_THREAD_CAPTURE_DROP_TIME,
 	AUDIO_THREAD_DEV_DROP_FRAMES,
+	AUDIO_THREAD_STREAMS_ADDED,
 };
 
 /* There are 8 bits of space for events. */
@@ -344,6 +396,157 @@ struct __attribute__((__packed__)) audio_thread_event_log {
 	struct audio_thread_event log[AUDIO_THREAD_EVENT_LOG_SIZE];
 };
 
+/* Tag of the trace records telling how many events the ring dropped. */
+#define AUDIO_THREAD_TRACE_DROPPED 0xff
+
+/* An audio thread event in the trace ring.
+ *    seq - Low 32 bits of the event position plus one, stored last by the
+ *        server so the reader knows the slot is complete.
+ *    tid - The thread that logged the event.
+ *    nsec - CLOCK_MONOTONIC_RAW time of the event in nanoseconds.
+ *    data1, data2, data3 - The event data, as in struct audio_thread_event.
+ *    cpu - The CPU the event was logged on.
+ *    tag - An enum AUDIO_THREAD_LOG_EVENTS.
+ */
+struct __attribute__((__packed__)) audio_thread_trace_event {
+	uint32_t seq;
+	uint32_t tid;
+	uint64_t nsec;
+	uint32_t data1;
+	uint32_t data2;
+	uint32_t data3;
+	uint16_t cpu;
+	uint8_t tag;
+	uint8_t reserved;
+};
+
+/* Ring of audio thread events shared read-write with a tracing client.
+ * Unlike the event log, the server never overwrites events the client hasn't
+ * consumed: when the ring is full new events are dropped and counted, so the
+ * client knows exactly what it missed.
+ *    len - The number of events in the ring, a power of two.
+ *    dropped - The number of events dropped because the ring was full.
+ *    read_pos - Consumer cursor, the free running count of events the client
+ *        has consumed. Kept on its own cache line as the client writes it.
+ *    events - The ring, event n is at events[n % len].
+ */
+struct __attribute__((__packed__)) audio_thread_trace {
+	uint32_t len;
+	uint32_t reserved;
+	uint64_t dropped;
+	uint8_t pad0[48];
+	uint64_t read_pos;
+	uint8_t pad1[56];
+	struct audio_thread_trace_event events[];
+};
+
+/* Audio thread timing histograms are log-linear: each power of two of
+ * nanoseconds is split in 2^AUDIO_THREAD_HIST_SUB_BITS buckets, so a bucket
+ * is never wider than 1/8 of the values it counts. Values below the number
+ * of sub buckets get a bucket each, and values of 2^32ns or more are counted
+ * in the last bucket. */
+#define AUDIO_THREAD_HIST_SUB_BITS 3
+#define AUDIO_THREAD_HIST_SUB_BUCKETS (1 << AUDIO_THREAD_HIST_SUB_BITS)
+#define AUDIO_THREAD_HIST_BUCKETS                                              \
+	((33 - AUDIO_THREAD_HIST_SUB_BITS) * AUDIO_THREAD_HIST_SUB_BUCKETS)
+
+/* Histogram of durations, updated with atomic operations so the audio threads
+ * can share it without a lock and readers never hold them up.
+ *    count - The number of values recorded.
+ *    sum_ns - The sum of the values recorded, in nanoseconds.
+ *    max_ns - The largest value recorded, in nanoseconds.
+ *    buckets - The number of values in each bucket, see
+ *        audio_thread_hist_bucket().
+ */
+struct __attribute__((__packed__)) audio_thread_hist {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint32_t buckets[AUDIO_THREAD_HIST_BUCKETS];
+};
+
+/* Timing statistics of the audio threads, kept since the server started.
+ *    wake_jitter - How late the threads woke up after the time they set their
+ *        wake up timer to.
+ *    run_cpu - CPU time the thread spent in each run of its devices.
+ *    run_wall - Wall time of each run of the devices. The difference with
+ *        run_cpu is the time the thread was preempted or blocked.
+ *    busyloops - The number of busyloops detected.
+ */
+struct __attribute__((__packed__)) audio_thread_timing {
+	struct audio_thread_hist wake_jitter;
+	struct audio_thread_hist run_cpu;
+	struct audio_thread_hist run_wall;
+	uint64_t busyloops;
+};
+
+/* Layout of the shm region shared with clients for audio thread debugging.
+ * The timing statistics follow the event log so clients that only map the
+ * log keep working. They are aligned for the atomic updates. */
+struct audio_thread_log_shm {
+	struct audio_thread_event_log log;
+	struct audio_thread_timing timing __attribute__((aligned(64)));
+};
+
+/* Returns the histogram bucket counting |ns|. */
+static inline unsigned int audio_thread_hist_bucket(uint64_t ns)
+{
+	unsigned int msb, idx;
+
+	if (ns < AUDIO_THREAD_HIST_SUB_BUCKETS)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	idx = ((msb - AUDIO_THREAD_HIST_SUB_BITS + 1)
+	       << AUDIO_THREAD_HIST_SUB_BITS) |
+	      ((ns >> (msb - AUDIO_THREAD_HIST_SUB_BITS)) &
+	       (AUDIO_THREAD_HIST_SUB_BUCKETS - 1));
+	if (idx >= AUDIO_THREAD_HIST_BUCKETS)
+		return AUDIO_THREAD_HIST_BUCKETS - 1;
+	return idx;
+}
+
+/* Returns the smallest value counted in histogram bucket |idx|. */
+static inline uint64_t audio_thread_hist_bucket_min(unsigned int idx)
+{
+	unsigned int sub = idx & (AUDIO_THREAD_HIST_SUB_BUCKETS - 1);
+	unsigned int exp = idx >> AUDIO_THREAD_HIST_SUB_BITS;
+
+	if (exp == 0)
+		return idx;
+	return (uint64_t)(AUDIO_THREAD_HIST_SUB_BUCKETS + sub) << (exp - 1);
+}
+
+/* Returns an upper bound of the |percentile| (0 to 100) of the values in
+ * |hist|, or 0 if it is empty. The bound is the top of the bucket holding the
+ * percentile, and never more than the largest value. */
+static inline uint64_t
+audio_thread_hist_percentile(const struct audio_thread_hist *hist,
+			     double percentile)
+{
+	uint64_t total = 0, target, seen = 0, top;
+	unsigned int i;
+
+	/* The buckets are updated one at a time, so sum them rather than
+	 * trusting count to match. */
+	for (i = 0; i < AUDIO_THREAD_HIST_BUCKETS; i++)
+		total += hist->buckets[i];
+	if (total == 0)
+		return 0;
+
+	target = (uint64_t)(total * percentile / 100.0 + 0.5);
+	if (target == 0)
+		target = 1;
+	for (i = 0; i < AUDIO_THREAD_HIST_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			break;
+	}
+	if (i == AUDIO_THREAD_HIST_BUCKETS - 1)
+		return hist->max_ns;
+	top = audio_thread_hist_bucket_min(i + 1) - 1;
+	return top < hist->max_ns ? top : hist->max_ns;
+}
+
 struct __attribute__((__packed__)) audio_dev_debug_info {
 	char dev_name[CRAS_NODE_NAME_BUFFER_SIZE];
 	uint32_t buffer_size;
@@ -362,6 +565,9 @@ struct __attribute__((__packed__)) audio_dev_debug_info {
 	uint32_t longest_wake_sec;
 	uint32_t longest_wake_nsec;
 	double software_gain_scaler;
+	uint64_t num_output_blocks;
+	uint64_t stage_total_ns[CRAS_NUM_OUTPUT_STAGES];
+	uint32_t stage_max_ns[CRAS_NUM_OUTPUT_STAGES];
 };
 
 struct __attribute__((__packed__)) audio_stream_debug_info {
@@ -488,7 +694,7 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
  *    bt_debug_info - ring buffer for storing bluetooth event logs.
  *    bt_wbs_enabled - Whether or not bluetooth wideband speech is enabled.
  */
-#define CRAS_SERVER_STATE_VERSION 2
+#define CRAS_SERVER_STATE_VERSION 3
 struct __attribute__((packed, aligned(4))) cras_server_state {
 	uint32_t state_version;
 	uint32_t volume;
@@ -11,6 +11,7 @@ extern "C" {
 #endif
 
 #include <poll.h>
+#include <pthread.h>
 #include <time.h>
 
 #include "cras_types.h"
@@ -28,6 +29,20 @@ int cras_set_thread_priority(int priority);
 /* Sets the niceness level of the current thread. */
 int cras_set_nice_level(int nice);
 
+/* Initializes a mutex that boosts its owner to the priority of the threads
+ * waiting for it, for locks real time threads contend on. */
+static inline int cras_pi_mutex_init(pthread_mutex_t *mutex)
+{
+	pthread_mutexattr_t attr;
+	int rc;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	rc = pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return rc;
+}
+
 /* Converts a buffer level from one sample rate to another. */
 static inline size_t cras_frames_at_rate(size_t orig_rate, size_t orig_frames,
 					 size_t act_rate)
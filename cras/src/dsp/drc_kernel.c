@@ -14,11 +14,11 @@
 
 #include "drc_math.h"
 #include "drc_kernel.h"
+#include "dsp_ops.h"
 
 #define MAX_PRE_DELAY_FRAMES 1024
 #define MAX_PRE_DELAY_FRAMES_MASK (MAX_PRE_DELAY_FRAMES - 1)
 #define DEFAULT_PRE_DELAY_FRAMES 256
-#define DIVISION_FRAMES 32
 #define DIVISION_FRAMES_MASK (DIVISION_FRAMES - 1)
 
 #define assert_on_compile(e) ((void)sizeof(char[1 - 2 * !(e)]))
@@ -56,7 +56,7 @@ void dk_init(struct drc_kernel *dk, float sample_rate)
 	dk->K = uninitialized_value;
 
 	assert_on_compile_is_power_of_2(DIVISION_FRAMES);
-	assert_on_compile(DIVISION_FRAMES % 4 == 0);
+	assert_on_compile(DIVISION_FRAMES % 8 == 0);
 	/* Allocate predelay buffers */
 	assert_on_compile_is_power_of_2(MAX_PRE_DELAY_FRAMES);
 	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
@@ -397,106 +397,6 @@ static void dk_update_envelope(struct drc_kernel *dk)
 	dk->scaled_desired_gain = scaled_desired_gain;
 }
 
-/* For a division of frames, take the absolute values of left channel and right
- * channel, store the maximum of them in output. */
-#if defined(__aarch64__)
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int count = DIVISION_FRAMES / 4;
-
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"ld1 {v0.4s}, [%[data0]], #16           \n"
-		"ld1 {v1.4s}, [%[data1]], #16           \n"
-		"fabs v0.4s, v0.4s                      \n"
-		"fabs v1.4s, v1.4s                      \n"
-		"fmax v0.4s, v0.4s, v1.4s               \n"
-		"st1 {v0.4s}, [%[output]], #16          \n"
-		"subs %w[count], %w[count], #1          \n"
-		"b.ne 1b                                \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count)
-		: /* input */
-		: /* clobber */
-		  "v0", "v1", "memory", "cc");
-	// clang-format on
-}
-#elif defined(__ARM_NEON__)
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int count = DIVISION_FRAMES / 4;
-
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"vld1.32 {q0}, [%[data0]]!              \n"
-		"vld1.32 {q1}, [%[data1]]!              \n"
-		"vabs.f32 q0, q0                        \n"
-		"vabs.f32 q1, q1                        \n"
-		"vmax.f32 q0, q1                        \n"
-		"vst1.32 {q0}, [%[output]]!             \n"
-		"subs %[count], #1                      \n"
-		"bne 1b                                 \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count)
-		: /* input */
-		: /* clobber */
-		  "q0", "q1", "memory", "cc");
-	// clang-format on
-}
-#elif defined(__SSE3__)
-#include <emmintrin.h>
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	__m128 x, y;
-	int count = DIVISION_FRAMES / 4;
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"lddqu (%[data0]), %[x]                 \n"
-		"lddqu (%[data1]), %[y]                 \n"
-		"andps %[mask], %[x]                    \n"
-		"andps %[mask], %[y]                    \n"
-		"maxps %[y], %[x]                       \n"
-		"movdqu %[x], (%[output])               \n"
-		"add $16, %[data0]                      \n"
-		"add $16, %[data1]                      \n"
-		"add $16, %[output]                     \n"
-		"sub $1, %[count]                       \n"
-		"jnz 1b                                 \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count),
-		  [x]"=&x"(x),
-		  [y]"=&x"(y)
-		: /* input */
-		  [mask]"x"(_mm_set1_epi32(0x7fffffff))
-		: /* clobber */
-		  "memory", "cc");
-	// clang-format on
-}
-#else
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int i;
-	for (i = 0; i < DIVISION_FRAMES; i++)
-		output[i] = fmaxf(fabsf(data0[i]), fabsf(data1[i]));
-}
-#endif
-
 /* Update detector_average from the last input division. */
 static void dk_update_detector_average(struct drc_kernel *dk)
 {
@@ -515,8 +415,9 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	}
 
 	/* The max abs value across all channels for this frame */
-	max_abs_division(abs_input_array, &dk->pre_delay_buffers[0][div_start],
-			 &dk->pre_delay_buffers[1][div_start]);
+	dsp_get_ops()->max_abs_division(abs_input_array,
+					&dk->pre_delay_buffers[0][div_start],
+					&dk->pre_delay_buffers[1][div_start]);
 
 	for (i = 0; i < DIVISION_FRAMES; i++) {
 		/* Compute compression amount from un-delayed signal */
@@ -559,404 +460,6 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	dk->detector_average = detector_average;
 }
 
-/* Calculate compress_gain from the envelope and apply total_gain to compress
- * the next output division. */
-/* TODO(fbarchard): Port to aarch64 */
-#if defined(__ARM_NEON__)
-#include <arm_neon.h>
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	/* See warp_sinf() for the details for the constants. */
-	const float32x4_t A7 = vdupq_n_f32(-4.3330336920917034149169921875e-3f);
-	const float32x4_t A5 = vdupq_n_f32(7.9434238374233245849609375e-2f);
-	const float32x4_t A3 = vdupq_n_f32(-0.645892798900604248046875f);
-	const float32x4_t A1 = vdupq_n_f32(1.5707910060882568359375f);
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		float c = compressor_gain - scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		float32x4_t x0 = { c * r, c * r * r, c * r * r * r,
-				   c * r * r * r * r };
-		float32x4_t x, x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"b 2f                                               \n"
-			"1:                                                 \n"
-			"vmul.f32 %q[x0], %q[r4]                            \n"
-			"2:                                                 \n"
-			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
-			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
-			"vadd.f32 %q[x], %q[x0], %q[base]                   \n"
-			/* Calculate warp_sin() for four values in x. */
-			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
-			"vmov.f32 %q[tmp1], %q[A5]                          \n"
-			"vmov.f32 %q[tmp2], %q[A1]                          \n"
-			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
-			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
-			"vmul.f32 %q[left], %q[tmp2]                        \n"
-			"vmul.f32 %q[right], %q[tmp2]                       \n"
-			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
-			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
-			"subs %[count], #1                                  \n"
-			"bne 1b                                             \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=w"(x0),
-			  [x]"=&w"(x),
-			  [x2]"=&w"(x2),
-			  [x4]"=&w"(x4),
-			  [left]"=&w"(left),
-			  [right]"=&w"(right),
-			  [tmp1]"=&w"(tmp1),
-			  [tmp2]"=&w"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x0]"3"(x0),
-			  [A1]"w"(A1),
-			  [A3]"w"(A3),
-			  [A5]"w"(A5),
-			  [A7]"w"(A7),
-			  [base]"w"(vdupq_n_f32(scaled_desired_gain)),
-			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
-			  [g]"w"(vdupq_n_f32(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	} else {
-		float c = compressor_gain;
-		float r = envelope_rate;
-		float32x4_t x = { c * r, c * r * r, c * r * r * r,
-				  c * r * r * r * r };
-		float32x4_t x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"b 2f                                               \n"
-			"1:                                                 \n"
-			"vmul.f32 %q[x], %q[r4]                             \n"
-			"2:                                                 \n"
-			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
-			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
-			"vmin.f32 %q[x], %q[one]                            \n"
-			/* Calculate warp_sin() for four values in x. */
-			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
-			"vmov.f32 %q[tmp1], %q[A5]                          \n"
-			"vmov.f32 %q[tmp2], %q[A1]                          \n"
-			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
-			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
-			"vmul.f32 %q[left], %q[tmp2]                        \n"
-			"vmul.f32 %q[right], %q[tmp2]                       \n"
-			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
-			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
-			"subs %[count], #1                                  \n"
-			"bne 1b                                             \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=w"(x),
-			  [x2]"=&w"(x2),
-			  [x4]"=&w"(x4),
-			  [left]"=&w"(left),
-			  [right]"=&w"(right),
-			  [tmp1]"=&w"(tmp1),
-			  [tmp2]"=&w"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x]"3"(x),
-			  [A1]"w"(A1),
-			  [A3]"w"(A3),
-			  [A5]"w"(A5),
-			  [A7]"w"(A7),
-			  [one]"w"(vdupq_n_f32(1)),
-			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
-			  [g]"w"(vdupq_n_f32(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	}
-}
-#elif defined(__SSE3__) && defined(__x86_64__)
-#include <emmintrin.h>
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	/* See warp_sinf() for the details for the constants. */
-	const __m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
-	const __m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
-	const __m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
-	const __m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		float c = compressor_gain - scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		__m128 x0 = { c * r, c * r * r, c * r * r * r,
-			      c * r * r * r * r };
-		__m128 x, x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"jmp 2f                                     \n"
-			"1:                                         \n"
-			"mulps %[r4], %[x0]                         \n"
-			"2:                                         \n"
-			"lddqu (%[ptr_left]), %[left]               \n"
-			"lddqu (%[ptr_right]), %[right]             \n"
-			"movaps %[x0], %[x]                         \n"
-			"addps %[base], %[x]                        \n"
-			/* Calculate warp_sin() for four values in x. */
-			"movaps %[x], %[x2]                         \n"
-			"mulps %[x], %[x2]                          \n"
-			"movaps %[x2], %[x4]                        \n"
-			"movaps %[x2], %[tmp1]                      \n"
-			"movaps %[x2], %[tmp2]                      \n"
-			"mulps %[x2], %[x4]                         \n"
-			"mulps %[A7], %[tmp1]                       \n"
-			"mulps %[A3], %[tmp2]                       \n"
-			"addps %[A5], %[tmp1]                       \n"
-			"addps %[A1], %[tmp2]                       \n"
-			"mulps %[x4], %[tmp1]                       \n"
-			"addps %[tmp1], %[tmp2]                     \n"
-			"mulps %[x], %[tmp2]                        \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"mulps %[g], %[tmp2]                        \n"
-			"mulps %[tmp2], %[left]                     \n"
-			"mulps %[tmp2], %[right]                    \n"
-			"movdqu %[left], (%[ptr_left])              \n"
-			"movdqu %[right], (%[ptr_right])            \n"
-			"add $16, %[ptr_left]                       \n"
-			"add $16, %[ptr_right]                      \n"
-			"sub $1, %[count]                           \n"
-			"jne 1b                                     \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=x"(x0),
-			  [x]"=&x"(x),
-			  [x2]"=&x"(x2),
-			  [x4]"=&x"(x4),
-			  [left]"=&x"(left),
-			  [right]"=&x"(right),
-			  [tmp1]"=&x"(tmp1),
-			  [tmp2]"=&x"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x0]"3"(x0),
-			  [A1]"x"(A1),
-			  [A3]"x"(A3),
-			  [A5]"x"(A5),
-			  [A7]"x"(A7),
-			  [base]"x"(_mm_set1_ps(scaled_desired_gain)),
-			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
-			  [g]"x"(_mm_set1_ps(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	} else {
-		/* See warp_sinf() for the details for the constants. */
-		__m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
-		__m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
-		__m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
-		__m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
-
-		float c = compressor_gain;
-		float r = envelope_rate;
-		__m128 x = { c * r, c * r * r, c * r * r * r,
-			     c * r * r * r * r };
-		__m128 x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"jmp 2f                                     \n"
-			"1:                                         \n"
-			"mulps %[r4], %[x]                          \n"
-			"2:                                         \n"
-			"lddqu (%[ptr_left]), %[left]               \n"
-			"lddqu (%[ptr_right]), %[right]             \n"
-			"minps %[one], %[x]                         \n"
-			/* Calculate warp_sin() for four values in x. */
-			"movaps %[x], %[x2]                         \n"
-			"mulps %[x], %[x2]                          \n"
-			"movaps %[x2], %[x4]                        \n"
-			"movaps %[x2], %[tmp1]                      \n"
-			"movaps %[x2], %[tmp2]                      \n"
-			"mulps %[x2], %[x4]                         \n"
-			"mulps %[A7], %[tmp1]                       \n"
-			"mulps %[A3], %[tmp2]                       \n"
-			"addps %[A5], %[tmp1]                       \n"
-			"addps %[A1], %[tmp2]                       \n"
-			"mulps %[x4], %[tmp1]                       \n"
-			"addps %[tmp1], %[tmp2]                     \n"
-			"mulps %[x], %[tmp2]                        \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"mulps %[g], %[tmp2]                        \n"
-			"mulps %[tmp2], %[left]                     \n"
-			"mulps %[tmp2], %[right]                    \n"
-			"movdqu %[left], (%[ptr_left])              \n"
-			"movdqu %[right], (%[ptr_right])            \n"
-			"add $16, %[ptr_left]                       \n"
-			"add $16, %[ptr_right]                      \n"
-			"sub $1, %[count]                           \n"
-			"jne 1b                                     \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=x"(x),
-			  [x2]"=&x"(x2),
-			  [x4]"=&x"(x4),
-			  [left]"=&x"(left),
-			  [right]"=&x"(right),
-			  [tmp1]"=&x"(tmp1),
-			  [tmp2]"=&x"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x]"3"(x),
-			  [A1]"x"(A1),
-			  [A3]"x"(A3),
-			  [A5]"x"(A5),
-			  [A7]"x"(A7),
-			  [one]"x"(_mm_set1_ps(1)),
-			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
-			  [g]"x"(_mm_set1_ps(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	}
-}
-#else
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	int i, j;
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		/* Attack - reduce gain to desired. */
-		float c = compressor_gain - scaled_desired_gain;
-		float base = scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		float x[4] = { c * r, c * r * r, c * r * r * r,
-			       c * r * r * r * r };
-		float r4 = r * r * r * r;
-
-		i = 0;
-		while (1) {
-			for (j = 0; j < 4; j++) {
-				/* Warp pre-compression gain to smooth out sharp
-				 * exponential transition points.
-				 */
-				float post_warp_compressor_gain =
-					warp_sinf(x[j] + base);
-
-				/* Calculate total gain using master gain. */
-				float total_gain = master_linear_gain *
-						   post_warp_compressor_gain;
-
-				/* Apply final gain. */
-				*ptr_left++ *= total_gain;
-				*ptr_right++ *= total_gain;
-			}
-
-			if (++i == count)
-				break;
-
-			for (j = 0; j < 4; j++)
-				x[j] = x[j] * r4;
-		}
-
-		dk->compressor_gain = x[3] + base;
-	} else {
-		/* Release - exponentially increase gain to 1.0 */
-		float c = compressor_gain;
-		float r = envelope_rate;
-		float x[4] = { c * r, c * r * r, c * r * r * r,
-			       c * r * r * r * r };
-		float r4 = r * r * r * r;
-
-		i = 0;
-		while (1) {
-			for (j = 0; j < 4; j++) {
-				/* Warp pre-compression gain to smooth out sharp
-				 * exponential transition points.
-				 */
-				float post_warp_compressor_gain =
-					warp_sinf(x[j]);
-
-				/* Calculate total gain using master gain. */
-				float total_gain = master_linear_gain *
-						   post_warp_compressor_gain;
-
-				/* Apply final gain. */
-				*ptr_left++ *= total_gain;
-				*ptr_right++ *= total_gain;
-			}
-
-			if (++i == count)
-				break;
-
-			for (j = 0; j < 4; j++)
-				x[j] = min(1.0f, x[j] * r4);
-		}
-
-		dk->compressor_gain = x[3];
-	}
-}
-#endif
-
 /* After one complete divison of samples have been received (and one divison of
  * samples have been output), we calculate shaped power average
  * (detector_average) from the input division, update envelope parameters from
@@ -967,7 +470,7 @@ static void dk_process_one_division(struct drc_kernel *dk)
 {
 	dk_update_detector_average(dk);
 	dk_update_envelope(dk);
-	dk_compress_output(dk);
+	dsp_get_ops()->dk_compress_output(dk);
 }
 
 /* Copy the input data to the pre-delay buffer, and copy the output data back to
@@ -1042,7 +545,7 @@ void dk_process(struct drc_kernel *dk, float *data_channels[], unsigned count)
 
 	if (!dk->processed) {
 		dk_update_envelope(dk);
-		dk_compress_output(dk);
+		dsp_get_ops()->dk_compress_output(dk);
 		dk->processed = 1;
 	}
 
@@ -16,6 +16,8 @@ extern "C" {
 #endif
 
 #define DRC_NUM_CHANNELS 2
+/* The number of frames processed with the same envelope. */
+#define DIVISION_FRAMES 32
 
 struct drc_kernel {
 	float sample_rate;
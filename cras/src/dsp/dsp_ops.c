@@ -0,0 +1,2139 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include "drc_math.h"
+#include "dsp_ops.h"
+
+#ifdef OPS_SSE42
+#define OPS(a) a##_sse42
+#elif OPS_AVX
+#define OPS(a) a##_avx
+#elif OPS_AVX2
+#define OPS(a) a##_avx2
+#elif OPS_FMA
+#define OPS(a) a##_fma
+#else
+#define OPS(a) a
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+/* a * b + c, and c - a * b. */
+#if defined(__FMA__)
+#define MADD(a, b, c) _mm256_fmadd_ps(a, b, c)
+#define NMADD(a, b, c) _mm256_fnmadd_ps(a, b, c)
+#else
+#define MADD(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#define NMADD(a, b, c) _mm256_sub_ps(c, _mm256_mul_ps(a, b))
+#endif
+#endif
+
+/*
+ * EQ2
+ */
+
+static inline void eq2_process_one(struct biquad (*bq)[2], float *data0,
+				   float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *qR = &bq[0][1];
+
+	float x1L = qL->x1;
+	float x2L = qL->x2;
+	float y1L = qL->y1;
+	float y2L = qL->y2;
+	float b0L = qL->b0;
+	float b1L = qL->b1;
+	float b2L = qL->b2;
+	float a1L = qL->a1;
+	float a2L = qL->a2;
+
+	float x1R = qR->x1;
+	float x2R = qR->x2;
+	float y1R = qR->y1;
+	float y2R = qR->y2;
+	float b0R = qR->b0;
+	float b1R = qR->b1;
+	float b2R = qR->b2;
+	float a1R = qR->a1;
+	float a2R = qR->a2;
+
+	int j;
+	for (j = 0; j < count; j++) {
+		float xL = data0[j];
+		float xR = data1[j];
+
+		float yL = b0L * xL + b1L * x1L + b2L * x2L - a1L * y1L -
+			   a2L * y2L;
+		x2L = x1L;
+		x1L = xL;
+		y2L = y1L;
+		y1L = yL;
+
+		float yR = b0R * xR + b1R * x1R + b2R * x2R - a1R * y1R -
+			   a2R * y2R;
+		x2R = x1R;
+		x1R = xR;
+		y2R = y1R;
+		y1R = yR;
+
+		data0[j] = yL;
+		data1[j] = yR;
+	}
+
+	qL->x1 = x1L;
+	qL->x2 = x2L;
+	qL->y1 = y1L;
+	qL->y2 = y2L;
+	qR->x1 = x1R;
+	qR->x2 = x2R;
+	qR->y1 = y1R;
+	qR->y2 = y2R;
+}
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+static inline void eq2_process_two_neon(struct biquad (*bq)[2], float *data0,
+					float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *rL = &bq[1][0];
+	struct biquad *qR = &bq[0][1];
+	struct biquad *rR = &bq[1][1];
+
+	float32x2_t x1 = { qL->x1, qR->x1 };
+	float32x2_t x2 = { qL->x2, qR->x2 };
+	float32x2_t y1 = { qL->y1, qR->y1 };
+	float32x2_t y2 = { qL->y2, qR->y2 };
+	float32x2_t qb0 = { qL->b0, qR->b0 };
+	float32x2_t qb1 = { qL->b1, qR->b1 };
+	float32x2_t qb2 = { qL->b2, qR->b2 };
+	float32x2_t qa1 = { qL->a1, qR->a1 };
+	float32x2_t qa2 = { qL->a2, qR->a2 };
+
+	float32x2_t z1 = { rL->y1, rR->y1 };
+	float32x2_t z2 = { rL->y2, rR->y2 };
+	float32x2_t rb0 = { rL->b0, rR->b0 };
+	float32x2_t rb1 = { rL->b1, rR->b1 };
+	float32x2_t rb2 = { rL->b2, rR->b2 };
+	float32x2_t ra1 = { rL->a1, rR->a1 };
+	float32x2_t ra2 = { rL->a2, rR->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* d0 = x, d1 = y, d2 = z */
+		"1:                                     \n"
+		"vmul.f32 d1, %P[qb1], %P[x1]           \n"
+		"vld1.32 d0[0], [%[data0]]              \n"
+		"vld1.32 d0[1], [%[data1]]              \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 d2, %P[rb1], %P[y1]           \n"
+		"vmla.f32 d1, %P[qb0], d0               \n"
+		"vmla.f32 d1, %P[qb2], %P[x2]           \n"
+		"vmov.f32 %P[x2], %P[x1]                \n"
+		"vmov.f32 %P[x1], d0                    \n"
+		"vmls.f32 d1, %P[qa1], %P[y1]           \n"
+		"vmls.f32 d1, %P[qa2], %P[y2]           \n"
+		"vmla.f32 d2, %P[rb0], d1               \n"
+		"vmla.f32 d2, %P[rb2], %P[y2]           \n"
+		"vmov.f32 %P[y2], %P[y1]                \n"
+		"vmov.f32 %P[y1], d1                    \n"
+		"vmls.f32 d2, %P[ra1], %P[z1]           \n"
+		"vmls.f32 d2, %P[ra2], %P[z2]           \n"
+		"vmov.f32 %P[z2], %P[z1]                \n"
+		"vmov.f32 %P[z1], d2                    \n"
+		"vst1.f32 d2[0], [%[data0]]!            \n"
+		"vst1.f32 d2[1], [%[data1]]!            \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [count]"+r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [qb0]"w"(qb0),
+		  [qb1]"w"(qb1),
+		  [qb2]"w"(qb2),
+		  [qa1]"w"(qa1),
+		  [qa2]"w"(qa2),
+		  [rb0]"w"(rb0),
+		  [rb1]"w"(rb1),
+		  [rb2]"w"(rb2),
+		  [ra1]"w"(ra1),
+		  [ra2]"w"(ra2)
+		: /* clobber */
+		  "d0", "d1", "d2", "memory", "cc");
+	// clang-format on
+
+	qL->x1 = x1[0];
+	qL->x2 = x2[0];
+	qL->y1 = y1[0];
+	qL->y2 = y2[0];
+	rL->y1 = z1[0];
+	rL->y2 = z2[0];
+	qR->x1 = x1[1];
+	qR->x2 = x2[1];
+	qR->y1 = y1[1];
+	qR->y2 = y2[1];
+	rR->y1 = z1[1];
+	rR->y2 = z2[1];
+}
+#endif
+
+#if defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static inline void eq2_process_two_sse3(struct biquad (*bq)[2], float *data0,
+					float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *rL = &bq[1][0];
+	struct biquad *qR = &bq[0][1];
+	struct biquad *rR = &bq[1][1];
+
+	__m128 x1 = { qL->x1, qR->x1 };
+	__m128 x2 = { qL->x2, qR->x2 };
+	__m128 y1 = { qL->y1, qR->y1 };
+	__m128 y2 = { qL->y2, qR->y2 };
+	__m128 qb0 = { qL->b0, qR->b0 };
+	__m128 qb1 = { qL->b1, qR->b1 };
+	__m128 qb2 = { qL->b2, qR->b2 };
+	__m128 qa1 = { qL->a1, qR->a1 };
+	__m128 qa2 = { qL->a2, qR->a2 };
+
+	__m128 z1 = { rL->y1, rR->y1 };
+	__m128 z2 = { rL->y2, rR->y2 };
+	__m128 rb0 = { rL->b0, rR->b0 };
+	__m128 rb1 = { rL->b1, rR->b1 };
+	__m128 rb2 = { rL->b2, rR->b2 };
+	__m128 ra1 = { rL->a1, rR->a1 };
+	__m128 ra2 = { rL->a2, rR->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[data0]), %%xmm2               \n"
+		"movss (%[data1]), %%xmm1               \n"
+		"unpcklps %%xmm1, %%xmm2                \n"
+		"mulps %[qb2],%[x2]                     \n"
+		"lddqu %[qb0],%%xmm0                    \n"
+		"mulps %[ra2],%[z2]                     \n"
+		"lddqu %[qb1],%%xmm1                    \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[qa1],%%xmm1                   \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[rb1],%[x2]                    \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[qa2],%%xmm1                   \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[rb2],%[y2]                     \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[rb0],%%xmm1                   \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[ra1],%[y2]                    \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"movss %%xmm1, (%[data0])               \n"
+		"shufps $1, %%xmm1, %%xmm1              \n"
+		"movss %%xmm1, (%[data1])               \n"
+		"add $4, %[data0]                       \n"
+		"add $4, %[data1]                       \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [qb0]"m"(qb0),
+		  [qb1]"m"(qb1),
+		  [qb2]"m"(qb2),
+		  [qa1]"x"(qa1),
+		  [qa2]"x"(qa2),
+		  [rb0]"x"(rb0),
+		  [rb1]"x"(rb1),
+		  [rb2]"x"(rb2),
+		  [ra1]"x"(ra1),
+		  [ra2]"x"(ra2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	qL->x1 = x1[0];
+	qL->x2 = x2[0];
+	qL->y1 = y1[0];
+	qL->y2 = y2[0];
+	rL->y1 = z1[0];
+	rL->y2 = z2[0];
+	qR->x1 = x1[1];
+	qR->x2 = x2[1];
+	qR->y1 = y1[1];
+	qR->y2 = y2[1];
+	rR->y1 = z1[1];
+	rR->y2 = z2[1];
+}
+#endif
+
+#if defined(__AVX2__)
+/* Four cascaded biquads of both channels, stage k in lanes 2k (left) and
+ * 2k + 1 (right). Each stage works on the sample the previous stage finished
+ * one step earlier, so the four stages run in parallel and the output lags
+ * the input by three steps. */
+struct eq2_four_state {
+	__m256 x1, x2, y1, y2;
+	__m256 b0, b1, b2, a1, a2;
+};
+
+static inline __m256 eq2_four_step(struct eq2_four_state *s, __m256 x)
+{
+	__m256 y;
+
+	y = NMADD(s->a2, s->y2, _mm256_mul_ps(s->b2, s->x2));
+	y = MADD(s->b1, s->x1, y);
+	y = NMADD(s->a1, s->y1, y);
+	y = MADD(s->b0, x, y);
+	s->x2 = s->x1;
+	s->x1 = x;
+	s->y2 = s->y1;
+	s->y1 = y;
+	return y;
+}
+
+/* Same as eq2_four_step(), but only lanes in |valid| update the state. Used
+ * while the pipeline fills and drains. */
+static inline __m256 eq2_four_step_masked(struct eq2_four_state *s, __m256 x,
+					  __m256 valid)
+{
+	__m256 y;
+
+	y = NMADD(s->a2, s->y2, _mm256_mul_ps(s->b2, s->x2));
+	y = MADD(s->b1, s->x1, y);
+	y = NMADD(s->a1, s->y1, y);
+	y = MADD(s->b0, x, y);
+	s->x2 = _mm256_blendv_ps(s->x2, s->x1, valid);
+	s->x1 = _mm256_blendv_ps(s->x1, x, valid);
+	s->y2 = _mm256_blendv_ps(s->y2, s->y1, valid);
+	s->y1 = _mm256_blendv_ps(s->y1, y, valid);
+	return y;
+}
+
+static void eq2_process_four_avx2(struct biquad (*bq)[2], float *data0,
+				  float *data1, int count)
+{
+	/* Moves the output of stage k - 1 to the input of stage k. */
+	const __m256i next_stage = _mm256_setr_epi32(0, 1, 0, 1, 2, 3, 4, 5);
+	const __m256i lane_stage = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	float x1[8], x2[8], y1[8], y2[8];
+	float b0[8], b1[8], b2[8], a1[8], a2[8];
+	struct eq2_four_state s;
+	struct biquad *q;
+	__m256 x, y, valid;
+	__m128 out;
+	__m256i t_vec;
+	int i, t;
+
+	for (i = 0; i < 8; i++) {
+		q = &bq[i / 2][i % 2];
+		x1[i] = q->x1;
+		x2[i] = q->x2;
+		y1[i] = q->y1;
+		y2[i] = q->y2;
+		b0[i] = q->b0;
+		b1[i] = q->b1;
+		b2[i] = q->b2;
+		a1[i] = q->a1;
+		a2[i] = q->a2;
+	}
+	s.x1 = _mm256_loadu_ps(x1);
+	s.x2 = _mm256_loadu_ps(x2);
+	s.y1 = _mm256_loadu_ps(y1);
+	s.y2 = _mm256_loadu_ps(y2);
+	s.b0 = _mm256_loadu_ps(b0);
+	s.b1 = _mm256_loadu_ps(b1);
+	s.b2 = _mm256_loadu_ps(b2);
+	s.a1 = _mm256_loadu_ps(a1);
+	s.a2 = _mm256_loadu_ps(a2);
+
+	y = _mm256_setzero_ps();
+	for (t = 0; t < count + 3; t++) {
+		x = _mm256_permutevar8x32_ps(y, next_stage);
+		if (t < count)
+			x = _mm256_blend_ps(
+				x,
+				_mm256_castps128_ps256(_mm_setr_ps(
+					data0[t], data1[t], 0.0f, 0.0f)),
+				0x03);
+
+		if (t >= 3 && t < count) {
+			y = eq2_four_step(&s, x);
+		} else {
+			/* Stage k works on sample t - k. */
+			t_vec = _mm256_set1_epi32(t);
+			valid = _mm256_castsi256_ps(_mm256_andnot_si256(
+				_mm256_cmpgt_epi32(lane_stage, t_vec),
+				_mm256_cmpgt_epi32(
+					_mm256_add_epi32(
+						lane_stage,
+						_mm256_set1_epi32(count)),
+					t_vec)));
+			y = eq2_four_step_masked(&s, x, valid);
+		}
+
+		if (t >= 3) {
+			out = _mm256_extractf128_ps(y, 1);
+			data0[t - 3] = _mm_cvtss_f32(_mm_movehl_ps(out, out));
+			data1[t - 3] = _mm_cvtss_f32(_mm_shuffle_ps(
+				out, out, _MM_SHUFFLE(0, 0, 0, 3)));
+		}
+	}
+
+	_mm256_storeu_ps(x1, s.x1);
+	_mm256_storeu_ps(x2, s.x2);
+	_mm256_storeu_ps(y1, s.y1);
+	_mm256_storeu_ps(y2, s.y2);
+	for (i = 0; i < 8; i++) {
+		q = &bq[i / 2][i % 2];
+		q->x1 = x1[i];
+		q->x2 = x2[i];
+		q->y1 = y1[i];
+		q->y2 = y2[i];
+	}
+}
+#endif
+
+static void eq2_process(struct biquad (*bq)[2], int n, float *data0,
+			float *data1, int count)
+{
+	int i = 0;
+
+	while (i < n) {
+#if defined(__AVX2__)
+		if (i + 4 <= n) {
+			eq2_process_four_avx2(&bq[i], data0, data1, count);
+			i += 4;
+			continue;
+		}
+#endif
+		if (i + 1 == n) {
+			eq2_process_one(&bq[i], data0, data1, count);
+			i++;
+			continue;
+		}
+#if defined(__ARM_NEON__)
+		eq2_process_two_neon(&bq[i], data0, data1, count);
+#elif defined(__SSE3__) && defined(__x86_64__)
+		eq2_process_two_sse3(&bq[i], data0, data1, count);
+#else
+		eq2_process_one(&bq[i], data0, data1, count);
+		eq2_process_one(&bq[i + 1], data0, data1, count);
+#endif
+		i += 2;
+	}
+}
+
+/*
+ * Crossover2
+ */
+
+/* Split input data using two LR4 filters, put the result into the input array
+ * and another array.
+ *
+ * data0 --+-- lp --> data0
+ *         |
+ *         \-- hp --> data1
+ */
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	float32x4_t x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	float32x4_t x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	float32x4_t y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	float32x4_t y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	float32x4_t z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	float32x4_t z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	float32x4_t b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	float32x4_t b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	float32x4_t b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	float32x4_t a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	float32x4_t a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* q0 = x, q1 = y, q2 = z */
+		"1:                                     \n"
+		"vmul.f32 q1, %q[b1], %q[x1]            \n"
+		"vld1.32 d0[], [%[data0L]]              \n"
+		"vld1.32 d1[], [%[data0R]]              \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 q2, %q[b1], %q[y1]            \n"
+		"vmla.f32 q1, %q[b0], q0                \n"
+		"vmla.f32 q1, %q[b2], %q[x2]            \n"
+		"vmov.f32 %q[x2], %q[x1]                \n"
+		"vmov.f32 %q[x1], q0                    \n"
+		"vmls.f32 q1, %q[a1], %q[y1]            \n"
+		"vmls.f32 q1, %q[a2], %q[y2]            \n"
+		"vmla.f32 q2, %q[b0], q1                \n"
+		"vmla.f32 q2, %q[b2], %q[y2]            \n"
+		"vmov.f32 %q[y2], %q[y1]                \n"
+		"vmov.f32 %q[y1], q1                    \n"
+		"vmls.f32 q2, %q[a1], %q[z1]            \n"
+		"vmls.f32 q2, %q[a2], %q[z2]            \n"
+		"vmov.f32 %q[z2], %q[z1]                \n"
+		"vmov.f32 %q[z1], q2                    \n"
+		"vst1.f32 d4[0], [%[data0L]]!           \n"
+		"vst1.f32 d4[1], [%[data1L]]!           \n"
+		"vst1.f32 d5[0], [%[data0R]]!           \n"
+		"vst1.f32 d5[1], [%[data1R]]!           \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  "=r"(data0L),
+		  "=r"(data0R),
+		  "=r"(data1L),
+		  "=r"(data1R),
+		  "=r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [data0L]"0"(data0L),
+		  [data0R]"1"(data0R),
+		  [data1L]"2"(data1L),
+		  [data1R]"3"(data1R),
+		  [count]"4"(count),
+		  [b0]"w"(b0),
+		  [b1]"w"(b1),
+		  [b2]"w"(b2),
+		  [a1]"w"(a1),
+		  [a2]"w"(a2)
+		: /* clobber */
+		  "q0", "q1", "q2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	__m128 x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	__m128 x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	__m128 y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	__m128 y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	__m128 z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	__m128 z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	__m128 b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	__m128 b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	__m128 b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	__m128 a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	__m128 a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[data0L]), %%xmm2              \n"
+		"movss (%[data0R]), %%xmm1              \n"
+		"shufps $0, %%xmm1, %%xmm2              \n"
+		"mulps %[b2],%[x2]                      \n"
+		"movaps %[b0], %%xmm0                   \n"
+		"mulps %[a2],%[z2]                      \n"
+		"movaps %[b1], %%xmm1                   \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[a1],%%xmm1                    \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[b1],%[x2]                     \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[a2],%%xmm1                    \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[b2],%[y2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[b0],%%xmm1                    \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[a1],%[y2]                     \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"movss %%xmm1, (%[data0L])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data1L])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data0R])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data1R])              \n"
+		"add $4, %[data0L]                      \n"
+		"add $4, %[data1L]                      \n"
+		"add $4, %[data0R]                      \n"
+		"add $4, %[data1R]                      \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0L]"+r"(data0L),
+		  [data0R]"+r"(data0R),
+		  [data1L]"+r"(data1L),
+		  [data1R]"+r"(data1R),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [b0]"x"(b0),
+		  [b1]"x"(b1),
+		  [b2]"x"(b2),
+		  [a1]"x"(a1),
+		  [a2]"x"(a2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#else
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	float lx1L = lp->x1L, lx1R = lp->x1R;
+	float lx2L = lp->x2L, lx2R = lp->x2R;
+	float ly1L = lp->y1L, ly1R = lp->y1R;
+	float ly2L = lp->y2L, ly2R = lp->y2R;
+	float lz1L = lp->z1L, lz1R = lp->z1R;
+	float lz2L = lp->z2L, lz2R = lp->z2R;
+	float lb0 = lp->b0;
+	float lb1 = lp->b1;
+	float lb2 = lp->b2;
+	float la1 = lp->a1;
+	float la2 = lp->a2;
+
+	float hx1L = hp->x1L, hx1R = hp->x1R;
+	float hx2L = hp->x2L, hx2R = hp->x2R;
+	float hy1L = hp->y1L, hy1R = hp->y1R;
+	float hy2L = hp->y2L, hy2R = hp->y2R;
+	float hz1L = hp->z1L, hz1R = hp->z1R;
+	float hz2L = hp->z2L, hz2R = hp->z2R;
+	float hb0 = hp->b0;
+	float hb1 = hp->b1;
+	float hb2 = hp->b2;
+	float ha1 = hp->a1;
+	float ha2 = hp->a2;
+
+	int i;
+	for (i = 0; i < count; i++) {
+		float xL, yL, zL, xR, yR, zR;
+		xL = data0L[i];
+		xR = data0R[i];
+		yL = lb0 * xL + lb1 * lx1L + lb2 * lx2L - la1 * ly1L -
+		     la2 * ly2L;
+		yR = lb0 * xR + lb1 * lx1R + lb2 * lx2R - la1 * ly1R -
+		     la2 * ly2R;
+		zL = lb0 * yL + lb1 * ly1L + lb2 * ly2L - la1 * lz1L -
+		     la2 * lz2L;
+		zR = lb0 * yR + lb1 * ly1R + lb2 * ly2R - la1 * lz1R -
+		     la2 * lz2R;
+		lx2L = lx1L;
+		lx2R = lx1R;
+		lx1L = xL;
+		lx1R = xR;
+		ly2L = ly1L;
+		ly2R = ly1R;
+		ly1L = yL;
+		ly1R = yR;
+		lz2L = lz1L;
+		lz2R = lz1R;
+		lz1L = zL;
+		lz1R = zR;
+		data0L[i] = zL;
+		data0R[i] = zR;
+
+		yL = hb0 * xL + hb1 * hx1L + hb2 * hx2L - ha1 * hy1L -
+		     ha2 * hy2L;
+		yR = hb0 * xR + hb1 * hx1R + hb2 * hx2R - ha1 * hy1R -
+		     ha2 * hy2R;
+		zL = hb0 * yL + hb1 * hy1L + hb2 * hy2L - ha1 * hz1L -
+		     ha2 * hz2L;
+		zR = hb0 * yR + hb1 * hy1R + hb2 * hy2R - ha1 * hz1R -
+		     ha2 * hz2R;
+		hx2L = hx1L;
+		hx2R = hx1R;
+		hx1L = xL;
+		hx1R = xR;
+		hy2L = hy1L;
+		hy2R = hy1R;
+		hy1L = yL;
+		hy1R = yR;
+		hz2L = hz1L;
+		hz2R = hz1R;
+		hz1L = zL;
+		hz1R = zR;
+		data1L[i] = zL;
+		data1R[i] = zR;
+	}
+
+	lp->x1L = lx1L;
+	lp->x1R = lx1R;
+	lp->x2L = lx2L;
+	lp->x2R = lx2R;
+	lp->y1L = ly1L;
+	lp->y1R = ly1R;
+	lp->y2L = ly2L;
+	lp->y2R = ly2R;
+	lp->z1L = lz1L;
+	lp->z1R = lz1R;
+	lp->z2L = lz2L;
+	lp->z2R = lz2R;
+
+	hp->x1L = hx1L;
+	hp->x1R = hx1R;
+	hp->x2L = hx2L;
+	hp->x2R = hx2R;
+	hp->y1L = hy1L;
+	hp->y1R = hy1R;
+	hp->y2L = hy2L;
+	hp->y2R = hy2R;
+	hp->z1L = hz1L;
+	hp->z1R = hz1R;
+	hp->z2L = hz2L;
+	hp->z2R = hz2R;
+}
+#endif
+
+/* Split input data using two LR4 filters and sum them back to the original
+ * data array.
+ *
+ * data --+-- lp --+--> data
+ *        |        |
+ *        \-- hp --/
+ */
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	float32x4_t x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	float32x4_t x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	float32x4_t y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	float32x4_t y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	float32x4_t z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	float32x4_t z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	float32x4_t b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	float32x4_t b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	float32x4_t b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	float32x4_t a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	float32x4_t a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* q0 = x, q1 = y, q2 = z */
+		"1:                                     \n"
+		"vmul.f32 q1, %q[b1], %q[x1]            \n"
+		"vld1.32 d0[], [%[dataL]]               \n"
+		"vld1.32 d1[], [%[dataR]]               \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 q2, %q[b1], %q[y1]            \n"
+		"vmla.f32 q1, %q[b0], q0                \n"
+		"vmla.f32 q1, %q[b2], %q[x2]            \n"
+		"vmov.f32 %q[x2], %q[x1]                \n"
+		"vmov.f32 %q[x1], q0                    \n"
+		"vmls.f32 q1, %q[a1], %q[y1]            \n"
+		"vmls.f32 q1, %q[a2], %q[y2]            \n"
+		"vmla.f32 q2, %q[b0], q1                \n"
+		"vmla.f32 q2, %q[b2], %q[y2]            \n"
+		"vmov.f32 %q[y2], %q[y1]                \n"
+		"vmov.f32 %q[y1], q1                    \n"
+		"vmls.f32 q2, %q[a1], %q[z1]            \n"
+		"vmls.f32 q2, %q[a2], %q[z2]            \n"
+		"vmov.f32 %q[z2], %q[z1]                \n"
+		"vmov.f32 %q[z1], q2                    \n"
+		"vpadd.f32 d4, d4, d5                   \n"
+		"vst1.f32 d4[0], [%[dataL]]!            \n"
+		"vst1.f32 d4[1], [%[dataR]]!            \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  "=r"(dataL),
+		  "=r"(dataR),
+		  "=r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [dataL]"0"(dataL),
+		  [dataR]"1"(dataR),
+		  [count]"2"(count),
+		  [b0]"w"(b0),
+		  [b1]"w"(b1),
+		  [b2]"w"(b2),
+		  [a1]"w"(a1),
+		  [a2]"w"(a2)
+		: /* clobber */
+		  "q0", "q1", "q2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	__m128 x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	__m128 x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	__m128 y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	__m128 y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	__m128 z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	__m128 z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	__m128 b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	__m128 b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	__m128 b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	__m128 a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	__m128 a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[dataL]), %%xmm2               \n"
+		"movss (%[dataR]), %%xmm1               \n"
+		"shufps $0, %%xmm1, %%xmm2              \n"
+		"mulps %[b2],%[x2]                      \n"
+		"movaps %[b0], %%xmm0                   \n"
+		"mulps %[a2],%[z2]                      \n"
+		"movaps %[b1], %%xmm1                   \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[a1],%%xmm1                    \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[b1],%[x2]                     \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[a2],%%xmm1                    \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[b2],%[y2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[b0],%%xmm1                    \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[a1],%[y2]                     \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"haddps %%xmm1, %%xmm1                  \n"
+		"movss %%xmm1, (%[dataL])               \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[dataR])               \n"
+		"add $4, %[dataL]                       \n"
+		"add $4, %[dataR]                       \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [dataL]"+r"(dataL),
+		  [dataR]"+r"(dataR),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [b0]"x"(b0),
+		  [b1]"x"(b1),
+		  [b2]"x"(b2),
+		  [a1]"x"(a1),
+		  [a2]"x"(a2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#else
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	float lx1L = lp->x1L, lx1R = lp->x1R;
+	float lx2L = lp->x2L, lx2R = lp->x2R;
+	float ly1L = lp->y1L, ly1R = lp->y1R;
+	float ly2L = lp->y2L, ly2R = lp->y2R;
+	float lz1L = lp->z1L, lz1R = lp->z1R;
+	float lz2L = lp->z2L, lz2R = lp->z2R;
+	float lb0 = lp->b0;
+	float lb1 = lp->b1;
+	float lb2 = lp->b2;
+	float la1 = lp->a1;
+	float la2 = lp->a2;
+
+	float hx1L = hp->x1L, hx1R = hp->x1R;
+	float hx2L = hp->x2L, hx2R = hp->x2R;
+	float hy1L = hp->y1L, hy1R = hp->y1R;
+	float hy2L = hp->y2L, hy2R = hp->y2R;
+	float hz1L = hp->z1L, hz1R = hp->z1R;
+	float hz2L = hp->z2L, hz2R = hp->z2R;
+	float hb0 = hp->b0;
+	float hb1 = hp->b1;
+	float hb2 = hp->b2;
+	float ha1 = hp->a1;
+	float ha2 = hp->a2;
+
+	int i;
+	for (i = 0; i < count; i++) {
+		float xL, yL, zL, xR, yR, zR;
+		xL = dataL[i];
+		xR = dataR[i];
+		yL = lb0 * xL + lb1 * lx1L + lb2 * lx2L - la1 * ly1L -
+		     la2 * ly2L;
+		yR = lb0 * xR + lb1 * lx1R + lb2 * lx2R - la1 * ly1R -
+		     la2 * ly2R;
+		zL = lb0 * yL + lb1 * ly1L + lb2 * ly2L - la1 * lz1L -
+		     la2 * lz2L;
+		zR = lb0 * yR + lb1 * ly1R + lb2 * ly2R - la1 * lz1R -
+		     la2 * lz2R;
+		lx2L = lx1L;
+		lx2R = lx1R;
+		lx1L = xL;
+		lx1R = xR;
+		ly2L = ly1L;
+		ly2R = ly1R;
+		ly1L = yL;
+		ly1R = yR;
+		lz2L = lz1L;
+		lz2R = lz1R;
+		lz1L = zL;
+		lz1R = zR;
+
+		yL = hb0 * xL + hb1 * hx1L + hb2 * hx2L - ha1 * hy1L -
+		     ha2 * hy2L;
+		yR = hb0 * xR + hb1 * hx1R + hb2 * hx2R - ha1 * hy1R -
+		     ha2 * hy2R;
+		zL = hb0 * yL + hb1 * hy1L + hb2 * hy2L - ha1 * hz1L -
+		     ha2 * hz2L;
+		zR = hb0 * yR + hb1 * hy1R + hb2 * hy2R - ha1 * hz1R -
+		     ha2 * hz2R;
+		hx2L = hx1L;
+		hx2R = hx1R;
+		hx1L = xL;
+		hx1R = xR;
+		hy2L = hy1L;
+		hy2R = hy1R;
+		hy1L = yL;
+		hy1R = yR;
+		hz2L = hz1L;
+		hz2R = hz1R;
+		hz1L = zL;
+		hz1R = zR;
+		dataL[i] = zL + lz1L;
+		dataR[i] = zR + lz1R;
+	}
+
+	lp->x1L = lx1L;
+	lp->x1R = lx1R;
+	lp->x2L = lx2L;
+	lp->x2R = lx2R;
+	lp->y1L = ly1L;
+	lp->y1R = ly1R;
+	lp->y2L = ly2L;
+	lp->y2R = ly2R;
+	lp->z1L = lz1L;
+	lp->z1R = lz1R;
+	lp->z2L = lz2L;
+	lp->z2R = lz2R;
+
+	hp->x1L = hx1L;
+	hp->x1R = hx1R;
+	hp->x2L = hx2L;
+	hp->x2R = hx2R;
+	hp->y1L = hy1L;
+	hp->y1R = hy1R;
+	hp->y2L = hy2L;
+	hp->y2R = hy2R;
+	hp->z1L = hz1L;
+	hp->z1R = hz1R;
+	hp->z2L = hz2L;
+	hp->z2R = hz2R;
+}
+#endif
+
+/*
+ * DRC kernel
+ */
+
+/* For a division of frames, take the absolute values of left channel and right
+ * channel, store the maximum of them in output. */
+#if defined(__AVX2__)
+static inline void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 x, y;
+	int i;
+
+	for (i = 0; i < DIVISION_FRAMES; i += 8) {
+		x = _mm256_and_ps(_mm256_loadu_ps(data0 + i), mask);
+		y = _mm256_and_ps(_mm256_loadu_ps(data1 + i), mask);
+		_mm256_storeu_ps(output + i, _mm256_max_ps(x, y));
+	}
+}
+#elif defined(__aarch64__)
+static inline void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int count = DIVISION_FRAMES / 4;
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"ld1 {v0.4s}, [%[data0]], #16           \n"
+		"ld1 {v1.4s}, [%[data1]], #16           \n"
+		"fabs v0.4s, v0.4s                      \n"
+		"fabs v1.4s, v1.4s                      \n"
+		"fmax v0.4s, v0.4s, v1.4s               \n"
+		"st1 {v0.4s}, [%[output]], #16          \n"
+		"subs %w[count], %w[count], #1          \n"
+		"b.ne 1b                                \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count)
+		: /* input */
+		: /* clobber */
+		  "v0", "v1", "memory", "cc");
+	// clang-format on
+}
+#elif defined(__ARM_NEON__)
+static inline void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int count = DIVISION_FRAMES / 4;
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"vld1.32 {q0}, [%[data0]]!              \n"
+		"vld1.32 {q1}, [%[data1]]!              \n"
+		"vabs.f32 q0, q0                        \n"
+		"vabs.f32 q1, q1                        \n"
+		"vmax.f32 q0, q1                        \n"
+		"vst1.32 {q0}, [%[output]]!             \n"
+		"subs %[count], #1                      \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count)
+		: /* input */
+		: /* clobber */
+		  "q0", "q1", "memory", "cc");
+	// clang-format on
+}
+#elif defined(__SSE3__)
+#include <emmintrin.h>
+static inline void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	__m128 x, y;
+	int count = DIVISION_FRAMES / 4;
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"lddqu (%[data0]), %[x]                 \n"
+		"lddqu (%[data1]), %[y]                 \n"
+		"andps %[mask], %[x]                    \n"
+		"andps %[mask], %[y]                    \n"
+		"maxps %[y], %[x]                       \n"
+		"movdqu %[x], (%[output])               \n"
+		"add $16, %[data0]                      \n"
+		"add $16, %[data1]                      \n"
+		"add $16, %[output]                     \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count),
+		  [x]"=&x"(x),
+		  [y]"=&x"(y)
+		: /* input */
+		  [mask]"x"(_mm_set1_epi32(0x7fffffff))
+		: /* clobber */
+		  "memory", "cc");
+	// clang-format on
+}
+#else
+static inline void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int i;
+	for (i = 0; i < DIVISION_FRAMES; i++)
+		output[i] = fmaxf(fabsf(data0[i]), fabsf(data1[i]));
+}
+#endif
+
+/* Calculate compress_gain from the envelope and apply total_gain to compress
+ * the next output division. */
+#if defined(__AVX2__)
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	const int attack = envelope_rate < 1;
+
+	/* See warp_sinf() for the details for the constants. */
+	const __m256 A7 = _mm256_set1_ps(-4.3330336920917034149169921875e-3f);
+	const __m256 A5 = _mm256_set1_ps(7.9434238374233245849609375e-2f);
+	const __m256 A3 = _mm256_set1_ps(-0.645892798900604248046875f);
+	const __m256 A1 = _mm256_set1_ps(1.5707910060882568359375f);
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256 g = _mm256_set1_ps(master_linear_gain);
+	__m256 x, x2, x4, base, r8, gain, tmp1, tmp2;
+	float c, r, powers[8];
+	int i;
+
+	if (attack) {
+		/* Exponential approach to desired gain. */
+		c = compressor_gain - scaled_desired_gain;
+		r = 1 - envelope_rate;
+		base = _mm256_set1_ps(scaled_desired_gain);
+	} else {
+		/* Release - exponentially increase gain to 1.0 */
+		c = compressor_gain;
+		r = envelope_rate;
+		base = _mm256_setzero_ps();
+	}
+
+	/* Eight frames at a time, c * r^1 .. c * r^8 in the first step. */
+	for (i = 0; i < 8; i++) {
+		c *= r;
+		powers[i] = c;
+	}
+	x = _mm256_loadu_ps(powers);
+	r = r * r;
+	r = r * r;
+	r8 = _mm256_set1_ps(r * r);
+
+	for (i = 0; i < DIVISION_FRAMES; i += 8) {
+		if (i)
+			x = _mm256_mul_ps(x, r8);
+		if (!attack)
+			x = _mm256_min_ps(x, one);
+		gain = _mm256_add_ps(x, base);
+
+		/* Calculate warp_sin() for eight values. */
+		x2 = _mm256_mul_ps(gain, gain);
+		x4 = _mm256_mul_ps(x2, x2);
+		tmp1 = MADD(A7, x2, A5);
+		tmp2 = MADD(A3, x2, A1);
+		tmp2 = _mm256_mul_ps(MADD(tmp1, x4, tmp2), gain);
+
+		tmp2 = _mm256_mul_ps(tmp2, g);
+		_mm256_storeu_ps(ptr_left + i,
+				 _mm256_mul_ps(_mm256_loadu_ps(ptr_left + i),
+					       tmp2));
+		_mm256_storeu_ps(ptr_right + i,
+				 _mm256_mul_ps(_mm256_loadu_ps(ptr_right + i),
+					       tmp2));
+	}
+
+	_mm256_storeu_ps(powers, gain);
+	dk->compressor_gain = powers[7];
+}
+/* TODO(fbarchard): Port to aarch64 */
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	/* See warp_sinf() for the details for the constants. */
+	const float32x4_t A7 = vdupq_n_f32(-4.3330336920917034149169921875e-3f);
+	const float32x4_t A5 = vdupq_n_f32(7.9434238374233245849609375e-2f);
+	const float32x4_t A3 = vdupq_n_f32(-0.645892798900604248046875f);
+	const float32x4_t A1 = vdupq_n_f32(1.5707910060882568359375f);
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		float c = compressor_gain - scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		float32x4_t x0 = { c * r, c * r * r, c * r * r * r,
+				   c * r * r * r * r };
+		float32x4_t x, x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"b 2f                                               \n"
+			"1:                                                 \n"
+			"vmul.f32 %q[x0], %q[r4]                            \n"
+			"2:                                                 \n"
+			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
+			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
+			"vadd.f32 %q[x], %q[x0], %q[base]                   \n"
+			/* Calculate warp_sin() for four values in x. */
+			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
+			"vmov.f32 %q[tmp1], %q[A5]                          \n"
+			"vmov.f32 %q[tmp2], %q[A1]                          \n"
+			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
+			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
+			"vmul.f32 %q[left], %q[tmp2]                        \n"
+			"vmul.f32 %q[right], %q[tmp2]                       \n"
+			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
+			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
+			"subs %[count], #1                                  \n"
+			"bne 1b                                             \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=w"(x0),
+			  [x]"=&w"(x),
+			  [x2]"=&w"(x2),
+			  [x4]"=&w"(x4),
+			  [left]"=&w"(left),
+			  [right]"=&w"(right),
+			  [tmp1]"=&w"(tmp1),
+			  [tmp2]"=&w"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x0]"3"(x0),
+			  [A1]"w"(A1),
+			  [A3]"w"(A3),
+			  [A5]"w"(A5),
+			  [A7]"w"(A7),
+			  [base]"w"(vdupq_n_f32(scaled_desired_gain)),
+			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
+			  [g]"w"(vdupq_n_f32(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	} else {
+		float c = compressor_gain;
+		float r = envelope_rate;
+		float32x4_t x = { c * r, c * r * r, c * r * r * r,
+				  c * r * r * r * r };
+		float32x4_t x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"b 2f                                               \n"
+			"1:                                                 \n"
+			"vmul.f32 %q[x], %q[r4]                             \n"
+			"2:                                                 \n"
+			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
+			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
+			"vmin.f32 %q[x], %q[one]                            \n"
+			/* Calculate warp_sin() for four values in x. */
+			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
+			"vmov.f32 %q[tmp1], %q[A5]                          \n"
+			"vmov.f32 %q[tmp2], %q[A1]                          \n"
+			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
+			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
+			"vmul.f32 %q[left], %q[tmp2]                        \n"
+			"vmul.f32 %q[right], %q[tmp2]                       \n"
+			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
+			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
+			"subs %[count], #1                                  \n"
+			"bne 1b                                             \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=w"(x),
+			  [x2]"=&w"(x2),
+			  [x4]"=&w"(x4),
+			  [left]"=&w"(left),
+			  [right]"=&w"(right),
+			  [tmp1]"=&w"(tmp1),
+			  [tmp2]"=&w"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x]"3"(x),
+			  [A1]"w"(A1),
+			  [A3]"w"(A3),
+			  [A5]"w"(A5),
+			  [A7]"w"(A7),
+			  [one]"w"(vdupq_n_f32(1)),
+			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
+			  [g]"w"(vdupq_n_f32(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	}
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	/* See warp_sinf() for the details for the constants. */
+	const __m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
+	const __m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
+	const __m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
+	const __m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		float c = compressor_gain - scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		__m128 x0 = { c * r, c * r * r, c * r * r * r,
+			      c * r * r * r * r };
+		__m128 x, x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"jmp 2f                                     \n"
+			"1:                                         \n"
+			"mulps %[r4], %[x0]                         \n"
+			"2:                                         \n"
+			"lddqu (%[ptr_left]), %[left]               \n"
+			"lddqu (%[ptr_right]), %[right]             \n"
+			"movaps %[x0], %[x]                         \n"
+			"addps %[base], %[x]                        \n"
+			/* Calculate warp_sin() for four values in x. */
+			"movaps %[x], %[x2]                         \n"
+			"mulps %[x], %[x2]                          \n"
+			"movaps %[x2], %[x4]                        \n"
+			"movaps %[x2], %[tmp1]                      \n"
+			"movaps %[x2], %[tmp2]                      \n"
+			"mulps %[x2], %[x4]                         \n"
+			"mulps %[A7], %[tmp1]                       \n"
+			"mulps %[A3], %[tmp2]                       \n"
+			"addps %[A5], %[tmp1]                       \n"
+			"addps %[A1], %[tmp2]                       \n"
+			"mulps %[x4], %[tmp1]                       \n"
+			"addps %[tmp1], %[tmp2]                     \n"
+			"mulps %[x], %[tmp2]                        \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"mulps %[g], %[tmp2]                        \n"
+			"mulps %[tmp2], %[left]                     \n"
+			"mulps %[tmp2], %[right]                    \n"
+			"movdqu %[left], (%[ptr_left])              \n"
+			"movdqu %[right], (%[ptr_right])            \n"
+			"add $16, %[ptr_left]                       \n"
+			"add $16, %[ptr_right]                      \n"
+			"sub $1, %[count]                           \n"
+			"jne 1b                                     \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=x"(x0),
+			  [x]"=&x"(x),
+			  [x2]"=&x"(x2),
+			  [x4]"=&x"(x4),
+			  [left]"=&x"(left),
+			  [right]"=&x"(right),
+			  [tmp1]"=&x"(tmp1),
+			  [tmp2]"=&x"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x0]"3"(x0),
+			  [A1]"x"(A1),
+			  [A3]"x"(A3),
+			  [A5]"x"(A5),
+			  [A7]"x"(A7),
+			  [base]"x"(_mm_set1_ps(scaled_desired_gain)),
+			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
+			  [g]"x"(_mm_set1_ps(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	} else {
+		/* See warp_sinf() for the details for the constants. */
+		__m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
+		__m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
+		__m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
+		__m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
+
+		float c = compressor_gain;
+		float r = envelope_rate;
+		__m128 x = { c * r, c * r * r, c * r * r * r,
+			     c * r * r * r * r };
+		__m128 x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"jmp 2f                                     \n"
+			"1:                                         \n"
+			"mulps %[r4], %[x]                          \n"
+			"2:                                         \n"
+			"lddqu (%[ptr_left]), %[left]               \n"
+			"lddqu (%[ptr_right]), %[right]             \n"
+			"minps %[one], %[x]                         \n"
+			/* Calculate warp_sin() for four values in x. */
+			"movaps %[x], %[x2]                         \n"
+			"mulps %[x], %[x2]                          \n"
+			"movaps %[x2], %[x4]                        \n"
+			"movaps %[x2], %[tmp1]                      \n"
+			"movaps %[x2], %[tmp2]                      \n"
+			"mulps %[x2], %[x4]                         \n"
+			"mulps %[A7], %[tmp1]                       \n"
+			"mulps %[A3], %[tmp2]                       \n"
+			"addps %[A5], %[tmp1]                       \n"
+			"addps %[A1], %[tmp2]                       \n"
+			"mulps %[x4], %[tmp1]                       \n"
+			"addps %[tmp1], %[tmp2]                     \n"
+			"mulps %[x], %[tmp2]                        \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"mulps %[g], %[tmp2]                        \n"
+			"mulps %[tmp2], %[left]                     \n"
+			"mulps %[tmp2], %[right]                    \n"
+			"movdqu %[left], (%[ptr_left])              \n"
+			"movdqu %[right], (%[ptr_right])            \n"
+			"add $16, %[ptr_left]                       \n"
+			"add $16, %[ptr_right]                      \n"
+			"sub $1, %[count]                           \n"
+			"jne 1b                                     \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=x"(x),
+			  [x2]"=&x"(x2),
+			  [x4]"=&x"(x4),
+			  [left]"=&x"(left),
+			  [right]"=&x"(right),
+			  [tmp1]"=&x"(tmp1),
+			  [tmp2]"=&x"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x]"3"(x),
+			  [A1]"x"(A1),
+			  [A3]"x"(A3),
+			  [A5]"x"(A5),
+			  [A7]"x"(A7),
+			  [one]"x"(_mm_set1_ps(1)),
+			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
+			  [g]"x"(_mm_set1_ps(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	}
+}
+#else
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	int i, j;
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		/* Attack - reduce gain to desired. */
+		float c = compressor_gain - scaled_desired_gain;
+		float base = scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		float x[4] = { c * r, c * r * r, c * r * r * r,
+			       c * r * r * r * r };
+		float r4 = r * r * r * r;
+
+		i = 0;
+		while (1) {
+			for (j = 0; j < 4; j++) {
+				/* Warp pre-compression gain to smooth out sharp
+				 * exponential transition points.
+				 */
+				float post_warp_compressor_gain =
+					warp_sinf(x[j] + base);
+
+				/* Calculate total gain using master gain. */
+				float total_gain = master_linear_gain *
+						   post_warp_compressor_gain;
+
+				/* Apply final gain. */
+				*ptr_left++ *= total_gain;
+				*ptr_right++ *= total_gain;
+			}
+
+			if (++i == count)
+				break;
+
+			for (j = 0; j < 4; j++)
+				x[j] = x[j] * r4;
+		}
+
+		dk->compressor_gain = x[3] + base;
+	} else {
+		/* Release - exponentially increase gain to 1.0 */
+		float c = compressor_gain;
+		float r = envelope_rate;
+		float x[4] = { c * r, c * r * r, c * r * r * r,
+			       c * r * r * r * r };
+		float r4 = r * r * r * r;
+
+		i = 0;
+		while (1) {
+			for (j = 0; j < 4; j++) {
+				/* Warp pre-compression gain to smooth out sharp
+				 * exponential transition points.
+				 */
+				float post_warp_compressor_gain =
+					warp_sinf(x[j]);
+
+				/* Calculate total gain using master gain. */
+				float total_gain = master_linear_gain *
+						   post_warp_compressor_gain;
+
+				/* Apply final gain. */
+				*ptr_left++ *= total_gain;
+				*ptr_right++ *= total_gain;
+			}
+
+			if (++i == count)
+				break;
+
+			for (j = 0; j < 4; j++)
+				x[j] = min(1.0f, x[j] * r4);
+		}
+
+		dk->compressor_gain = x[3];
+	}
+}
+#endif
+
+/*
+ * Stereo interleave and deinterleave
+ */
+
+/* Converts shorts in range of -32768 to 32767 to floats in range of
+ * -1.0f to 1.0f.
+ * scvtf instruction accepts fixed point ints, so sxtl is used to lengthen
+ * shorts to int with sign extension.
+ */
+#ifdef __aarch64__
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	int chunk = frames >> 3;
+	frames &= 7;
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"ld2  {v2.8h, v3.8h}, [%[input]], #32       \n"
+			"subs %w[chunk], %w[chunk], #1              \n"
+			"sxtl   v0.4s, v2.4h                        \n"
+			"sxtl2  v1.4s, v2.8h                        \n"
+			"sxtl   v2.4s, v3.4h                        \n"
+			"sxtl2  v3.4s, v3.8h                        \n"
+			"scvtf  v0.4s, v0.4s, #15                   \n"
+			"scvtf  v1.4s, v1.4s, #15                   \n"
+			"scvtf  v2.4s, v2.4s, #15                   \n"
+			"scvtf  v3.4s, v3.4s, #15                   \n"
+			"st1    {v0.4s, v1.4s}, [%[output1]], #32   \n"
+			"st1    {v2.4s, v3.4s}, [%[output2]], #32   \n"
+			"b.ne   1b                                  \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			: /* clobber */
+			  "v0", "v1", "v2", "v3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding away
+ * from zero.
+ * Rounding is achieved by using fcvtas instruction. (a = away)
+ * The float scaled to a range of -32768 to 32767 by adding 15 to the exponent.
+ * Add to exponent is equivalent to multiply for exponent range of 0 to 239,
+ * which is 2.59 * 10^33.  A signed saturating add (sqadd) limits exponents
+ * from 240 to 255 to clamp to 255.
+ * For very large values, beyond +/- 2 billion, fcvtas will clamp the result
+ * to the min or max value that fits an int.
+ * For other values, sqxtn clamps the output to -32768 to 32767 range.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"dup    v2.4s, %w[scale]                    \n"
+			"1:                                         \n"
+			"ld1    {v0.4s}, [%[input1]], #16           \n"
+			"ld1    {v1.4s}, [%[input2]], #16           \n"
+			"subs   %w[chunk], %w[chunk], #1            \n"
+			"sqadd  v0.4s, v0.4s, v2.4s                 \n"
+			"sqadd  v1.4s, v1.4s, v2.4s                 \n"
+			"fcvtas v0.4s, v0.4s                        \n"
+			"fcvtas v1.4s, v1.4s                        \n"
+			"sqxtn  v0.4h, v0.4s                        \n"
+			"sqxtn  v1.4h, v1.4s                        \n"
+			"st2    {v0.4h, v1.4h}, [%[output]], #16    \n"
+			"b.ne   1b                                  \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [scale]"r"(15 << 23)
+			: /* clobber */
+			  "v0", "v1", "v2", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	int chunk = frames >> 3;
+	frames &= 7;
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:					    \n"
+			"vld2.16 {d0-d3}, [%[input]]!		    \n"
+			"subs %[chunk], #1			    \n"
+			"vmovl.s16 q3, d3			    \n"
+			"vmovl.s16 q2, d2			    \n"
+			"vmovl.s16 q1, d1			    \n"
+			"vmovl.s16 q0, d0			    \n"
+			"vcvt.f32.s32 q3, q3, #15		    \n"
+			"vcvt.f32.s32 q2, q2, #15		    \n"
+			"vcvt.f32.s32 q1, q1, #15		    \n"
+			"vcvt.f32.s32 q0, q0, #15		    \n"
+			"vst1.32 {d4-d7}, [%[output2]]!		    \n"
+			"vst1.32 {d0-d3}, [%[output1]]!		    \n"
+			"bne 1b					    \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			: /* clobber */
+			  "q0", "q1", "q2", "q3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding away
+ * from zero.
+ * Rounding is achieved by adding 0.5 or -0.5 adjusted for fixed point
+ * precision, and then converting float to fixed point using vcvt instruction
+ * which truncated toward zero.
+ * For very large values, beyond +/- 2 billion, vcvt will clamp the result
+ * to the min or max value that fits an int.
+ * For other values, vqmovn clamps the output to -32768 to 32767 range.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	float32x4_t pos = vdupq_n_f32(0.5f / 32768.0f);
+	float32x4_t neg = vdupq_n_f32(-0.5f / 32768.0f);
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"veor q0, q0, q0			    \n"
+			"1:					    \n"
+			"vld1.32 {d2-d3}, [%[input1]]!		    \n"
+			"vld1.32 {d4-d5}, [%[input2]]!		    \n"
+			"subs %[chunk], #1			    \n"
+			/* We try to round to the nearest number by adding 0.5
+			 * to positive input, and adding -0.5 to the negative
+			 * input, then truncate.
+			 */
+			"vcgt.f32 q3, q1, q0			    \n"
+			"vcgt.f32 q4, q2, q0			    \n"
+			"vbsl q3, %q[pos], %q[neg]		    \n"
+			"vbsl q4, %q[pos], %q[neg]		    \n"
+			"vadd.f32 q1, q1, q3			    \n"
+			"vadd.f32 q2, q2, q4			    \n"
+			"vcvt.s32.f32 q1, q1, #15		    \n"
+			"vcvt.s32.f32 q2, q2, #15		    \n"
+			"vqmovn.s32 d2, q1			    \n"
+			"vqmovn.s32 d3, q2			    \n"
+			"vst2.16 {d2-d3}, [%[output]]!		    \n"
+			"bne 1b					    \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [pos]"w"(pos),
+			  [neg]"w"(neg)
+			: /* clobber */
+			  "q0", "q1", "q2", "q3", "q4", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+
+#if defined(__AVX2__)
+/* Same as the SSE3 version below, eight frames per loop. */
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	const __m256 scale_2_n31 = _mm256_set1_ps(1.0f / (1 << 15) / (1 << 16));
+	const __m256 scale_2_n15 = _mm256_set1_ps(1.0f / (1 << 15));
+	__m256 left, right;
+	__m256i in;
+
+	for (; frames >= 8; frames -= 8) {
+		in = _mm256_loadu_si256((const __m256i *)input);
+		/* The left sample shifted up to the top half keeps its sign,
+		 * the right one is already there. */
+		left = _mm256_cvtepi32_ps(_mm256_slli_epi32(in, 16));
+		right = _mm256_cvtepi32_ps(_mm256_srai_epi32(in, 16));
+		_mm256_storeu_ps(output1, _mm256_mul_ps(left, scale_2_n31));
+		_mm256_storeu_ps(output2, _mm256_mul_ps(right, scale_2_n15));
+		input += 16;
+		output1 += 8;
+		output2 += 8;
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Same as the SSE3 version below, eight frames per loop. The in-lane unpack
+ * and pack put the frames back in order:
+ * L0 R0 L1 R1 | L4 R4 L5 R5 and L2 R2 L3 R3 | L6 R6 L7 R7 ->
+ * L0 R0 L1 R1 L2 R2 L3 R3 | L4 R4 L5 R5 L6 R6 L7 R7 */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	const __m256 scale_2_15 = _mm256_set1_ps(32768.0f);
+	__m256 left, right;
+	__m256i lo, hi;
+
+	for (; frames >= 8; frames -= 8) {
+		left = _mm256_mul_ps(_mm256_loadu_ps(input1), scale_2_15);
+		right = _mm256_mul_ps(_mm256_loadu_ps(input2), scale_2_15);
+		lo = _mm256_cvtps_epi32(_mm256_unpacklo_ps(left, right));
+		hi = _mm256_cvtps_epi32(_mm256_unpackhi_ps(left, right));
+		_mm256_storeu_si256((__m256i *)output,
+				    _mm256_packs_epi32(lo, hi));
+		input1 += 8;
+		input2 += 8;
+		output += 16;
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#elif defined(__SSE3__)
+#include <emmintrin.h>
+
+/* Converts shorts in range of -32768 to 32767 to floats in range of
+ * -1.0f to 1.0f.
+ * pslld and psrad shifts are used to isolate the low and high word, but
+ * each in a different range:
+ * The low word is shifted to the high bits in range 0x80000000 .. 0x7fff0000.
+ * The high word is shifted to the low bits in range 0x00008000 .. 0x00007fff.
+ * cvtdq2ps converts ints to floats as is.
+ * mulps is used to normalize the range of the low and high words, adjusting
+ * for high and low words being in different range.
+ */
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	int chunk = frames >> 3;
+	frames &= 7;
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"lddqu (%[input]), %%xmm0                   \n"
+			"lddqu 16(%[input]), %%xmm1                 \n"
+			"add $32, %[input]                          \n"
+			"movdqa %%xmm0, %%xmm2                      \n"
+			"movdqa %%xmm1, %%xmm3                      \n"
+			"pslld $16, %%xmm0                          \n"
+			"pslld $16, %%xmm1                          \n"
+			"psrad $16, %%xmm2                          \n"
+			"psrad $16, %%xmm3                          \n"
+			"cvtdq2ps %%xmm0, %%xmm0                    \n"
+			"cvtdq2ps %%xmm1, %%xmm1                    \n"
+			"cvtdq2ps %%xmm2, %%xmm2                    \n"
+			"cvtdq2ps %%xmm3, %%xmm3                    \n"
+			"mulps %[scale_2_n31], %%xmm0               \n"
+			"mulps %[scale_2_n31], %%xmm1               \n"
+			"mulps %[scale_2_n15], %%xmm2               \n"
+			"mulps %[scale_2_n15], %%xmm3               \n"
+			"movdqu %%xmm0, (%[output1])                \n"
+			"movdqu %%xmm1, 16(%[output1])              \n"
+			"movdqu %%xmm2, (%[output2])                \n"
+			"movdqu %%xmm3, 16(%[output2])              \n"
+			"add $32, %[output1]                        \n"
+			"add $32, %[output2]                        \n"
+			"sub $1, %[chunk]                           \n"
+			"jnz 1b                                     \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			  [scale_2_n31]"x"(_mm_set1_ps(1.0f/(1<<15)/(1<<16))),
+			  [scale_2_n15]"x"(_mm_set1_ps(1.0f/(1<<15)))
+			: /* clobber */
+			  "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding to
+ * even.
+ * For very large values, beyond +/- 2 billion, cvtps2dq will produce
+ * 0x80000000 and packssdw will clamp -32768.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"lddqu (%[input1]), %%xmm0                  \n"
+			"lddqu (%[input2]), %%xmm2                  \n"
+			"add $16, %[input1]                         \n"
+			"add $16, %[input2]                         \n"
+			"movaps %%xmm0, %%xmm1                      \n"
+			"unpcklps %%xmm2, %%xmm0                    \n"
+			"unpckhps %%xmm2, %%xmm1                    \n"
+			"paddsw %[scale_2_15], %%xmm0               \n"
+			"paddsw %[scale_2_15], %%xmm1               \n"
+			"cvtps2dq %%xmm0, %%xmm0                    \n"
+			"cvtps2dq %%xmm1, %%xmm1                    \n"
+			"packssdw %%xmm1, %%xmm0                    \n"
+			"movdqu %%xmm0, (%[output])                 \n"
+			"add $16, %[output]                         \n"
+			"sub $1, %[chunk]                           \n"
+			"jnz 1b                                     \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [scale_2_15]"x"(_mm_set1_epi32(15 << 23)),
+			  [clamp_large]"x"(_mm_set1_ps(32767.0f))
+			: /* clobber */
+			  "xmm0", "xmm1", "xmm2", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+
+const struct dsp_ops OPS(dsp_kernels) = {
+	.eq2_process = eq2_process,
+	.lr42_split = lr42_split,
+	.lr42_merge = lr42_merge,
+	.max_abs_division = max_abs_division,
+	.dk_compress_output = dk_compress_output,
+#ifdef deinterleave_stereo
+	.deinterleave_stereo = deinterleave_stereo,
+#endif
+#ifdef interleave_stereo
+	.interleave_stereo = interleave_stereo,
+#endif
+};
@@ -0,0 +1,68 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef DSP_OPS_H_
+#define DSP_OPS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "biquad.h"
+#include "crossover2.h"
+#include "drc_kernel.h"
+
+extern const struct dsp_ops dsp_kernels;
+extern const struct dsp_ops dsp_kernels_sse42;
+extern const struct dsp_ops dsp_kernels_avx;
+extern const struct dsp_ops dsp_kernels_avx2;
+extern const struct dsp_ops dsp_kernels_fma;
+
+/* Struct containing the inner loops of the DSP modules. Like cras_mix_ops,
+ * dsp_ops.c is built once per instruction set and dsp_util_init() picks the
+ * implementation for the CPU at runtime.
+ *
+ * Members:
+ *   eq2_process: Runs the first |n| biquads of both channels of an EQ2.
+ *   lr42_split: Splits both channels with a pair of LR4 filters, see
+ *       crossover2_process().
+ *   lr42_merge: Splits both channels with a pair of LR4 filters and sums the
+ *       two bands back, see crossover2_process().
+ *   max_abs_division: Stores the larger absolute value of the two channels
+ *       for each frame of a DRC division.
+ *   dk_compress_output: Applies the compressor gain envelope to the next DRC
+ *       output division.
+ *   deinterleave_stereo: Converts S16 stereo frames to two float channels.
+ *       NULL if there is nothing faster than the generic loop.
+ *   interleave_stereo: Converts two float channels to S16 stereo frames.
+ *       NULL if there is nothing faster than the generic loop.
+ */
+struct dsp_ops {
+	void (*eq2_process)(struct biquad (*bq)[2], int n, float *data0,
+			    float *data1, int count);
+	void (*lr42_split)(struct lr42 *lp, struct lr42 *hp, int count,
+			   float *data0L, float *data0R, float *data1L,
+			   float *data1R);
+	void (*lr42_merge)(struct lr42 *lp, struct lr42 *hp, int count,
+			   float *dataL, float *dataR);
+	void (*max_abs_division)(float *output, const float *data0,
+				 const float *data1);
+	void (*dk_compress_output)(struct drc_kernel *dk);
+	void (*deinterleave_stereo)(int16_t *input, float *output1,
+				    float *output2, int frames);
+	void (*interleave_stereo)(float *input1, float *input2,
+				  int16_t *output, int frames);
+};
+
+/* Returns the implementation selected by dsp_util_init(). */
+const struct dsp_ops *dsp_get_ops();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* DSP_OPS_H_ */
@@ -14,6 +14,12 @@ extern "C" {
 
 #include "cras_audio_format.h"
 
+/* Selects the fastest implementation of the DSP kernels for the CPU.
+ * Args:
+ *    cpu_flags - The CPU_X86_* flags from cras_cpu_flags.h.
+ */
+void dsp_util_init(unsigned int cpu_flags);
+
 /* Converts from interleaved int16_t samples to non-interleaved float samples.
  * The int16_t samples have range [-32768, 32767], and the float samples have
  * range [-1.0, 1.0].
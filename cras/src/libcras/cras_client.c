@@ -19,6 +19,14 @@
  *  running - Once the connections are established, the client will listen for
  *    requests on aud_fd and fill the shm region with the requested number of
  *    samples. This happens in the aud_cb specified in the stream parameters.
+ *    If the server accepted SHM_WAKEUP, requests and replies are written to
+ *    the shm header instead. The audio thread sleeps on a futex there and
+ *    replies through an eventfd sent with the connected message. If the
+ *    server laid a playback shm out as a ring, samples are written at the
+ *    ring's write counter instead of into the next of two buffers.
+ *    With cras_client_set_shared_audio_thread(), a single audio thread waits
+ *    on the aud_fds of all streams with epoll instead, and services the
+ *    streams that are ready in the order of their deadlines.
  */
 
 #ifndef _GNU_SOURCE
@@ -32,12 +40,14 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/ipc.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -59,6 +69,10 @@ static const size_t SERVER_SHUTDOWN_TIMEOUT_US = 500000;
 static const size_t SERVER_CONNECT_TIMEOUT_MS = 1000;
 static const size_t HOTWORD_FRAME_RATE = 16000;
 static const size_t HOTWORD_BLOCK_SIZE = 320;
+/* Streams handled per wake up of the shared audio thread. */
+#define MAX_SHARED_AUD_EVENTS 32
+/* Epoll data of the eventfd that wakes the shared audio thread. */
+static const uint64_t SHARED_AUD_WAKE_ID = UINT64_MAX;
 
 /* Commands sent from the user to the running client. */
 enum { CLIENT_STOP,
@@ -146,6 +160,15 @@ struct cras_stream_params {
  * tid - Thread id of the audio thread spawned for this stream.
  * running - Audio thread runs while this is non-zero.
  * wake_fds - Pipe to wake the audio thread.
+ * wake_fd - Eventfd to signal replies to the server, -1 unless the server
+ *    accepted SHM_WAKEUP.
+ * wake_seq - Sequence number of the last shm request handled.
+ * cb_frames - Frames the running audio callback can access through
+ *    cras_client_playback_begin() or cras_client_capture_begin().
+ * cb_committed - Frames committed by the running audio callback, or -1 if it
+ *    doesn't use the begin/commit functions.
+ * pull - Set with aud_lock held once the server accepted PULL_MODE and the
+ *    ring is mapped, so other threads can write it.
  * client - The client this stream is attached to.
  * config - Audio stream configuration.
  * shm - Shared memory used to exchange audio samples with the server.
@@ -159,6 +182,11 @@ struct client_stream {
 	float volume_scaler;
 	struct thread_state thread;
 	int wake_fds[2]; /* Pipe to wake the thread */
+	int wake_fd;
+	uint32_t wake_seq;
+	unsigned int cb_frames;
+	int cb_committed;
+	bool pull;
 	struct cras_client *client;
 	struct cras_stream_params *config;
 	struct cras_audio_shm *shm;
@@ -207,14 +235,28 @@ typedef enum cras_socket_state {
  * streams - Linked list of streams attached to this client.
  * server_state - RO shared memory region holding server state.
  * atlog_ro - RO shared memory region holding audio thread log.
+ * attiming_ro - The audio thread timing statistics in the atlog region, NULL
+ *    if the server doesn't provide them.
  * debug_info_callback - Function to call when debug info is received.
  * atlog_access_callback - Function to call when atlog RO fd is received.
+ * attrace - The atlog trace ring shared read-write with the server, NULL if
+ *    no trace was started.
+ * attrace_size - Size of the attrace mapping.
+ * attrace_callback - Function to call when the server replies to starting a
+ *    trace.
  * get_hotword_models_cb_t - Function to call when hotword models info is ready.
  * server_connection_cb - Function to called when a connection state changes.
  * server_connection_user_arg - User argument for server_connection_cb.
  * thread_priority_cb - Function to call for setting audio thread priority.
  * observer_ops - Functions to call when system state changes.
  * observer_context - Context passed to client in state change callbacks.
+ * shared_aud - Set when one audio thread services all streams.
+ * aud_thread - The shared audio thread.
+ * aud_epoll_fd - Epoll set of the aud_fds of the connected streams, waited
+ *    on by the shared audio thread.
+ * aud_wake_fd - Eventfd to wake the shared audio thread.
+ * aud_lock - Held by the shared audio thread while it services streams, and
+ *    by the client thread while it adds or removes streams.
  */
 struct cras_client {
 	int id;
@@ -235,14 +277,23 @@ struct cras_client {
 	struct client_stream *streams;
 	const struct cras_server_state *server_state;
 	struct audio_thread_event_log *atlog_ro;
+	const struct audio_thread_timing *attiming_ro;
 	void (*debug_info_callback)(struct cras_client *);
 	void (*atlog_access_callback)(struct cras_client *);
+	struct audio_thread_trace *attrace;
+	size_t attrace_size;
+	void (*attrace_callback)(struct cras_client *, int);
 	get_hotword_models_cb_t get_hotword_models_cb;
 	cras_connection_status_cb_t server_connection_cb;
 	void *server_connection_user_arg;
 	cras_thread_priority_cb_t thread_priority_cb;
 	struct cras_observer_ops observer_ops;
 	void *observer_context;
+	bool shared_aud;
+	struct thread_state aud_thread;
+	int aud_epoll_fd;
+	int aud_wake_fd;
+	pthread_mutex_t aud_lock;
 };
 
 /*
@@ -274,6 +325,9 @@ struct cras_hotword_handle {
 	void *user_data;
 };
 
+/* The stream whose audio callback is running on this thread. */
+static __thread struct client_stream *cb_stream;
+
 /*
  * Local Helpers
  */
@@ -1041,6 +1095,19 @@ static unsigned int config_capture_buf(struct client_stream *stream,
 	return num_frames;
 }
 
+/* Writes the reply to the last request of a SHM_WAKEUP stream to shm, and
+ * wakes the server up. */
+static int send_shm_reply(struct client_stream *stream, unsigned int frames,
+			  int err)
+{
+	uint64_t one = 1;
+
+	cras_shm_wake_reply(stream->shm, stream->wake_seq, frames, err);
+	if (write(stream->wake_fd, &one, sizeof(one)) != sizeof(one))
+		return -EPIPE;
+	return 0;
+}
+
 static void complete_capture_read_current(struct client_stream *stream,
 					  unsigned int num_frames)
 {
@@ -1056,6 +1123,9 @@ static int send_capture_reply(struct client_stream *stream, unsigned int frames,
 	if (!cras_stream_uses_input_hw(stream->direction))
 		return 0;
 
+	if (stream->wake_fd >= 0)
+		return send_shm_reply(stream, frames, err);
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_CAPTURED;
 	aud_msg.frames = frames;
 	aud_msg.error = err;
@@ -1067,6 +1137,76 @@ static int send_capture_reply(struct client_stream *stream, unsigned int frames,
 	return 0;
 }
 
+/* Marks the audio callback of |stream| as running on this thread, with
+ * |frames| frames accessible through the begin/commit functions. */
+static void begin_callback(struct client_stream *stream, unsigned int frames)
+{
+	stream->cb_frames = frames;
+	stream->cb_committed = -1;
+	cb_stream = stream;
+}
+
+/* Ends the audio callback of |stream|.
+ * Returns:
+ *    The number of frames committed if the callback used the begin/commit
+ *    functions and didn't fail, otherwise |rc|, the callback's return value.
+ */
+static int end_callback(struct client_stream *stream, int rc)
+{
+	cb_stream = NULL;
+	if (rc < 0 || stream->cb_committed < 0)
+		return rc;
+	return stream->cb_committed;
+}
+
+/* Gets the stream whose audio callback is running on this thread, if it is
+ * |stream_id| of |client| and has a direction that matches |output|. */
+static struct client_stream *callback_stream(const struct cras_client *client,
+					     cras_stream_id_t stream_id,
+					     bool output)
+{
+	struct client_stream *stream = cb_stream;
+
+	if (!stream || stream->client != client || stream->id != stream_id)
+		return NULL;
+	if ((stream->direction == CRAS_STREAM_OUTPUT) != output)
+		return NULL;
+	return stream;
+}
+
+/* Looks up a stream that can be written from any thread, see PULL_MODE.
+ * Returns it with aud_lock held so it can't be removed, or NULL. */
+static struct client_stream *lock_pull_stream(struct cras_client *client,
+					      cras_stream_id_t stream_id)
+{
+	struct client_stream *stream;
+
+	pthread_mutex_lock(&client->aud_lock);
+	stream = stream_from_id(client, stream_id);
+	if (stream && stream->pull)
+		return stream;
+	pthread_mutex_unlock(&client->aud_lock);
+	return NULL;
+}
+
+/* Frames committed so far by the running audio callback. */
+static unsigned int callback_committed(const struct client_stream *stream)
+{
+	return stream->cb_committed < 0 ? 0 : stream->cb_committed;
+}
+
+/* Commits frames for the running audio callback. */
+static int commit_callback_frames(struct client_stream *stream,
+				  unsigned int frames)
+{
+	unsigned int committed = callback_committed(stream);
+
+	if (frames > stream->cb_frames - committed)
+		return -EINVAL;
+	stream->cb_committed = committed + frames;
+	return 0;
+}
+
 /* For capture streams this handles the message signalling that data is ready to
  * be passed to the user of this stream.  Calls the audio callback with the new
  * samples, and mark them as read.
@@ -1098,6 +1238,7 @@ static int handle_capture_data_ready(struct client_stream *stream,
 
 	cras_timespec_to_timespec(&ts, &stream->shm->header->ts);
 
+	begin_callback(stream, num_frames);
 	if (config->unified_cb)
 		frames = config->unified_cb(stream->client, stream->id,
 					    captured_frames, NULL, num_frames,
@@ -1106,6 +1247,7 @@ static int handle_capture_data_ready(struct client_stream *stream,
 		frames = config->aud_cb(stream->client, stream->id,
 					captured_frames, num_frames, &ts,
 					config->user_data);
+	frames = end_callback(stream, frames);
 	if (frames < 0) {
 		send_stream_message(stream, CLIENT_STREAM_EOF);
 		rc = frames;
@@ -1129,6 +1271,9 @@ static int send_playback_reply(struct client_stream *stream,
 	if (!cras_stream_uses_output_hw(stream->direction))
 		return 0;
 
+	if (stream->wake_fd >= 0)
+		return send_shm_reply(stream, frames, error);
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_READY;
 	aud_msg.frames = frames;
 	aud_msg.error = error;
@@ -1152,6 +1297,7 @@ static int handle_playback_request(struct client_stream *stream,
 	struct cras_stream_params *config;
 	struct cras_audio_shm *shm = stream->shm;
 	struct timespec ts;
+	unsigned int cb_frames;
 
 	config = stream->config;
 
@@ -1165,10 +1311,21 @@ static int handle_playback_request(struct client_stream *stream,
 
 	/* Limit the amount of frames to the configured amount. */
 	num_frames = MIN(num_frames, config->cb_threshold);
+	cb_frames = num_frames;
+
+	/* A ring can only be written up to its end in one go. The server sizes
+	 * it in multiples of cb_threshold, so only short callbacks split.
+	 * cras_client_playback_begin() can write across the end. */
+	if (cras_shm_is_ring(shm)) {
+		num_frames = MIN(num_frames, cras_shm_get_num_writeable(shm));
+		cb_frames = MIN(cb_frames,
+				shm->ring_frames - cras_shm_get_frames(shm));
+	}
 
 	cras_timespec_to_timespec(&ts, &shm->header->ts);
 
 	/* Get samples from the user */
+	begin_callback(stream, cb_frames);
 	if (config->unified_cb)
 		frames = config->unified_cb(stream->client, stream->id, NULL,
 					    buf, num_frames, NULL, &ts,
@@ -1176,6 +1333,7 @@ static int handle_playback_request(struct client_stream *stream,
 	else
 		frames = config->aud_cb(stream->client, stream->id, buf,
 					num_frames, &ts, config->user_data);
+	frames = end_callback(stream, frames);
 	if (frames < 0) {
 		send_stream_message(stream, CLIENT_STREAM_EOF);
 		rc = frames;
@@ -1185,16 +1343,20 @@ static int handle_playback_request(struct client_stream *stream,
 	cras_shm_buffer_written_start(shm, frames);
 
 reply_written:
+	/* The server doesn't wait for pull streams, they are only notified. */
+	if (stream->pull)
+		return rc;
+
 	/* Signal server that data is ready, or that an error has occurred. */
 	rc = send_playback_reply(stream, frames, rc);
 	return rc;
 }
 
-static void audio_thread_set_priority(struct client_stream *stream)
+static void audio_thread_set_priority(struct cras_client *client)
 {
 	/* Use provided callback to set priority if available. */
-	if (stream->client->thread_priority_cb) {
-		stream->client->thread_priority_cb(stream->client);
+	if (client->thread_priority_cb) {
+		client->thread_priority_cb(client);
 		return;
 	}
 
@@ -1204,8 +1366,55 @@ static void audio_thread_set_priority(struct client_stream *stream)
 		cras_set_nice_level(CRAS_CLIENT_NICENESS_LEVEL);
 }
 
+/* Waits for the next request from the server in the shm header of a
+ * SHM_WAKEUP stream, or until stop_aud_thread() wakes the thread.
+ * Returns:
+ *    The size of the request filled in |msg|, or 0 if there is none.
+ */
+static int wait_for_shm_request(struct client_stream *stream,
+				struct audio_message *msg)
+{
+	struct cras_audio_shm *shm = stream->shm;
+	uint32_t futex, id, frames;
+	int rc = 0;
+
+	futex = cras_shm_wake_begin_wait(shm);
+	if (thread_is_running(&stream->thread)) {
+		rc = cras_shm_wake_next_request(shm, &stream->wake_seq, &id,
+						&frames);
+		if (!rc)
+			cras_shm_wake_wait(shm, futex);
+	}
+	cras_shm_wake_end_wait(shm);
+	if (!rc)
+		return 0;
+
+	msg->id = (enum CRAS_AUDIO_MESSAGE_ID)id;
+	msg->frames = frames;
+	msg->error = 0;
+	return sizeof(*msg);
+}
+
+/* Handles a request from the server for a stream.
+ * Returns:
+ *    0, unless the stream shouldn't be serviced anymore.
+ */
+static int handle_aud_message(struct client_stream *stream,
+			      const struct audio_message *aud_msg)
+{
+	switch (aud_msg->id) {
+	case AUDIO_MESSAGE_DATA_READY:
+		return handle_capture_data_ready(stream, aud_msg->frames);
+	case AUDIO_MESSAGE_REQUEST_DATA:
+		return handle_playback_request(stream, aud_msg->frames);
+	default:
+		return 0;
+	}
+}
+
 /* Listens to the audio socket for messages from the server indicating that
- * the stream needs to be serviced.  One of these runs per stream. */
+ * the stream needs to be serviced.  One of these runs per stream, unless the
+ * client uses a shared audio thread. */
 static void *audio_thread(void *arg)
 {
 	struct client_stream *stream = (struct client_stream *)arg;
@@ -1217,7 +1426,7 @@ static void *audio_thread(void *arg)
 	if (arg == NULL)
 		return (void *)-EIO;
 
-	audio_thread_set_priority(stream);
+	audio_thread_set_priority(stream->client);
 
 	/* Notify the control thread that we've started. */
 	pthread_mutex_lock(&stream->client->stream_start_lock);
@@ -1230,26 +1439,19 @@ static void *audio_thread(void *arg)
 		aud_fd = (stream->thread.state == CRAS_THREAD_WARMUP) ?
 				 -1 :
 				 stream->aud_fd;
-		num_read =
-			read_with_wake_fd(stream->wake_fds[0], aud_fd,
-					  (uint8_t *)&aud_msg, sizeof(aud_msg));
+		if (aud_fd >= 0 && stream->wake_fd >= 0)
+			num_read = wait_for_shm_request(stream, &aud_msg);
+		else
+			num_read = read_with_wake_fd(stream->wake_fds[0],
+						     aud_fd,
+						     (uint8_t *)&aud_msg,
+						     sizeof(aud_msg));
 		if (num_read < 0)
 			return (void *)-EIO;
 		if (num_read == 0)
 			continue;
 
-		switch (aud_msg.id) {
-		case AUDIO_MESSAGE_DATA_READY:
-			thread_terminated = handle_capture_data_ready(
-				stream, aud_msg.frames);
-			break;
-		case AUDIO_MESSAGE_REQUEST_DATA:
-			thread_terminated =
-				handle_playback_request(stream, aud_msg.frames);
-			break;
-		default:
-			break;
-		}
+		thread_terminated = handle_aud_message(stream, &aud_msg);
 	}
 
 	return NULL;
@@ -1277,6 +1479,8 @@ static void stop_aud_thread(struct client_stream *stream, int join)
 	if (thread_is_running(&stream->thread)) {
 		stream->thread.state = CRAS_THREAD_STOP;
 		wake_aud_thread(stream);
+		if (stream->wake_fd >= 0 && stream->shm)
+			cras_shm_wake_client(stream->shm, 1);
 		if (join)
 			pthread_join(stream->thread.tid, NULL);
 	}
@@ -1337,6 +1541,230 @@ static int start_aud_thread(struct client_stream *stream)
 	return 0;
 }
 
+/* Gets the time by which the last request of a stream has to be serviced.
+ * That is when the next sample written will be played, or when capture will
+ * overrun the buffer. */
+static void stream_deadline(const struct client_stream *stream,
+			    struct timespec *deadline)
+{
+	struct timespec buffer_time;
+
+	cras_timespec_to_timespec(deadline, &stream->shm->header->ts);
+	if (stream->direction == CRAS_STREAM_OUTPUT)
+		return;
+	cras_frames_to_time(stream->config->buffer_frames,
+			    stream->config->format.frame_rate, &buffer_time);
+	add_timespecs(deadline, &buffer_time);
+}
+
+/* Stops the shared audio thread from waiting on the aud_fd of a stream. */
+static void shared_aud_thread_unwatch(struct cras_client *client,
+				      struct client_stream *stream)
+{
+	epoll_ctl(client->aud_epoll_fd, EPOLL_CTL_DEL, stream->aud_fd, NULL);
+}
+
+/* Reads the pending request of every stream in |ready|, which is sorted by
+ * deadline, and services them. Called with aud_lock held. */
+static void service_ready_streams(struct cras_client *client,
+				  struct client_stream **ready,
+				  unsigned int num_ready)
+{
+	struct audio_message aud_msg;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < num_ready; i++) {
+		rc = read(ready[i]->aud_fd, &aud_msg, sizeof(aud_msg));
+		if (rc != sizeof(aud_msg)) {
+			/* The server closed the stream, it will tell the
+			 * client thread why. */
+			shared_aud_thread_unwatch(client, ready[i]);
+			continue;
+		}
+		if (handle_aud_message(ready[i], &aud_msg))
+			shared_aud_thread_unwatch(client, ready[i]);
+	}
+}
+
+/* Waits until some streams of a client are ready, then services them in the
+ * order of their deadlines.
+ * Returns:
+ *    0 on success, or a negative error code if waiting failed.
+ */
+static int shared_aud_thread_wait(struct cras_client *client)
+{
+	struct epoll_event events[MAX_SHARED_AUD_EVENTS];
+	struct client_stream *ready[MAX_SHARED_AUD_EVENTS];
+	struct timespec deadlines[MAX_SHARED_AUD_EVENTS];
+	struct client_stream *stream;
+	struct timespec deadline;
+	unsigned int num_ready, j;
+	eventfd_t value;
+	int num_events, i;
+
+	num_events = epoll_wait(client->aud_epoll_fd, events,
+				MAX_SHARED_AUD_EVENTS, -1);
+	if (num_events < 0)
+		return (errno == EINTR) ? 0 : -errno;
+
+	pthread_mutex_lock(&client->aud_lock);
+	num_ready = 0;
+	for (i = 0; i < num_events; i++) {
+		if (events[i].data.u64 == SHARED_AUD_WAKE_ID) {
+			eventfd_read(client->aud_wake_fd, &value);
+			continue;
+		}
+		/* The stream may have been removed since epoll_wait()
+		 * returned. */
+		stream = stream_from_id(client,
+					(cras_stream_id_t)events[i].data.u64);
+		if (!stream || !stream->shm)
+			continue;
+
+		/* Insertion sort, there are only a few streams. */
+		stream_deadline(stream, &deadline);
+		for (j = num_ready; j > 0; j--) {
+			if (!timespec_after(&deadlines[j - 1], &deadline))
+				break;
+			ready[j] = ready[j - 1];
+			deadlines[j] = deadlines[j - 1];
+		}
+		ready[j] = stream;
+		deadlines[j] = deadline;
+		num_ready++;
+	}
+	service_ready_streams(client, ready, num_ready);
+	pthread_mutex_unlock(&client->aud_lock);
+
+	return 0;
+}
+
+/* Services all streams of a client that enabled a shared audio thread, used
+ * instead of one audio_thread() per stream. */
+static void *shared_audio_thread(void *arg)
+{
+	struct cras_client *client = (struct cras_client *)arg;
+	int rc;
+
+	audio_thread_set_priority(client);
+
+	/* Notify the control thread that we've started. */
+	pthread_mutex_lock(&client->stream_start_lock);
+	pthread_cond_broadcast(&client->stream_start_cond);
+	pthread_mutex_unlock(&client->stream_start_lock);
+
+	while (thread_is_running(&client->aud_thread)) {
+		rc = shared_aud_thread_wait(client);
+		if (rc < 0) {
+			syslog(LOG_ERR, "cras_client: epoll_wait: %s",
+			       strerror(-rc));
+			return (void *)-EIO;
+		}
+	}
+
+	return NULL;
+}
+
+/* Stops the shared audio thread of a client, and frees its resources. */
+static void stop_shared_aud_thread(struct cras_client *client)
+{
+	if (thread_is_running(&client->aud_thread)) {
+		client->aud_thread.state = CRAS_THREAD_STOP;
+		eventfd_write(client->aud_wake_fd, 1);
+		pthread_join(client->aud_thread.tid, NULL);
+	}
+
+	if (client->aud_epoll_fd >= 0) {
+		close(client->aud_epoll_fd);
+		client->aud_epoll_fd = -1;
+	}
+	if (client->aud_wake_fd >= 0) {
+		close(client->aud_wake_fd);
+		client->aud_wake_fd = -1;
+	}
+}
+
+/* Starts the shared audio thread of a client if it isn't running yet.
+ * Returns when the thread has started and is waiting.
+ * Returns:
+ *    0 for success, or a negative error code.
+ */
+static int start_shared_aud_thread(struct cras_client *client)
+{
+	struct epoll_event ev;
+	struct timespec future;
+	int rc;
+
+	if (thread_is_running(&client->aud_thread))
+		return 0;
+
+	client->aud_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	client->aud_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (client->aud_epoll_fd < 0 || client->aud_wake_fd < 0) {
+		rc = -errno;
+		syslog(LOG_ERR, "cras_client: shared audio thread setup: %s",
+		       strerror(-rc));
+		goto error;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = SHARED_AUD_WAKE_ID;
+	if (epoll_ctl(client->aud_epoll_fd, EPOLL_CTL_ADD, client->aud_wake_fd,
+		      &ev) < 0) {
+		rc = -errno;
+		goto error;
+	}
+
+	client->aud_thread.state = CRAS_THREAD_RUNNING;
+
+	pthread_mutex_lock(&client->stream_start_lock);
+	rc = pthread_create(&client->aud_thread.tid, NULL, shared_audio_thread,
+			    client);
+	if (rc) {
+		pthread_mutex_unlock(&client->stream_start_lock);
+		syslog(LOG_ERR, "cras_client: Couldn't create audio thread: %s",
+		       strerror(rc));
+		client->aud_thread.state = CRAS_THREAD_STOP;
+		rc = -rc;
+		goto error;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &future);
+	future.tv_sec += 2; /* Wait up to two seconds. */
+	rc = pthread_cond_timedwait(&client->stream_start_cond,
+				    &client->stream_start_lock, &future);
+	pthread_mutex_unlock(&client->stream_start_lock);
+	if (rc != 0) {
+		syslog(LOG_ERR, "cras_client: Audio thread not responding: %s",
+		       strerror(rc));
+		rc = -rc;
+		goto error;
+	}
+	return 0;
+
+error:
+	stop_shared_aud_thread(client);
+	return rc;
+}
+
+/* Starts waiting on the aud_fd of a newly connected stream in the shared
+ * audio thread. */
+static int shared_aud_thread_watch(struct cras_client *client,
+				   struct client_stream *stream)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = stream->id;
+	if (epoll_ctl(client->aud_epoll_fd, EPOLL_CTL_ADD, stream->aud_fd,
+		      &ev) < 0)
+		return -errno;
+	return 0;
+}
+
 /*
  * Client thread.
  */
@@ -1378,13 +1806,14 @@ static void free_shm(struct client_stream *stream)
  * thread that will handle requests from the server. */
 static int stream_connected(struct client_stream *stream,
 			    const struct cras_client_stream_connected *msg,
-			    const int stream_fds[2], const unsigned int num_fds)
+			    const int stream_fds[3], const unsigned int num_fds)
 {
 	int rc, samples_prot;
 	unsigned int i;
 	struct cras_shm_info header_info, samples_info;
 
-	if (msg->err || num_fds != 2) {
+	/* A third fd is the eventfd of a SHM_WAKEUP stream. */
+	if (msg->err || num_fds < 2 || num_fds > 3) {
 		syslog(LOG_ERR, "cras_client: Error setting up stream %d\n",
 		       msg->err);
 		rc = msg->err;
@@ -1418,8 +1847,30 @@ static int stream_connected(struct client_stream *stream,
 	cras_shm_copy_shared_config(stream->shm);
 	cras_shm_set_volume_scaler(stream->shm, stream->volume_scaler);
 
-	stream->thread.state = CRAS_THREAD_RUNNING;
-	wake_aud_thread(stream);
+	if (num_fds == 3) {
+		stream->wake_fd = stream_fds[2];
+		stream->wake_seq = 0;
+	}
+
+	if (stream->client->shared_aud) {
+		rc = shared_aud_thread_watch(stream->client, stream);
+		if (rc < 0) {
+			syslog(LOG_ERR, "cras_client: Error watching stream");
+			/* The other fds are closed below. */
+			stream->wake_fd = -1;
+			goto err_ret;
+		}
+	} else {
+		stream->thread.state = CRAS_THREAD_RUNNING;
+		wake_aud_thread(stream);
+	}
+
+	/* The server only keeps PULL_MODE with a ring. */
+	if ((stream->flags & PULL_MODE) && cras_shm_is_ring(stream->shm)) {
+		pthread_mutex_lock(&stream->client->aud_lock);
+		stream->pull = true;
+		pthread_mutex_unlock(&stream->client->aud_lock);
+	}
 
 	close(stream_fds[0]);
 	close(stream_fds[1]);
@@ -1438,6 +1889,12 @@ static int send_connect_message(struct cras_client *client,
 	int rc;
 	struct cras_connect_message serv_msg;
 	int sock[2] = { -1, -1 };
+	uint32_t flags = stream->flags | SHM_RING;
+
+	/* The shared audio thread waits on the aud_fds with epoll, it can't
+	 * sleep on the futex of each stream. Pull streams never reply. */
+	if (!client->shared_aud && !(flags & PULL_MODE))
+		flags |= SHM_WAKEUP;
 
 	/* Create a socket pair for the server to notify of audio events. */
 	rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
@@ -1451,7 +1908,8 @@ static int send_connect_message(struct cras_client *client,
 				  stream->id, stream->config->stream_type,
 				  stream->config->client_type,
 				  stream->config->buffer_frames,
-				  stream->config->cb_threshold, stream->flags,
+				  stream->config->cb_threshold,
+				  flags,
 				  stream->config->effects,
 				  stream->config->format, dev_idx);
 
@@ -1526,7 +1984,10 @@ static int client_thread_add_stream(struct cras_client *client,
 	stream->client = client;
 
 	/* Start the audio thread. */
-	rc = start_aud_thread(stream);
+	if (client->shared_aud)
+		rc = start_shared_aud_thread(client);
+	else
+		rc = start_aud_thread(stream);
 	if (rc != 0)
 		return rc;
 
@@ -1539,7 +2000,9 @@ static int client_thread_add_stream(struct cras_client *client,
 	}
 
 	/* Add the stream to the linked list */
+	pthread_mutex_lock(&client->aud_lock);
 	DL_APPEND(client->streams, stream);
+	pthread_mutex_unlock(&client->aud_lock);
 
 	return 0;
 }
@@ -1568,11 +2031,19 @@ static int client_thread_rm_stream(struct cras_client *client,
 	/* And shut down locally. */
 	stop_aud_thread(stream, 1);
 
+	/* The shared audio thread only looks streams up with aud_lock held. */
+	pthread_mutex_lock(&client->aud_lock);
+	if (client->shared_aud && stream->aud_fd >= 0)
+		shared_aud_thread_unwatch(client, stream);
+	DL_DELETE(client->streams, stream);
+	pthread_mutex_unlock(&client->aud_lock);
+
 	free_shm(stream);
 
-	DL_DELETE(client->streams, stream);
 	if (stream->aud_fd >= 0)
 		close(stream->aud_fd);
+	if (stream->wake_fd >= 0)
+		close(stream->wake_fd);
 
 	free(stream->config);
 	free(stream);
@@ -1601,9 +2072,59 @@ static int client_thread_set_stream_volume(struct cras_client *client,
 /* Attach to the shm region containing the audio thread log. */
 static void attach_atlog_shm(struct cras_client *client, int fd)
 {
-	client->atlog_ro = (struct audio_thread_event_log *)mmap(
-		NULL, sizeof(*client->atlog_ro), PROT_READ, MAP_SHARED, fd, 0);
+	struct audio_thread_log_shm *shm;
+	size_t size = sizeof(*client->atlog_ro);
+	struct stat st;
+
+	/* Older servers share the log without the timing statistics. */
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(*shm))
+		size = sizeof(*shm);
+
+	shm = (struct audio_thread_log_shm *)mmap(NULL, size, PROT_READ,
+						  MAP_SHARED, fd, 0);
 	close(fd);
+	if (shm == MAP_FAILED) {
+		client->atlog_ro = NULL;
+		return;
+	}
+	client->atlog_ro = &shm->log;
+	if (size == sizeof(*shm))
+		client->attiming_ro = &shm->timing;
+}
+
+/* Maps the atlog trace ring received from the server. */
+static int attach_atlog_trace(struct cras_client *client, int fd)
+{
+	struct audio_thread_trace *ring;
+	struct stat st;
+	size_t size;
+	int rc = 0;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*ring)) {
+		rc = -EINVAL;
+		goto done;
+	}
+	size = st.st_size;
+	ring = (struct audio_thread_trace *)mmap(
+		NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		rc = -errno;
+		goto done;
+	}
+	/* The reader relies on a power of two ring that fits the mapping. */
+	if (ring->len == 0 || (ring->len & (ring->len - 1)) ||
+	    ring->len > (size - sizeof(*ring)) / sizeof(ring->events[0])) {
+		munmap(ring, size);
+		rc = -EINVAL;
+		goto done;
+	}
+	if (client->attrace)
+		munmap(client->attrace, client->attrace_size);
+	client->attrace = ring;
+	client->attrace_size = size;
+done:
+	close(fd);
+	return rc;
 }
 
 /* Attach to the shm region containing the server state. */
@@ -1661,8 +2182,9 @@ static int handle_message_from_server(struct cras_client *client)
 	struct cras_client_message *msg;
 	int rc = 0;
 	int nread;
-	int server_fds[2];
-	unsigned int num_fds = 2;
+	int server_fds[3];
+	unsigned int num_fds = 3;
+	unsigned int i;
 
 	msg = (struct cras_client_message *)buf;
 	nread = cras_recv_with_fds(client->server_fd, buf, sizeof(buf),
@@ -1689,7 +2211,7 @@ static int handle_message_from_server(struct cras_client *client)
 		struct client_stream *stream =
 			stream_from_id(client, cmsg->stream_id);
 		if (stream == NULL) {
-			if (num_fds != 2) {
+			if (num_fds < 2) {
 				syslog(LOG_ERR,
 				       "cras_client: Error receiving "
 				       "stream 0x%x connected message",
@@ -1702,8 +2224,8 @@ static int handle_message_from_server(struct cras_client *client)
 			 * callback. However, sometimes a stream is removed
 			 * before it is connected.
 			 */
-			close(server_fds[0]);
-			close(server_fds[1]);
+			for (i = 0; i < num_fds; i++)
+				close(server_fds[i]);
 			break;
 		}
 		rc = stream_connected(stream, cmsg, server_fds, num_fds);
@@ -1725,6 +2247,23 @@ static int handle_message_from_server(struct cras_client *client)
 			client->atlog_access_callback(client);
 		client->atlog_access_callback = NULL;
 		break;
+	case CRAS_CLIENT_ATLOG_TRACE_READY: {
+		struct cras_client_atlog_trace_ready *cmsg =
+			(struct cras_client_atlog_trace_ready *)msg;
+
+		if (msg->length < sizeof(*cmsg))
+			return -EINVAL;
+		rc = cmsg->err;
+		if (rc == 0 && (num_fds != 1 || server_fds[0] < 0))
+			rc = -EINVAL;
+		else if (rc == 0)
+			rc = attach_atlog_trace(client, server_fds[0]);
+		if (client->attrace_callback)
+			client->attrace_callback(client, rc);
+		client->attrace_callback = NULL;
+		rc = 0;
+		break;
+	}
 	case CRAS_CLIENT_GET_HOTWORD_MODELS_READY: {
 		struct cras_client_get_hotword_models_ready *cmsg =
 			(struct cras_client_get_hotword_models_ready *)msg;
@@ -1876,6 +2415,7 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 		/* Stop all playing streams */
 		DL_FOREACH (client->streams, s)
 			client_thread_rm_stream(client, s->id);
+		stop_shared_aud_thread(client);
 
 		/* And stop this client */
 		client->thread.state = CRAS_THREAD_STOP;
@@ -2119,6 +2659,15 @@ int cras_client_create_with_type(struct cras_client **client,
 		goto free_rwlock;
 	}
 
+	rc = pthread_mutex_init(&(*client)->aud_lock, NULL);
+	if (rc != 0) {
+		syslog(LOG_ERR, "cras_client: Could not init audio lock.");
+		rc = -rc;
+		goto free_lock;
+	}
+	(*client)->aud_epoll_fd = -1;
+	(*client)->aud_wake_fd = -1;
+
 	pthread_condattr_init(&cond_attr);
 	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
 	rc = pthread_cond_init(&(*client)->stream_start_cond, &cond_attr);
@@ -2126,7 +2675,7 @@ int cras_client_create_with_type(struct cras_client **client,
 	if (rc != 0) {
 		syslog(LOG_ERR, "cras_client: Could not init start cond.");
 		rc = -rc;
-		goto free_lock;
+		goto free_aud_lock;
 	}
 
 	(*client)->server_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
@@ -2177,6 +2726,8 @@ free_error:
 	free((void *)(*client)->sock_file);
 free_cond:
 	pthread_cond_destroy(&(*client)->stream_start_cond);
+free_aud_lock:
+	pthread_mutex_destroy(&(*client)->aud_lock);
 free_lock:
 	pthread_mutex_destroy(&(*client)->stream_start_lock);
 free_rwlock:
@@ -2207,6 +2758,9 @@ void cras_client_destroy(struct cras_client *client)
 	close(client->stream_fds[0]);
 	close(client->stream_fds[1]);
 	cras_file_wait_destroy(client->sock_file_wait);
+	if (client->attrace)
+		munmap(client->attrace, client->attrace_size);
+	pthread_mutex_destroy(&client->aud_lock);
 	pthread_rwlock_destroy(&client_int->server_state_rwlock);
 	free((void *)client->sock_file);
 	free(client_int);
@@ -2371,6 +2925,7 @@ static inline int cras_client_send_add_stream_command_message(
 	stream->aud_fd = -1;
 	stream->wake_fds[0] = -1;
 	stream->wake_fds[1] = -1;
+	stream->wake_fd = -1;
 	stream->direction = config->direction;
 	stream->flags = config->flags;
 
@@ -2748,6 +3303,166 @@ void cras_client_set_thread_priority_cb(struct cras_client *client,
 	client->thread_priority_cb = cb;
 }
 
+/* Fills |spans| with |frames| frames of the playback shm, starting |offset|
+ * frames after the write position. */
+static int playback_spans(struct cras_audio_shm *shm, unsigned int offset,
+			  unsigned int frames, struct cras_stream_spans *spans)
+{
+	unsigned int first;
+	uint32_t pos;
+
+	memset(spans, 0, sizeof(*spans));
+	if (!cras_shm_is_ring(shm)) {
+		spans->buf[0] = cras_shm_get_write_buffer_base(shm) +
+				offset * shm->config.frame_bytes;
+		spans->frames[0] = frames;
+		return frames;
+	}
+
+	pos = (shm->header->ring.write + offset) % shm->ring_frames;
+	first = MIN(frames, shm->ring_frames - pos);
+	spans->buf[0] = cras_shm_ring_frame(shm, pos);
+	spans->frames[0] = first;
+	if (frames > first) {
+		spans->buf[1] = shm->samples;
+		spans->frames[1] = frames - first;
+	}
+	return frames;
+}
+
+int cras_client_playback_begin(struct cras_client *client,
+			       cras_stream_id_t stream_id, unsigned int frames,
+			       struct cras_stream_spans *spans)
+{
+	struct client_stream *stream;
+	unsigned int committed;
+	int rc;
+
+	if (!client || !spans)
+		return -EINVAL;
+
+	stream = callback_stream(client, stream_id, true);
+	if (stream) {
+		committed = callback_committed(stream);
+		return playback_spans(stream->shm, committed,
+				      MIN(frames, stream->cb_frames - committed),
+				      spans);
+	}
+
+	stream = lock_pull_stream(client, stream_id);
+	if (!stream)
+		return -EINVAL;
+	rc = playback_spans(stream->shm, 0,
+			    MIN(frames, cras_shm_ring_free(stream->shm)), spans);
+	pthread_mutex_unlock(&client->aud_lock);
+	return rc;
+}
+
+int cras_client_playback_commit(struct cras_client *client,
+				cras_stream_id_t stream_id, unsigned int frames)
+{
+	struct client_stream *stream;
+	int rc = -EINVAL;
+
+	if (!client)
+		return -EINVAL;
+
+	stream = callback_stream(client, stream_id, true);
+	if (stream)
+		return commit_callback_frames(stream, frames);
+
+	/* Outside of the callback, publish the frames right away. */
+	stream = lock_pull_stream(client, stream_id);
+	if (!stream)
+		return -EINVAL;
+	if (frames <= cras_shm_ring_free(stream->shm)) {
+		cras_shm_buffer_written_start(stream->shm, frames);
+		rc = 0;
+	}
+	pthread_mutex_unlock(&client->aud_lock);
+	return rc;
+}
+
+int cras_client_set_stream_low_watermark(struct cras_client *client,
+					 cras_stream_id_t stream_id,
+					 unsigned int frames)
+{
+	struct client_stream *stream;
+
+	if (!client)
+		return -EINVAL;
+
+	stream = lock_pull_stream(client, stream_id);
+	if (!stream)
+		return -EINVAL;
+	cras_shm_ring_set_low_watermark(stream->shm, frames);
+	pthread_mutex_unlock(&client->aud_lock);
+	return 0;
+}
+
+int cras_client_get_stream_underruns(struct cras_client *client,
+				     cras_stream_id_t stream_id,
+				     unsigned int *underruns,
+				     unsigned int *frames)
+{
+	struct client_stream *stream;
+
+	if (!client || !underruns || !frames)
+		return -EINVAL;
+
+	stream = lock_pull_stream(client, stream_id);
+	if (!stream)
+		return -EINVAL;
+	*underruns = stream->shm->header->ring.underruns;
+	*frames = stream->shm->header->ring.underrun_frames;
+	pthread_mutex_unlock(&client->aud_lock);
+	return 0;
+}
+
+int cras_client_capture_begin(struct cras_client *client,
+			      cras_stream_id_t stream_id, unsigned int frames,
+			      struct cras_stream_spans *spans)
+{
+	struct client_stream *stream;
+	unsigned int committed;
+
+	stream = callback_stream(client, stream_id, false);
+	if (!stream || !spans)
+		return -EINVAL;
+
+	/* Capture always uses the double buffer. */
+	committed = callback_committed(stream);
+	frames = MIN(frames, stream->cb_frames - committed);
+	memset(spans, 0, sizeof(*spans));
+	spans->buf[0] = cras_shm_get_read_buffer_base(stream->shm) +
+			committed * stream->shm->config.frame_bytes;
+	spans->frames[0] = frames;
+	return frames;
+}
+
+int cras_client_capture_commit(struct cras_client *client,
+			       cras_stream_id_t stream_id, unsigned int frames)
+{
+	struct client_stream *stream;
+
+	stream = callback_stream(client, stream_id, false);
+	if (!stream)
+		return -EINVAL;
+	return commit_callback_frames(stream, frames);
+}
+
+int cras_client_set_shared_audio_thread(struct cras_client *client,
+					int enable)
+{
+	if (client == NULL)
+		return -EINVAL;
+	if (client->streams)
+		return -EBUSY;
+
+	client->shared_aud = !!enable;
+	return 0;
+}
+
 int cras_client_get_output_devices(const struct cras_client *client,
 				   struct cras_iodev_info *devs,
 				   struct cras_ionode_info *nodes,
@@ -3096,6 +3811,81 @@ int cras_client_update_audio_debug_info(
 	return write_message_to_server(client, &msg.header);
 }
 
+int cras_client_get_audio_thread_timing(struct cras_client *client,
+					struct audio_thread_timing *timing)
+{
+	if (!client || !timing)
+		return -EINVAL;
+	if (!client->attiming_ro)
+		return -ENODEV;
+
+	memcpy(timing, client->attiming_ro, sizeof(*timing));
+	return 0;
+}
+
+int cras_client_start_atlog_trace(struct cras_client *client,
+				  unsigned int num_events,
+				  void (*cb)(struct cras_client *, int))
+{
+	struct cras_set_atlog_trace msg;
+
+	if (client == NULL || num_events == 0)
+		return -EINVAL;
+
+	if (client->attrace_callback != NULL)
+		return -EINVAL;
+	client->attrace_callback = cb;
+
+	cras_fill_set_atlog_trace(&msg, num_events);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_stop_atlog_trace(struct cras_client *client)
+{
+	struct cras_set_atlog_trace msg;
+	int rc;
+
+	if (client == NULL || client->attrace == NULL)
+		return -EINVAL;
+
+	cras_fill_set_atlog_trace(&msg, 0);
+	rc = write_message_to_server(client, &msg.header);
+	munmap(client->attrace, client->attrace_size);
+	client->attrace = NULL;
+	return rc;
+}
+
+int cras_client_read_atlog_trace(struct cras_client *client,
+				 struct audio_thread_trace_event *buf,
+				 unsigned int max_events, uint64_t *dropped)
+{
+	struct audio_thread_trace *ring;
+	struct audio_thread_trace_event *ev;
+	uint64_t pos;
+	unsigned int n = 0;
+
+	if (client == NULL || client->attrace == NULL || buf == NULL)
+		return -EINVAL;
+	ring = client->attrace;
+
+	/* Only this end writes the cursor. */
+	pos = ring->read_pos;
+	while (n < max_events) {
+		ev = &ring->events[pos & (ring->len - 1)];
+		if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) !=
+		    (uint32_t)(pos + 1))
+			break;
+		buf[n++] = *ev;
+		pos++;
+	}
+	/* Hand the slots back to the server. */
+	__atomic_store_n(&ring->read_pos, pos, __ATOMIC_RELEASE);
+
+	if (dropped)
+		*dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	return n;
+}
+
 int cras_client_get_atlog_access(struct cras_client *client,
 				 void (*atlog_access_cb)(struct cras_client *))
 {
@@ -104,6 +104,19 @@ typedef int (*cras_unified_cb_t)(struct cras_client *client,
 				 const struct timespec *playback_time,
 				 void *user_arg);
 
+/* Up to two spans of the shared memory of a stream, handed out by
+ * cras_client_playback_begin() and cras_client_capture_begin(). The second
+ * span is used when the region wraps around the end of the samples area, and
+ * has zero frames otherwise.
+ *
+ *  buf - Start of each span.
+ *  frames - The number of frames in each span.
+ */
+struct cras_stream_spans {
+	uint8_t *buf[2];
+	unsigned int frames[2];
+};
+
 /* Callback for handling stream errors.
  * Args:
  *    client - The client created with cras_client_create().
@@ -292,6 +305,20 @@ void cras_client_set_connection_status_cb(
 void cras_client_set_thread_priority_cb(struct cras_client *client,
 					cras_thread_priority_cb_t cb);
 
+/* Services all the streams of the client from a single audio thread, instead
+ * of starting one thread per stream. The thread waits on all streams at once
+ * and runs the callbacks of the streams that are ready in the order of their
+ * deadlines. Must be called before any stream is added.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    enable - Non-zero to use a single shared audio thread.
+ * Returns:
+ *    0 on success, -EBUSY if the client already has streams.
+ */
+int cras_client_set_shared_audio_thread(struct cras_client *client,
+					int enable);
+
 /* Returns the current list of output devices.
  *
  * Requires that the connection to the server has been established.
@@ -514,6 +541,62 @@ int cras_client_read_atlog(struct cras_client *client, uint64_t *read_idx,
 			   uint64_t *missing,
 			   struct audio_thread_event_log *buf);
 
+/* Starts streaming every audio thread event to a trace ring shared with this
+ * client. Unlike the atlog, the server never overwrites events that weren't
+ * read: it drops new events while the ring is full and counts them. Only one
+ * client can trace at a time, the trace stops when the client disconnects.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    num_events - The requested size of the ring. The server rounds it up to
+ *        a power of two within its limits.
+ *    cb - Function called from the client thread with 0 once the ring can be
+ *        read, or with a negative error code, for example -EBUSY if another
+ *        client is tracing.
+ * Returns:
+ *    0 if the request was sent, -EINVAL if the client or num_events isn't
+ *    valid or a request is pending.
+ */
+int cras_client_start_atlog_trace(struct cras_client *client,
+				  unsigned int num_events,
+				  void (*cb)(struct cras_client *, int));
+
+/* Stops the trace started by cras_client_start_atlog_trace() and releases the
+ * ring.
+ * Returns:
+ *    0 on success, -EINVAL if there is no trace, or the error sending the
+ *    request.
+ */
+int cras_client_stop_atlog_trace(struct cras_client *client);
+
+/* Moves the events available in the trace ring to |buf|, oldest first, and
+ * gives their slots back to the server.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    buf - Filled with the events.
+ *    max_events - The number of events buf can hold.
+ *    dropped - If not NULL, filled with the number of events the server has
+ *        dropped since the trace started.
+ * Returns:
+ *    The number of events copied, or -EINVAL if there is no trace.
+ */
+int cras_client_read_atlog_trace(struct cras_client *client,
+				 struct audio_thread_trace_event *buf,
+				 unsigned int max_events, uint64_t *dropped);
+
+/* Copies the audio thread timing statistics: histograms of the wake up
+ * jitter and of the time spent servicing devices on each wake up. They are
+ * read live from the atlog region, so cras_client_get_atlog_access() must be
+ * called beforehand. Use audio_thread_hist_percentile() to read them.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    timing - Filled with a snapshot of the statistics.
+ * Returns:
+ *    0 on success, -EINVAL if the client or timing isn't valid, -ENODEV if
+ *    there is no atlog access or the server doesn't provide the statistics.
+ */
+int cras_client_get_audio_thread_timing(struct cras_client *client,
+					struct audio_thread_timing *timing);
+
 /* Asks the server to dump current audio thread snapshots.
  *
  * Args:
@@ -664,6 +747,90 @@ int cras_client_set_stream_volume(struct cras_client *client,
 				  cras_stream_id_t stream_id,
 				  float volume_scaler);
 
+/* Reserves playback frames in the shared memory of a stream so they can be
+ * rendered in place, without staging them in another buffer. Only valid from
+ * the audio callback of that stream, or from any thread for a PULL_MODE
+ * stream once it is connected. A reservation starts after the frames
+ * committed so far, and can span the end of the samples area, which the
+ * samples pointer passed to the callback can't. A PULL_MODE stream must not
+ * be written from its callback and another thread at the same time.
+ *
+ * Args:
+ *    client - The client passed to the audio callback.
+ *    stream_id - The stream whose audio callback is running.
+ *    frames - The maximum number of frames to reserve.
+ *    spans - Filled with where to write the reserved frames.
+ * Returns:
+ *    The number of frames reserved, or -EINVAL if not called from the audio
+ *    callback of an output stream or for a connected PULL_MODE stream.
+ */
+int cras_client_playback_begin(struct cras_client *client,
+			       cras_stream_id_t stream_id, unsigned int frames,
+			       struct cras_stream_spans *spans);
+
+/* Commits frames written to the start of the last reservation from
+ * cras_client_playback_begin(). Once the audio callback commits frames, the
+ * total committed is sent to the server when it returns, instead of its return
+ * value. A negative return value still ends the stream. Outside of the audio
+ * callback of a PULL_MODE stream, the frames are queued right away.
+ *
+ * Args:
+ *    client - The client passed to the audio callback.
+ *    stream_id - The stream whose audio callback is running.
+ *    frames - The number of frames written.
+ * Returns:
+ *    0 on success, or -EINVAL if not called from the audio callback of an
+ *    output stream or if more frames are committed than reserved.
+ */
+int cras_client_playback_commit(struct cras_client *client,
+				cras_stream_id_t stream_id,
+				unsigned int frames);
+
+/* Sets the level of the ring of a PULL_MODE stream at which the server calls
+ * the audio callback, with as many frames as can be written. The server
+ * doesn't wait for the callback to write anything. The watermark starts at
+ * the callback threshold of the stream.
+ *
+ * Args:
+ *    client - The client the stream is attached to.
+ *    stream_id - The PULL_MODE stream.
+ *    frames - The low watermark in frames, zero disables the callback.
+ * Returns:
+ *    0 on success, or -EINVAL if the stream isn't a connected PULL_MODE
+ *    stream.
+ */
+int cras_client_set_stream_low_watermark(struct cras_client *client,
+					 cras_stream_id_t stream_id,
+					 unsigned int frames);
+
+/* Gets how often the server played silence because the ring of a PULL_MODE
+ * stream didn't have enough frames.
+ *
+ * Args:
+ *    client - The client the stream is attached to.
+ *    stream_id - The PULL_MODE stream.
+ *    underruns - Filled with the number of underruns.
+ *    frames - Filled with the number of frames of silence played, at the
+ *        rate of the device.
+ * Returns:
+ *    0 on success, or -EINVAL if the stream isn't a connected PULL_MODE
+ *    stream.
+ */
+int cras_client_get_stream_underruns(struct cras_client *client,
+				     cras_stream_id_t stream_id,
+				     unsigned int *underruns,
+				     unsigned int *frames);
+
+/* Like cras_client_playback_begin(), for reading captured frames in place
+ * from the audio callback of an input stream. */
+int cras_client_capture_begin(struct cras_client *client,
+			      cras_stream_id_t stream_id, unsigned int frames,
+			      struct cras_stream_spans *spans);
+
+/* Like cras_client_playback_commit(), marks captured frames as read. */
+int cras_client_capture_commit(struct cras_client *client,
+			       cras_stream_id_t stream_id, unsigned int frames);
+
 /*
  * System level functions.
  */
@@ -24,20 +24,37 @@ play_buffer_callback(struct cras_client *client, cras_stream_id_t stream_id,
 		     const struct timespec *playback_time, void *user_arg)
 {
 	struct buffer_data *data = (struct buffer_data *)user_arg;
+	struct cras_stream_spans spans;
 	int to_copy = data->len - data->offset;
+	unsigned int i, bytes, total = 0;
+	int rc;
 
-	if (to_copy <= 0) {
+	/* A partial frame at the end of the buffer can't be played. */
+	if (to_copy < (int)data->frame_bytes) {
 		free(user_arg);
 		return EOF;
 	}
 
-	to_copy = MIN(to_copy, frames * data->frame_bytes);
-
-	memcpy(playback_samples, data->buffer + data->offset, to_copy);
+	/* Copy straight into the shm, including past the end of the ring. */
+	rc = cras_client_playback_begin(client, stream_id,
+					to_copy / data->frame_bytes, &spans);
+	if (rc < 0) {
+		/* The stream ends on an error without calling back again. */
+		free(user_arg);
+		return rc;
+	}
 
-	data->offset += to_copy;
+	for (i = 0; i < 2; i++) {
+		bytes = spans.frames[i] * data->frame_bytes;
+		memcpy(spans.buf[i], data->buffer + data->offset, bytes);
+		data->offset += bytes;
+		total += spans.frames[i];
+	}
 
-	return to_copy / data->frame_bytes;
+	rc = cras_client_playback_commit(client, stream_id, total);
+	if (rc < 0)
+		free(user_arg);
+	return rc;
 }
 
 static int play_buffer_error(struct cras_client *client,
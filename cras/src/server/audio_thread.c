@@ -4,15 +4,22 @@
  */
 
 #ifndef _GNU_SOURCE
-#define _GNU_SOURCE /* for ppoll and asprintf*/
+#define _GNU_SOURCE /* for asprintf and sched_getcpu */
 #endif
 
-#include <pthread.h>
+#include <errno.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "audio_thread_log.h"
 #include "cras_audio_thread_monitor.h"
@@ -27,6 +34,7 @@
 #include "cras_util.h"
 #include "dev_stream.h"
 #include "audio_thread.h"
+#include "mix_bus.h"
 #include "utlist.h"
 
 #define MIN_PROCESS_TIME_US 500 /* 0.5ms - min amount of time to mix/src. */
@@ -36,6 +44,14 @@
  * # to check whether a busyloop event happens
  */
 #define MAX_CONTINUOUS_ZERO_SLEEP_COUNT 2
+/* Number of commands the main thread can queue to an audio thread. A power
+ * of two so the slot index survives the counters wrapping. */
+#define AUDIO_THREAD_CMD_RING_SIZE 64
+/* Maximum size of a command message. */
+#define AUDIO_THREAD_MAX_CMD_SIZE 256
+/* Bounds of the number of events in the atlog trace ring. */
+#define ATLOG_TRACE_MIN_EVENTS 1024
+#define ATLOG_TRACE_MAX_EVENTS (1 << 22)
 
 /* Messages that can be sent from the main context to the audio thread. */
 enum AUDIO_THREAD_COMMAND {
@@ -51,6 +67,8 @@ enum AUDIO_THREAD_COMMAND {
 	AUDIO_THREAD_DEV_START_RAMP,
 	AUDIO_THREAD_REMOVE_CALLBACK,
 	AUDIO_THREAD_AEC_DUMP,
+	AUDIO_THREAD_ADD_STREAMS,
+	AUDIO_THREAD_DISCONNECT_STREAMS,
 };
 
 struct audio_thread_msg {
@@ -86,6 +104,14 @@ struct audio_thread_add_rm_stream_msg {
 	unsigned int num_devs;
 };
 
+struct audio_thread_add_rm_streams_msg {
+	struct audio_thread_msg header;
+	struct cras_rstream **streams;
+	unsigned int num_streams;
+	struct cras_iodev **devs;
+	unsigned int num_devs;
+};
+
 struct audio_thread_dump_debug_info_msg {
 	struct audio_thread_msg header;
 	struct audio_debug_info *info;
@@ -112,8 +138,8 @@ struct audio_thread_event_log *atlog;
 char *atlog_name;
 int atlog_rw_shm_fd;
 int atlog_ro_shm_fd;
-
-static struct iodev_callback_list *iodev_callbacks;
+struct audio_thread_tracer *attrace;
+int attrace_writers;
 
 struct iodev_callback_list {
 	int fd;
@@ -121,17 +147,137 @@ struct iodev_callback_list {
 	int enabled;
 	thread_callback cb;
 	void *cb_data;
-	struct pollfd *pollfd;
 	struct iodev_callback_list *prev, *next;
 };
 
+/* Called in the main thread when the audio thread is done with a command.
+ * Args:
+ *    thread - The thread that handled the command.
+ *    msg - The command message, handlers may return data in it.
+ *    rc - The result of the command.
+ *    data - The data given when the command was queued.
+ */
+typedef void (*audio_thread_cmd_done)(struct audio_thread *thread,
+				      struct audio_thread_msg *msg, int rc,
+				      void *data);
+
+/* A command queued for an audio thread.
+ *    msg - The message, a struct starting with audio_thread_msg.
+ *    rc - The result of the command, set by the audio thread.
+ *    done_cb - Called when the command is retired, NULL if the main thread
+ *        waits for the command instead.
+ *    done_data - Passed to done_cb.
+ */
+struct audio_thread_cmd {
+	union {
+		struct audio_thread_msg header;
+		uint8_t buf[AUDIO_THREAD_MAX_CMD_SIZE];
+	} msg;
+	int rc;
+	audio_thread_cmd_done done_cb;
+	void *done_data;
+};
+
+/* Single producer single consumer queue of commands from the main thread to
+ * an audio thread. The counters only increase, slots are indexed modulo the
+ * ring size.
+ *    queued - Number of commands queued, written by the main thread.
+ *    retired - Number of commands whose slots are free again, only used by
+ *        the main thread.
+ *    done - Number of commands handled, written by the audio thread.
+ *    sleeping - Set by the audio thread before it waits for events, the
+ *        doorbell only needs to be rung while it is set.
+ *    cmds - The command slots.
+ */
+struct audio_thread_cmd_ring {
+	unsigned int queued;
+	unsigned int retired;
+	unsigned int done __attribute__((aligned(64)));
+	int sleeping;
+	struct audio_thread_cmd cmds[AUDIO_THREAD_CMD_RING_SIZE]
+		__attribute__((aligned(64)));
+};
+
+/* Number of threads sharing atlog, it is created with the first thread and
+ * destroyed with the last one. */
+static unsigned int atlog_users;
+
+/* All the audio threads that have been created. Only accessed from the main
+ * thread. */
+static struct audio_thread *threads;
+
+/* The audio thread running in this context, NULL in the main thread. */
+static __thread struct audio_thread *current_thread;
+
+/* The thread that polls callbacks added from the main thread. NULL to use the
+ * first thread created. */
+static struct audio_thread *callback_owner;
+
+/* The last global remix configuration, applied to threads started later. */
+static unsigned int remix_num_channels;
+static float remix_coefficient[CRAS_CH_MAX * CRAS_CH_MAX];
+
+/* Returns the thread whose callbacks are changed from the current context.
+ * Callbacks added from an audio thread, for example when a device is
+ * reconfigured, stay with the thread running that device. */
+static struct audio_thread *callback_thread()
+{
+	if (current_thread)
+		return current_thread;
+	return callback_owner ? callback_owner : threads;
+}
+
+void audio_thread_set_callback_owner(struct audio_thread *thread)
+{
+	callback_owner = thread;
+}
+
+/* Starts polling the fd of an enabled callback in |thread|. */
+static void watch_callback(struct audio_thread *thread,
+			   struct iodev_callback_list *iodev_cb)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	/* The poll() event bits have the same values in epoll. */
+	ev.events = iodev_cb->events;
+	ev.data.ptr = iodev_cb;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, iodev_cb->fd, &ev) < 0)
+		syslog(LOG_ERR, "Failed to poll callback fd %d: %d",
+		       iodev_cb->fd, errno);
+}
+
+/* Stops polling the fd of a callback in |thread|. Events already returned
+ * for it in this wake up are dropped, the callback may be freed. */
+static void unwatch_callback(struct audio_thread *thread,
+			     struct iodev_callback_list *iodev_cb)
+{
+	int i;
+
+	/* Fails if the fd has been closed, which removed it already. */
+	epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, iodev_cb->fd, NULL);
+
+	if (thread != current_thread)
+		return;
+	for (i = 0; i < thread->num_ready_events; i++)
+		if (thread->ready_events[i].data.ptr == iodev_cb)
+			thread->ready_events[i].data.ptr = NULL;
+}
+
 void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 				      int events)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
+	if (!thread) {
+		syslog(LOG_ERR, "No audio thread to add callback for fd %d",
+		       fd);
+		return;
+	}
+
 	/* Don't add iodev_cb twice */
-	DL_FOREACH (iodev_callbacks, iodev_cb)
+	DL_FOREACH (thread->callbacks, iodev_cb)
 		if (iodev_cb->fd == fd && iodev_cb->cb_data == data)
 			return;
 
@@ -142,16 +288,23 @@ void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 	iodev_cb->enabled = 1;
 	iodev_cb->events = events;
 
-	DL_APPEND(iodev_callbacks, iodev_cb);
+	DL_APPEND(thread->callbacks, iodev_cb);
+	watch_callback(thread, iodev_cb);
 }
 
 void audio_thread_rm_callback(int fd)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	if (!thread)
+		return;
+
+	DL_FOREACH (thread->callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
-			DL_DELETE(iodev_callbacks, iodev_cb);
+			if (iodev_cb->enabled)
+				unwatch_callback(thread, iodev_cb);
+			DL_DELETE(thread->callbacks, iodev_cb);
 			free(iodev_cb);
 			return;
 		}
@@ -160,91 +313,24 @@ void audio_thread_rm_callback(int fd)
 
 void audio_thread_enable_callback(int fd, int enabled)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	if (!thread)
+		return;
+
+	DL_FOREACH (thread->callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
+			if (iodev_cb->enabled == !!enabled)
+				return;
 			iodev_cb->enabled = !!enabled;
-			return;
-		}
-	}
-}
-
-/* Sends a response (error code) from the audio thread to the main thread.
- * Indicates that the last message sent to the audio thread has been handled
- * with an error code of rc.
- * Args:
- *    thread - thread responding to command.
- *    rc - Result code to send back to the main thread.
- * Returns:
- *    The number of bytes written to the main thread.
- */
-static int audio_thread_send_response(struct audio_thread *thread, int rc)
-{
-	return write(thread->to_main_fds[1], &rc, sizeof(rc));
-}
-
-/* Reads from a file descriptor until all bytes are read.
- *
- * Args:
- *    fd - file descriptor to read
- *    buf - the buffer to be written.
- *    count - the number of bytes to read from fd
- * Returns:
- *    |count| on success, negative error code on failure.
- */
-static int read_until_finished(int fd, void *buf, size_t count)
-{
-	int nread, count_left = count;
-
-	while (count_left > 0) {
-		nread = read(fd, (uint8_t *)buf + count - count_left,
-			     count_left);
-		if (nread < 0) {
-			if (errno == EINTR)
-				continue;
+			if (enabled)
+				watch_callback(thread, iodev_cb);
 			else
-				return nread;
-		} else if (nread == 0) {
-			syslog(LOG_ERR, "Pipe has been closed.");
-			return -EPIPE;
+				unwatch_callback(thread, iodev_cb);
+			return;
 		}
-		count_left -= nread;
 	}
-	return count;
-}
-
-/* Reads a command from the main thread.  Called from the playback/capture
- * thread.  This will read the next available command from the main thread and
- * put it in buf.
- * Args:
- *    thread - thread reading the command.
- *    buf - Message is stored here on return.
- *    max_len - maximum length of message to put into buf.
- * Returns:
- *    0 on success, negative error code on failure.
- */
-static int audio_thread_read_command(struct audio_thread *thread, uint8_t *buf,
-				     size_t max_len)
-{
-	int to_read, nread, rc;
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
-
-	/* Get the length of the message first */
-	nread = read_until_finished(thread->to_thread_fds[0], buf,
-				    sizeof(msg->length));
-	if (nread < 0)
-		return nread;
-
-	if (msg->length > max_len)
-		return -ENOMEM;
-
-	to_read = msg->length - sizeof(msg->length);
-	rc = read_until_finished(thread->to_thread_fds[0],
-				 &buf[0] + sizeof(msg->length), to_read);
-	if (rc < 0)
-		return rc;
-	return 0;
 }
 
 /* Builds an initial buffer to avoid an underrun. Adds min_level of latency. */
@@ -266,6 +352,14 @@ static int thread_add_open_dev(struct audio_thread *thread,
 	adev = (struct open_dev *)calloc(1, sizeof(*adev));
 	adev->dev = iodev;
 
+	/* Mix on a float bus if enabled and the device format allows it. If
+	 * the bus can't be created the device keeps mixing in its format. */
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    cras_system_get_float_mix_bus_enabled() &&
+	    mix_bus_format_supported(iodev->format->format))
+		adev->mix_bus = mix_bus_create(iodev->format->num_channels,
+					       iodev->buffer_size);
+
 	/*
 	 * Start output devices by padding the output. This avoids a burst of
 	 * audio callbacks when the stream starts
@@ -367,6 +461,41 @@ static int thread_find_stream(struct audio_thread *thread,
 	return 0;
 }
 
+/* Starts polling the fd of a stream whose client replies wake up the thread:
+ * output streams and input streams using device timing. This is the audio
+ * socket, or the eventfd of a SHM_WAKEUP stream. Edge triggered so a reply
+ * wakes the thread once. dev_io handles it on that wake up if the stream is
+ * waiting for a reply. */
+static void watch_stream(struct audio_thread *thread,
+			 struct cras_rstream *stream)
+{
+	struct epoll_event ev;
+
+	if (!stream_uses_output(stream) &&
+	    !(stream_uses_input(stream) && (stream->flags & USE_DEV_TIMING)))
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = NULL;
+	/* Already polled if the stream is on another device of this thread. */
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD,
+		      cras_rstream_get_reply_fd(stream), &ev) < 0 &&
+	    errno != EEXIST)
+		syslog(LOG_ERR, "Failed to poll stream %x fd: %d",
+		       stream->stream_id, errno);
+}
+
+/* Stops polling the fd of a stream no longer attached to this thread. */
+static void unwatch_stream(struct audio_thread *thread,
+			   struct cras_rstream *stream)
+{
+	if (thread_find_stream(thread, stream))
+		return;
+	epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL,
+		  cras_rstream_get_reply_fd(stream), NULL);
+}
+
 /* Handles the disconnect_stream message from the main thread. */
 static int thread_disconnect_stream(struct audio_thread *thread,
 				    struct cras_rstream *stream,
@@ -374,11 +503,15 @@ static int thread_disconnect_stream(struct audio_thread *thread,
 {
 	int rc;
 
-	if (!thread_find_stream(thread, stream))
+	if (!thread_find_stream(thread, stream)) {
+		/* dev_io may have removed it after a device error. */
+		unwatch_stream(thread, stream);
 		return 0;
+	}
 
 	rc = dev_io_remove_stream(&thread->open_devs[stream->direction], stream,
 				  dev);
+	unwatch_stream(thread, stream);
 
 	return rc;
 }
@@ -420,9 +553,11 @@ static int thread_drain_stream(struct audio_thread *thread,
 		return 0;
 
 	ms_left = thread_drain_stream_ms_remaining(thread, rstream);
-	if (ms_left == 0)
+	if (ms_left == 0) {
 		dev_io_remove_stream(&thread->open_devs[rstream->direction],
 				     rstream, NULL);
+		unwatch_stream(thread, rstream);
+	}
 
 	return ms_left;
 }
@@ -440,9 +575,57 @@ static int thread_add_stream(struct audio_thread *thread,
 	if (rc < 0)
 		return rc;
 
+	watch_stream(thread, stream);
 	return 0;
 }
 
+/* Handles the add_streams message from the main thread. Every stream is
+ * attached even if an earlier one fails, the first error is returned. */
+static int thread_add_streams(struct audio_thread *thread,
+			      struct cras_rstream **streams,
+			      unsigned int num_streams,
+			      struct cras_iodev **iodevs,
+			      unsigned int num_iodevs)
+{
+	unsigned int i;
+	int rc, ret = 0;
+
+	for (i = 0; i < num_streams; i++) {
+		rc = thread_add_stream(thread, streams[i], iodevs, num_iodevs);
+		if (rc < 0 && ret == 0)
+			ret = rc;
+	}
+	return ret;
+}
+
+/* Handles the disconnect_streams message from the main thread. The streams
+ * are removed from all devices if |num_iodevs| is zero. */
+static int thread_disconnect_streams(struct audio_thread *thread,
+				     struct cras_rstream **streams,
+				     unsigned int num_streams,
+				     struct cras_iodev **iodevs,
+				     unsigned int num_iodevs)
+{
+	struct cras_iodev *all_devs = NULL;
+	unsigned int i, j;
+	int rc, ret = 0;
+
+	if (num_iodevs == 0) {
+		iodevs = &all_devs;
+		num_iodevs = 1;
+	}
+
+	for (i = 0; i < num_streams; i++) {
+		for (j = 0; j < num_iodevs; j++) {
+			rc = thread_disconnect_stream(thread, streams[i],
+						      iodevs[j]);
+			if (rc < 0 && ret == 0)
+				ret = rc;
+		}
+	}
+	return ret;
+}
+
 /* Starts or stops aec dump task. */
 static int thread_set_aec_dump(struct audio_thread *thread,
 			       cras_stream_id_t stream_id, unsigned int start,
@@ -479,6 +662,8 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 {
 	struct cras_audio_format *fmt = adev->dev->format;
 	struct timespec now, time_since;
+	unsigned int i;
+
 	strncpy(di->dev_name, adev->dev->info.name, sizeof(di->dev_name));
 	di->buffer_size = adev->dev->buffer_size;
 	di->min_buffer_level = adev->dev->min_buffer_level;
@@ -499,6 +684,12 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	di->runtime_nsec = time_since.tv_nsec;
 	di->longest_wake_sec = adev->longest_wake.tv_sec;
 	di->longest_wake_nsec = adev->longest_wake.tv_nsec;
+	di->num_output_blocks = adev->dev->stage_stats.num_blocks;
+	for (i = 0; i < CRAS_NUM_OUTPUT_STAGES; i++) {
+		di->stage_total_ns[i] = adev->dev->stage_stats.total_ns[i];
+		di->stage_max_ns[i] =
+			MIN(adev->dev->stage_stats.max_ns[i], UINT32_MAX);
+	}
 
 	if (fmt) {
 		di->frame_rate = fmt->frame_rate;
@@ -547,17 +738,12 @@ static void append_stream_dump_info(struct audio_debug_info *info,
 	si->runtime_nsec = time_since.tv_nsec;
 }
 
-/* Handle a message sent to the playback thread */
-static int handle_playback_thread_message(struct audio_thread *thread)
+/* Handle a message sent to the playback thread. Returns the result sent back
+ * to the main thread. */
+static int handle_playback_thread_message(struct audio_thread *thread,
+					  struct audio_thread_msg *msg)
 {
-	uint8_t buf[256];
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
 	int ret = 0;
-	int err;
-
-	err = audio_thread_read_command(thread, buf, 256);
-	if (err < 0)
-		return err;
 
 	ATLOG(atlog, AUDIO_THREAD_PB_MSG, msg->id, 0, 0);
 
@@ -580,6 +766,26 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 					       rmsg->devs[0]);
 		break;
 	}
+	case AUDIO_THREAD_ADD_STREAMS: {
+		struct audio_thread_add_rm_streams_msg *amsg;
+
+		amsg = (struct audio_thread_add_rm_streams_msg *)msg;
+		ATLOG(atlog, AUDIO_THREAD_STREAMS_ADDED, amsg->num_streams,
+		      amsg->num_devs, 0);
+		ret = thread_add_streams(thread, amsg->streams,
+					 amsg->num_streams, amsg->devs,
+					 amsg->num_devs);
+		break;
+	}
+	case AUDIO_THREAD_DISCONNECT_STREAMS: {
+		struct audio_thread_add_rm_streams_msg *rmsg;
+
+		rmsg = (struct audio_thread_add_rm_streams_msg *)msg;
+		ret = thread_disconnect_streams(thread, rmsg->streams,
+						rmsg->num_streams, rmsg->devs,
+						rmsg->num_devs);
+		break;
+	}
 	case AUDIO_THREAD_ADD_OPEN_DEV: {
 		struct audio_thread_open_device_msg *rmsg;
 
@@ -602,11 +808,8 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 		break;
 	}
 	case AUDIO_THREAD_STOP:
+		/* The thread exits once the command is completed. */
 		ret = 0;
-		err = audio_thread_send_response(thread, ret);
-		if (err < 0)
-			return err;
-		terminate_pb_thread();
 		break;
 	case AUDIO_THREAD_DUMP_THREAD_INFO: {
 		struct dev_stream *curr;
@@ -669,16 +872,15 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 	}
 	case AUDIO_THREAD_CONFIG_GLOBAL_REMIX: {
 		struct audio_thread_config_global_remix *rmsg;
-		void *rsp;
+		struct cras_fmt_conv *old;
 
 		/* Respond the pointer to the old remix converter, so it can be
 		 * freed later in main thread. */
-		rsp = (void *)thread->remix_converter;
-
 		rmsg = (struct audio_thread_config_global_remix *)msg;
+		old = thread->remix_converter;
 		thread->remix_converter = rmsg->fmt_conv;
-
-		return write(thread->to_main_fds[1], &rsp, sizeof(rsp));
+		rmsg->fmt_conv = old;
+		break;
 	}
 	case AUDIO_THREAD_DEV_START_RAMP: {
 		struct audio_thread_dev_start_ramp_msg *rmsg;
@@ -700,12 +902,48 @@ static int handle_playback_thread_message(struct audio_thread *thread)
 		break;
 	}
 
-	err = audio_thread_send_response(thread, ret);
-	if (err < 0)
-		return err;
 	return ret;
 }
 
+/* Returns non-zero if the main thread has queued commands not handled yet. */
+static int cmds_pending(struct audio_thread *thread)
+{
+	struct audio_thread_cmd_ring *ring = thread->cmds;
+
+	return __atomic_load_n(&ring->queued, __ATOMIC_ACQUIRE) != ring->done;
+}
+
+/* Handles the commands queued by the main thread, and wakes the main thread
+ * up to retire them. */
+static void handle_cmds(struct audio_thread *thread)
+{
+	struct audio_thread_cmd_ring *ring = thread->cmds;
+	struct audio_thread_cmd *cmd;
+	unsigned int done = ring->done;
+	int stop = 0;
+
+	if (!cmds_pending(thread))
+		return;
+
+	while (!stop &&
+	       done != __atomic_load_n(&ring->queued, __ATOMIC_ACQUIRE)) {
+		cmd = &ring->cmds[done % AUDIO_THREAD_CMD_RING_SIZE];
+		cmd->rc = handle_playback_thread_message(thread,
+							 &cmd->msg.header);
+		if (cmd->rc < 0)
+			syslog(LOG_ERR, "handle message %d", cmd->rc);
+		stop = cmd->msg.header.id == AUDIO_THREAD_STOP;
+		done++;
+		__atomic_store_n(&ring->done, done, __ATOMIC_RELEASE);
+	}
+
+	if (eventfd_write(thread->completion_fd, 1) < 0)
+		syslog(LOG_ERR, "Failed to signal command completion: %d",
+		       errno);
+	if (stop)
+		terminate_pb_thread();
+}
+
 /* Returns the number of active streams plus the number of active devices. */
 static int fill_next_sleep_interval(struct audio_thread *thread,
 				    struct timespec *ts)
@@ -731,25 +969,100 @@ static int fill_next_sleep_interval(struct audio_thread *thread,
 	return ret;
 }
 
-static struct pollfd *add_pollfd(struct audio_thread *thread, int fd,
-				 int events)
+/* Arms the wake up timer to expire after |ts|, or disarms it if |ts| is
+ * NULL. */
+static void set_wake_timer(struct audio_thread *thread,
+			   const struct timespec *ts)
 {
-	thread->pollfds[thread->num_pollfds].fd = fd;
-	thread->pollfds[thread->num_pollfds].events = events;
-	thread->num_pollfds++;
-	if (thread->num_pollfds >= thread->pollfds_size) {
-		thread->pollfds_size *= 2;
-		thread->pollfds = (struct pollfd *)realloc(
-			thread->pollfds,
-			sizeof(*thread->pollfds) * thread->pollfds_size);
-		return NULL;
+	struct itimerspec its;
+
+	if (!ts && !thread->timer_armed)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	if (ts) {
+		its.it_value = *ts;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &thread->wake_deadline);
+		add_timespecs(&thread->wake_deadline, ts);
 	}
+	/* Setting the timer also drops any expiration not read yet. */
+	if (timerfd_settime(thread->timer_fd, 0, &its, NULL) < 0)
+		syslog(LOG_ERR, "Failed to set audio thread timer: %d", errno);
+	thread->timer_armed = !!ts;
+}
+
+/* Reads the expirations of the wake up timer, so it stops being ready. */
+static void clear_wake_timer(struct audio_thread *thread)
+{
+	uint64_t expirations;
 
-	return &thread->pollfds[thread->num_pollfds - 1];
+	if (read(thread->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN)
+		syslog(LOG_ERR, "Failed to read audio thread timer: %d", errno);
+	thread->timer_armed = 0;
 }
 
-static int continuous_zero_sleep_count = 0;
-static unsigned busyloop_count = 0;
+/* Returns the time from |start| to |end| in nanoseconds, or 0 if |end| is
+ * before |start|. */
+static uint64_t elapsed_ns(const struct timespec *start,
+			   const struct timespec *end)
+{
+	struct timespec diff;
+
+	if (timespec_after(start, end))
+		return 0;
+	subtract_timespecs(end, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+}
+
+/* Records how late the wake up timer fired after the deadline it was set
+ * for. */
+static void record_wake_jitter(struct audio_thread *thread)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	audio_thread_hist_add(&audio_thread_event_log_timing(atlog)->wake_jitter,
+			      elapsed_ns(&thread->wake_deadline, &now));
+}
+
+/* Runs the callbacks of the fds that are ready, and clears the doorbell and
+ * the timer. Stream fds are registered without data, they only wake the
+ * thread up. */
+static void handle_ready_events(struct audio_thread *thread)
+{
+	struct iodev_callback_list *iodev_cb;
+	struct epoll_event *ev;
+	eventfd_t count;
+	int i;
+
+	for (i = 0; i < thread->num_ready_events; i++) {
+		ev = &thread->ready_events[i];
+
+		if (ev->data.ptr == &thread->doorbell_fd) {
+			/* Commands are handled after the events. */
+			if (eventfd_read(thread->doorbell_fd, &count) < 0 &&
+			    errno != EAGAIN)
+				syslog(LOG_ERR, "Failed to read doorbell: %d",
+				       errno);
+		} else if (ev->data.ptr == &thread->timer_fd) {
+			clear_wake_timer(thread);
+			record_wake_jitter(thread);
+		} else if (ev->data.ptr) {
+			iodev_cb = (struct iodev_callback_list *)ev->data.ptr;
+			if (!(ev->events & iodev_cb->events))
+				continue;
+			ATLOG(atlog, AUDIO_THREAD_IODEV_CB, ev->events,
+			      iodev_cb->events, 0);
+			iodev_cb->cb(iodev_cb->cb_data, ev->events);
+		}
+	}
+	thread->num_ready_events = 0;
+}
+
+/* Busyloop tracking is kept for each audio thread. */
+static __thread int continuous_zero_sleep_count = 0;
+static __thread unsigned busyloop_count = 0;
 
 /*
  * Logs the number of busyloop during one audio thread running state
@@ -757,8 +1070,8 @@ static unsigned busyloop_count = 0;
  */
 static void log_busyloop(struct timespec *wait_ts)
 {
-	static struct timespec start_time;
-	static bool started = false;
+	static __thread struct timespec start_time;
+	static __thread bool started = false;
 	struct timespec diff, now;
 
 	/* If wait_ts is NULL, there is no stream running. */
@@ -781,6 +1094,9 @@ static void check_busyloop(struct timespec *wait_ts)
 		if (continuous_zero_sleep_count ==
 		    MAX_CONTINUOUS_ZERO_SLEEP_COUNT) {
 			busyloop_count++;
+			__atomic_fetch_add(
+				&audio_thread_event_log_timing(atlog)->busyloops,
+				1, __ATOMIC_RELAXED);
 			cras_audio_thread_event_busyloop();
 		}
 	} else {
@@ -798,70 +1114,40 @@ static void check_busyloop(struct timespec *wait_ts)
 static void *audio_io_thread(void *arg)
 {
 	struct audio_thread *thread = (struct audio_thread *)arg;
-	struct open_dev *adev;
-	struct dev_stream *curr;
+	struct audio_thread_timing *timing;
 	struct timespec ts;
-	int msg_fd;
+	struct timespec cpu_start, cpu_end, wall_start, wall_end;
+	int timeout_ms;
 	int rc;
 
-	msg_fd = thread->to_thread_fds[0];
+	current_thread = thread;
+	timing = audio_thread_event_log_timing(atlog);
 
 	/* Attempt to get realtime scheduling */
 	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
 		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
 
-	thread->pollfds[0].fd = msg_fd;
-	thread->pollfds[0].events = POLLIN;
-
 	while (1) {
 		struct timespec *wait_ts;
-		struct iodev_callback_list *iodev_cb;
 
 		wait_ts = NULL;
-		thread->num_pollfds = 1;
 
 		/* device opened */
+		clock_gettime(CLOCK_MONOTONIC_RAW, &wall_start);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
 		dev_io_run(&thread->open_devs[CRAS_STREAM_OUTPUT],
 			   &thread->open_devs[CRAS_STREAM_INPUT],
 			   thread->remix_converter);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &wall_end);
+		audio_thread_hist_add(&timing->run_cpu,
+				      elapsed_ns(&cpu_start, &cpu_end));
+		audio_thread_hist_add(&timing->run_wall,
+				      elapsed_ns(&wall_start, &wall_end));
 
 		if (fill_next_sleep_interval(thread, &ts))
 			wait_ts = &ts;
 
-	restart_poll_loop:
-		thread->num_pollfds = 1;
-
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (!iodev_cb->enabled) {
-				iodev_cb->pollfd = NULL;
-				continue;
-			}
-			iodev_cb->pollfd = add_pollfd(thread, iodev_cb->fd,
-						      iodev_cb->events);
-			if (!iodev_cb->pollfd)
-				goto restart_poll_loop;
-		}
-
-		/* TODO(dgreid) - once per rstream not per dev_stream */
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
-		}
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
-		}
-
 		log_busyloop(wait_ts);
 
 		ATLOG(atlog, AUDIO_THREAD_SLEEP, wait_ts ? wait_ts->tv_sec : 0,
@@ -873,61 +1159,186 @@ static void *audio_io_thread(void *arg)
 		__sync_synchronize();
 		atlog->sync_write_pos = atlog->write_pos;
 
-		rc = ppoll(thread->pollfds, thread->num_pollfds, wait_ts, NULL);
+		/* Tell main the doorbell is needed from now on, then look for
+		 * commands queued before it could see that. */
+		__atomic_store_n(&thread->cmds->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		/* A zero wait only polls, don't arm the timer for it. */
+		timeout_ms = -1;
+		if (cmds_pending(thread) ||
+		    (wait_ts && !timespec_is_nonzero(wait_ts)))
+			timeout_ms = 0;
+		else
+			set_wake_timer(thread, wait_ts);
+
+		rc = epoll_wait(thread->epoll_fd, thread->ready_events,
+				AUDIO_THREAD_MAX_READY_EVENTS, timeout_ms);
+		__atomic_store_n(&thread->cmds->sleeping, 0, __ATOMIC_RELAXED);
 		ATLOG(atlog, AUDIO_THREAD_WAKE, rc, 0, 0);
-		if (rc <= 0)
-			continue;
 
-		if (thread->pollfds[0].revents & POLLIN) {
-			rc = handle_playback_thread_message(thread);
-			if (rc < 0)
-				syslog(LOG_ERR, "handle message %d", rc);
+		if (rc > 0) {
+			thread->num_ready_events = rc;
+			handle_ready_events(thread);
 		}
+		handle_cmds(thread);
+	}
 
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (iodev_cb->pollfd &&
-			    iodev_cb->pollfd->revents & iodev_cb->events) {
-				ATLOG(atlog, AUDIO_THREAD_IODEV_CB,
-				      iodev_cb->pollfd->revents,
-				      iodev_cb->events, 0);
-				iodev_cb->cb(iodev_cb->cb_data,
-					     iodev_cb->pollfd->revents);
-			}
+	return NULL;
+}
+
+/* Runs the callbacks of the commands the audio thread is done with and frees
+ * their slots. Called from the main thread. */
+static void retire_cmds(struct audio_thread *thread)
+{
+	struct audio_thread_cmd_ring *ring = thread->cmds;
+	struct audio_thread_cmd *cmd;
+	unsigned int done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+
+	while (ring->retired != done) {
+		cmd = &ring->cmds[ring->retired % AUDIO_THREAD_CMD_RING_SIZE];
+		if (cmd->done_cb)
+			cmd->done_cb(thread, &cmd->msg.header, cmd->rc,
+				     cmd->done_data);
+		ring->retired++;
+	}
+}
+
+/* Waits for the audio thread to be done with the command at |seq|. */
+static int wait_cmd_done(struct audio_thread *thread, unsigned int seq)
+{
+	struct audio_thread_cmd_ring *ring = thread->cmds;
+	struct pollfd pollfd;
+	eventfd_t count;
+
+	pollfd.fd = thread->completion_fd;
+	pollfd.events = POLLIN;
+	while ((int)(__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE) - seq) <=
+	       0) {
+		if (poll(&pollfd, 1, -1) < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "Failed to wait for audio thread: %d",
+			       errno);
+			return -errno;
 		}
+		/* May have been read already by the main loop handler. */
+		eventfd_read(thread->completion_fd, &count);
 	}
+	return 0;
+}
 
-	return NULL;
+/* Queues a command for the audio thread, ringing the doorbell if the thread
+ * may be sleeping. Blocks only if the queue is full.
+ * Args:
+ *    thread - thread to receive the command.
+ *    msg - The message to send, copied into the queue.
+ *    done_cb - Called when the command is retired, or NULL.
+ *    done_data - Passed to done_cb.
+ *    seq - Filled with the sequence number of the command.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+static int queue_cmd(struct audio_thread *thread, struct audio_thread_msg *msg,
+		     audio_thread_cmd_done done_cb, void *done_data,
+		     unsigned int *seq)
+{
+	struct audio_thread_cmd_ring *ring = thread->cmds;
+	struct audio_thread_cmd *cmd;
+	int rc;
+
+	if (msg->length > AUDIO_THREAD_MAX_CMD_SIZE)
+		return -EINVAL;
+
+	retire_cmds(thread);
+	while (ring->queued - ring->retired == AUDIO_THREAD_CMD_RING_SIZE) {
+		rc = wait_cmd_done(thread, ring->retired);
+		if (rc < 0)
+			return rc;
+		retire_cmds(thread);
+	}
+
+	cmd = &ring->cmds[ring->queued % AUDIO_THREAD_CMD_RING_SIZE];
+	memcpy(&cmd->msg, msg, msg->length);
+	cmd->rc = 0;
+	cmd->done_cb = done_cb;
+	cmd->done_data = done_data;
+	*seq = ring->queued;
+	__atomic_store_n(&ring->queued, ring->queued + 1, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence in the audio thread before it sleeps. Either
+	 * it sees the new command or it is seen sleeping here. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) &&
+	    eventfd_write(thread->doorbell_fd, 1) < 0) {
+		syslog(LOG_ERR, "Failed to ring audio thread doorbell: %d",
+		       errno);
+		return -errno;
+	}
+	return 0;
 }
 
-/* Write a message to the playback thread and wait for an ack, This keeps these
- * operations synchronous for the main server thread.  For instance when the
- * RM_STREAM message is sent, the stream can be deleted after the function
- * returns.  Making this synchronous also allows the thread to return an error
- * code that can be handled by the caller.
+/* Write a message to the playback thread and wait for it to be handled, This
+ * keeps these operations synchronous for the main server thread.  For
+ * instance when the RM_STREAM message is sent, the stream can be deleted after
+ * the function returns.  Making this synchronous also allows the thread to
+ * return an error code that can be handled by the caller.
  * Args:
  *    thread - thread to receive message.
- *    msg - The message to send.
+ *    msg - The message to send. Data returned by the handler is copied back
+ *        into it.
  * Returns:
  *    A return code from the message handler in the thread.
  */
 static int audio_thread_post_message(struct audio_thread *thread,
 				     struct audio_thread_msg *msg)
 {
-	int err, rsp;
+	struct audio_thread_cmd *cmd;
+	unsigned int seq;
+	int rc;
 
-	err = write(thread->to_thread_fds[1], msg, msg->length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to post message to thread.");
-		return err;
-	}
-	/* Synchronous action, wait for response. */
-	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to read reply from thread.");
-		return err;
-	}
+	rc = queue_cmd(thread, msg, NULL, NULL, &seq);
+	if (rc < 0)
+		return rc;
+	rc = wait_cmd_done(thread, seq);
+	if (rc < 0)
+		return rc;
+
+	/* The slot stays valid until another command is queued. */
+	cmd = &thread->cmds->cmds[seq % AUDIO_THREAD_CMD_RING_SIZE];
+	memcpy(msg, &cmd->msg, msg->length);
+	rc = cmd->rc;
+	retire_cmds(thread);
+	return rc;
+}
 
-	return rsp;
+/* Posts a message to the playback thread without waiting for it to be
+ * handled. The message must not point to data owned by the caller.
+ * Args:
+ *    thread - thread to receive message.
+ *    msg - The message to send.
+ *    done_cb - Called in the main thread once the message is handled, with
+ *        the result of the handler. May be NULL.
+ *    done_data - Passed to done_cb.
+ * Returns:
+ *    0 if the message is queued, negative error code on failure.
+ */
+static int audio_thread_post_message_async(struct audio_thread *thread,
+					   struct audio_thread_msg *msg,
+					   audio_thread_cmd_done done_cb,
+					   void *done_data)
+{
+	unsigned int seq;
+
+	return queue_cmd(thread, msg, done_cb, done_data, &seq);
+}
+
+/* Main loop handler of the completion eventfd. */
+static void cmds_completed(void *data, int revents)
+{
+	struct audio_thread *thread = (struct audio_thread *)data;
+	eventfd_t count;
+
+	eventfd_read(thread->completion_fd, &count);
+	retire_cmds(thread);
 }
 
 static void init_open_device_msg(struct audio_thread_open_device_msg *msg,
@@ -965,6 +1376,21 @@ static void init_add_rm_stream_msg(struct audio_thread_add_rm_stream_msg *msg,
 	msg->num_devs = num_devs;
 }
 
+static void
+init_add_rm_streams_msg(struct audio_thread_add_rm_streams_msg *msg,
+			enum AUDIO_THREAD_COMMAND id,
+			struct cras_rstream **streams, unsigned int num_streams,
+			struct cras_iodev **devs, unsigned int num_devs)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->header.id = id;
+	msg->header.length = sizeof(*msg);
+	msg->streams = streams;
+	msg->num_streams = num_streams;
+	msg->devs = devs;
+	msg->num_devs = num_devs;
+}
+
 static void
 init_dump_debug_info_msg(struct audio_thread_dump_debug_info_msg *msg,
 			 struct audio_debug_info *info)
@@ -1002,6 +1428,108 @@ int audio_thread_event_log_shm_fd()
 	return atlog_ro_shm_fd;
 }
 
+int audio_thread_event_log_start_trace(void *owner, unsigned int num_events)
+{
+	struct audio_thread_tracer *tracer;
+	unsigned int len = ATLOG_TRACE_MIN_EVENTS;
+	int fd, rc;
+
+	if (attrace)
+		return -EBUSY;
+
+	while (len < num_events && len < ATLOG_TRACE_MAX_EVENTS)
+		len <<= 1;
+
+	tracer = (struct audio_thread_tracer *)calloc(1, sizeof(*tracer));
+	if (!tracer)
+		return -ENOMEM;
+	tracer->size = sizeof(*tracer->ring) +
+		       (size_t)len * sizeof(tracer->ring->events[0]);
+	fd = cras_shm_open_sealed("/ATtrace", tracer->size);
+	if (fd < 0) {
+		syslog(LOG_ERR, "Failed to create atlog trace: %d", fd);
+		free(tracer);
+		return fd;
+	}
+	tracer->ring = (struct audio_thread_trace *)mmap(
+		NULL, tracer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (tracer->ring == MAP_FAILED) {
+		rc = -errno;
+		close(fd);
+		free(tracer);
+		return rc;
+	}
+	tracer->ring->len = len;
+	tracer->mask = len - 1;
+	tracer->owner = owner;
+
+	__atomic_store_n(&attrace, tracer, __ATOMIC_SEQ_CST);
+	return fd;
+}
+
+int audio_thread_event_log_stop_trace(void *owner)
+{
+	struct audio_thread_tracer *tracer = attrace;
+
+	if (!tracer || tracer->owner != owner)
+		return -EINVAL;
+
+	__atomic_store_n(&attrace, NULL, __ATOMIC_SEQ_CST);
+	/* Writers that saw the trace before it was cleared are never blocked,
+	 * they are done in a moment. */
+	while (__atomic_load_n(&attrace_writers, __ATOMIC_SEQ_CST))
+		sched_yield();
+
+	munmap(tracer->ring, tracer->size);
+	free(tracer);
+	return 0;
+}
+
+/* Appends an event to the trace ring, or counts it as dropped if the client
+ * hasn't made room for it. Writers announce themselves in attrace_writers
+ * before looking at attrace, so the trace can be stopped without a lock. */
+void audio_thread_trace_data(const struct timespec *now,
+			     enum AUDIO_THREAD_LOG_EVENTS event, uint32_t data1,
+			     uint32_t data2, uint32_t data3)
+{
+	static __thread uint32_t tid;
+	struct audio_thread_tracer *tracer;
+	struct audio_thread_trace_event *ev;
+	uint64_t pos, read_pos;
+
+	__atomic_fetch_add(&attrace_writers, 1, __ATOMIC_SEQ_CST);
+	tracer = __atomic_load_n(&attrace, __ATOMIC_SEQ_CST);
+	if (!tracer)
+		goto done;
+
+	pos = __atomic_load_n(&tracer->reserve_pos, __ATOMIC_RELAXED);
+	do {
+		read_pos = __atomic_load_n(&tracer->ring->read_pos,
+					   __ATOMIC_ACQUIRE);
+		if (pos - read_pos > tracer->mask) {
+			__atomic_fetch_add(&tracer->ring->dropped, 1,
+					   __ATOMIC_RELAXED);
+			goto done;
+		}
+	} while (!__atomic_compare_exchange_n(&tracer->reserve_pos, &pos,
+					      pos + 1, true, __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+
+	if (!tid)
+		tid = syscall(__NR_gettid);
+	ev = &tracer->ring->events[pos & tracer->mask];
+	ev->tid = tid;
+	ev->nsec = (uint64_t)now->tv_sec * 1000000000ULL + now->tv_nsec;
+	ev->data1 = data1;
+	ev->data2 = data2;
+	ev->data3 = data3;
+	ev->cpu = sched_getcpu();
+	ev->tag = event;
+	__atomic_store_n(&ev->seq, (uint32_t)(pos + 1), __ATOMIC_RELEASE);
+done:
+	__atomic_fetch_sub(&attrace_writers, 1, __ATOMIC_RELEASE);
+}
+
 int audio_thread_add_stream(struct audio_thread *thread,
 			    struct cras_rstream *stream,
 			    struct cras_iodev **devs, unsigned int num_devs)
@@ -1031,6 +1559,43 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_add_streams(struct audio_thread *thread,
+			     struct cras_rstream **streams,
+			     unsigned int num_streams, struct cras_iodev **devs,
+			     unsigned int num_devs)
+{
+	struct audio_thread_add_rm_streams_msg msg;
+
+	assert(thread && streams);
+
+	if (!thread->started)
+		return -EINVAL;
+	if (num_streams == 0)
+		return 0;
+
+	init_add_rm_streams_msg(&msg, AUDIO_THREAD_ADD_STREAMS, streams,
+				num_streams, devs, num_devs);
+	return audio_thread_post_message(thread, &msg.header);
+}
+
+int audio_thread_disconnect_streams(struct audio_thread *thread,
+				    struct cras_rstream **streams,
+				    unsigned int num_streams,
+				    struct cras_iodev **devs,
+				    unsigned int num_devs)
+{
+	struct audio_thread_add_rm_streams_msg msg;
+
+	assert(thread && streams);
+
+	if (num_streams == 0)
+		return 0;
+
+	init_add_rm_streams_msg(&msg, AUDIO_THREAD_DISCONNECT_STREAMS, streams,
+				num_streams, devs, num_devs);
+	return audio_thread_post_message(thread, &msg.header);
+}
+
 int audio_thread_drain_stream(struct audio_thread *thread,
 			      struct cras_rstream *stream)
 {
@@ -1043,13 +1608,46 @@ int audio_thread_drain_stream(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+/* Appends the devices and streams of |other| to |info|. */
+static void merge_debug_info(struct audio_debug_info *info,
+			     const struct audio_debug_info *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < other->num_devs && info->num_devs < MAX_DEBUG_DEVS; i++)
+		info->devs[info->num_devs++] = other->devs[i];
+	for (i = 0; i < other->num_streams &&
+		    info->num_streams < MAX_DEBUG_STREAMS;
+	     i++)
+		info->streams[info->num_streams++] = other->streams[i];
+}
+
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info)
 {
 	struct audio_thread_dump_debug_info_msg msg;
+	struct audio_debug_info *other_info;
+	struct audio_thread *other;
+	int rc;
 
 	init_dump_debug_info_msg(&msg, info);
-	return audio_thread_post_message(thread, &msg.header);
+	rc = audio_thread_post_message(thread, &msg.header);
+	if (rc < 0 || threads == NULL || threads->next == NULL)
+		return rc;
+
+	/* Add the devices run by the other threads. */
+	other_info = (struct audio_debug_info *)calloc(1, sizeof(*other_info));
+	if (!other_info)
+		return rc;
+	DL_FOREACH (threads, other) {
+		if (other == thread || !other->started)
+			continue;
+		init_dump_debug_info_msg(&msg, other_info);
+		if (audio_thread_post_message(other, &msg.header) == 0)
+			merge_debug_info(info, other_info);
+	}
+	free(other_info);
+	return rc;
 }
 
 int audio_thread_set_aec_dump(struct audio_thread *thread,
@@ -1057,6 +1655,11 @@ int audio_thread_set_aec_dump(struct audio_thread *thread,
 			      int fd)
 {
 	struct audio_thread_aec_dump_msg msg;
+	struct audio_thread *other;
+	int rc;
+
+	if (!thread->started)
+		return -EINVAL;
 
 	memset(&msg, 0, sizeof(msg));
 	msg.header.id = AUDIO_THREAD_AEC_DUMP;
@@ -1064,30 +1667,65 @@ int audio_thread_set_aec_dump(struct audio_thread *thread,
 	msg.stream_id = stream_id;
 	msg.start = start;
 	msg.fd = fd;
-	return audio_thread_post_message(thread, &msg.header);
+	rc = audio_thread_post_message_async(thread, &msg.header, NULL, NULL);
+
+	/* The input device of the stream may run in another thread. */
+	DL_FOREACH (threads, other) {
+		if (other == thread || !other->started)
+			continue;
+		audio_thread_post_message_async(other, &msg.header, NULL, NULL);
+	}
+	return rc;
 }
 
 int audio_thread_rm_callback_sync(struct audio_thread *thread, int fd)
 {
 	struct audio_thread_rm_callback_msg msg;
+	struct audio_thread *other;
+	int rc;
 
 	memset(&msg, 0, sizeof(msg));
 	msg.header.id = AUDIO_THREAD_REMOVE_CALLBACK;
 	msg.header.length = sizeof(msg);
 	msg.fd = fd;
 
-	return audio_thread_post_message(thread, &msg.header);
+	rc = audio_thread_post_message(thread, &msg.header);
+
+	/* The callback may have been added to the thread running the device,
+	 * remove it from the other threads too. */
+	DL_FOREACH (threads, other) {
+		if (other == thread || !other->started)
+			continue;
+		audio_thread_post_message(other, &msg.header);
+	}
+	return rc;
 }
 
-int audio_thread_config_global_remix(struct audio_thread *thread,
-				     unsigned int num_channels,
-				     const float *coefficient)
+/* Destroys the remix converter the audio thread replaced. */
+static void global_remix_done(struct audio_thread *thread,
+			      struct audio_thread_msg *msg, int rc, void *data)
+{
+	struct audio_thread_config_global_remix *rmsg =
+		(struct audio_thread_config_global_remix *)msg;
+
+	if (rmsg->fmt_conv)
+		cras_fmt_conv_destroy(&rmsg->fmt_conv);
+}
+
+/* Sends a new remix converter to |thread|, the old one is freed once the
+ * thread has swapped it out. */
+static int post_global_remix(struct audio_thread *thread,
+			     unsigned int num_channels,
+			     const float *coefficient)
 {
 	int err;
 	int identity_remix = 1;
 	unsigned int i, j;
 	struct audio_thread_config_global_remix msg;
-	void *rsp;
+
+	/* The last configuration is applied when the thread starts. */
+	if (!thread->started)
+		return 0;
 
 	init_config_global_remix_msg(&msg);
 
@@ -1115,23 +1753,94 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
 			return -ENOMEM;
 	}
 
-	err = write(thread->to_thread_fds[1], &msg, msg.header.length);
+	err = audio_thread_post_message_async(thread, &msg.header,
+					      global_remix_done, NULL);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to post message to thread.");
+		if (msg.fmt_conv)
+			cras_fmt_conv_destroy(&msg.fmt_conv);
 		return err;
 	}
-	/* Synchronous action, wait for response. */
-	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to read reply from thread.");
-		return err;
+	return 0;
+}
+
+int audio_thread_config_global_remix(struct audio_thread *thread,
+				     unsigned int num_channels,
+				     const float *coefficient)
+{
+	struct audio_thread *other;
+	int rc;
+
+	rc = post_global_remix(thread, num_channels, coefficient);
+	if (rc < 0)
+		return rc;
+
+	if (num_channels <= CRAS_CH_MAX) {
+		remix_num_channels = num_channels;
+		memcpy(remix_coefficient, coefficient,
+		       sizeof(*coefficient) * num_channels * num_channels);
 	}
 
-	if (rsp)
-		cras_fmt_conv_destroy((struct cras_fmt_conv **)&rsp);
+	DL_FOREACH (threads, other) {
+		if (other == thread || !other->started)
+			continue;
+		post_global_remix(other, num_channels, coefficient);
+	}
 	return 0;
 }
 
+/* Creates the command queue with its eventfds, the epoll instance and the
+ * wake up timer of |thread|, and adds the doorbell and the timer to the epoll
+ * instance. */
+static int init_wake_fds(struct audio_thread *thread)
+{
+	struct epoll_event ev;
+
+	thread->cmds = (struct audio_thread_cmd_ring *)calloc(
+		1, sizeof(*thread->cmds));
+	if (!thread->cmds)
+		return -ENOMEM;
+
+	thread->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (thread->doorbell_fd < 0)
+		return -errno;
+	thread->completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (thread->completion_fd < 0)
+		return -errno;
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd < 0)
+		return -errno;
+	thread->timer_fd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (thread->timer_fd < 0)
+		return -errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &thread->doorbell_fd;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->doorbell_fd,
+		      &ev) < 0)
+		return -errno;
+	ev.data.ptr = &thread->timer_fd;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->timer_fd, &ev) <
+	    0)
+		return -errno;
+	return 0;
+}
+
+static void close_wake_fds(struct audio_thread *thread)
+{
+	if (thread->timer_fd >= 0)
+		close(thread->timer_fd);
+	if (thread->epoll_fd >= 0)
+		close(thread->epoll_fd);
+	if (thread->completion_fd >= 0)
+		close(thread->completion_fd);
+	if (thread->doorbell_fd >= 0)
+		close(thread->doorbell_fd);
+	free(thread->cmds);
+}
+
 struct audio_thread *audio_thread_create()
 {
 	int rc;
@@ -1141,35 +1850,37 @@ struct audio_thread *audio_thread_create()
 	if (!thread)
 		return NULL;
 
-	thread->to_thread_fds[0] = -1;
-	thread->to_thread_fds[1] = -1;
-	thread->to_main_fds[0] = -1;
-	thread->to_main_fds[1] = -1;
+	thread->doorbell_fd = -1;
+	thread->completion_fd = -1;
+	thread->epoll_fd = -1;
+	thread->timer_fd = -1;
 
-	/* Two way pipes for communication with the device's audio thread. */
-	rc = pipe(thread->to_thread_fds);
+	rc = init_wake_fds(thread);
 	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to pipe");
-		free(thread);
-		return NULL;
-	}
-	rc = pipe(thread->to_main_fds);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to pipe");
+		syslog(LOG_ERR, "Failed to set up audio thread wake up: %d",
+		       rc);
+		close_wake_fds(thread);
 		free(thread);
 		return NULL;
 	}
 
-	if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
-		syslog(LOG_ERR, "Failed to generate ATlog name.");
-		exit(-1);
-	}
+	/* Commands posted asynchronously are retired from the main loop. */
+	rc = cras_system_add_select_fd(thread->completion_fd, cmds_completed,
+				       thread, POLLIN);
+	if (rc < 0)
+		syslog(LOG_WARNING, "Failed to watch audio thread commands: %d",
+		       rc);
 
-	atlog = audio_thread_event_log_init(atlog_name);
+	if (atlog_users++ == 0) {
+		if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
+			syslog(LOG_ERR, "Failed to generate ATlog name.");
+			exit(-1);
+		}
 
-	thread->pollfds_size = 32;
-	thread->pollfds = (struct pollfd *)malloc(sizeof(*thread->pollfds) *
-						  thread->pollfds_size);
+		atlog = audio_thread_event_log_init(atlog_name);
+	}
+
+	DL_APPEND(threads, thread);
 
 	return thread;
 }
@@ -1214,6 +1925,18 @@ int audio_thread_is_dev_open(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+static void dev_start_ramp_done(struct audio_thread *thread,
+				struct audio_thread_msg *msg, int rc,
+				void *data)
+{
+	struct audio_thread_dev_start_ramp_msg *rmsg =
+		(struct audio_thread_dev_start_ramp_msg *)msg;
+
+	if (rc < 0)
+		syslog(LOG_ERR, "Failed to start ramp on device %u: %d",
+		       rmsg->dev_idx, rc);
+}
+
 int audio_thread_dev_start_ramp(struct audio_thread *thread,
 				unsigned int dev_idx,
 				enum CRAS_IODEV_RAMP_REQUEST request)
@@ -1227,7 +1950,8 @@ int audio_thread_dev_start_ramp(struct audio_thread *thread,
 
 	init_device_start_ramp_msg(&msg, AUDIO_THREAD_DEV_START_RAMP, dev_idx,
 				   request);
-	return audio_thread_post_message(thread, &msg.header);
+	return audio_thread_post_message_async(thread, &msg.header,
+					       dev_start_ramp_done, NULL);
 }
 
 int audio_thread_start(struct audio_thread *thread)
@@ -1242,6 +1966,10 @@ int audio_thread_start(struct audio_thread *thread)
 
 	thread->started = 1;
 
+	if (remix_num_channels)
+		post_global_remix(thread, remix_num_channels,
+				  remix_coefficient);
+
 	return 0;
 }
 
@@ -1256,18 +1984,25 @@ void audio_thread_destroy(struct audio_thread *thread)
 		pthread_join(thread->tid, NULL);
 	}
 
-	free(thread->pollfds);
+	/* Run the completions of the commands left. */
+	retire_cmds(thread);
+	cras_system_rm_select_fd(thread->completion_fd);
+	close_wake_fds(thread);
 
-	audio_thread_event_log_deinit(atlog, atlog_name);
-	free(atlog_name);
+	DL_DELETE(threads, thread);
+	if (callback_owner == thread)
+		callback_owner = NULL;
+	while (thread->callbacks) {
+		struct iodev_callback_list *iodev_cb = thread->callbacks;
 
-	if (thread->to_thread_fds[0] != -1) {
-		close(thread->to_thread_fds[0]);
-		close(thread->to_thread_fds[1]);
+		DL_DELETE(thread->callbacks, iodev_cb);
+		free(iodev_cb);
 	}
-	if (thread->to_main_fds[0] != -1) {
-		close(thread->to_main_fds[0]);
-		close(thread->to_main_fds[1]);
+
+	if (--atlog_users == 0) {
+		audio_thread_event_log_deinit(atlog, atlog_name);
+		free(atlog_name);
+		atlog_name = NULL;
 	}
 
 	if (thread->remix_converter)
@@ -8,6 +8,7 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 
 #include "cras_iodev.h"
 #include "cras_types.h"
@@ -18,37 +19,60 @@ struct cras_fmt_conv;
 struct cras_iodev;
 struct cras_rstream;
 struct dev_stream;
+struct audio_thread_cmd_ring;
+struct iodev_callback_list;
 
-/* Hold communication pipes and pthread info for the thread used to play or
+/* Maximum number of ready FDs handled in one wake up of the audio thread. The
+ * others are returned by the next call to epoll_wait(). */
+#define AUDIO_THREAD_MAX_READY_EVENTS 32
+
+/* Hold the command queue and pthread info for the thread used to play or
  * record audio.
- *    to_thread_fds - Send a message from main to running thread.
- *    to_main_fds - Send a synchronous response to main from running thread.
+ *    cmds - Queue of commands from the main thread to the running thread.
+ *    doorbell_fd - eventfd written by main to wake the running thread up for
+ *        new commands. Only written if the thread may be sleeping.
+ *    completion_fd - eventfd written by the running thread when it is done
+ *        with commands, so main can retire them.
  *    tid - Thread ID of the running playback/capture thread.
  *    started - Non-zero if the thread has started successfully.
  *    suspended - Non-zero if the thread is suspended.
  *    open_devs - Lists of open input and output devices.
- *    pollfds - What FDs wake up this thread.
- *    pollfds_size - Number of available poll fds.
- *    num_pollfds - Number of currently registered poll fds.
+ *    epoll_fd - The epoll instance of the FDs that wake up this thread. The
+ *        doorbell, the wake up timer, callback FDs and stream FDs are
+ *        registered once when they are added and removed, not on each wake.
+ *    timer_fd - Timer armed to the next device wake up time.
+ *    timer_armed - Non-zero if timer_fd may still fire.
+ *    wake_deadline - The CLOCK_MONOTONIC_RAW time the timer was last set to
+ *        wake the thread up at, to measure how late it fires.
+ *    ready_events - Events returned by the last epoll_wait().
+ *    num_ready_events - Number of events in ready_events still to handle.
  *    remix_converter - Format converter used to remix output channels.
+ *    callbacks - Callbacks polled by this thread.
  */
 struct audio_thread {
-	int to_thread_fds[2];
-	int to_main_fds[2];
+	struct audio_thread_cmd_ring *cmds;
+	int doorbell_fd;
+	int completion_fd;
 	pthread_t tid;
 	int started;
 	int suspended;
 	struct open_dev *open_devs[CRAS_NUM_DIRECTIONS];
-	struct pollfd *pollfds;
-	size_t pollfds_size;
-	size_t num_pollfds;
+	int epoll_fd;
+	int timer_fd;
+	int timer_armed;
+	struct timespec wake_deadline;
+	struct epoll_event ready_events[AUDIO_THREAD_MAX_READY_EVENTS];
+	int num_ready_events;
 	struct cras_fmt_conv *remix_converter;
+	struct iodev_callback_list *callbacks;
+	struct audio_thread *prev, *next;
 };
 
 /* Callback function to be handled in main loop in audio thread.
  * Args:
  *    data - The data for callback function.
- *    revent - The returned event from ppoll().
+ *    revent - The returned events from epoll_wait(). The poll() event bits,
+ *        like POLLIN and POLLOUT, have the same values.
  */
 typedef int (*thread_callback)(void *data, int revent);
 
@@ -90,7 +114,7 @@ int audio_thread_is_dev_open(struct audio_thread *thread,
  *      The callback will be called when any of requested events matched.
  *    cb - The callback function.
  *    data - The data for the callback function.
- *    events - The requested events to ppoll().
+ *    events - The requested events, as poll() event bits.
  */
 void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 				      int events);
@@ -101,7 +125,8 @@ void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
  */
 void audio_thread_rm_callback(int fd);
 
-/* Removes a thread_callback from main thread.
+/* Removes a thread_callback from main thread. The callback is also removed
+ * from any other running audio thread that polls it.
  * Args:
  *     thread - The thread to remove callback from.
  *     fd - The file descriptor of the previous added callback.
@@ -111,6 +136,14 @@ int audio_thread_rm_callback_sync(struct audio_thread *thread, int fd);
 /* Enables or Disabled the callback associated with fd. */
 void audio_thread_enable_callback(int fd, int enabled);
 
+/* Sets the thread that polls the callbacks added from the main thread. Called
+ * before opening a device, so the callbacks it adds are polled by the thread
+ * that runs it.
+ * Args:
+ *    thread - The thread to own new callbacks, NULL for the first thread.
+ */
+void audio_thread_set_callback_owner(struct audio_thread *thread);
+
 /* Starts a thread created with audio_thread_create.
  * Args:
  *    thread - The thread to start.
@@ -125,6 +158,24 @@ void audio_thread_destroy(struct audio_thread *thread);
 /* Returns the shm fd for the ATlog. */
 int audio_thread_event_log_shm_fd();
 
+/* Starts copying the ATlog events to a trace ring shared with a client, see
+ * struct audio_thread_trace. Only one trace can run at a time.
+ * Args:
+ *    owner - Identifies the client, for audio_thread_event_log_stop_trace().
+ *    num_events - The requested size of the ring, rounded up to a power of
+ *        two within the supported bounds.
+ * Returns:
+ *    A read-write fd of the ring for the caller to send and close, -EBUSY if
+ *    a trace is already running, or another negative error code.
+ */
+int audio_thread_event_log_start_trace(void *owner, unsigned int num_events);
+
+/* Stops the trace started for |owner| and frees the ring.
+ * Returns:
+ *    0 on success, -EINVAL if there is no trace running for |owner|.
+ */
+int audio_thread_event_log_stop_trace(void *owner);
+
 /* Add a stream to the thread. After this call, the ownership of the stream will
  * be passed to the audio thread. Audio thread is responsible to release the
  * stream's resources.
@@ -141,6 +192,23 @@ int audio_thread_add_stream(struct audio_thread *thread,
 			    struct cras_rstream *stream,
 			    struct cras_iodev **devs, unsigned int num_devs);
 
+/* Adds several streams to the same devices with a single message, so that
+ * moving many streams to a new device costs one wake of the thread.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    streams - an array of streams to add.
+ *    num_streams - number of streams in the array pointed by streams.
+ *    devs - an array of devices to attach every stream to.
+ *    num_devs - number of devices in the array pointed by devs
+ * Returns:
+ *    zero on success, otherwise the first error returned while adding the
+ *    streams. The other streams are still added.
+ */
+int audio_thread_add_streams(struct audio_thread *thread,
+			     struct cras_rstream **streams,
+			     unsigned int num_streams, struct cras_iodev **devs,
+			     unsigned int num_devs);
+
 /* Begin draining a stream and check the draining status.
  * Args:
  *    thread - a pointer to the audio thread.
@@ -165,11 +233,30 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 				   struct cras_rstream *stream,
 				   struct cras_iodev *iodev);
 
-/* Dumps information about all active streams to syslog. */
+/* Disconnects several streams with a single message.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    streams - an array of streams to disconnect.
+ *    num_streams - number of streams in the array pointed by streams.
+ *    devs - the devices to disconnect the streams from.
+ *    num_devs - number of devices in the array pointed by devs, zero to
+ *        disconnect the streams from all devices.
+ * Returns:
+ *    0 on success, otherwise the first error met.
+ */
+int audio_thread_disconnect_streams(struct audio_thread *thread,
+				    struct cras_rstream **streams,
+				    unsigned int num_streams,
+				    struct cras_iodev **devs,
+				    unsigned int num_devs);
+
+/* Dumps information about all active streams to syslog. Devices and streams
+ * run by the other audio threads are added after the ones of |thread|. */
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info);
 
-/* Starts or stops the aec dump task.
+/* Starts or stops the aec dump task, in every audio thread. Returns once the
+ * request is queued, the audio threads handle it asynchronously.
  * Args:
  *    thread - pointer to the audio thread.
  *    stream_id - id of the target stream for aec dump.
@@ -181,7 +268,9 @@ int audio_thread_set_aec_dump(struct audio_thread *thread,
 			      int fd);
 
 /* Configures the global converter for output remixing. Called by main
- * thread. */
+ * thread. The configuration applies to all audio threads, including the ones
+ * started later. The threads switch converters asynchronously, the old ones
+ * are destroyed in the main thread when they are done. */
 int audio_thread_config_global_remix(struct audio_thread *thread,
 				     unsigned int num_channels,
 				     const float *coefficient);
@@ -196,7 +285,8 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
  *   dev_idx - Index of the the device to start ramping.
  *   request - Check the docstrings of CRAS_IODEV_RAMP_REQUEST.
  * Returns:
- *    0 on success, negative if error.
+ *    0 once the request is queued, negative if error. Errors from starting
+ *    the ramp in the audio thread are only logged.
  */
 int audio_thread_dev_start_ramp(struct audio_thread *thread,
 				unsigned int dev_idx,
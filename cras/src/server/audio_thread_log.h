@@ -2,7 +2,7 @@
  * Use of this source code is governed by a BSD-style license that can be
  * found in the LICENSE file.
  *
- * The blow logging funcitons must only be called from the audio thread.
+ * The blow logging funcitons must only be called from the audio threads.
  */
 
 #ifndef AUDIO_THREAD_LOG_H_
@@ -25,31 +25,52 @@
 #define ATLOG(log, event, data1, data2, data3)
 #endif
 
+/* State of the trace ring, private to the server.
+ *    ring - The ring shared with the tracing client.
+ *    mask - The number of events in the ring minus one. Kept here as the
+ *        client can write to the ring.
+ *    reserve_pos - Free running count of the events reserved by writers.
+ *    size - Size of the ring mapping in bytes.
+ *    owner - The client the trace was started for.
+ */
+struct audio_thread_tracer {
+	struct audio_thread_trace *ring;
+	uint32_t mask;
+	uint64_t reserve_pos;
+	size_t size;
+	void *owner;
+};
+
 extern struct audio_thread_event_log *atlog;
 extern int atlog_rw_shm_fd;
 extern int atlog_ro_shm_fd;
+/* The running trace or NULL, and the number of writers using it. */
+extern struct audio_thread_tracer *attrace;
+extern int attrace_writers;
 
+/* Creates the audio thread event log, followed by the timing statistics in
+ * the same shm region, see struct audio_thread_log_shm. */
 static inline struct audio_thread_event_log *
 audio_thread_event_log_init(char *name)
 {
-	struct audio_thread_event_log *log;
+	struct audio_thread_log_shm *shm;
 
 	atlog_ro_shm_fd = -1;
 	atlog_rw_shm_fd = -1;
 
-	log = (struct audio_thread_event_log *)cras_shm_setup(
-		name, sizeof(*log), &atlog_rw_shm_fd, &atlog_ro_shm_fd);
+	shm = (struct audio_thread_log_shm *)cras_shm_setup(
+		name, sizeof(*shm), &atlog_rw_shm_fd, &atlog_ro_shm_fd);
 	/* Fallback to calloc if device shared memory resource is empty and
 	 * cras_shm_setup fails.
 	 */
-	if (log == NULL) {
+	if (shm == NULL) {
 		syslog(LOG_ERR, "Failed to create atlog by cras_shm_setup");
-		log = (struct audio_thread_event_log *)calloc(
-			1, sizeof(struct audio_thread_event_log));
+		shm = (struct audio_thread_log_shm *)calloc(
+			1, sizeof(struct audio_thread_log_shm));
 	}
-	log->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+	shm->log.len = AUDIO_THREAD_EVENT_LOG_SIZE;
 
-	return log;
+	return &shm->log;
 }
 
 static inline void
@@ -57,7 +78,7 @@ audio_thread_event_log_deinit(struct audio_thread_event_log *log, char *name)
 {
 	if (log) {
 		if (atlog_rw_shm_fd >= 0) {
-			munmap(log, sizeof(*log));
+			munmap(log, sizeof(struct audio_thread_log_shm));
 			cras_shm_close_unlink(name, atlog_rw_shm_fd);
 		} else {
 			free(log);
@@ -68,8 +89,40 @@ audio_thread_event_log_deinit(struct audio_thread_event_log *log, char *name)
 	}
 }
 
+/* Returns the timing statistics stored after |log|. */
+static inline struct audio_thread_timing *
+audio_thread_event_log_timing(struct audio_thread_event_log *log)
+{
+	return &((struct audio_thread_log_shm *)log)->timing;
+}
+
+/* Adds |ns| to |hist|. Lock free, the audio threads of all devices share the
+ * histograms. */
+static inline void audio_thread_hist_add(struct audio_thread_hist *hist,
+					 uint64_t ns)
+{
+	uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&hist->buckets[audio_thread_hist_bucket(ns)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	while (ns > max &&
+	       !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Appends an event to the trace ring, or counts it as dropped if the client
+ * hasn't made room for it. Only called while a trace is running. */
+void audio_thread_trace_data(const struct timespec *now,
+			     enum AUDIO_THREAD_LOG_EVENTS event, uint32_t data1,
+			     uint32_t data2, uint32_t data3);
+
 /* Log a tag and the current time, Uses two words, the first is split
  * 8 bits for tag and 24 for seconds, second word is micro seconds.
+ * The slot is reserved atomically, so audio threads running different devices
+ * can share the log.
  */
 static inline void
 audio_thread_event_log_data(struct audio_thread_event_log *log,
@@ -77,7 +130,9 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 			    uint32_t data2, uint32_t data3)
 {
 	struct timespec now;
-	uint64_t pos_mod_len = log->write_pos % AUDIO_THREAD_EVENT_LOG_SIZE;
+	uint64_t pos_mod_len =
+		__atomic_fetch_add(&log->write_pos, 1, __ATOMIC_RELAXED) %
+		AUDIO_THREAD_EVENT_LOG_SIZE;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	log->log[pos_mod_len].tag_sec =
@@ -87,7 +142,8 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 	log->log[pos_mod_len].data2 = data2;
 	log->log[pos_mod_len].data3 = data3;
 
-	log->write_pos++;
+	if (__atomic_load_n(&attrace, __ATOMIC_RELAXED))
+		audio_thread_trace_data(&now, event, data1, data2, data3);
 }
 
 #endif /* AUDIO_THREAD_LOG_H_ */
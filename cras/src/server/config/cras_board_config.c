@@ -15,12 +15,24 @@ static const int32_t DEFAULT_OUTPUT_BUFFER_SIZE = 512;
 static const int32_t AEC_SUPPORTED_DEFAULT = 0;
 static const int32_t AEC_GROUP_ID_DEFAULT = -1;
 static const int32_t BLUETOOTH_WBS_ENABLED_INI_DEFAULT = 0;
+static const int32_t FLOAT_MIX_BUS_ENABLED_DEFAULT = 0;
+static const int32_t POLYPHASE_RESAMPLER_ENABLED_DEFAULT = 0;
+static const int32_t PER_DEVICE_THREADS_ENABLED_DEFAULT = 0;
+static const int32_t APM_SHARING_ENABLED_DEFAULT = 0;
+static const int32_t APM_WORKER_ENABLED_DEFAULT = 0;
+static const int32_t A2DP_ENCODER_THREAD_ENABLED_DEFAULT = 0;
 
 #define CONFIG_NAME "board.ini"
 #define DEFAULT_OUTPUT_BUF_SIZE_INI_KEY "output:default_output_buffer_size"
 #define AEC_SUPPORTED_INI_KEY "processing:aec_supported"
 #define AEC_GROUP_ID_INI_KEY "processing:group_id"
 #define BLUETOOTH_WBS_ENABLED_INI_KEY "bluetooth:wbs_enabled"
+#define FLOAT_MIX_BUS_ENABLED_INI_KEY "output:float_mix_bus"
+#define POLYPHASE_RESAMPLER_ENABLED_INI_KEY "processing:polyphase_resampler"
+#define PER_DEVICE_THREADS_ENABLED_INI_KEY "audio_thread:per_device_threads"
+#define APM_SHARING_ENABLED_INI_KEY "processing:apm_sharing"
+#define APM_WORKER_ENABLED_INI_KEY "processing:apm_worker"
+#define A2DP_ENCODER_THREAD_ENABLED_INI_KEY "bluetooth:a2dp_encoder_thread"
 
 void cras_board_config_get(const char *config_path,
 			   struct cras_board_config *board_config)
@@ -32,6 +44,15 @@ void cras_board_config_get(const char *config_path,
 	board_config->default_output_buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
 	board_config->aec_supported = AEC_SUPPORTED_DEFAULT;
 	board_config->aec_group_id = AEC_GROUP_ID_DEFAULT;
+	board_config->float_mix_bus_enabled = FLOAT_MIX_BUS_ENABLED_DEFAULT;
+	board_config->polyphase_resampler_enabled =
+		POLYPHASE_RESAMPLER_ENABLED_DEFAULT;
+	board_config->per_device_threads_enabled =
+		PER_DEVICE_THREADS_ENABLED_DEFAULT;
+	board_config->apm_sharing_enabled = APM_SHARING_ENABLED_DEFAULT;
+	board_config->apm_worker_enabled = APM_WORKER_ENABLED_DEFAULT;
+	board_config->a2dp_encoder_thread_enabled =
+		A2DP_ENCODER_THREAD_ENABLED_DEFAULT;
 	if (config_path == NULL)
 		return;
 
@@ -63,6 +84,36 @@ void cras_board_config_get(const char *config_path,
 	board_config->bt_wbs_enabled = iniparser_getint(
 		ini, ini_key, BLUETOOTH_WBS_ENABLED_INI_DEFAULT);
 
+	snprintf(ini_key, MAX_KEY_LEN, FLOAT_MIX_BUS_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->float_mix_bus_enabled = iniparser_getint(
+		ini, ini_key, FLOAT_MIX_BUS_ENABLED_DEFAULT);
+
+	snprintf(ini_key, MAX_KEY_LEN, POLYPHASE_RESAMPLER_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->polyphase_resampler_enabled = iniparser_getint(
+		ini, ini_key, POLYPHASE_RESAMPLER_ENABLED_DEFAULT);
+
+	snprintf(ini_key, MAX_KEY_LEN, PER_DEVICE_THREADS_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->per_device_threads_enabled = iniparser_getint(
+		ini, ini_key, PER_DEVICE_THREADS_ENABLED_DEFAULT);
+
+	snprintf(ini_key, MAX_KEY_LEN, APM_SHARING_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->apm_sharing_enabled =
+		iniparser_getint(ini, ini_key, APM_SHARING_ENABLED_DEFAULT);
+
+	snprintf(ini_key, MAX_KEY_LEN, APM_WORKER_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->apm_worker_enabled =
+		iniparser_getint(ini, ini_key, APM_WORKER_ENABLED_DEFAULT);
+
+	snprintf(ini_key, MAX_KEY_LEN, A2DP_ENCODER_THREAD_ENABLED_INI_KEY);
+	ini_key[MAX_KEY_LEN] = 0;
+	board_config->a2dp_encoder_thread_enabled = iniparser_getint(
+		ini, ini_key, A2DP_ENCODER_THREAD_ENABLED_DEFAULT);
+
 	iniparser_freedict(ini);
 	syslog(LOG_DEBUG, "Loaded ini file %s", ini_name);
 }
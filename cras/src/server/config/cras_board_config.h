@@ -13,6 +13,12 @@ struct cras_board_config {
 	int32_t aec_supported;
 	int32_t aec_group_id;
 	int32_t bt_wbs_enabled;
+	int32_t float_mix_bus_enabled;
+	int32_t polyphase_resampler_enabled;
+	int32_t per_device_threads_enabled;
+	int32_t apm_sharing_enabled;
+	int32_t apm_worker_enabled;
+	int32_t a2dp_encoder_thread_enabled;
 };
 
 /* Gets a configuration based on the config file specified.
@@ -113,9 +113,9 @@ void a2dp_reset(struct a2dp_info *a2dp)
 	a2dp->frame_count = 0;
 }
 
-static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+/* Fills the RTP header of the packet in a2dp buffer. */
+static void avdtp_fill_header(struct a2dp_info *a2dp)
 {
-	int err, samples;
 	struct rtp_header *header;
 	struct rtp_payload *payload;
 
@@ -129,17 +129,20 @@ static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
 	header->sequence_number = htons(a2dp->seq_num);
 	header->timestamp = htonl(a2dp->nsamples);
 	header->ssrc = htonl(1);
+}
 
-	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
-		   MSG_DONTWAIT);
-	if (err < 0)
-		return -errno;
+/* Starts the next packet once the current one has been sent. Returns the
+ * number of samples in the sent packet. */
+static int avdtp_packet_done(struct a2dp_info *a2dp)
+{
+	int samples;
 
 	/* Returns the number of samples in frame. */
 	samples = a2dp->samples;
 
 	/* Reset some data */
-	a2dp->a2dp_buf_used = sizeof(*header) + sizeof(*payload);
+	a2dp->a2dp_buf_used =
+		sizeof(struct rtp_header) + sizeof(struct rtp_payload);
 	a2dp->frame_count = 0;
 	a2dp->samples = 0;
 	a2dp->seq_num++;
@@ -147,6 +150,20 @@ static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
 	return samples;
 }
 
+static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+{
+	int err;
+
+	avdtp_fill_header(a2dp);
+
+	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
+		   MSG_DONTWAIT);
+	if (err < 0)
+		return -errno;
+
+	return avdtp_packet_done(a2dp);
+}
+
 int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu)
 {
@@ -185,3 +202,18 @@ int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu)
 
 	return 0;
 }
+
+int a2dp_take_packet(struct a2dp_info *a2dp, uint8_t *packet, size_t *size,
+		     size_t link_mtu)
+{
+	/* Same as a2dp_write, the packet is done when the max number of SBC
+	 * frames is reached. */
+	if (a2dp->a2dp_buf_used + a2dp->frame_length <= link_mtu)
+		return 0;
+
+	avdtp_fill_header(a2dp);
+	memcpy(packet, a2dp->a2dp_buf, a2dp->a2dp_buf_used);
+	*size = a2dp->a2dp_buf_used;
+
+	return avdtp_packet_done(a2dp);
+}
@@ -86,4 +86,18 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
  */
 int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu);
 
+/*
+ * Moves the encoded frames out as one AVDTP packet, instead of writing it
+ * like a2dp_write does. For sending the packet later from another thread.
+ * Args:
+ *    a2dp: The a2dp info object.
+ *    packet: Buffer of A2DP_BUF_SIZE_BYTES to copy the packet to.
+ *    size: Filled with the size of the packet in bytes.
+ *    link_mtu: The maximum transmit unit.
+ * Returns:
+ *    The number of frames in the packet, 0 if the packet isn't full yet.
+ */
+int a2dp_take_packet(struct a2dp_info *a2dp, uint8_t *packet, size_t *size,
+		     size_t link_mtu);
+
 #endif /* CRAS_A2DP_INFO_H_ */
@@ -3,7 +3,10 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <linux/sockios.h>
@@ -11,6 +14,7 @@
 #include <sys/time.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "audio_thread.h"
 #include "audio_thread_log.h"
@@ -22,7 +26,9 @@
 #include "cras_audio_area.h"
 #include "cras_audio_thread_monitor.h"
 #include "cras_bt_device.h"
+#include "cras_config.h"
 #include "cras_iodev.h"
+#include "cras_system_state.h"
 #include "cras_util.h"
 #include "sfh.h"
 #include "rtp.h"
@@ -30,6 +36,9 @@
 
 #define PCM_BUF_MAX_SIZE_FRAMES (4096 * 4)
 #define PCM_BUF_MAX_SIZE_BYTES (PCM_BUF_MAX_SIZE_FRAMES * 4)
+/* Number of packets the encoder thread can have ready ahead of the flush
+ * schedule. */
+#define A2DP_ENCODER_PACKETS 4
 
 /* Threshold for reasonable a2dp throttle log in audio dump. */
 static const struct timespec throttle_log_threshold = {
@@ -41,6 +50,56 @@ static const struct timespec throttle_event_threshold = {
 	2, 0 /* 2s */
 };
 
+/* An AVDTP packet built by the encoder thread, ready to send.
+ * Members:
+ *    data - The RTP header and the SBC frames.
+ *    size - Size of the packet in bytes.
+ *    frames - Number of PCM frames encoded in the packet.
+ */
+struct a2dp_packet {
+	uint8_t data[A2DP_BUF_SIZE_BYTES];
+	size_t size;
+	unsigned int frames;
+};
+
+/* Encoder stage running the SBC encoding off the audio thread. The audio
+ * thread writes PCM to |pcm| and sends the packets, the encoder thread
+ * encodes the PCM into packets as soon as there is enough of it, so the
+ * packets are ready before next_flush_time. The counters only increase,
+ * the rings are indexed modulo their sizes.
+ * Members:
+ *    thread - The encoder thread.
+ *    fd - Eventfd waking the encoder when PCM is written or a packet sent.
+ *    running - Cleared to stop the encoder.
+ *    link_mtu - The write MTU of the transport.
+ *    format_bytes - Size of a PCM frame in bytes.
+ *    pcm - Ring of PCM_BUF_MAX_SIZE_BYTES of PCM waiting to be encoded.
+ *    packets - Ring of the packets ready to send.
+ *    pcm_written - Bytes of PCM written by the audio thread.
+ *    packets_sent - Number of packets sent by the audio thread.
+ *    frames_written - Frames of PCM written by the audio thread.
+ *    frames_sent - Frames of PCM in the packets sent.
+ *    pcm_read - Bytes of PCM encoded by the encoder thread.
+ *    packets_built - Number of packets built by the encoder thread.
+ *    err - The encode error that stopped the encoder thread, 0 if none.
+ */
+struct a2dp_encoder {
+	pthread_t thread;
+	int fd;
+	int running;
+	size_t link_mtu;
+	size_t format_bytes;
+	uint8_t *pcm;
+	struct a2dp_packet packets[A2DP_ENCODER_PACKETS];
+	unsigned int pcm_written;
+	unsigned int packets_sent;
+	unsigned int frames_written;
+	unsigned int frames_sent;
+	unsigned int pcm_read __attribute__((aligned(64)));
+	unsigned int packets_built;
+	int err;
+};
+
 /* Child of cras_iodev to handle bluetooth A2DP streaming.
  * Members:
  *    base - The cras_iodev structure "base class"
@@ -53,6 +112,9 @@ static const struct timespec throttle_event_threshold = {
  *    flush_period - The time period between two a2dp packet writes.
  *    write_block - How many frames of audio samples are transferred in one
  *        a2dp packet write.
+ *    encoder - The encoder thread building the packets, NULL if they are
+ *        encoded on the audio thread. When set, |a2dp| belongs to the
+ *        encoder thread and |pcm_buf| isn't used.
  */
 struct a2dp_io {
 	struct cras_iodev base;
@@ -64,10 +126,209 @@ struct a2dp_io {
 	struct timespec next_flush_time;
 	struct timespec flush_period;
 	unsigned int write_block;
+	struct a2dp_encoder *encoder;
 };
 
 static int encode_and_flush(const struct cras_iodev *iodev);
 
+static void encoder_wake(struct a2dp_encoder *enc)
+{
+	if (eventfd_write(enc->fd, 1) < 0)
+		syslog(LOG_ERR, "Failed to wake A2DP encoder: %d", errno);
+}
+
+/* Gets the bytes of PCM the audio thread can write to the encoder. */
+static unsigned int encoder_pcm_writable(const struct a2dp_encoder *enc)
+{
+	return PCM_BUF_MAX_SIZE_BYTES -
+	       (enc->pcm_written -
+		__atomic_load_n(&enc->pcm_read, __ATOMIC_ACQUIRE));
+}
+
+/* Gets the frames written but not sent, less the frames of the next packet
+ * to send. Same as the level of |pcm_buf| when the audio thread encodes the
+ * packets itself. */
+static unsigned int encoder_frames_queued(const struct a2dp_encoder *enc)
+{
+	const struct a2dp_packet *next;
+	unsigned int queued = enc->frames_written - enc->frames_sent;
+
+	if (enc->packets_sent !=
+	    __atomic_load_n(&enc->packets_built, __ATOMIC_ACQUIRE)) {
+		next = &enc->packets[enc->packets_sent % A2DP_ENCODER_PACKETS];
+		queued -= next->frames;
+	}
+	return queued;
+}
+
+/* Encodes the PCM written so far until the packet ring is full. Runs on the
+ * encoder thread.
+ * Returns:
+ *    0 for success, otherwise negative error code.
+ */
+static int encoder_build_packets(struct a2dp_io *a2dpio)
+{
+	struct a2dp_encoder *enc = a2dpio->encoder;
+	struct a2dp_packet *packet;
+	unsigned int written, offset, readable;
+	int processed, frames;
+
+	while (enc->packets_built -
+		       __atomic_load_n(&enc->packets_sent, __ATOMIC_ACQUIRE) <
+	       A2DP_ENCODER_PACKETS) {
+		packet = &enc->packets[enc->packets_built %
+				       A2DP_ENCODER_PACKETS];
+		frames = a2dp_take_packet(&a2dpio->a2dp, packet->data,
+					  &packet->size, enc->link_mtu);
+		if (frames) {
+			packet->frames = frames;
+			__atomic_store_n(&enc->packets_built,
+					 enc->packets_built + 1,
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+
+		written = __atomic_load_n(&enc->pcm_written, __ATOMIC_ACQUIRE);
+		offset = enc->pcm_read % PCM_BUF_MAX_SIZE_BYTES;
+		readable = MIN(written - enc->pcm_read,
+			       PCM_BUF_MAX_SIZE_BYTES - offset);
+		if (readable == 0)
+			return 0;
+
+		processed = a2dp_encode(&a2dpio->a2dp, enc->pcm + offset,
+					readable, enc->format_bytes,
+					enc->link_mtu);
+		/* Less than one SBC frame of PCM, wait for more. */
+		if (processed == -ENOSPC || processed == 0)
+			return 0;
+		if (processed < 0)
+			return processed;
+
+		__atomic_store_n(&enc->pcm_read, enc->pcm_read + processed,
+				 __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void *encoder_thread(void *arg)
+{
+	struct a2dp_io *a2dpio = (struct a2dp_io *)arg;
+	struct a2dp_encoder *enc = a2dpio->encoder;
+	eventfd_t count;
+	int err;
+
+	/* Packets are due at next_flush_time, same as the audio thread. */
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+
+	while (1) {
+		if (eventfd_read(enc->fd, &count) < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "A2DP encoder read err %d", errno);
+			break;
+		}
+		if (!__atomic_load_n(&enc->running, __ATOMIC_ACQUIRE))
+			break;
+
+		err = encoder_build_packets(a2dpio);
+		if (err < 0) {
+			__atomic_store_n(&enc->err, err, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int encoder_start(struct a2dp_io *a2dpio)
+{
+	struct a2dp_encoder *enc;
+	int rc;
+
+	enc = (struct a2dp_encoder *)calloc(1, sizeof(*enc));
+	if (enc == NULL)
+		return -ENOMEM;
+	enc->pcm = (uint8_t *)malloc(PCM_BUF_MAX_SIZE_BYTES);
+	if (enc->pcm == NULL) {
+		rc = -ENOMEM;
+		goto free_enc;
+	}
+	enc->fd = eventfd(0, EFD_CLOEXEC);
+	if (enc->fd < 0) {
+		rc = -errno;
+		goto free_pcm;
+	}
+	enc->link_mtu = cras_bt_transport_write_mtu(a2dpio->transport);
+	enc->format_bytes = cras_get_format_bytes(a2dpio->base.format);
+	enc->running = 1;
+
+	a2dpio->encoder = enc;
+	rc = pthread_create(&enc->thread, NULL, encoder_thread, a2dpio);
+	if (rc) {
+		a2dpio->encoder = NULL;
+		rc = -rc;
+		goto close_fd;
+	}
+	return 0;
+
+close_fd:
+	close(enc->fd);
+free_pcm:
+	free(enc->pcm);
+free_enc:
+	free(enc);
+	return rc;
+}
+
+static void encoder_stop(struct a2dp_io *a2dpio)
+{
+	struct a2dp_encoder *enc = a2dpio->encoder;
+
+	if (enc == NULL)
+		return;
+
+	__atomic_store_n(&enc->running, 0, __ATOMIC_RELEASE);
+	encoder_wake(enc);
+	pthread_join(enc->thread, NULL);
+
+	close(enc->fd);
+	free(enc->pcm);
+	free(enc);
+	a2dpio->encoder = NULL;
+}
+
+/* Sends the next packet built by the encoder thread.
+ * Returns:
+ *    The number of frames sent, 0 if no packet is ready, otherwise negative
+ *    error code.
+ */
+static int encoder_send_packet(struct a2dp_io *a2dpio)
+{
+	struct a2dp_encoder *enc = a2dpio->encoder;
+	struct a2dp_packet *packet;
+	unsigned int frames;
+	int err;
+
+	err = __atomic_load_n(&enc->err, __ATOMIC_ACQUIRE);
+	if (err)
+		return err;
+	if (enc->packets_sent ==
+	    __atomic_load_n(&enc->packets_built, __ATOMIC_ACQUIRE))
+		return 0;
+
+	packet = &enc->packets[enc->packets_sent % A2DP_ENCODER_PACKETS];
+	err = send(cras_bt_transport_fd(a2dpio->transport), packet->data,
+		   packet->size, MSG_DONTWAIT);
+	if (err < 0)
+		return -errno;
+
+	/* The slot belongs to the encoder again once the packet is sent. */
+	frames = packet->frames;
+	enc->frames_sent += frames;
+	__atomic_store_n(&enc->packets_sent, enc->packets_sent + 1,
+			 __ATOMIC_RELEASE);
+	encoder_wake(enc);
+	return frames;
+}
+
 static int update_supported_formats(struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
@@ -111,6 +372,13 @@ static int update_supported_formats(struct cras_iodev *iodev)
 static unsigned int bt_local_queued_frames(const struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
+
+	/* Frames in the encoder thread are in use by that thread, count them
+	 * from the audio thread side. */
+	if (a2dpio->encoder)
+		return a2dpio->encoder->frames_written -
+		       a2dpio->encoder->frames_sent;
+
 	return a2dp_queued_frames(&a2dpio->a2dp) +
 	       buf_queued(a2dpio->pcm_buf) /
 		       cras_get_format_bytes(iodev->format);
@@ -272,9 +540,18 @@ static int configure_dev(struct cras_iodev *iodev)
 	iodev->format->format = SND_PCM_FORMAT_S16_LE;
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
 
-	a2dpio->pcm_buf = byte_buffer_create(PCM_BUF_MAX_SIZE_BYTES);
-	if (!a2dpio->pcm_buf)
-		return -ENOMEM;
+	if (cras_system_get_a2dp_encoder_thread_enabled()) {
+		err = encoder_start(a2dpio);
+		if (err < 0)
+			syslog(LOG_ERR, "Failed to start A2DP encoder: %d, "
+					"encoding on the audio thread", err);
+	}
+
+	if (!a2dpio->encoder) {
+		a2dpio->pcm_buf = byte_buffer_create(PCM_BUF_MAX_SIZE_BYTES);
+		if (!a2dpio->pcm_buf)
+			return -ENOMEM;
+	}
 
 	/* Set up the socket to hold two MTUs full of data before returning
 	 * EAGAIN.  This will allow the write to be throttled when a reasonable
@@ -346,6 +623,7 @@ static int close_dev(struct cras_iodev *iodev)
 	 * the transport. */
 	audio_thread_rm_callback_sync(cras_iodev_list_get_audio_thread(),
 				      cras_bt_transport_fd(a2dpio->transport));
+	encoder_stop(a2dpio);
 
 	err = cras_bt_transport_release(a2dpio->transport, !a2dpio->destroyed);
 	if (err < 0)
@@ -419,9 +697,11 @@ static int encode_and_flush(const struct cras_iodev *iodev)
 	    (iodev->state != CRAS_IODEV_STATE_NO_STREAM_RUN))
 		return 0;
 
-	err = encode_a2dp_packet(a2dpio);
-	if (err < 0)
-		return err;
+	if (!a2dpio->encoder) {
+		err = encode_a2dp_packet(a2dpio);
+		if (err < 0)
+			return err;
+	}
 
 do_flush:
 	/* If flush gets called before targeted next flush time, do nothing. */
@@ -442,11 +722,17 @@ do_flush:
 	if (timespec_after(&ts, &throttle_event_threshold))
 		cras_audio_thread_event_a2dp_throttle();
 
-	written = a2dp_write(&a2dpio->a2dp,
-			     cras_bt_transport_fd(a2dpio->transport),
-			     cras_bt_transport_write_mtu(a2dpio->transport));
-	ATLOG(atlog, AUDIO_THREAD_A2DP_WRITE, written,
-	      a2dp_queued_frames(&a2dpio->a2dp), 0);
+	if (a2dpio->encoder) {
+		written = encoder_send_packet(a2dpio);
+		ATLOG(atlog, AUDIO_THREAD_A2DP_WRITE, written,
+		      bt_local_queued_frames(iodev), 0);
+	} else {
+		written = a2dp_write(
+			&a2dpio->a2dp, cras_bt_transport_fd(a2dpio->transport),
+			cras_bt_transport_write_mtu(a2dpio->transport));
+		ATLOG(atlog, AUDIO_THREAD_A2DP_WRITE, written,
+		      a2dp_queued_frames(&a2dpio->a2dp), 0);
+	}
 	if (written == -EAGAIN) {
 		/* If EAGAIN error lasts longer than 5 seconds, suspend the
 		 * a2dp connection. */
@@ -483,12 +769,18 @@ do_flush:
 	 * encode more. But avoid the case when PCM buffer level is too close
 	 * to min_buffer_level so that another A2DP write could causes underrun.
 	 */
-	queued_frames = buf_queued(a2dpio->pcm_buf) / format_bytes;
+	if (a2dpio->encoder)
+		queued_frames = encoder_frames_queued(a2dpio->encoder);
+	else
+		queued_frames = buf_queued(a2dpio->pcm_buf) / format_bytes;
 	if (written &&
 	    (iodev->min_buffer_level + a2dpio->write_block < queued_frames)) {
-		err = encode_a2dp_packet(a2dpio);
-		if (err < 0)
-			return err;
+		/* The encoder thread keeps the next packets ready. */
+		if (!a2dpio->encoder) {
+			err = encode_a2dp_packet(a2dpio);
+			if (err < 0)
+				return err;
+		}
 		goto do_flush;
 	}
 
@@ -509,6 +801,9 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 {
 	size_t format_bytes;
 	struct a2dp_io *a2dpio;
+	struct a2dp_encoder *enc;
+	unsigned int offset, writable;
+	uint8_t *buf;
 
 	a2dpio = (struct a2dp_io *)iodev;
 
@@ -517,10 +812,20 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return 0;
 
-	*frames = MIN(*frames, buf_writable(a2dpio->pcm_buf) / format_bytes);
+	if (a2dpio->encoder) {
+		enc = a2dpio->encoder;
+		offset = enc->pcm_written % PCM_BUF_MAX_SIZE_BYTES;
+		writable = MIN(encoder_pcm_writable(enc),
+			       PCM_BUF_MAX_SIZE_BYTES - offset);
+		buf = enc->pcm + offset;
+	} else {
+		writable = buf_writable(a2dpio->pcm_buf);
+		buf = buf_write_pointer(a2dpio->pcm_buf);
+	}
+
+	*frames = MIN(*frames, writable / format_bytes);
 	iodev->area->frames = *frames;
-	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-					    buf_write_pointer(a2dpio->pcm_buf));
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format, buf);
 	*area = iodev->area;
 	return 0;
 }
@@ -530,10 +835,24 @@ static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 	size_t written_bytes;
 	size_t format_bytes;
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
+	struct a2dp_encoder *enc;
 
 	format_bytes = cras_get_format_bytes(iodev->format);
 	written_bytes = nwritten * format_bytes;
 
+	if (a2dpio->encoder) {
+		enc = a2dpio->encoder;
+		if (written_bytes > encoder_pcm_writable(enc))
+			return -EINVAL;
+
+		__atomic_store_n(&enc->pcm_written,
+				 enc->pcm_written + written_bytes,
+				 __ATOMIC_RELEASE);
+		enc->frames_written += nwritten;
+		encoder_wake(enc);
+		return encode_and_flush(iodev);
+	}
+
 	if (written_bytes > buf_writable(a2dpio->pcm_buf))
 		return -EINVAL;
 
@@ -3,9 +3,13 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include <webrtc-apm/webrtc_apm.h>
 
@@ -13,9 +17,12 @@
 #include "cras_apm_list.h"
 #include "cras_audio_area.h"
 #include "cras_audio_format.h"
+#include "cras_config.h"
 #include "cras_dsp_pipeline.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_system_state.h"
+#include "cras_util.h"
 #include "dsp_util.h"
 #include "dumper.h"
 #include "float_buffer.h"
@@ -27,6 +34,70 @@ static const unsigned int MAX_INI_NAME_LEN = 63;
 #define AEC_CONFIG_NAME "aec.ini"
 #define APM_CONFIG_NAME "apm.ini"
 
+/* Number of 10ms blocks each ring between an audio thread and the APM worker
+ * holds. */
+#define APM_WORKER_BLOCKS 4
+/* Number of blocks the processed output lags behind the input when APM runs
+ * in the worker, giving the worker one block period for each block. */
+#define APM_WORKER_LATENCY_BLOCKS 1
+
+/*
+ * Single producer single consumer ring of 10ms float blocks handed between an
+ * audio thread and the APM worker. The counters only increase, slots are
+ * indexed modulo APM_WORKER_BLOCKS.
+ *
+ * Members:
+ *    samples - Planar samples of all the slots.
+ *    channels - Channel pointers of all the slots, num_channels per slot.
+ *    num_channels - The number of channels of a block.
+ *    frames - The number of frames of a block.
+ *    rate - The sample rate of the blocks.
+ *    filled - Frames written to the block being filled, the one numbered
+ *        |queued|. Only used by the audio thread.
+ *    queued - Number of blocks queued, written by the audio thread.
+ *    retired - Number of processed blocks read back by the audio thread.
+ *        Only used for capture blocks, which go back to the audio thread.
+ *    done - Number of blocks processed, written by the worker.
+ */
+struct apm_block_ring {
+	float *samples;
+	float **channels;
+	unsigned int num_channels;
+	unsigned int frames;
+	unsigned int rate;
+	unsigned int filled;
+	unsigned int queued;
+	unsigned int retired;
+	unsigned int done __attribute__((aligned(64)));
+};
+
+/*
+ * Thread running the webrtc APM calls instead of the audio threads, so a slow
+ * block doesn't delay the other devices of an audio thread.
+ *
+ * Members:
+ *    thread - The worker thread.
+ *    fd - Eventfd written by the audio threads when they queue a block.
+ *    lock - Held by the worker while it runs, and by the main thread when it
+ *        changes the instance list. Audio threads never take it.
+ *    running - Cleared to stop the worker.
+ *    reverse - Reverse stream blocks for every instance doing echo
+ *        cancellation, the ring the worker reads. Only used by the worker.
+ *    reverse_next - A reverse ring the output audio thread configured that
+ *        the worker hasn't taken over yet, NULL if there is none.
+ *    reverse_dropped - Number of times reverse data was dropped because the
+ *        worker was behind.
+ */
+struct apm_worker {
+	pthread_t thread;
+	int fd;
+	pthread_mutex_t lock;
+	int running;
+	struct apm_block_ring *reverse;
+	struct apm_block_ring *reverse_next;
+	unsigned int reverse_dropped;
+};
+
 /*
  * Structure holding a WebRTC audio processing module and necessary
  * info to process and transfer input buffer from device to stream.
@@ -51,32 +122,81 @@ static const unsigned int MAX_INI_NAME_LEN = 63;
  *                     |
  *                     |------------------------------------> stream N
  *
+ * When APM sharing is enabled, streams requesting the same effects on the
+ * same device use a single instance. Only one of them, the feeder, passes
+ * device input to it, and each stream reads the processed data at its own
+ * offset. The other streams move through the device input in step with the
+ * feeder, so any of them can take over feeding without a gap. A stream that
+ * falls behind reading drops its oldest data once the buffer is full, as
+ * long as another stream has read it.
+ *
  * Members:
  *    apm_ptr - An APM instance from libwebrtc_audio_processing
  *    dev_ptr - Pointer to the device this APM is associated with.
+ *    effects - The effects bit map of the streams using this instance.
  *    buffer - Stores the processed/interleaved data ready for stream to read.
  *    fbuffer - Stores the floating pointer buffer from input device waiting
  *        for APM to process.
  *    dev_fmt - The format used by the iodev this APM attaches to.
  *    fmt - The audio data format configured for this APM.
- *    area - The cras_audio_area used for copying processed data to client
- *        stream.
+ *    dev_channel - For each channel of |fmt|, the index of the channel in
+ *        |dev_fmt| it is read from. -1 if the device doesn't have it.
  *    work_queue - A task queue instance created and destroyed by
  *        libwebrtc_apm.
  *    use_tuned_settings - True if this APM uses settings tuned specifically
  *        for this hardware in AEC use case. Otherwise it uses the generic
  *        settings like run inside browser.
+ *    feeder - The active cras_apm that passes input and reverse data to
+ *        this instance. NULL if no user is active.
+ *    fed - Frames of device input passed to this instance so far.
+ *    num_users - The number of cras_apm using this instance.
+ *    forward - Capture blocks processed by the APM worker. NULL if this
+ *        instance processes on the audio thread.
+ *    worker_rc - The last error of the worker processing this instance.
+ *    late_blocks - Number of times a processed block wasn't ready when the
+ *        audio thread wanted to read it.
+ *    waiting - Set while a late block hasn't been retired yet.
  */
-struct cras_apm {
+struct apm_instance {
 	webrtc_apm apm_ptr;
 	void *dev_ptr;
+	uint64_t effects;
 	struct byte_buffer *buffer;
 	struct float_buffer *fbuffer;
 	struct cras_audio_format dev_fmt;
 	struct cras_audio_format fmt;
-	struct cras_audio_area *area;
+	int dev_channel[CRAS_CH_MAX];
 	void *work_queue;
 	bool use_tuned_settings;
+	struct cras_apm *feeder;
+	unsigned int fed;
+	unsigned int num_users;
+	struct apm_block_ring *forward;
+	int worker_rc;
+	unsigned int late_blocks;
+	int waiting;
+	struct apm_instance *prev, *next;
+};
+
+/*
+ * The APM of a stream on one device.
+ *
+ * Members:
+ *    inst - The APM instance processing data for this stream.
+ *    dev_ptr - Pointer to the device this APM is associated with.
+ *    read_offset - Bytes of processed data in the buffer of inst this
+ *        stream has already read.
+ *    consumed - Frames of device input this stream has moved past, in step
+ *        with |fed| of inst once it caught up.
+ *    area - The cras_audio_area used for copying processed data to client
+ *        stream.
+ */
+struct cras_apm {
+	struct apm_instance *inst;
+	void *dev_ptr;
+	unsigned int read_offset;
+	unsigned int consumed;
+	struct cras_audio_area *area;
 	struct cras_apm *prev, *next;
 };
 
@@ -126,6 +246,8 @@ struct active_apm {
  *    dev_rate - The sample rate odev is opened for.
  *    process_reverse - Flag to indicate if there's APM has effect that
  *        needs to process reverse stream.
+ *    ring - The ring passing reverse data to the APM worker. NULL if there
+ *        is no worker.
  */
 struct cras_apm_reverse_module {
 	struct ext_dsp_module ext;
@@ -133,9 +255,17 @@ struct cras_apm_reverse_module {
 	struct cras_iodev *odev;
 	unsigned int dev_rate;
 	unsigned process_reverse;
+	struct apm_block_ring *ring;
 };
 
+static struct apm_instance *instances = NULL;
+static struct apm_worker *worker = NULL;
 static struct cras_apm_reverse_module *rmodule = NULL;
+/* Held by the audio threads while they use the active APMs, the instances
+ * and the reverse module. With per-device audio threads the capture device
+ * and the echo reference of a stream may run on different threads. Taken
+ * after a stream lock, never before. */
+static pthread_mutex_t apm_lock = PTHREAD_MUTEX_INITIALIZER;
 static const char *aec_config_dir = NULL;
 static char ini_name[MAX_INI_NAME_LEN + 1];
 static dictionary *aec_ini = NULL;
@@ -156,20 +286,341 @@ static void update_process_reverse_flag()
 	}
 }
 
+static void block_ring_destroy(struct apm_block_ring *ring)
+{
+	if (ring == NULL)
+		return;
+	free(ring->samples);
+	free(ring->channels);
+	free(ring);
+}
+
+static struct apm_block_ring *block_ring_create(unsigned int frames,
+						unsigned int num_channels,
+						unsigned int rate)
+{
+	struct apm_block_ring *ring;
+	unsigned int i;
+
+	ring = (struct apm_block_ring *)calloc(1, sizeof(*ring));
+	if (ring == NULL)
+		return NULL;
+	ring->samples = (float *)calloc(
+		APM_WORKER_BLOCKS * num_channels * frames, sizeof(float));
+	ring->channels = (float **)calloc(APM_WORKER_BLOCKS * num_channels,
+					  sizeof(float *));
+	if (ring->samples == NULL || ring->channels == NULL) {
+		block_ring_destroy(ring);
+		return NULL;
+	}
+	for (i = 0; i < APM_WORKER_BLOCKS * num_channels; i++)
+		ring->channels[i] = ring->samples + i * frames;
+	ring->num_channels = num_channels;
+	ring->frames = frames;
+	ring->rate = rate;
+	return ring;
+}
+
+/* Returns the channels of the block numbered |n| in |ring|. */
+static float *const *block_ring_slot(const struct apm_block_ring *ring,
+				     unsigned int n)
+{
+	return &ring->channels[(n % APM_WORKER_BLOCKS) * ring->num_channels];
+}
+
+/* Returns the number of frames that can be written to the block being filled
+ * in |ring|, 0 if the ring is full. |consumed| is the number of blocks whose
+ * slots are free again. */
+static unsigned int block_ring_writable(const struct apm_block_ring *ring,
+					unsigned int consumed)
+{
+	if (ring->queued - consumed == APM_WORKER_BLOCKS)
+		return 0;
+	return ring->frames - ring->filled;
+}
+
+/* Copies |frames| frames of |src| to the block being filled in |ring|, and
+ * queues the block to the worker once it is full. NULL channels in |src| are
+ * skipped. The caller checks block_ring_writable() first. */
+static void block_ring_write(struct apm_block_ring *ring, float *const *src,
+			     unsigned int frames)
+{
+	float *const *dst = block_ring_slot(ring, ring->queued);
+	unsigned int ch;
+
+	for (ch = 0; ch < ring->num_channels; ch++)
+		if (src[ch])
+			memcpy(dst[ch] + ring->filled, src[ch],
+			       frames * sizeof(float));
+
+	ring->filled += frames;
+	if (ring->filled < ring->frames)
+		return;
+
+	ring->filled = 0;
+	__atomic_store_n(&ring->queued, ring->queued + 1, __ATOMIC_RELEASE);
+	if (eventfd_write(worker->fd, 1) < 0)
+		syslog(LOG_ERR, "Failed to wake APM worker: %d", errno);
+}
+
+/* Runs the reverse blocks queued since the last run through every instance
+ * doing echo cancellation. Called with the worker lock held. */
+static void worker_run_reverse()
+{
+	struct apm_block_ring *ring;
+	struct apm_instance *inst;
+	float *const *block;
+
+	/* The output audio thread writes to a new ring once it reconfigures,
+	 * so the old one is only left to the worker. */
+	ring = __atomic_exchange_n(&worker->reverse_next, NULL,
+				   __ATOMIC_ACQUIRE);
+	if (ring) {
+		block_ring_destroy(worker->reverse);
+		worker->reverse = ring;
+	}
+
+	ring = worker->reverse;
+	if (ring == NULL)
+		return;
+
+	while (ring->done != __atomic_load_n(&ring->queued, __ATOMIC_ACQUIRE)) {
+		block = block_ring_slot(ring, ring->done);
+		DL_FOREACH (instances, inst) {
+			if (!(inst->effects & APM_ECHO_CANCELLATION) ||
+			    inst->feeder == NULL)
+				continue;
+			if (webrtc_apm_process_reverse_stream_f(
+				    inst->apm_ptr, ring->num_channels,
+				    ring->rate, block))
+				syslog(LOG_ERR, "APM process reverse err");
+		}
+		__atomic_store_n(&ring->done, ring->done + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/* Processes the capture blocks queued since the last run, in place. Called
+ * with the worker lock held. */
+static void worker_run_forward()
+{
+	struct apm_block_ring *ring;
+	struct apm_instance *inst;
+	int rc;
+
+	DL_FOREACH (instances, inst) {
+		ring = inst->forward;
+		if (ring == NULL)
+			continue;
+
+		while (ring->done !=
+		       __atomic_load_n(&ring->queued, __ATOMIC_ACQUIRE)) {
+			rc = webrtc_apm_process_stream_f(
+				inst->apm_ptr, ring->num_channels, ring->rate,
+				block_ring_slot(ring, ring->done));
+			if (rc) {
+				syslog(LOG_ERR, "APM process stream f err");
+				__atomic_store_n(&inst->worker_rc, rc,
+						 __ATOMIC_RELAXED);
+			}
+			__atomic_store_n(&ring->done, ring->done + 1,
+					 __ATOMIC_RELEASE);
+		}
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	eventfd_t count;
+
+	/* Processed blocks are due one block period after they are queued,
+	 * run at the priority of the audio threads to meet that. */
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+
+	while (1) {
+		if (eventfd_read(worker->fd, &count) < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "APM worker read err %d", errno);
+			break;
+		}
+		if (!__atomic_load_n(&worker->running, __ATOMIC_ACQUIRE))
+			break;
+
+		/* Reverse first, so echo cancellation sees the reference
+		 * before the capture it is mixed in. */
+		pthread_mutex_lock(&worker->lock);
+		worker_run_reverse();
+		worker_run_forward();
+		pthread_mutex_unlock(&worker->lock);
+	}
+	return NULL;
+}
+
+static int worker_start()
+{
+	int rc;
+
+	worker = (struct apm_worker *)calloc(1, sizeof(*worker));
+	if (worker == NULL)
+		return -ENOMEM;
+
+	worker->fd = eventfd(0, EFD_CLOEXEC);
+	if (worker->fd < 0) {
+		rc = -errno;
+		goto free_worker;
+	}
+	pthread_mutex_init(&worker->lock, NULL);
+	worker->running = 1;
+
+	rc = pthread_create(&worker->thread, NULL, worker_thread, NULL);
+	if (rc) {
+		rc = -rc;
+		goto destroy_lock;
+	}
+	return 0;
+
+destroy_lock:
+	pthread_mutex_destroy(&worker->lock);
+	close(worker->fd);
+free_worker:
+	free(worker);
+	worker = NULL;
+	return rc;
+}
+
+static void worker_stop()
+{
+	if (worker == NULL)
+		return;
+
+	__atomic_store_n(&worker->running, 0, __ATOMIC_RELEASE);
+	if (eventfd_write(worker->fd, 1) < 0)
+		syslog(LOG_ERR, "Failed to stop APM worker: %d", errno);
+	pthread_join(worker->thread, NULL);
+
+	if (worker->reverse_dropped)
+		syslog(LOG_WARNING, "APM worker dropped reverse data %u times",
+		       worker->reverse_dropped);
+	pthread_mutex_destroy(&worker->lock);
+	close(worker->fd);
+	block_ring_destroy(worker->reverse);
+	block_ring_destroy(worker->reverse_next);
+	free(worker);
+	worker = NULL;
+}
+
+/* The instance list and the user counts are only changed on the main thread.
+ * The worker walks the list too, so changes hold its lock. */
+static void instances_lock()
+{
+	if (worker)
+		pthread_mutex_lock(&worker->lock);
+}
+
+static void instances_unlock()
+{
+	if (worker)
+		pthread_mutex_unlock(&worker->lock);
+}
+
+/* Drops a user of |inst| and destroys it when it was the last one. */
+static void instance_put(struct apm_instance *inst)
+{
+	if (--inst->num_users)
+		return;
+
+	instances_lock();
+	DL_DELETE(instances, inst);
+	instances_unlock();
+
+	if (inst->late_blocks)
+		syslog(LOG_WARNING, "APM worker was late for %u blocks",
+		       inst->late_blocks);
+	block_ring_destroy(inst->forward);
+	byte_buffer_destroy(&inst->buffer);
+	float_buffer_destroy(&inst->fbuffer);
+
+	/* Any unfinished AEC dump handle will be closed. */
+	webrtc_apm_destroy(inst->apm_ptr);
+	free(inst);
+}
+
 static void apm_destroy(struct cras_apm **apm)
 {
 	if (*apm == NULL)
 		return;
-	byte_buffer_destroy(&(*apm)->buffer);
-	float_buffer_destroy(&(*apm)->fbuffer);
+	if ((*apm)->inst->feeder == *apm)
+		(*apm)->inst->feeder = NULL;
 	cras_audio_area_destroy((*apm)->area);
-
-	/* Any unfinished AEC dump handle will be closed. */
-	webrtc_apm_destroy((*apm)->apm_ptr);
+	instance_put((*apm)->inst);
 	free(*apm);
 	*apm = NULL;
 }
 
+/* Returns the first active user of |inst|, or NULL if there is none. */
+static struct cras_apm *first_active_user(struct apm_instance *inst)
+{
+	struct active_apm *active;
+
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == inst)
+			return active->apm;
+	}
+	return NULL;
+}
+
+/* Frees the processed data of |inst| that |apm| and every other active user
+ * have read. Pass NULL as |apm| when it is no longer reading. */
+static void release_processed(struct apm_instance *inst, struct cras_apm *apm)
+{
+	struct active_apm *active;
+	unsigned int read;
+
+	read = apm ? apm->read_offset : buf_queued(inst->buffer);
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == inst && active->apm != apm)
+			read = MIN(read, active->apm->read_offset);
+	}
+	if (read == 0)
+		return;
+
+	buf_increment_read(inst->buffer, read);
+	if (apm)
+		apm->read_offset -= read;
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == inst && active->apm != apm)
+			active->apm->read_offset -= read;
+	}
+}
+
+/* Makes room for |bytes| of processed data in the buffer of |inst|. When it
+ * is full but one user has read enough of it, the users behind drop their
+ * oldest data so a slow reader doesn't stall the others. Returns whether
+ * there is room. */
+static int make_room(struct apm_instance *inst, unsigned int bytes)
+{
+	struct active_apm *active;
+	unsigned int needed, most = 0;
+
+	if (buf_available(inst->buffer) >= bytes)
+		return 1;
+
+	needed = bytes - buf_available(inst->buffer);
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == inst)
+			most = MAX(most, active->apm->read_offset);
+	}
+	if (most < needed)
+		return 0;
+
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == inst &&
+		    active->apm->read_offset < needed)
+			active->apm->read_offset = needed;
+	}
+	release_processed(inst, NULL);
+	return buf_available(inst->buffer) >= bytes;
+}
+
 struct cras_apm_list *cras_apm_list_create(void *stream_ptr, uint64_t effects)
 {
 	struct cras_apm_list *list;
@@ -203,7 +654,11 @@ static struct active_apm *get_active_apm(void *stream_ptr, void *dev_ptr)
 
 struct cras_apm *cras_apm_list_get_active_apm(void *stream_ptr, void *dev_ptr)
 {
-	struct active_apm *active = get_active_apm(stream_ptr, dev_ptr);
+	struct active_apm *active;
+
+	pthread_mutex_lock(&apm_lock);
+	active = get_active_apm(stream_ptr, dev_ptr);
+	pthread_mutex_unlock(&apm_lock);
 	return active ? active->apm : NULL;
 }
 
@@ -266,12 +721,116 @@ static void get_best_channels(struct cras_audio_format *apm_fmt)
 		apm_fmt->channel_layout[ch] = layout[ch];
 }
 
+static int apm_format_equal(const struct cras_audio_format *a,
+			    const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
+
+/* Finds an instance the stream can share, configured the same way it would
+ * configure a new one. */
+static struct apm_instance *
+find_instance(void *dev_ptr, uint64_t effects,
+	      const struct cras_audio_format *dev_fmt, bool use_tuned_settings)
+{
+	struct apm_instance *inst;
+
+	DL_FOREACH (instances, inst) {
+		if (inst->dev_ptr == dev_ptr && inst->effects == effects &&
+		    inst->use_tuned_settings == use_tuned_settings &&
+		    apm_format_equal(&inst->dev_fmt, dev_fmt))
+			return inst;
+	}
+	return NULL;
+}
+
+static struct apm_instance *
+instance_create(void *dev_ptr, uint64_t effects,
+		const struct cras_audio_format *dev_fmt,
+		bool use_tuned_settings)
+{
+	struct apm_instance *inst;
+	int ch, i;
+
+	inst = (struct apm_instance *)calloc(1, sizeof(*inst));
+
+	/* Configures APM to the format used by input device. If the channel
+	 * count is larger than stereo, use the standard channel count/layout
+	 * in APM. */
+	inst->dev_fmt = *dev_fmt;
+	inst->fmt = *dev_fmt;
+	get_best_channels(&inst->fmt);
+
+	/* Look up once which device channel feeds each APM channel. */
+	for (i = 0; i < CRAS_CH_MAX; i++)
+		inst->dev_channel[i] = -1;
+	for (ch = CRAS_CH_MAX - 1; ch >= 0; ch--) {
+		i = inst->fmt.channel_layout[ch];
+		if (i >= 0 && i < CRAS_CH_MAX)
+			inst->dev_channel[i] = inst->dev_fmt.channel_layout[ch];
+	}
+
+	/* Use the configs tuned specifically for internal device. Otherwise
+	 * just pass NULL so every other settings will be default. */
+	inst->use_tuned_settings = use_tuned_settings;
+	inst->apm_ptr =
+		use_tuned_settings ?
+			webrtc_apm_create(inst->fmt.num_channels,
+					  inst->fmt.frame_rate, aec_ini,
+					  apm_ini) :
+			webrtc_apm_create(inst->fmt.num_channels,
+					  inst->fmt.frame_rate, NULL, NULL);
+	if (inst->apm_ptr == NULL) {
+		syslog(LOG_ERR,
+		       "Fail to create webrtc apm for ch %zu"
+		       " rate %zu effect %" PRIu64,
+		       dev_fmt->num_channels, dev_fmt->frame_rate, effects);
+		free(inst);
+		return NULL;
+	}
+
+	inst->dev_ptr = dev_ptr;
+	inst->effects = effects;
+	inst->work_queue = NULL;
+	inst->num_users = 1;
+
+	if (worker) {
+		inst->forward = block_ring_create(10 * inst->fmt.frame_rate /
+							  1000,
+						  inst->fmt.num_channels,
+						  inst->fmt.frame_rate);
+		if (inst->forward == NULL)
+			syslog(LOG_ERR, "No memory for APM worker blocks, "
+					"processing on the audio thread");
+	}
+
+	/* WebRTC APM wants 10 ms equivalence of data to process. The worker
+	 * may hand back every block of its ring at once after a late one, and
+	 * the streams sharing the instance may read a few blocks apart. */
+	inst->buffer = byte_buffer_create(APM_WORKER_BLOCKS * 10 *
+					  inst->fmt.frame_rate / 1000 *
+					  cras_get_format_bytes(&inst->fmt));
+	inst->fbuffer = float_buffer_create(10 * inst->fmt.frame_rate / 1000,
+					    inst->fmt.num_channels);
+
+	instances_lock();
+	DL_APPEND(instances, inst);
+	instances_unlock();
+
+	return inst;
+}
+
 struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
 				       void *dev_ptr,
 				       const struct cras_audio_format *dev_fmt,
 				       bool is_aec_use_case)
 {
+	struct apm_instance *inst = NULL;
 	struct cras_apm *apm;
+	bool use_tuned_settings;
 
 	DL_FOREACH (list->apms, apm)
 		if (apm->dev_ptr == dev_ptr)
@@ -281,69 +840,44 @@ struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
 	if (!(list->effects & APM_ECHO_CANCELLATION))
 		return NULL;
 
-	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
-
-	/* Configures APM to the format used by input device. If the channel
-	 * count is larger than stereo, use the standard channel count/layout
-	 * in APM. */
-	apm->dev_fmt = *dev_fmt;
-	apm->fmt = *dev_fmt;
-	get_best_channels(&apm->fmt);
-
 	/* Use tuned settings only when the forward dev(capture) and reverse
 	 * dev(playback) both are in typical AEC use case. */
-	apm->use_tuned_settings = is_aec_use_case;
+	use_tuned_settings = is_aec_use_case;
 	if (rmodule->odev) {
-		apm->use_tuned_settings &=
+		use_tuned_settings &=
 			cras_iodev_is_aec_use_case(rmodule->odev->active_node);
 	}
 
-	/* Use the configs tuned specifically for internal device. Otherwise
-	 * just pass NULL so every other settings will be default. */
-	apm->apm_ptr =
-		apm->use_tuned_settings ?
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, aec_ini,
-					  apm_ini) :
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, NULL, NULL);
-	if (apm->apm_ptr == NULL) {
-		syslog(LOG_ERR,
-		       "Fail to create webrtc apm for ch %zu"
-		       " rate %zu effect %" PRIu64,
-		       dev_fmt->num_channels, dev_fmt->frame_rate,
-		       list->effects);
-		free(apm);
-		return NULL;
+	if (cras_system_get_apm_sharing_enabled())
+		inst = find_instance(dev_ptr, list->effects, dev_fmt,
+				     use_tuned_settings);
+	if (inst) {
+		inst->num_users++;
+	} else {
+		inst = instance_create(dev_ptr, list->effects, dev_fmt,
+				       use_tuned_settings);
+		if (inst == NULL)
+			return NULL;
 	}
 
+	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
+	apm->inst = inst;
 	apm->dev_ptr = dev_ptr;
-	apm->work_queue = NULL;
-
-	/* WebRTC APM wants 10 ms equivalence of data to process. */
-	apm->buffer = byte_buffer_create(10 * apm->fmt.frame_rate / 1000 *
-					 cras_get_format_bytes(&apm->fmt));
-	apm->fbuffer = float_buffer_create(10 * apm->fmt.frame_rate / 1000,
-					   apm->fmt.num_channels);
-	apm->area = cras_audio_area_create(apm->fmt.num_channels);
-	cras_audio_area_config_channels(apm->area, &apm->fmt);
+	apm->area = cras_audio_area_create(inst->fmt.num_channels);
+	cras_audio_area_config_channels(apm->area, &inst->fmt);
 
 	DL_APPEND(list->apms, apm);
 
 	return apm;
 }
 
-void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
+static void start_apm(struct cras_apm_list *list, void *dev_ptr)
 {
 	struct active_apm *active;
 	struct cras_apm *apm;
 
-	if (list == NULL)
-		return;
-
 	/* Check if this apm has already been started. */
-	apm = cras_apm_list_get_active_apm(list->stream_ptr, dev_ptr);
-	if (apm)
+	if (get_active_apm(list->stream_ptr, dev_ptr))
 		return;
 
 	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
@@ -360,9 +894,24 @@ void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
 	active->effects = list->effects;
 	DL_APPEND(active_apms, active);
 
+	apm->read_offset = 0;
+	apm->consumed = apm->inst->fed;
+	if (apm->inst->feeder == NULL)
+		apm->inst->feeder = apm;
+
 	update_process_reverse_flag();
 }
 
+void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
+{
+	if (list == NULL)
+		return;
+
+	pthread_mutex_lock(&apm_lock);
+	start_apm(list, dev_ptr);
+	pthread_mutex_unlock(&apm_lock);
+}
+
 void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr)
 {
 	struct active_apm *active;
@@ -370,13 +919,22 @@ void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr)
 	if (list == NULL)
 		return;
 
+	pthread_mutex_lock(&apm_lock);
 	active = get_active_apm(list->stream_ptr, dev_ptr);
 	if (active) {
+		struct cras_apm *apm = active->apm;
+
 		DL_DELETE(active_apms, active);
 		free(active);
+
+		/* Hand the instance over to another stream using it. */
+		if (apm->inst->feeder == apm)
+			apm->inst->feeder = first_active_user(apm->inst);
+		release_processed(apm->inst, NULL);
 	}
 
 	update_process_reverse_flag();
+	pthread_mutex_unlock(&apm_lock);
 }
 
 int cras_apm_list_destroy(struct cras_apm_list *list)
@@ -462,69 +1020,140 @@ static void handle_device_disabled(struct cras_iodev *iodev, void *cb_data)
 	update_first_output_dev_to_process();
 }
 
-static int process_reverse(struct float_buffer *fbuf, unsigned int frame_rate)
+/* Passes one 10ms block of reverse data to the APMs doing echo cancellation.
+ * Args:
+ *    data - The channels of the block. webrtc may modify them in place, so
+ *        they must not be the playback output.
+ *    num_channels - The number of channels in |data|.
+ *    frame_rate - The sample rate of the output device.
+ */
+static int process_reverse(float *const *data, unsigned int num_channels,
+			   unsigned int frame_rate)
 {
 	struct active_apm *active;
 	int ret;
-	float *const *wp;
-
-	if (float_buffer_writable(fbuf))
-		return 0;
-
-	wp = float_buffer_write_pointer(fbuf);
 
 	DL_FOREACH (active_apms, active) {
 		if (!(active->effects & APM_ECHO_CANCELLATION))
 			continue;
 
-		ret = webrtc_apm_process_reverse_stream_f(active->apm->apm_ptr,
-							  fbuf->num_channels,
-							  frame_rate, wp);
+		/* A shared instance analyzes the reverse stream once. */
+		if (active->apm->inst->feeder != active->apm)
+			continue;
+
+		ret = webrtc_apm_process_reverse_stream_f(
+			active->apm->inst->apm_ptr, num_channels, frame_rate,
+			data);
 		if (ret) {
 			syslog(LOG_ERR, "APM process reverse err");
 			return ret;
 		}
 	}
-	float_buffer_reset(fbuf);
 	return 0;
 }
 
-void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
+/* Copies the output of the DSP run to the reverse ring of the APM worker.
+ * Data that doesn't fit in the ring is dropped. */
+static void reverse_data_to_worker(struct ext_dsp_module *ext,
+				   unsigned int nframes)
+{
+	struct apm_block_ring *ring = rmodule->ring;
+	float *src[MAX_EXT_DSP_PORTS];
+	unsigned int consumed, writable, offset = 0;
+	unsigned int i;
+
+	if (ring == NULL || active_apms == NULL)
+		return;
+
+	while (nframes) {
+		consumed = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+		writable = block_ring_writable(ring, consumed);
+		if (writable == 0) {
+			/* Start the next block over rather than join the
+			 * partial one to data after the gap. */
+			ring->filled = 0;
+			worker->reverse_dropped++;
+			return;
+		}
+		writable = MIN(nframes, writable);
+		for (i = 0; i < ring->num_channels; i++)
+			src[i] = ext->ports[i] + offset;
+		block_ring_write(ring, src, writable);
+
+		offset += writable;
+		nframes -= writable;
+	}
+}
+
+static void reverse_run(struct ext_dsp_module *ext, unsigned int nframes)
 {
 	struct cras_apm_reverse_module *rmod =
 		(struct cras_apm_reverse_module *)ext;
-	unsigned int writable;
+	struct float_buffer *fbuf = rmod->fbuf;
+	unsigned int writable, nread;
 	int i, offset = 0;
 	float *const *wp;
+	float *const *rp;
 
 	if (!rmod->process_reverse)
 		return;
 
+	if (worker) {
+		reverse_data_to_worker(ext, nframes);
+		return;
+	}
+
+	/* webrtc processes the reverse stream in place, so the DSP output
+	 * that is played is copied to |fbuf| first. */
 	while (nframes) {
-		process_reverse(rmod->fbuf, rmod->dev_rate);
-		writable = float_buffer_writable(rmod->fbuf);
+		writable = float_buffer_writable(fbuf);
 		writable = MIN(nframes, writable);
-		wp = float_buffer_write_pointer(rmod->fbuf);
-		for (i = 0; i < rmod->fbuf->num_channels; i++)
+		wp = float_buffer_write_pointer(fbuf);
+		for (i = 0; i < fbuf->num_channels; i++)
 			memcpy(wp[i], ext->ports[i] + offset,
 			       writable * sizeof(float));
 
 		offset += writable;
-		float_buffer_written(rmod->fbuf, writable);
+		float_buffer_written(fbuf, writable);
 		nframes -= writable;
+
+		if (float_buffer_writable(fbuf))
+			continue;
+		nread = float_buffer_level(fbuf);
+		rp = float_buffer_read_pointer(fbuf, 0, &nread);
+		process_reverse(rp, fbuf->num_channels, rmod->dev_rate);
+		float_buffer_reset(fbuf);
 	}
 }
 
+void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
+{
+	pthread_mutex_lock(&apm_lock);
+	reverse_run(ext, nframes);
+	pthread_mutex_unlock(&apm_lock);
+}
+
 void reverse_data_configure(struct ext_dsp_module *ext,
 			    unsigned int buffer_size, unsigned int num_channels,
 			    unsigned int rate)
 {
 	struct cras_apm_reverse_module *rmod =
 		(struct cras_apm_reverse_module *)ext;
+
+	pthread_mutex_lock(&apm_lock);
 	if (rmod->fbuf)
 		float_buffer_destroy(&rmod->fbuf);
 	rmod->fbuf = float_buffer_create(rate / 100, num_channels);
 	rmod->dev_rate = rate;
+
+	/* Hands the new ring to the worker without waiting for it. A ring
+	 * the worker hasn't taken over yet was never read, free it here. */
+	if (worker) {
+		rmod->ring = block_ring_create(rate / 100, num_channels, rate);
+		block_ring_destroy(__atomic_exchange_n(
+			&worker->reverse_next, rmod->ring, __ATOMIC_RELEASE));
+	}
+	pthread_mutex_unlock(&apm_lock);
 }
 
 static void get_aec_ini(const char *config_dir)
@@ -560,12 +1189,18 @@ static void get_apm_ini(const char *config_dir)
 int cras_apm_list_init(const char *device_config_dir)
 {
 	if (rmodule == NULL) {
+		cras_pi_mutex_init(&apm_lock);
 		rmodule = (struct cras_apm_reverse_module *)calloc(
 			1, sizeof(*rmodule));
 		rmodule->ext.run = reverse_data_run;
 		rmodule->ext.configure = reverse_data_configure;
 	}
 
+	if (worker == NULL && cras_system_get_apm_worker_enabled() &&
+	    worker_start())
+		syslog(LOG_ERR, "Failed to start APM worker, processing on "
+				"the audio thread");
+
 	aec_config_dir = device_config_dir;
 	get_aec_ini(aec_config_dir);
 	get_apm_ini(aec_config_dir);
@@ -591,7 +1226,9 @@ void cras_apm_list_reload_aec_config()
 
 int cras_apm_list_deinit()
 {
+	worker_stop();
 	if (rmodule) {
+		rmodule->ring = NULL;
 		if (rmodule->fbuf)
 			float_buffer_destroy(&rmodule->fbuf);
 		free(rmodule);
@@ -600,11 +1237,57 @@ int cras_apm_list_deinit()
 	return 0;
 }
 
-int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
-			  unsigned int offset)
+/* Moves the blocks processed before the last APM_WORKER_LATENCY_BLOCKS
+ * queued ones to the buffer streams read from. After a late block, all the
+ * blocks held back behind it move at once, so the output gets back to
+ * APM_WORKER_LATENCY_BLOCKS behind the input. A block the worker hasn't
+ * finished yet isn't skipped, it is retired by a later call once done. */
+static void retire_from_worker(struct apm_instance *inst)
+{
+	struct apm_block_ring *ring = inst->forward;
+	unsigned int block_bytes =
+		ring->frames * cras_get_format_bytes(&inst->fmt);
+	unsigned int done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+
+	while (ring->queued - ring->retired > APM_WORKER_LATENCY_BLOCKS) {
+		if (ring->retired == done) {
+			if (!inst->waiting)
+				inst->late_blocks++;
+			inst->waiting = 1;
+			return;
+		}
+		if (!make_room(inst, block_bytes))
+			return;
+		inst->waiting = 0;
+
+		dsp_util_interleave(block_ring_slot(ring, ring->retired),
+				    buf_write_pointer(inst->buffer),
+				    ring->num_channels, inst->fmt.format,
+				    ring->frames);
+		buf_increment_write(inst->buffer, block_bytes);
+		ring->retired++;
+	}
+}
+
+/* Points |src| at the channels of |rp| each APM channel of |inst| reads,
+ * NULL for the ones the device doesn't have. */
+static void map_dev_channels(const struct apm_instance *inst,
+			     float *const *rp, float **src)
+{
+	int i;
+
+	for (i = 0; i < inst->fmt.num_channels; i++)
+		src[i] = inst->dev_channel[i] < 0 ? NULL :
+						    rp[inst->dev_channel[i]];
+}
+
+static int process_apm(struct cras_apm *apm, struct float_buffer *input,
+		       unsigned int offset)
 {
-	unsigned int writable, nframes, nread;
-	int ch, i, j, ret;
+	struct apm_instance *inst = apm->inst;
+	unsigned int writable, nframes, nread, skip;
+	float *src[CRAS_CH_MAX];
+	int i, ret;
 	float *const *wp;
 	float *const *rp;
 
@@ -614,91 +1297,146 @@ int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 		return -EINVAL;
 	}
 
-	writable = float_buffer_writable(apm->fbuffer);
+	/* Only the feeder passes input to a shared instance. The other users
+	 * skip what it has passed, and a new feeder first catches up to it. */
+	skip = MIN(inst->fed - apm->consumed, nread - offset);
+	apm->consumed += skip;
+	offset += skip;
+	if (inst->feeder && inst->feeder != apm)
+		return skip;
+
+	/* The worker processes the blocks in its ring, the input goes
+	 * there directly. */
+	if (inst->forward) {
+		ret = __atomic_load_n(&inst->worker_rc, __ATOMIC_RELAXED);
+		if (ret)
+			return ret;
+
+		writable = block_ring_writable(inst->forward,
+					       inst->forward->retired);
+		writable = MIN(nread - offset, writable);
+		for (nframes = writable; nframes; nframes -= nread) {
+			nread = nframes;
+			rp = float_buffer_read_pointer(input, offset, &nread);
+			map_dev_channels(inst, rp, src);
+			block_ring_write(inst->forward, src, nread);
+			offset += nread;
+		}
+		inst->fed += writable;
+		apm->consumed += writable;
+		retire_from_worker(inst);
+		return skip + writable;
+	}
+
+	/* webrtc processes in place, so the input shared with the other
+	 * streams on the device is copied out. */
+	writable = float_buffer_writable(inst->fbuffer);
 	writable = MIN(nread - offset, writable);
 
 	nframes = writable;
 	while (nframes) {
 		nread = nframes;
-		wp = float_buffer_write_pointer(apm->fbuffer);
+		wp = float_buffer_write_pointer(inst->fbuffer);
 		rp = float_buffer_read_pointer(input, offset, &nread);
+		map_dev_channels(inst, rp, src);
 
-		for (i = 0; i < apm->fbuffer->num_channels; i++) {
-			/* Look up the channel position and copy from
-			 * the correct index of |input| buffer.
-			 */
-			for (ch = 0; ch < CRAS_CH_MAX; ch++)
-				if (apm->fmt.channel_layout[ch] == i)
-					break;
-			if (ch == CRAS_CH_MAX)
-				continue;
-
-			j = apm->dev_fmt.channel_layout[ch];
-			if (j == -1)
-				continue;
-
-			memcpy(wp[i], rp[j], nread * sizeof(float));
-		}
+		for (i = 0; i < inst->fbuffer->num_channels; i++)
+			if (src[i])
+				memcpy(wp[i], src[i], nread * sizeof(float));
 
 		nframes -= nread;
 		offset += nread;
 
-		float_buffer_written(apm->fbuffer, nread);
+		float_buffer_written(inst->fbuffer, nread);
 	}
 
+	inst->fed += writable;
+	apm->consumed += writable;
+
 	/* process and move to int buffer */
-	if ((float_buffer_writable(apm->fbuffer) == 0) &&
-	    (buf_queued(apm->buffer) == 0)) {
-		nread = float_buffer_level(apm->fbuffer);
-		rp = float_buffer_read_pointer(apm->fbuffer, 0, &nread);
-		ret = webrtc_apm_process_stream_f(apm->apm_ptr,
-						  apm->fmt.num_channels,
-						  apm->fmt.frame_rate, rp);
+	if ((float_buffer_writable(inst->fbuffer) == 0) &&
+	    make_room(inst, float_buffer_level(inst->fbuffer) *
+				    cras_get_format_bytes(&inst->fmt))) {
+		nread = float_buffer_level(inst->fbuffer);
+		rp = float_buffer_read_pointer(inst->fbuffer, 0, &nread);
+		ret = webrtc_apm_process_stream_f(inst->apm_ptr,
+						  inst->fmt.num_channels,
+						  inst->fmt.frame_rate, rp);
 		if (ret) {
 			syslog(LOG_ERR, "APM process stream f err");
 			return ret;
 		}
 
-		dsp_util_interleave(rp, buf_write_pointer(apm->buffer),
-				    apm->fbuffer->num_channels, apm->fmt.format,
-				    nread);
-		buf_increment_write(apm->buffer,
-				    nread * cras_get_format_bytes(&apm->fmt));
-		float_buffer_reset(apm->fbuffer);
+		dsp_util_interleave(rp, buf_write_pointer(inst->buffer),
+				    inst->fbuffer->num_channels,
+				    inst->fmt.format, nread);
+		buf_increment_write(inst->buffer,
+				    nread * cras_get_format_bytes(&inst->fmt));
+		float_buffer_reset(inst->fbuffer);
 	}
 
-	return writable;
+	return skip + writable;
 }
 
-struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm)
+int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
+			  unsigned int offset)
 {
-	uint8_t *buf_ptr;
+	int rc;
 
-	buf_ptr = buf_read_pointer_size(apm->buffer, &apm->area->frames);
-	apm->area->frames /= cras_get_format_bytes(&apm->fmt);
-	cras_audio_area_config_buf_pointers(apm->area, &apm->fmt, buf_ptr);
+	pthread_mutex_lock(&apm_lock);
+	rc = process_apm(apm, input, offset);
+	pthread_mutex_unlock(&apm_lock);
+	return rc;
+}
+
+struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm)
+{
+	struct apm_instance *inst = apm->inst;
+	struct byte_buffer *buf = inst->buffer;
+	unsigned int pos, readable;
+
+	/* The data after |read_offset| may wrap around the end of the
+	 * buffer, return the part up to the end. */
+	pthread_mutex_lock(&apm_lock);
+	pos = (buf->read_idx + apm->read_offset) % buf->used_size;
+	readable = MIN(buf_queued(buf) - apm->read_offset,
+		       buf->used_size - pos);
+	apm->area->frames = readable / cras_get_format_bytes(&inst->fmt);
+	cras_audio_area_config_buf_pointers(apm->area, &inst->fmt,
+					    buf->bytes + pos);
+	pthread_mutex_unlock(&apm_lock);
 	return apm->area;
 }
 
 void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames)
 {
-	buf_increment_read(apm->buffer,
-			   frames * cras_get_format_bytes(&apm->fmt));
+	pthread_mutex_lock(&apm_lock);
+	apm->read_offset += frames * cras_get_format_bytes(&apm->inst->fmt);
+	release_processed(apm->inst, apm);
+	pthread_mutex_unlock(&apm_lock);
+}
+
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm)
+{
+	if (apm->inst->forward == NULL)
+		return 0;
+	return APM_WORKER_LATENCY_BLOCKS * apm->inst->forward->frames;
 }
 
 struct cras_audio_format *cras_apm_list_get_format(struct cras_apm *apm)
 {
-	return &apm->fmt;
+	return &apm->inst->fmt;
 }
 
 bool cras_apm_list_get_use_tuned_settings(struct cras_apm *apm)
 {
-	return apm->use_tuned_settings;
+	return apm->inst->use_tuned_settings;
 }
 
 void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
 				int start, int fd)
 {
+	struct apm_instance *inst;
 	struct cras_apm *apm;
 	char file_name[256];
 	int rc;
@@ -707,6 +1445,7 @@ void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
 	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
 	if (apm == NULL)
 		return;
+	inst = apm->inst;
 
 	if (start) {
 		handle = fdopen(fd, "w");
@@ -716,13 +1455,13 @@ void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
 			return;
 		}
 		/* webrtc apm will own the FILE handle and close it. */
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, start,
+		rc = webrtc_apm_aec_dump(inst->apm_ptr, &inst->work_queue, start,
 					 handle);
 		if (rc)
 			syslog(LOG_ERR, "Fail to dump debug file %s, rc %d",
 			       file_name, rc);
 	} else {
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, 0,
+		rc = webrtc_apm_aec_dump(inst->apm_ptr, &inst->work_queue, 0,
 					 NULL);
 		if (rc)
 			syslog(LOG_ERR, "Failed to stop apm debug, rc %d", rc);
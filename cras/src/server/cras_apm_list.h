@@ -55,7 +55,9 @@ struct cras_apm_list *cras_apm_list_create(void *stream_ptr, uint64_t effects);
 /*
  * Creates a cras_apm associated to given dev_ptr and adds it to the list.
  * If there already exists an APM instance linked to dev_ptr, we assume
- * the open format is unchanged so just return it. This should be called
+ * the open format is unchanged so just return it. When APM sharing is
+ * enabled, the new cras_apm reuses the webrtc APM of another stream with the
+ * same effects and format on dev_ptr if there is one. This should be called
  * in main thread.
  * Args:
  *    list - The list holding APM instances.
@@ -143,6 +145,16 @@ void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames);
  */
 struct cras_audio_format *cras_apm_list_get_format(struct cras_apm *apm);
 
+/* Gets the latency the APM adds to the processed data. Non zero only when
+ * the processing runs on the APM worker thread, which hands back each 10ms
+ * block a fixed number of blocks after it was passed in.
+ * Args:
+ *    apm - The cras_apm instance processing the data.
+ * Returns:
+ *    The delay in frames of the format returned by cras_apm_list_get_format.
+ */
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm);
+
 /*
  * Gets if this apm instance is using tuned settings.
  */
@@ -233,6 +245,11 @@ cras_apm_list_get_format(struct cras_apm *apm)
 	return NULL;
 }
 
+static inline unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm)
+{
+	return 0;
+}
+
 static inline bool cras_apm_list_get_use_tuned_settings(struct cras_apm *apm)
 {
 	return 0;
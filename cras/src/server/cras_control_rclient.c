@@ -2,9 +2,11 @@
  * Use of this source code is governed by a BSD-style license that can be
  * found in the LICENSE file.
  */
+
 #include <assert.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "audio_thread.h"
 #include "audio_thread_log.h"
@@ -49,6 +51,31 @@ static void get_atlog_fd(struct cras_rclient *client)
 	client->ops->send_message_to_client(client, &msg.header, &atlog_fd, 1);
 }
 
+/* Starts or stops the atlog trace of the client. The ring fd is sent back
+ * when a trace starts. */
+static void set_atlog_trace(struct cras_rclient *client,
+			    unsigned int num_events)
+{
+	struct cras_client_atlog_trace_ready msg;
+	int fd;
+
+	if (num_events == 0) {
+		audio_thread_event_log_stop_trace(client);
+		return;
+	}
+
+	fd = audio_thread_event_log_start_trace(client, num_events);
+	if (fd < 0) {
+		cras_fill_client_atlog_trace_ready(&msg, fd);
+		client->ops->send_message_to_client(client, &msg.header, NULL,
+						    0);
+		return;
+	}
+	cras_fill_client_atlog_trace_ready(&msg, 0);
+	client->ops->send_message_to_client(client, &msg.header, &fd, 1);
+	close(fd);
+}
+
 /* Handles dumping audio snapshots to shared memory for the client. */
 static void dump_audio_thread_snapshots(struct cras_rclient *client)
 {
@@ -401,6 +428,14 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_GET_ATLOG_FD:
 		get_atlog_fd(client);
 		break;
+	case CRAS_SERVER_SET_ATLOG_TRACE: {
+		const struct cras_set_atlog_trace *m =
+			(const struct cras_set_atlog_trace *)msg;
+		if (!MSG_LEN_VALID(msg, struct cras_set_atlog_trace))
+			return -EINVAL;
+		set_atlog_trace(client, m->num_events);
+		break;
+	}
 	case CRAS_SERVER_DUMP_BT: {
 		struct cras_client_audio_debug_info_ready msg;
 		struct cras_server_state *state;
@@ -515,11 +550,18 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	return 0;
 }
 
+/* Stops the atlog trace of the client, if any, before destroying it. */
+static void ccr_destroy(struct cras_rclient *client)
+{
+	audio_thread_event_log_stop_trace(client);
+	rclient_destroy(client);
+}
+
 /* Declarations of cras_rclient operators for cras_control_rclient. */
 static const struct cras_rclient_ops cras_control_rclient_ops = {
 	.handle_message_from_client = ccr_handle_message_from_client,
 	.send_message_to_client = rclient_send_message_to_client,
-	.destroy = rclient_destroy,
+	.destroy = ccr_destroy,
 };
 
 /*
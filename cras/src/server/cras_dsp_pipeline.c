@@ -3,7 +3,9 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <string.h>
 #include <sys/param.h>
 #include <syslog.h>
 
@@ -878,6 +880,53 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 	return 0;
 }
 
+int cras_dsp_pipeline_apply_float(struct pipeline *pipeline, float **planes,
+				  unsigned int num_channels,
+				  unsigned int frames)
+{
+	size_t offset;
+	size_t chunk;
+	size_t i;
+	float *source[num_channels];
+	float *sink[num_channels];
+	struct timespec begin, end, delta;
+
+	if (!pipeline || frames == 0)
+		return 0;
+
+	if ((unsigned int)pipeline->input_channels != num_channels ||
+	    (unsigned int)pipeline->output_channels != num_channels)
+		return -EINVAL;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+
+	for (i = 0; i < num_channels; i++) {
+		source[i] = cras_dsp_pipeline_get_source_buffer(pipeline, i);
+		sink[i] = cras_dsp_pipeline_get_sink_buffer(pipeline, i);
+	}
+
+	/* The samples are already float, only copy them in and out of the
+	 * pipeline buffers. */
+	for (offset = 0; offset < frames; offset += chunk) {
+		chunk = MIN(frames - offset, (size_t)DSP_BUFFER_SIZE);
+
+		for (i = 0; i < num_channels; i++)
+			memcpy(source[i], planes[i] + offset,
+			       chunk * sizeof(float));
+
+		cras_dsp_pipeline_run(pipeline, chunk);
+
+		for (i = 0; i < num_channels; i++)
+			memcpy(planes[i] + offset, sink[i],
+			       chunk * sizeof(float));
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	subtract_timespecs(&end, &begin, &delta);
+	cras_dsp_pipeline_add_statistic(pipeline, &delta, frames);
+	return 0;
+}
+
 void cras_dsp_pipeline_free(struct pipeline *pipeline)
 {
 	int i;
@@ -149,6 +149,20 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 			    snd_pcm_format_t format, unsigned int frames);
 
+/* Runs the specified pipeline across the given planar float buffers in place.
+ * The pipeline must have the same number of input and output channels.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    planes - One buffer of samples per channel.
+ *    num_channels - The number of buffers in planes.
+ *    frames - the number of samples in each buffer.
+ * Returns:
+ *    -EINVAL if the channel count doesn't match the pipeline, otherwise 0.
+ */
+int cras_dsp_pipeline_apply_float(struct pipeline *pipeline, float **planes,
+				  unsigned int num_channels,
+				  unsigned int frames);
+
 /* Dumps the current state of the pipeline. For debugging only */
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline);
 
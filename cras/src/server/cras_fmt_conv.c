@@ -3,7 +3,6 @@
  * found in the LICENSE file.
  */
 
-/* For now just use speex, can add more resamplers later. */
 #include <speex/speex_resampler.h>
 #include <sys/param.h>
 #include <syslog.h>
@@ -12,13 +11,12 @@
 
 #include "cras_fmt_conv.h"
 #include "cras_fmt_conv_ops.h"
+#include "cras_fmt_conv_pool.h"
 #include "cras_audio_format.h"
 #include "cras_util.h"
 #include "linear_resampler.h"
+#include "polyphase_resampler.h"
 
-/* The quality level is a value between 0 and 10. This is a tradeoff between
- * performance, latency, and quality. */
-#define SPEEX_QUALITY_LEVEL 4
 /* Max number of converters, src, down/up mix, 2xformat, and linear resample. */
 #define MAX_NUM_CONVERTERS 5
 /* Channel index for stereo. */
@@ -31,9 +29,34 @@ typedef size_t (*channel_converter_t)(struct cras_fmt_conv *conv,
 				      const uint8_t *in, size_t in_frames,
 				      uint8_t *out);
 
+/* The speex quality level is a value between 0 and 10. This is a tradeoff
+ * between performance, latency, and quality. The quality tiers only apply to
+ * the polyphase backend, speex keeps the same level for every stream. */
+#define SPEEX_QUALITY_LEVEL 4
+
+/* Polyphase resampler settings of a quality tier.
+ * Members:
+ *    num_taps - Filter length of the polyphase resampler.
+ *    num_phases - Number of filter phases of the polyphase resampler.
+ *    kaiser_beta - Window shape of the polyphase resampler filters.
+ */
+struct resampler_tier {
+	unsigned int num_taps;
+	unsigned int num_phases;
+	float kaiser_beta;
+};
+
+static const struct resampler_tier
+	resampler_tiers[CRAS_RESAMPLER_NUM_QUALITY] = {
+		[CRAS_RESAMPLER_QUALITY_LOW] = { 16, 64, 6.0f },
+		[CRAS_RESAMPLER_QUALITY_MEDIUM] = { 32, 128, 8.0f },
+		[CRAS_RESAMPLER_QUALITY_HIGH] = { 64, 256, 10.0f },
+	};
+
 /* Member data for the resampler. */
 struct cras_fmt_conv {
 	SpeexResamplerState *speex_state;
+	struct polyphase_resampler *polyphase;
 	channel_converter_t channel_converter;
 	float **ch_conv_mtx; /* Coefficient matrix for mixing channels. */
 	sample_format_converter_t in_format_converter;
@@ -45,6 +68,9 @@ struct cras_fmt_conv {
 	size_t tmp_buf_frames;
 	size_t pre_linear_resample;
 	size_t num_converters; /* Incremented once for SRC, channel, format. */
+	int use_float; /* Set if the chain runs on float instead of S16_LE. */
+	enum CRAS_RESAMPLER_BACKEND backend;
+	enum CRAS_RESAMPLER_QUALITY quality;
 };
 
 static int is_channel_layout_equal(const struct cras_audio_format *a,
@@ -58,6 +84,23 @@ static int is_channel_layout_equal(const struct cras_audio_format *a,
 	return 1;
 }
 
+/* Returns non-zero if the conversion should run on float samples. This is
+ * the case when neither end is S16_LE and there is any conversion to do,
+ * even only a format change, so the samples never go through S16_LE and are
+ * quantized only once after full precision channel and rate conversion. */
+static int float_chain_needed(const struct cras_audio_format *in,
+			      const struct cras_audio_format *out)
+{
+	if (in->format == SND_PCM_FORMAT_S16_LE ||
+	    out->format == SND_PCM_FORMAT_S16_LE)
+		return 0;
+
+	return in->format != out->format ||
+	       in->num_channels != out->num_channels ||
+	       in->frame_rate != out->frame_rate ||
+	       (in->num_channels > 2 && !is_channel_layout_equal(in, out));
+}
+
 static void normalize_buf(float *buf, size_t size)
 {
 	int i;
@@ -131,12 +174,16 @@ static int is_supported_format(const struct cras_audio_format *fmt)
 static size_t mono_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
+	if (conv->use_float)
+		return f32_mono_to_stereo(in, in_frames, out);
 	return s16_mono_to_stereo(in, in_frames, out);
 }
 
 static size_t stereo_to_mono(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
+	if (conv->use_float)
+		return f32_stereo_to_mono(in, in_frames, out);
 	return s16_stereo_to_mono(in, in_frames, out);
 }
 
@@ -149,6 +196,8 @@ static size_t mono_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
+	if (conv->use_float)
+		return f32_mono_to_51(left, right, center, in, in_frames, out);
 	return s16_mono_to_51(left, right, center, in, in_frames, out);
 }
 
@@ -161,12 +210,17 @@ static size_t stereo_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
+	if (conv->use_float)
+		return f32_stereo_to_51(left, right, center, in, in_frames,
+					out);
 	return s16_stereo_to_51(left, right, center, in, in_frames, out);
 }
 
 static size_t _51_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			    size_t in_frames, uint8_t *out)
 {
+	if (conv->use_float)
+		return f32_51_to_stereo(in, in_frames, out);
 	return s16_51_to_stereo(in, in_frames, out);
 }
 
@@ -180,6 +234,9 @@ static size_t stereo_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->out_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->out_fmt.channel_layout[CRAS_CH_RR];
 
+	if (conv->use_float)
+		return f32_stereo_to_quad(front_left, front_right, rear_left,
+					  rear_right, in, in_frames, out);
 	return s16_stereo_to_quad(front_left, front_right, rear_left,
 				  rear_right, in, in_frames, out);
 }
@@ -194,6 +251,9 @@ static size_t quad_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->in_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->in_fmt.channel_layout[CRAS_CH_RR];
 
+	if (conv->use_float)
+		return f32_quad_to_stereo(front_left, front_right, rear_left,
+					  rear_right, in, in_frames, out);
 	return s16_quad_to_stereo(front_left, front_right, rear_left,
 				  rear_right, in, in_frames, out);
 }
@@ -206,6 +266,9 @@ static size_t default_all_to_all(struct cras_fmt_conv *conv, const uint8_t *in,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
+	if (conv->use_float)
+		return f32_default_all_to_all(num_in_ch, num_out_ch, in,
+					      in_frames, out);
 	return s16_default_all_to_all(&conv->out_fmt, num_in_ch, num_out_ch, in,
 				      in_frames, out);
 }
@@ -220,10 +283,20 @@ static size_t convert_channels(struct cras_fmt_conv *conv, const uint8_t *in,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
+	if (conv->use_float)
+		return f32_convert_channels(ch_conv_mtx, num_in_ch, num_out_ch,
+					    in, in_frames, out);
 	return s16_convert_channels(ch_conv_mtx, num_in_ch, num_out_ch, in,
 				    in_frames, out);
 }
 
+/* Returns non-zero if the linear resampler has drift to correct. There is
+ * no linear resampler when the polyphase resampler corrects the drift. */
+static int linear_resample_needed(const struct cras_fmt_conv *conv)
+{
+	return conv->resampler && linear_resampler_needed(conv->resampler);
+}
+
 /*
  * Exported interface
  */
@@ -232,8 +305,23 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					   const struct cras_audio_format *out,
 					   size_t max_frames,
 					   size_t pre_linear_resample)
+{
+	return cras_fmt_conv_create_resampler(in, out, max_frames,
+					      pre_linear_resample,
+					      CRAS_RESAMPLER_SPEEX,
+					      CRAS_RESAMPLER_QUALITY_MEDIUM);
+}
+
+struct cras_fmt_conv *
+cras_fmt_conv_create_resampler(const struct cras_audio_format *in,
+			       const struct cras_audio_format *out,
+			       size_t max_frames, size_t pre_linear_resample,
+			       enum CRAS_RESAMPLER_BACKEND backend,
+			       enum CRAS_RESAMPLER_QUALITY quality)
 {
 	struct cras_fmt_conv *conv;
+	const struct resampler_tier *tier;
+	int use_polyphase;
 	int rc;
 	unsigned i;
 
@@ -244,6 +332,7 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 	conv->out_fmt = *out;
 	conv->tmp_buf_frames = max_frames;
 	conv->pre_linear_resample = pre_linear_resample;
+	conv->backend = backend;
 
 	if (!is_supported_format(in)) {
 		syslog(LOG_ERR, "Invalid input format %d", in->format);
@@ -257,10 +346,63 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 		return NULL;
 	}
 
-	/* Set up sample format conversion. */
-	/* TODO(dgreid) - modify channel and sample rate conversion so
-	 * converting to s16 isnt necessary. */
-	if (in->format != SND_PCM_FORMAT_S16_LE) {
+	if (quality >= CRAS_RESAMPLER_NUM_QUALITY)
+		quality = CRAS_RESAMPLER_QUALITY_MEDIUM;
+	conv->quality = quality;
+	tier = &resampler_tiers[quality];
+
+	/* The polyphase resampler only works on float samples. */
+	use_polyphase = backend == CRAS_RESAMPLER_POLYPHASE &&
+			in->frame_rate != out->frame_rate;
+
+	/* Set up sample format conversion. Channel and sample rate conversion
+	 * run on either S16_LE or float samples. */
+	conv->use_float = use_polyphase || float_chain_needed(in, out);
+	if (conv->use_float) {
+		conv->num_converters += 2;
+		syslog(LOG_DEBUG, "Convert from format %d to %d through float.",
+		       in->format, out->format);
+		switch (in->format) {
+		case SND_PCM_FORMAT_U8:
+			conv->in_format_converter = convert_u8_to_f32;
+			break;
+		case SND_PCM_FORMAT_S16_LE:
+			conv->in_format_converter = convert_s16le_to_f32;
+			break;
+		case SND_PCM_FORMAT_S24_LE:
+			conv->in_format_converter = convert_s24le_to_f32;
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+			conv->in_format_converter = convert_s32le_to_f32;
+			break;
+		case SND_PCM_FORMAT_S24_3LE:
+			conv->in_format_converter = convert_s243le_to_f32;
+			break;
+		default:
+			syslog(LOG_ERR, "Should never reachable");
+			break;
+		}
+		switch (out->format) {
+		case SND_PCM_FORMAT_U8:
+			conv->out_format_converter = convert_f32_to_u8;
+			break;
+		case SND_PCM_FORMAT_S16_LE:
+			conv->out_format_converter = convert_f32_to_s16le;
+			break;
+		case SND_PCM_FORMAT_S24_LE:
+			conv->out_format_converter = convert_f32_to_s24le;
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+			conv->out_format_converter = convert_f32_to_s32le;
+			break;
+		case SND_PCM_FORMAT_S24_3LE:
+			conv->out_format_converter = convert_f32_to_s243le;
+			break;
+		default:
+			syslog(LOG_ERR, "Should never reachable");
+			break;
+		}
+	} else if (in->format != SND_PCM_FORMAT_S16_LE) {
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
 		       out->format);
@@ -282,7 +424,7 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 			break;
 		}
 	}
-	if (out->format != SND_PCM_FORMAT_S16_LE) {
+	if (!conv->use_float && out->format != SND_PCM_FORMAT_S16_LE) {
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
 		       out->format);
@@ -374,36 +516,56 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from %zu to %zu Hz.", in->frame_rate,
 		       out->frame_rate);
-		conv->speex_state =
-			speex_resampler_init(out->num_channels, in->frame_rate,
-					     out->frame_rate,
-					     SPEEX_QUALITY_LEVEL, &rc);
-		if (conv->speex_state == NULL) {
-			syslog(LOG_ERR, "Fail to create speex:%zu %zu %zu %d",
-			       out->num_channels, in->frame_rate,
-			       out->frame_rate, rc);
-			cras_fmt_conv_destroy(&conv);
-			return NULL;
+		if (use_polyphase) {
+			conv->polyphase = polyphase_resampler_create(
+				out->num_channels, in->frame_rate,
+				out->frame_rate, tier->num_taps,
+				tier->num_phases, tier->kaiser_beta);
+			if (conv->polyphase == NULL) {
+				syslog(LOG_ERR,
+				       "Fail to create polyphase:%zu %zu %zu",
+				       out->num_channels, in->frame_rate,
+				       out->frame_rate);
+				cras_fmt_conv_destroy(&conv);
+				return NULL;
+			}
+		} else {
+			conv->speex_state = speex_resampler_init(
+				out->num_channels, in->frame_rate,
+				out->frame_rate, SPEEX_QUALITY_LEVEL, &rc);
+			if (conv->speex_state == NULL) {
+				syslog(LOG_ERR,
+				       "Fail to create speex:%zu %zu %zu %d",
+				       out->num_channels, in->frame_rate,
+				       out->frame_rate, rc);
+				cras_fmt_conv_destroy(&conv);
+				return NULL;
+			}
 		}
 	}
 
 	/*
-	 * Set up linear resampler.
+	 * Set up linear resampler, unless the polyphase resampler already
+	 * takes care of the drift.
 	 *
 	 * Note: intended to give both src_rate and dst_rate the same value
 	 * (i.e. out->frame_rate).  They will be updated in runtime in
 	 * update_estimated_rate() when the audio thread wants to adjust the
 	 * rate for inaccurate device consumption rate.
 	 */
-	conv->num_converters++;
-	conv->resampler =
-		linear_resampler_create(out->num_channels,
-					cras_get_format_bytes(out),
-					out->frame_rate, out->frame_rate);
-	if (conv->resampler == NULL) {
-		syslog(LOG_ERR, "Fail to create linear resampler");
-		cras_fmt_conv_destroy(&conv);
-		return NULL;
+	if (!conv->polyphase) {
+		conv->num_converters++;
+		conv->resampler = linear_resampler_create(
+			out->num_channels,
+			conv->use_float ? sizeof(float) * out->num_channels :
+					  cras_get_format_bytes(out),
+			out->frame_rate, out->frame_rate);
+		if (conv->resampler == NULL) {
+			syslog(LOG_ERR, "Fail to create linear resampler");
+			cras_fmt_conv_destroy(&conv);
+			return NULL;
+		}
+		linear_resampler_set_float(conv->resampler, conv->use_float);
 	}
 
 	/* Need num_converters-1 temp buffers, the final converter renders
@@ -433,6 +595,8 @@ void cras_fmt_conv_destroy(struct cras_fmt_conv **convp)
 						 conv->out_fmt.num_channels);
 	if (conv->speex_state)
 		speex_resampler_destroy(conv->speex_state);
+	if (conv->polyphase)
+		polyphase_resampler_destroy(conv->polyphase);
 	if (conv->resampler)
 		linear_resampler_destroy(conv->resampler);
 	for (i = 0; i < MAX_NUM_CONVERTERS - 1; i++)
@@ -441,6 +605,58 @@ void cras_fmt_conv_destroy(struct cras_fmt_conv **convp)
 	*convp = NULL;
 }
 
+/* Returns non-zero if the two formats are identical, including the channel
+ * layout. */
+static int is_format_equal(const struct cras_audio_format *a,
+			   const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       is_channel_layout_equal(a, b);
+}
+
+int cras_fmt_conv_matches(const struct cras_fmt_conv *conv,
+			  const struct cras_audio_format *in,
+			  const struct cras_audio_format *out,
+			  size_t max_frames, size_t pre_linear_resample,
+			  enum CRAS_RESAMPLER_BACKEND backend,
+			  enum CRAS_RESAMPLER_QUALITY quality)
+{
+	if (quality >= CRAS_RESAMPLER_NUM_QUALITY)
+		quality = CRAS_RESAMPLER_QUALITY_MEDIUM;
+
+	return is_format_equal(&conv->in_fmt, in) &&
+	       is_format_equal(&conv->out_fmt, out) &&
+	       conv->tmp_buf_frames >= max_frames &&
+	       !conv->pre_linear_resample == !pre_linear_resample &&
+	       conv->backend == backend && conv->quality == quality;
+}
+
+int cras_fmt_conv_same_chain(const struct cras_fmt_conv *a,
+			     const struct cras_fmt_conv *b)
+{
+	return is_format_equal(&a->in_fmt, &b->in_fmt) &&
+	       is_format_equal(&a->out_fmt, &b->out_fmt) &&
+	       !a->pre_linear_resample == !b->pre_linear_resample &&
+	       a->backend == b->backend && a->quality == b->quality;
+}
+
+void cras_fmt_conv_reset(struct cras_fmt_conv *conv)
+{
+	if (conv->speex_state)
+		speex_resampler_reset_mem(conv->speex_state);
+	if (conv->polyphase) {
+		polyphase_resampler_reset(conv->polyphase);
+		polyphase_resampler_set_rates(conv->polyphase,
+					      conv->in_fmt.frame_rate,
+					      conv->out_fmt.frame_rate);
+	}
+	if (conv->resampler)
+		linear_resampler_set_rates(conv->resampler,
+					   conv->out_fmt.frame_rate,
+					   conv->out_fmt.frame_rate);
+}
+
 struct cras_fmt_conv *cras_channel_remix_conv_create(unsigned int num_channels,
 						     const float *coefficient)
 {
@@ -514,6 +730,9 @@ size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
 {
 	if (!conv)
 		return in_frames;
+	if (conv->polyphase)
+		return polyphase_resampler_in_frames_to_out(conv->polyphase,
+							    in_frames);
 
 	if (conv->pre_linear_resample)
 		in_frames = linear_resampler_in_frames_to_out(conv->resampler,
@@ -531,6 +750,9 @@ size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 {
 	if (!conv)
 		return out_frames;
+	if (conv->polyphase)
+		return polyphase_resampler_out_frames_to_in(conv->polyphase,
+							    out_frames);
 	if (!conv->pre_linear_resample)
 		out_frames = linear_resampler_out_frames_to_in(conv->resampler,
 							       out_frames);
@@ -545,9 +767,50 @@ size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to)
 {
+	/* The linear resampler scales the output rate by to / from, fold
+	 * the same correction into the nominal ratio. */
+	if (conv->polyphase) {
+		polyphase_resampler_set_rates(conv->polyphase,
+					      conv->in_fmt.frame_rate,
+					      (double)conv->out_fmt.frame_rate *
+						      to / from);
+		return;
+	}
 	linear_resampler_set_rates(conv->resampler, from, to);
 }
 
+/* Runs the linear resampler ahead of the other converters. Returns the number
+ * of frames written to |dst| and updates |src_frames| to the number of frames
+ * consumed. */
+static unsigned int run_pre_linear_resample(struct cras_fmt_conv *conv,
+					    uint8_t *src,
+					    unsigned int *src_frames,
+					    uint8_t *dst, size_t out_frames)
+{
+	unsigned resample_limit = out_frames;
+
+	/* If there is a 2nd fmt conversion we should convert the
+	 * resample limit and round it to the lower bound in order
+	 * not to convert too many frames in the pre linear resampler.
+	 */
+	if (conv->speex_state != NULL) {
+		resample_limit = resample_limit * conv->in_fmt.frame_rate /
+				 conv->out_fmt.frame_rate;
+		/*
+		 * However if the limit frames count is less than
+		 * |out_rate / in_rate|, the final limit value could be
+		 * rounded to zero so it confuses linear resampler to
+		 * do nothing. Make sure it's non-zero in that case.
+		 */
+		if (resample_limit == 0)
+			resample_limit = 1;
+	}
+
+	resample_limit = MIN(resample_limit, conv->tmp_buf_frames);
+	return linear_resampler_resample(conv->resampler, src, src_frames,
+					 dst, resample_limit);
+}
+
 size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 				    const uint8_t *in_buf, uint8_t *out_buf,
 				    unsigned int *in_frames, size_t out_frames)
@@ -564,13 +827,13 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	assert(conv);
 	assert(*in_frames <= conv->tmp_buf_frames);
 
-	if (linear_resampler_needed(conv->resampler)) {
+	if (linear_resample_needed(conv)) {
 		post_linear_resample = !conv->pre_linear_resample;
 		pre_linear_resample = conv->pre_linear_resample;
 	}
 
 	/* If no SRC, then in_frames should = out_frames. */
-	if (conv->speex_state == NULL) {
+	if (conv->speex_state == NULL && conv->polyphase == NULL) {
 		fr_in = MIN(*in_frames, out_frames);
 		if (out_frames < *in_frames && !logged_frames_dont_fit) {
 			syslog(LOG_INFO, "fmt_conv: %u to %zu no SRC.",
@@ -585,7 +848,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	/* Set up a chain of buffers.  The output buffer of the first conversion
 	 * is used as input to the second and so forth, ending in the output
 	 * buffer. */
-	if (!linear_resampler_needed(conv->resampler))
+	if (conv->resampler && !linear_resampler_needed(conv->resampler))
 		used_converters--;
 
 	buffers[4] = (uint8_t *)conv->tmp_bufs[3];
@@ -595,43 +858,34 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	buffers[0] = (uint8_t *)in_buf;
 	buffers[used_converters] = out_buf;
 
-	if (pre_linear_resample) {
+	/* The S16_LE chain resamples the input as is, the float chain has to
+	 * convert it to float first. */
+	if (pre_linear_resample && !conv->use_float) {
 		linear_resample_fr = fr_in;
-		unsigned resample_limit = out_frames;
-
-		/* If there is a 2nd fmt conversion we should convert the
-		 * resample limit and round it to the lower bound in order
-		 * not to convert too many frames in the pre linear resampler.
-		 */
-		if (conv->speex_state != NULL) {
-			resample_limit = resample_limit *
-					 conv->in_fmt.frame_rate /
-					 conv->out_fmt.frame_rate;
-			/*
-			 * However if the limit frames count is less than
-			 * |out_rate / in_rate|, the final limit value could be
-			 * rounded to zero so it confuses linear resampler to
-			 * do nothing. Make sure it's non-zero in that case.
-			 */
-			if (resample_limit == 0)
-				resample_limit = 1;
-		}
-
-		resample_limit = MIN(resample_limit, conv->tmp_buf_frames);
-		fr_in = linear_resampler_resample(
-			conv->resampler, buffers[buf_idx], &linear_resample_fr,
-			buffers[buf_idx + 1], resample_limit);
+		fr_in = run_pre_linear_resample(conv, buffers[buf_idx],
+						&linear_resample_fr,
+						buffers[buf_idx + 1],
+						out_frames);
 		buf_idx++;
 	}
 
-	/* If the input format isn't S16_LE convert to it. */
-	if (conv->in_fmt.format != SND_PCM_FORMAT_S16_LE) {
+	/* If the input format isn't S16_LE or float convert to it. */
+	if (conv->in_format_converter) {
 		conv->in_format_converter(buffers[buf_idx],
 					  fr_in * conv->in_fmt.num_channels,
 					  (uint8_t *)buffers[buf_idx + 1]);
 		buf_idx++;
 	}
 
+	if (pre_linear_resample && conv->use_float) {
+		linear_resample_fr = fr_in;
+		fr_in = run_pre_linear_resample(conv, buffers[buf_idx],
+						&linear_resample_fr,
+						buffers[buf_idx + 1],
+						out_frames);
+		buf_idx++;
+	}
+
 	/* Then channel conversion. */
 	if (conv->channel_converter != NULL) {
 		conv->channel_converter(conv, buffers[buf_idx], fr_in,
@@ -656,9 +910,23 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		}
 		/* limit frames to the output size. */
 		fr_out = MIN(fr_out, out_limit);
-		speex_resampler_process_interleaved_int(
-			conv->speex_state, (int16_t *)buffers[buf_idx], &fr_in,
-			(int16_t *)buffers[buf_idx + 1], &fr_out);
+		if (conv->use_float)
+			speex_resampler_process_interleaved_float(
+				conv->speex_state, (float *)buffers[buf_idx],
+				&fr_in, (float *)buffers[buf_idx + 1], &fr_out);
+		else
+			speex_resampler_process_interleaved_int(
+				conv->speex_state, (int16_t *)buffers[buf_idx],
+				&fr_in, (int16_t *)buffers[buf_idx + 1],
+				&fr_out);
+		buf_idx++;
+	} else if (conv->polyphase != NULL) {
+		/* Always followed by the float to output format converter,
+		 * so the output goes to a temporary buffer. */
+		fr_out = polyphase_resampler_resample(
+			conv->polyphase, (const float *)buffers[buf_idx],
+			&fr_in, (float *)buffers[buf_idx + 1],
+			MIN(out_frames, conv->tmp_buf_frames));
 		buf_idx++;
 	}
 
@@ -672,7 +940,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	}
 
 	/* If the output format isn't S16_LE convert to it. */
-	if (conv->out_fmt.format != SND_PCM_FORMAT_S16_LE) {
+	if (conv->out_format_converter) {
 		conv->out_format_converter(buffers[buf_idx],
 					   fr_out * conv->out_fmt.num_channels,
 					   (uint8_t *)buffers[buf_idx + 1]);
@@ -701,15 +969,32 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv)
 {
-	return linear_resampler_needed(conv->resampler) ||
-	       (conv->num_converters > 1);
+	return linear_resample_needed(conv) || (conv->num_converters > 1);
 }
 
 /* If the server cannot provide the requested format, configures an audio format
  * converter that handles transforming the input format to the format used by
  * the server. */
+enum CRAS_RESAMPLER_QUALITY
+cras_fmt_conv_stream_type_quality(enum CRAS_STREAM_TYPE stream_type)
+{
+	switch (stream_type) {
+	case CRAS_STREAM_TYPE_VOICE_COMMUNICATION:
+	case CRAS_STREAM_TYPE_SPEECH_RECOGNITION:
+		/* Speech band content, latency matters more than the
+		 * stop band. */
+		return CRAS_RESAMPLER_QUALITY_LOW;
+	case CRAS_STREAM_TYPE_PRO_AUDIO:
+		return CRAS_RESAMPLER_QUALITY_HIGH;
+	default:
+		return CRAS_RESAMPLER_QUALITY_MEDIUM;
+	}
+}
+
 int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
+			    enum CRAS_STREAM_TYPE stream_type,
+			    enum CRAS_RESAMPLER_BACKEND backend,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
 			    unsigned int frames)
@@ -731,8 +1016,9 @@ int config_format_converter(struct cras_fmt_conv **conv,
 	       "frames = %u",
 	       from->format, from->frame_rate, from->num_channels,
 	       target.format, target.frame_rate, target.num_channels, frames);
-	*conv = cras_fmt_conv_create(from, &target, frames,
-				     (dir == CRAS_STREAM_INPUT));
+	*conv = cras_fmt_conv_pool_get(
+		from, &target, frames, (dir == CRAS_STREAM_INPUT), backend,
+		cras_fmt_conv_stream_type_quality(stream_type));
 	if (!*conv) {
 		syslog(LOG_ERR, "Failed to create format converter");
 		return -ENOMEM;
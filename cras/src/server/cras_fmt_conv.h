@@ -4,8 +4,8 @@
  */
 
 /*
- * Used to convert from one audio format to another.  Currently only supports
- * sample rate conversion with the speex backend.
+ * Used to convert from one audio format to another.  Sample rate conversion
+ * is done either by speex or by the built-in polyphase resampler.
  */
 #ifndef CRAS_FMT_CONV_H_
 #define CRAS_FMT_CONV_H_
@@ -18,13 +18,82 @@
 struct cras_audio_format;
 struct cras_fmt_conv;
 
-/* Create and destroy format converters. */
+/* Backends of the sample rate conversion.
+ *    CRAS_RESAMPLER_SPEEX - Speex converts the nominal rate, the linear
+ *        resampler corrects the rate estimator drift in a second pass.
+ *    CRAS_RESAMPLER_POLYPHASE - The polyphase resampler converts the nominal
+ *        rate and corrects the drift in a single pass, on float samples.
+ */
+enum CRAS_RESAMPLER_BACKEND {
+	CRAS_RESAMPLER_SPEEX,
+	CRAS_RESAMPLER_POLYPHASE,
+};
+
+/* Quality tiers of the polyphase sample rate conversion, higher tiers cost
+ * more CPU. The speex backend runs at one quality for all of them. */
+enum CRAS_RESAMPLER_QUALITY {
+	CRAS_RESAMPLER_QUALITY_LOW,
+	CRAS_RESAMPLER_QUALITY_MEDIUM,
+	CRAS_RESAMPLER_QUALITY_HIGH,
+	CRAS_RESAMPLER_NUM_QUALITY,
+};
+
+/* Create and destroy format converters. cras_fmt_conv_create uses speex at
+ * medium quality. */
 struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					   const struct cras_audio_format *out,
 					   size_t max_frames,
 					   size_t pre_linear_resample);
+/* Creates a format converter with the given resampler.
+ * Args:
+ *    in - Format to convert from.
+ *    out - Format to convert to.
+ *    max_frames - The maximum number of frames converted at once.
+ *    pre_linear_resample - Non-zero to correct the drift before the other
+ *        conversions, only used by the speex backend.
+ *    backend - The resampler backend.
+ *    quality - The quality tier of the resampler.
+ */
+struct cras_fmt_conv *
+cras_fmt_conv_create_resampler(const struct cras_audio_format *in,
+			       const struct cras_audio_format *out,
+			       size_t max_frames, size_t pre_linear_resample,
+			       enum CRAS_RESAMPLER_BACKEND backend,
+			       enum CRAS_RESAMPLER_QUALITY quality);
 void cras_fmt_conv_destroy(struct cras_fmt_conv **conv);
 
+/* Checks if a converter was created with the given parameters, so it can be
+ * used in place of a new one. A converter created for more frames than
+ * |max_frames| matches too.
+ * Args:
+ *    conv - The format converter to check.
+ *    in, out, max_frames, pre_linear_resample, backend, quality - The
+ *        arguments cras_fmt_conv_create_resampler would be called with.
+ * Returns:
+ *    Non-zero if the converter matches.
+ */
+int cras_fmt_conv_matches(const struct cras_fmt_conv *conv,
+			  const struct cras_audio_format *in,
+			  const struct cras_audio_format *out,
+			  size_t max_frames, size_t pre_linear_resample,
+			  enum CRAS_RESAMPLER_BACKEND backend,
+			  enum CRAS_RESAMPLER_QUALITY quality);
+
+/* Checks if two converters run the same conversion chain, so that feeding
+ * them the same input gives the same output. Only the nominal chain is
+ * compared, the caller must make sure the linear resample rates agree.
+ * Args:
+ *    a, b - The format converters to compare.
+ * Returns:
+ *    Non-zero if the chains are the same.
+ */
+int cras_fmt_conv_same_chain(const struct cras_fmt_conv *a,
+			     const struct cras_fmt_conv *b);
+
+/* Drops the samples buffered in the resamplers and restores the nominal
+ * rates, so a converter can be reused for a new stream. */
+void cras_fmt_conv_reset(struct cras_fmt_conv *conv);
+
 /* Creates the format converter for channel remixing. The conversion takes
  * a N by N float matrix, to multiply each N-channels sample.
  * Args:
@@ -60,7 +129,8 @@ size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
 /* Get the number of input frames that will result from converting out_frames */
 size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 				      size_t out_frames);
-/* Sets the input and output rate to the linear resampler. */
+/* Sets the input and output rate to the linear resampler. With the polyphase
+ * backend the ratio is applied on top of the nominal conversion instead. */
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to);
 /* Converts in_frames samples from in_buf, storing the results in out_buf.
@@ -86,18 +156,27 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
  */
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv);
 
+/* Returns the resampler quality tier used for streams of the given type. */
+enum CRAS_RESAMPLER_QUALITY
+cras_fmt_conv_stream_type_quality(enum CRAS_STREAM_TYPE stream_type);
+
 /* If the server cannot provide the requested format, configures an audio format
  * converter that handles transforming the input format to the format used by
- * the server.
+ * the server. The converter is taken from the pool of idle converters when
+ * one matches, and should be returned with cras_fmt_conv_pool_put.
  * Args:
  *    conv - filled with the new converter if needed.
  *    dir - the stream direction the new converter used for.
+ *    stream_type - the type of the stream, selects the resampler quality.
+ *    backend - the resampler backend to use.
  *    from - Format to convert from.
  *    to - Format to convert to.
  *    frames - size of buffer.
  */
 int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
+			    enum CRAS_STREAM_TYPE stream_type,
+			    enum CRAS_RESAMPLER_BACKEND backend,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
 			    unsigned int frames);
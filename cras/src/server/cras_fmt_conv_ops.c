@@ -122,6 +122,140 @@ void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*_out = ((uint32_t)(int32_t)*_in << 16);
 }
 
+/*
+ * Float format converter.
+ */
+#define F32_S8_SCALE 128.0f
+#define F32_S16_SCALE 32768.0f
+#define F32_S24_SCALE 8388608.0f
+#define F32_S32_SCALE 2147483648.0f
+
+/* Scales, rounds and clips a float sample to the range [min, max]. */
+static inline int32_t f32_to_int(float in, float scale, int32_t min,
+				 int32_t max)
+{
+	/* Compare in double, INT32_MAX is not representable in float. */
+	double value = (double)in * scale;
+
+	value += value >= 0.0 ? 0.5 : -0.5;
+	if (value >= max)
+		return max;
+	if (value <= min)
+		return min;
+	return (int32_t)value;
+}
+
+void convert_u8_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = ((int)in[i] - 0x80) / F32_S8_SCALE;
+}
+
+void convert_s16le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const int16_t *_in = (const int16_t *)in;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = _in[i] / F32_S16_SCALE;
+}
+
+void convert_s243le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	int32_t sample;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++, in += 3) {
+		sample = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 |
+				   (uint32_t)in[2] << 24);
+		_out[i] = (sample >> 8) / F32_S24_SCALE;
+	}
+}
+
+void convert_s24le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const int32_t *_in = (const int32_t *)in;
+	float *_out = (float *)out;
+
+	/* Only the lower 24 bits are valid, sign extend them. */
+	for (i = 0; i < in_samples; i++)
+		_out[i] = ((int32_t)((uint32_t)_in[i] << 8) >> 8) /
+			  F32_S24_SCALE;
+}
+
+void convert_s32le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const int32_t *_in = (const int32_t *)in;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = _in[i] / F32_S32_SCALE;
+}
+
+void convert_f32_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+
+	for (i = 0; i < in_samples; i++)
+		out[i] = (uint8_t)(f32_to_int(_in[i], F32_S8_SCALE, -0x80,
+					      0x7f) +
+				   0x80);
+}
+
+void convert_f32_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int16_t *_out = (int16_t *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = f32_to_int(_in[i], F32_S16_SCALE, INT16_MIN,
+				     INT16_MAX);
+}
+
+void convert_f32_to_s243le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	int32_t sample;
+	const float *_in = (const float *)in;
+
+	for (i = 0; i < in_samples; i++, out += 3) {
+		sample = f32_to_int(_in[i], F32_S24_SCALE, -0x800000, 0x7fffff);
+		out[0] = sample & 0xff;
+		out[1] = (sample >> 8) & 0xff;
+		out[2] = (sample >> 16) & 0xff;
+	}
+}
+
+void convert_f32_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int32_t *_out = (int32_t *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = f32_to_int(_in[i], F32_S24_SCALE, -0x800000,
+				     0x7fffff);
+}
+
+void convert_f32_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int32_t *_out = (int32_t *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = f32_to_int(_in[i], F32_S32_SCALE, INT_MIN, INT_MAX);
+}
+
 /*
  * Channel converter: mono to stereo.
  */
@@ -384,3 +518,190 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 
 	return in_frames;
 }
+
+/*
+ * Float channel converters, see the s16 versions above for the mapping rules.
+ */
+size_t f32_mono_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = in[i];
+		out[2 * i + 1] = in[i];
+	}
+	return in_frames;
+}
+
+size_t f32_stereo_to_mono(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	for (i = 0; i < in_frames; i++)
+		out[i] = in[2 * i] + in[2 * i + 1];
+	return in_frames;
+}
+
+size_t f32_mono_to_51(size_t left, size_t right, size_t center,
+		      const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] = in[i];
+	else if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + right] = in[i] / 2;
+			out[6 * i + left] = in[i] / 2;
+		}
+	else
+		for (i = 0; i < in_frames; i++)
+			out[6 * i] = in[i];
+
+	return in_frames;
+}
+
+size_t f32_stereo_to_51(size_t left, size_t right, size_t center,
+			const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + left] = in[2 * i];
+			out[6 * i + right] = in[2 * i + 1];
+		}
+	else if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] = in[2 * i] + in[2 * i + 1];
+	else
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i] = in[2 * i];
+			out[6 * i + 1] = in[2 * i + 1];
+		}
+
+	return in_frames;
+}
+
+size_t f32_51_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	static const unsigned int left_idx = 0;
+	static const unsigned int right_idx = 1;
+	static const unsigned int center_idx = 4;
+	size_t i;
+
+	for (i = 0; i < in_frames; i++) {
+		float half_center = in[6 * i + center_idx] / 2;
+
+		out[2 * i + left_idx] = in[6 * i + left_idx] + half_center;
+		out[2 * i + right_idx] = in[6 * i + right_idx] + half_center;
+	}
+	return in_frames;
+}
+
+size_t f32_stereo_to_quad(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[4 * i + front_left] = in[2 * i];
+		out[4 * i + front_right] = in[2 * i + 1];
+		out[4 * i + rear_left] = in[2 * i];
+		out[4 * i + rear_right] = in[2 * i + 1];
+	}
+	return in_frames;
+}
+
+size_t f32_quad_to_stereo(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = in[4 * i + front_left] + in[4 * i + rear_left] / 4;
+		out[2 * i + 1] =
+			in[4 * i + front_right] + in[4 * i + rear_right] / 4;
+	}
+	return in_frames;
+}
+
+size_t f32_default_all_to_all(size_t num_in_ch, size_t num_out_ch,
+			      const uint8_t *_in, size_t in_frames,
+			      uint8_t *_out)
+{
+	unsigned int in_ch, out_ch, i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	float sum;
+
+	for (i = 0; i < in_frames; i++) {
+		sum = 0.0f;
+		for (in_ch = 0; in_ch < num_in_ch; in_ch++)
+			sum += in[in_ch + i * num_in_ch];
+		sum /= num_in_ch;
+		for (out_ch = 0; out_ch < num_out_ch; out_ch++)
+			out[out_ch + i * num_out_ch] = sum;
+	}
+	return in_frames;
+}
+
+size_t f32_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *_in,
+			    size_t in_frames, uint8_t *_out)
+{
+	unsigned i, j, fr;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	float sum;
+
+	for (fr = 0; fr < in_frames; fr++) {
+		for (i = 0; i < num_out_ch; i++) {
+			sum = 0.0f;
+			for (j = 0; j < num_in_ch; j++)
+				sum += ch_conv_mtx[i][j] * in[j];
+			out[i] = sum;
+		}
+		in += num_in_ch;
+		out += num_out_ch;
+	}
+
+	return in_frames;
+}
@@ -23,6 +23,21 @@ void convert_s16le_to_s243le(const uint8_t *in, size_t in_samples,
 void convert_s16le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out);
 void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
 
+/*
+ * Float format converter. Float samples are normalized to [-1.0, 1.0), values
+ * out of range are clipped when converting back to integer.
+ */
+void convert_u8_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s16le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s243le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s24le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s32le_to_f32(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32_to_s243le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+
 /*
  * Channel converter: mono to stereo.
  */
@@ -85,4 +100,28 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 			    size_t num_out_ch, const uint8_t *in,
 			    size_t in_frames, uint8_t *out);
 
+/*
+ * Float versions of the channel converters above. Sums are not clipped, it is
+ * left to the conversion back to integer.
+ */
+size_t f32_mono_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_mono(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_mono_to_51(size_t left, size_t right, size_t center,
+		      const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_51(size_t left, size_t right, size_t center,
+			const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_51_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_quad(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_quad_to_stereo(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_default_all_to_all(size_t num_in_ch, size_t num_out_ch,
+			      const uint8_t *in, size_t in_frames,
+			      uint8_t *out);
+size_t f32_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *in,
+			    size_t in_frames, uint8_t *out);
+
 #endif /* CRAS_FMT_CONV_OPS_H_ */
@@ -0,0 +1,166 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cras_fmt_conv_pool.h"
+#include "cras_server_metrics.h"
+
+/* Number of lookups between two reports of the hit rate. */
+#define POOL_METRICS_LOOKUPS 100
+
+/* An idle converter in the pool.
+ * Members:
+ *    conv - The converter, NULL if the slot is free.
+ *    stamp - Value of the pool clock when the converter was returned.
+ */
+struct pool_entry {
+	struct cras_fmt_conv *conv;
+	unsigned int stamp;
+};
+
+static struct pool_entry entries[CRAS_FMT_CONV_POOL_SIZE];
+static unsigned int pool_clock;
+static struct cras_fmt_conv_pool_stats stats;
+/* Hits and lookups since the hit rate was last reported. */
+static unsigned int window_hits, window_lookups;
+/* Audio threads running different devices share the pool. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Counts a lookup and, once every POOL_METRICS_LOOKUPS of them, returns the
+ * hit rate of the window in percent to report. Called with the lock held.
+ * Returns:
+ *    The hit rate to report, or -1 if the window isn't over yet.
+ */
+static int count_lookup(bool hit)
+{
+	int rate;
+
+	if (hit) {
+		stats.hits++;
+		window_hits++;
+	} else {
+		stats.misses++;
+	}
+	if (++window_lookups < POOL_METRICS_LOOKUPS)
+		return -1;
+
+	rate = window_hits * 100 / window_lookups;
+	window_hits = 0;
+	window_lookups = 0;
+	return rate;
+}
+
+/* Reports the hit rate returned by count_lookup(), without the lock. */
+static void report_hit_rate(int rate)
+{
+	if (rate >= 0)
+		cras_server_metrics_fmt_conv_pool_hit_rate(rate);
+}
+
+struct cras_fmt_conv *
+cras_fmt_conv_pool_get(const struct cras_audio_format *in,
+		       const struct cras_audio_format *out, size_t max_frames,
+		       size_t pre_linear_resample,
+		       enum CRAS_RESAMPLER_BACKEND backend,
+		       enum CRAS_RESAMPLER_QUALITY quality)
+{
+	struct pool_entry *best = NULL;
+	struct cras_fmt_conv *conv;
+	unsigned int i;
+	int rate;
+
+	pthread_mutex_lock(&pool_lock);
+
+	/* Prefer the most recently returned match, its buffers are the most
+	 * likely to still be in cache. */
+	for (i = 0; i < CRAS_FMT_CONV_POOL_SIZE; i++) {
+		if (!entries[i].conv)
+			continue;
+		if (!cras_fmt_conv_matches(entries[i].conv, in, out, max_frames,
+					   pre_linear_resample, backend,
+					   quality))
+			continue;
+		if (!best || entries[i].stamp > best->stamp)
+			best = &entries[i];
+	}
+
+	if (best) {
+		conv = best->conv;
+		best->conv = NULL;
+		rate = count_lookup(true);
+		pthread_mutex_unlock(&pool_lock);
+		report_hit_rate(rate);
+		cras_fmt_conv_reset(conv);
+		return conv;
+	}
+
+	rate = count_lookup(false);
+	pthread_mutex_unlock(&pool_lock);
+	report_hit_rate(rate);
+	return cras_fmt_conv_create_resampler(in, out, max_frames,
+					      pre_linear_resample, backend,
+					      quality);
+}
+
+void cras_fmt_conv_pool_put(struct cras_fmt_conv **conv)
+{
+	struct pool_entry *slot = NULL;
+	struct cras_fmt_conv *evicted;
+	unsigned int i;
+
+	if (!*conv)
+		return;
+
+	pthread_mutex_lock(&pool_lock);
+	for (i = 0; i < CRAS_FMT_CONV_POOL_SIZE; i++) {
+		if (!entries[i].conv) {
+			slot = &entries[i];
+			break;
+		}
+		if (!slot || entries[i].stamp < slot->stamp)
+			slot = &entries[i];
+	}
+
+	evicted = slot->conv;
+	if (evicted)
+		stats.evictions++;
+	slot->conv = *conv;
+	slot->stamp = ++pool_clock;
+	pthread_mutex_unlock(&pool_lock);
+
+	*conv = NULL;
+	if (evicted)
+		cras_fmt_conv_destroy(&evicted);
+}
+
+void cras_fmt_conv_pool_drain(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool_lock);
+	for (i = 0; i < CRAS_FMT_CONV_POOL_SIZE; i++)
+		if (entries[i].conv)
+			cras_fmt_conv_destroy(&entries[i].conv);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void cras_fmt_conv_pool_get_stats(struct cras_fmt_conv_pool_stats *out)
+{
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void cras_fmt_conv_pool_reset_stats(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	memset(&stats, 0, sizeof(stats));
+	window_hits = 0;
+	window_lookups = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,59 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A pool of idle format converters. Creating a converter allocates the
+ * resampler state and the conversion buffers, which is costly on the audio
+ * thread when streams move between devices, or when a device falls back and
+ * resumes. Converters released by a dev_stream are kept here, keyed by their
+ * input format, output format and channel layout, and handed out again with
+ * their state reset. The pool is shared by all the audio threads.
+ */
+#ifndef CRAS_FMT_CONV_POOL_H_
+#define CRAS_FMT_CONV_POOL_H_
+
+#include <stddef.h>
+
+#include "cras_fmt_conv.h"
+
+/* Maximum number of idle converters kept in the pool. */
+#define CRAS_FMT_CONV_POOL_SIZE 8
+
+/* Counters of the pool usage.
+ * Members:
+ *    hits - Number of converters handed out from the pool.
+ *    misses - Number of converters that had to be created.
+ *    evictions - Number of idle converters destroyed to make room.
+ */
+struct cras_fmt_conv_pool_stats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+};
+
+/* Gets a format converter, from the pool if an idle one matches, otherwise
+ * a newly created one. Args are the same as cras_fmt_conv_create_resampler.
+ * Returns:
+ *    A converter ready to use, or NULL on error.
+ */
+struct cras_fmt_conv *
+cras_fmt_conv_pool_get(const struct cras_audio_format *in,
+		       const struct cras_audio_format *out, size_t max_frames,
+		       size_t pre_linear_resample,
+		       enum CRAS_RESAMPLER_BACKEND backend,
+		       enum CRAS_RESAMPLER_QUALITY quality);
+
+/* Returns a converter to the pool and sets |*conv| to NULL. When the pool is
+ * full the least recently returned converter is destroyed. */
+void cras_fmt_conv_pool_put(struct cras_fmt_conv **conv);
+
+/* Destroys all the idle converters. */
+void cras_fmt_conv_pool_drain(void);
+
+/* Fills |stats| with the counters of the pool. */
+void cras_fmt_conv_pool_get_stats(struct cras_fmt_conv_pool_stats *stats);
+
+/* Resets the counters of the pool. */
+void cras_fmt_conv_pool_reset_stats(void);
+
+#endif /* CRAS_FMT_CONV_POOL_H_ */
@@ -30,6 +30,7 @@
 #include "cras_util.h"
 #include "dev_stream.h"
 #include "input_data.h"
+#include "mix_bus.h"
 #include "utlist.h"
 #include "rate_estimator.h"
 #include "softvol_curve.h"
@@ -946,6 +947,7 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 	iodev->state = CRAS_IODEV_STATE_OPEN;
 	iodev->highest_hw_level = 0;
 	iodev->input_dsp_offset = 0;
+	memset(&iodev->stage_stats, 0, sizeof(iodev->stage_stats));
 
 	if (iodev->direction == CRAS_STREAM_OUTPUT) {
 		/* If device supports start ops, device can be in open state.
@@ -1050,6 +1052,86 @@ int cras_iodev_put_input_buffer(struct cras_iodev *iodev)
 	return min_frames;
 }
 
+/* Returns non-zero if the iodev has a loopback of the given type. */
+static int has_loopback(const struct cras_iodev *iodev,
+			enum CRAS_LOOPBACK_TYPE type)
+{
+	struct cras_loopback *loopback;
+
+	DL_FOREACH (iodev->loopbacks, loopback) {
+		if (loopback->type == type)
+			return 1;
+	}
+	return 0;
+}
+
+/* Passes the output samples to every loopback of the given type. */
+static void run_loopbacks(struct cras_iodev *iodev,
+			  enum CRAS_LOOPBACK_TYPE type, const uint8_t *frames,
+			  unsigned int nframes)
+{
+	struct cras_loopback *loopback;
+
+	DL_FOREACH (iodev->loopbacks, loopback) {
+		if (loopback->type == type)
+			loopback->hook_data(frames, nframes, iodev->format,
+					    loopback->cb_data);
+	}
+}
+
+void cras_iodev_stage_time_add(struct cras_iodev *iodev,
+			       enum CRAS_OUTPUT_STAGE stage,
+			       struct timespec *start)
+{
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, start, &elapsed);
+	iodev->stage_stats.block_ns[stage] +=
+		(uint64_t)elapsed.tv_sec * 1000000000 + elapsed.tv_nsec;
+	*start = now;
+}
+
+/* Adds the stage times of the block just committed, or dropped by a DSP
+ * error, to the totals. */
+static void end_stage_block(struct cras_iodev *iodev)
+{
+	struct cras_iodev_stage_stats *stats = &iodev->stage_stats;
+	unsigned int i;
+
+	for (i = 0; i < CRAS_NUM_OUTPUT_STAGES; i++) {
+		stats->total_ns[i] += stats->block_ns[i];
+		if (stats->block_ns[i] > stats->max_ns[i])
+			stats->max_ns[i] = stats->block_ns[i];
+		stats->block_ns[i] = 0;
+	}
+	stats->num_blocks++;
+}
+
+/* Remixes the channels if needed and commits the samples to the device.
+ * |stage_ts| is the time the remix starts, see cras_iodev_stage_time_add(). */
+static int commit_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
+				unsigned int nframes,
+				struct cras_fmt_conv *remix_converter,
+				struct timespec *stage_ts)
+{
+	int rc;
+
+	if (remix_converter) {
+		cras_channel_remix_convert(remix_converter, iodev->format,
+					   frames, nframes);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_FMT_CONV,
+					  stage_ts);
+	}
+	if (iodev->rate_est)
+		rate_estimator_add_frames(iodev->rate_est, nframes);
+
+	rc = iodev->put_buffer(iodev, nframes);
+	cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_HW_WRITE, stage_ts);
+	end_stage_block(iodev);
+	return rc;
+}
+
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes, int *is_non_empty,
 				 struct cras_fmt_conv *remix_converter)
@@ -1063,48 +1145,38 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 	};
 	float software_volume_scaler = 1.0;
 	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
+	float scaler = 1.0f;
+	float increment = 0.0f;
+	float target = 1.0f;
+	struct timespec stage_ts;
 	int rc;
-	struct cras_loopback *loopback;
 
-	/* Calculate whether the final output was non-empty, if requested. */
-	if (is_non_empty) {
-		unsigned int i;
-		for (i = 0; i < nframes * cras_get_format_bytes(fmt); i++) {
-			if (frames[i]) {
-				*is_non_empty = 1;
-				break;
-			}
-		}
-	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &stage_ts);
 
-	DL_FOREACH (iodev->loopbacks, loopback) {
-		if (loopback->type == LOOPBACK_POST_MIX_PRE_DSP)
-			loopback->hook_data(frames, nframes, iodev->format,
-					    loopback->cb_data);
+	if (iodev->loopbacks) {
+		run_loopbacks(iodev, LOOPBACK_POST_MIX_PRE_DSP, frames,
+			      nframes);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_LOOPBACK,
+					  &stage_ts);
 	}
 
 	rc = apply_dsp(iodev, frames, nframes);
-	if (rc)
+	cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_DSP, &stage_ts);
+	if (rc) {
+		end_stage_block(iodev);
 		return rc;
+	}
 
-	DL_FOREACH (iodev->loopbacks, loopback) {
-		if (loopback->type == LOOPBACK_POST_DSP)
-			loopback->hook_data(frames, nframes, iodev->format,
-					    loopback->cb_data);
+	if (iodev->loopbacks) {
+		run_loopbacks(iodev, LOOPBACK_POST_DSP, frames, nframes);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_LOOPBACK,
+					  &stage_ts);
 	}
 
 	if (iodev->ramp) {
 		ramp_action = cras_ramp_get_current_action(iodev->ramp);
 	}
 
-	/* Mute samples if adjusted volume is 0 or system is muted, plus
-	 * that this device is not ramping. */
-	if (output_should_mute(iodev) &&
-	    ramp_action.type != CRAS_RAMP_ACTION_PARTIAL) {
-		const unsigned int frame_bytes = cras_get_format_bytes(fmt);
-		cras_mix_mute_buffer(frames, frame_bytes, nframes);
-	}
-
 	/* Compute scaler for software volume if needed. */
 	if (software_volume_needed) {
 		software_volume_scaler =
@@ -1113,7 +1185,115 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 
 	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
 		/* Scale with increment for ramp and possibly
-		 * software volume using cras_scale_buffer_increment.*/
+		 * software volume. */
+		scaler = ramp_action.scaler;
+		increment = ramp_action.increment;
+		target = ramp_action.target;
+
+		if (software_volume_needed) {
+			scaler *= software_volume_scaler;
+			increment *= software_volume_scaler;
+			target *= software_volume_scaler;
+		}
+	} else if (output_should_mute(iodev)) {
+		/* Mute samples if adjusted volume is 0 or system is muted,
+		 * plus that this device is not ramping. */
+		scaler = 0.0f;
+	} else if (software_volume_needed) {
+		scaler = software_volume_scaler;
+	}
+
+	/* Mute or scale, and calculate whether the final output was
+	 * non-empty if requested, in a single pass over the samples. */
+	cras_scale_buffer_check(fmt->format, frames, nframes, scaler,
+				increment, target, fmt->num_channels,
+				is_non_empty);
+	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL)
+		cras_ramp_update_ramped_frames(iodev->ramp, nframes);
+	cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_VOLUME, &stage_ts);
+
+	return commit_output_buffer(iodev, frames, nframes, remix_converter,
+				    &stage_ts);
+}
+
+int cras_iodev_put_output_mix_bus(struct cras_iodev *iodev,
+				  struct mix_bus *bus, uint8_t *frames,
+				  unsigned int nframes, int *is_non_empty,
+				  struct cras_fmt_conv *remix_converter)
+{
+	const struct cras_audio_format *fmt = iodev->format;
+	struct cras_ramp_action ramp_action = {
+		.type = CRAS_RAMP_ACTION_NONE,
+		.scaler = 0.0f,
+		.increment = 0.0f,
+		.target = 1.0f,
+	};
+	float software_volume_scaler = 1.0;
+	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
+	struct cras_dsp_context *ctx = iodev->dsp_context;
+	struct pipeline *pipeline = NULL;
+	struct timespec stage_ts;
+	int rc;
+
+	if (ctx)
+		pipeline = cras_dsp_get_pipeline(ctx);
+
+	/* A pipeline changing the number of channels can't run in place on
+	 * the bus, quantize and let the integer path handle it. */
+	if (pipeline &&
+	    (cras_dsp_pipeline_get_num_input_channels(pipeline) !=
+		     (int)bus->num_channels ||
+	     cras_dsp_pipeline_get_num_output_channels(pipeline) !=
+		     (int)bus->num_channels)) {
+		cras_dsp_put_pipeline(ctx);
+		mix_bus_quantize(bus, fmt->format, frames, nframes);
+		return cras_iodev_put_output_buffer(iodev, frames, nframes,
+						    is_non_empty,
+						    remix_converter);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &stage_ts);
+
+	if (has_loopback(iodev, LOOPBACK_POST_MIX_PRE_DSP)) {
+		mix_bus_quantize(bus, fmt->format, frames, nframes);
+		run_loopbacks(iodev, LOOPBACK_POST_MIX_PRE_DSP, frames,
+			      nframes);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_LOOPBACK,
+					  &stage_ts);
+	}
+
+	if (pipeline) {
+		rc = cras_dsp_pipeline_apply_float(pipeline, bus->planes,
+						   bus->num_channels, nframes);
+		cras_dsp_put_pipeline(ctx);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_DSP,
+					  &stage_ts);
+		if (rc) {
+			end_stage_block(iodev);
+			return rc;
+		}
+	}
+
+	if (has_loopback(iodev, LOOPBACK_POST_DSP)) {
+		mix_bus_quantize(bus, fmt->format, frames, nframes);
+		run_loopbacks(iodev, LOOPBACK_POST_DSP, frames, nframes);
+		cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_LOOPBACK,
+					  &stage_ts);
+	}
+
+	/* Checked after the DSP and before the volume, like the integer
+	 * path does. */
+	if (is_non_empty && mix_bus_is_non_empty(bus, nframes))
+		*is_non_empty = 1;
+
+	if (iodev->ramp)
+		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+
+	if (software_volume_needed)
+		software_volume_scaler =
+			cras_iodev_get_software_volume_scaler(iodev);
+
+	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
 		float starting_scaler = ramp_action.scaler;
 		float increment = ramp_action.increment;
 		float target = ramp_action.target;
@@ -1124,25 +1304,21 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 			target *= software_volume_scaler;
 		}
 
-		cras_scale_buffer_increment(fmt->format, frames, nframes,
-					    starting_scaler, increment, target,
-					    fmt->num_channels);
+		mix_bus_scale_increment(bus, nframes, starting_scaler,
+					increment, target);
 		cras_ramp_update_ramped_frames(iodev->ramp, nframes);
-	} else if (!output_should_mute(iodev) && software_volume_needed) {
-		/* Just scale for software volume using
-		 * cras_scale_buffer. */
-		unsigned int nsamples = nframes * fmt->num_channels;
-		cras_scale_buffer(fmt->format, frames, nsamples,
-				  software_volume_scaler);
+	} else if (output_should_mute(iodev)) {
+		mix_bus_zero(bus, 0, nframes);
+	} else if (software_volume_needed) {
+		mix_bus_scale(bus, nframes, software_volume_scaler);
 	}
+	cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_VOLUME, &stage_ts);
 
-	if (remix_converter)
-		cras_channel_remix_convert(remix_converter, iodev->format,
-					   frames, nframes);
-	if (iodev->rate_est)
-		rate_estimator_add_frames(iodev->rate_est, nframes);
+	mix_bus_quantize(bus, fmt->format, frames, nframes);
+	cras_iodev_stage_time_add(iodev, CRAS_OUTPUT_STAGE_FMT_CONV, &stage_ts);
 
-	return iodev->put_buffer(iodev, nframes);
+	return commit_output_buffer(iodev, frames, nframes, remix_converter,
+				    &stage_ts);
 }
 
 int cras_iodev_get_input_buffer(struct cras_iodev *iodev, unsigned int *frames)
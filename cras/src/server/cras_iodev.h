@@ -28,6 +28,7 @@ struct cras_audio_area;
 struct cras_audio_format;
 struct audio_thread;
 struct cras_iodev;
+struct mix_bus;
 struct rate_estimator;
 
 /*
@@ -141,6 +142,21 @@ struct cras_ionode {
 	struct cras_ionode *prev, *next;
 };
 
+/* Time spent by an output device in each stage of the output path.
+ * Members:
+ *    num_blocks - Number of blocks through the output path, committed to the
+ *        device or dropped by a DSP error.
+ *    block_ns - Time of each stage for the block being written.
+ *    total_ns - Total time of each stage, in nanoseconds.
+ *    max_ns - Longest time of each stage for one block, in nanoseconds.
+ */
+struct cras_iodev_stage_stats {
+	uint64_t num_blocks;
+	uint64_t block_ns[CRAS_NUM_OUTPUT_STAGES];
+	uint64_t total_ns[CRAS_NUM_OUTPUT_STAGES];
+	uint64_t max_ns[CRAS_NUM_OUTPUT_STAGES];
+};
+
 /* An input or output device, that can have audio routed to/from it.
  * set_volume - Function to call if the system volume changes.
  * set_capture_gain - Function to call if active node's capture_gain changes.
@@ -241,6 +257,7 @@ struct cras_ionode {
  *              stream side processing.
  * initial_ramp_request - The value indicates which type of ramp the device
  * should perform when some samples are ready for playback.
+ * stage_stats - Time spent in each stage of the output path since open.
  *
  */
 struct cras_iodev {
@@ -316,6 +333,7 @@ struct cras_iodev {
 	unsigned int input_dsp_offset;
 	unsigned int initial_ramp_request;
 	struct input_data *input_data;
+	struct cras_iodev_stage_stats stage_stats;
 	struct cras_iodev *prev, *next;
 };
 
@@ -578,6 +596,24 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes, int *is_non_empty,
 				 struct cras_fmt_conv *remix_converter);
 
+/* Marks a buffer from get_buffer as written, taking the samples from the
+ * float mix bus of the device. The DSP, ramping and volume stages run on the
+ * bus and the result is quantized into |frames| before it is committed.
+ * Args:
+ *    iodev - The output device.
+ *    bus - The mix bus holding the mixed samples at its head.
+ *    frames - The buffer from get_buffer.
+ *    nframes - The number of frames to commit.
+ *    is_non_empty - If not NULL, set to 1 if the output isn't silent.
+ *    remix_converter - Converter to remix the channels, may be NULL.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int cras_iodev_put_output_mix_bus(struct cras_iodev *iodev,
+				  struct mix_bus *bus, uint8_t *frames,
+				  unsigned int nframes, int *is_non_empty,
+				  struct cras_fmt_conv *remix_converter);
+
 /* Returns a buffer to read from.
  * Args:
  *    iodev - The device.
@@ -824,6 +860,18 @@ int cras_iodev_is_zero_volume(const struct cras_iodev *odev);
 void cras_iodev_update_highest_hw_level(struct cras_iodev *iodev,
 					unsigned int hw_level);
 
+/*
+ * Adds the time elapsed since |*start| to a stage of the output path, then
+ * sets |*start| to the current time so the next stage can be timed from it.
+ * Args:
+ *    iodev - The output device.
+ *    stage - The stage that ran since |*start|.
+ *    start - CLOCK_MONOTONIC_RAW time the stage started.
+ */
+void cras_iodev_stage_time_add(struct cras_iodev *iodev,
+			       enum CRAS_OUTPUT_STAGE stage,
+			       struct timespec *start);
+
 /*
  * Makes an input device drop the specific number of frames by given time.
  * Args:
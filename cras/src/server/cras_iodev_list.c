@@ -76,8 +76,21 @@ static uint32_t next_iodev_idx = MAX_SPECIAL_DEVICE_IDX;
 /* Call when a device is enabled or disabled. */
 struct device_enabled_cb *device_enable_cbs;
 
+/* An audio thread running a single device.
+ * Members:
+ *    dev_idx - The index of the device run by the thread.
+ *    thread - The audio thread.
+ */
+struct dev_thread {
+	unsigned int dev_idx;
+	struct audio_thread *thread;
+	struct dev_thread *prev, *next;
+};
+
 /* Thread that handles audio input and output. */
 static struct audio_thread *audio_thread;
+/* Threads of the devices opened while per device threads are enabled. */
+static struct dev_thread *dev_threads;
 /* List of all streams. */
 static struct stream_list *stream_list;
 /* Idle device timer. */
@@ -91,6 +104,173 @@ static int hotword_suspended = 0;
 
 static void idle_dev_check(struct cras_timer *timer, void *data);
 
+static struct dev_thread *find_dev_thread(unsigned int dev_idx)
+{
+	struct dev_thread *dt;
+
+	DL_FOREACH (dev_threads, dt)
+		if (dt->dev_idx == dev_idx)
+			return dt;
+	return NULL;
+}
+
+/* Returns the audio thread that runs |dev|. */
+static struct audio_thread *dev_audio_thread(const struct cras_iodev *dev)
+{
+	struct dev_thread *dt = find_dev_thread(dev->info.idx);
+
+	return dt ? dt->thread : audio_thread;
+}
+
+/* Returns the audio thread to run |dev|, creating one for it if per device
+ * threads are enabled. Special devices and the loopback devices, which are
+ * fed by the output devices, stay in the shared thread. Falls back to the
+ * shared thread if a new thread can't be started. */
+static struct audio_thread *start_dev_thread(struct cras_iodev *dev)
+{
+	struct dev_thread *dt;
+	struct audio_thread *thread;
+
+	if (!cras_system_get_per_device_threads_enabled() ||
+	    dev->info.idx < MAX_SPECIAL_DEVICE_IDX || dev == loopdev_post_mix ||
+	    dev == loopdev_post_dsp)
+		return audio_thread;
+
+	dt = find_dev_thread(dev->info.idx);
+	if (dt)
+		return dt->thread;
+
+	thread = audio_thread_create();
+	if (!thread) {
+		syslog(LOG_ERR, "Failed to create audio thread for dev %u",
+		       dev->info.idx);
+		return audio_thread;
+	}
+	if (audio_thread_start(thread)) {
+		audio_thread_destroy(thread);
+		return audio_thread;
+	}
+
+	dt = (struct dev_thread *)calloc(1, sizeof(*dt));
+	dt->dev_idx = dev->info.idx;
+	dt->thread = thread;
+	DL_APPEND(dev_threads, dt);
+	return thread;
+}
+
+/* Stops the thread running |dev| if it has its own. */
+static void stop_dev_thread(struct cras_iodev *dev)
+{
+	struct dev_thread *dt = find_dev_thread(dev->info.idx);
+
+	if (!dt)
+		return;
+	DL_DELETE(dev_threads, dt);
+	audio_thread_destroy(dt->thread);
+	free(dt);
+}
+
+/* Disconnects |streams| from |dev|, or from all devices if |dev| is NULL,
+ * with one message to each audio thread involved. */
+static int disconnect_streams(struct cras_rstream **streams,
+			      unsigned int num_streams, struct cras_iodev *dev)
+{
+	struct dev_thread *dt;
+	int rc;
+
+	if (dev)
+		return audio_thread_disconnect_streams(dev_audio_thread(dev),
+						       streams, num_streams,
+						       &dev, 1);
+
+	rc = audio_thread_disconnect_streams(audio_thread, streams,
+					     num_streams, NULL, 0);
+	DL_FOREACH (dev_threads, dt)
+		audio_thread_disconnect_streams(dt->thread, streams,
+						num_streams, NULL, 0);
+	return rc;
+}
+
+/* Disconnects |stream| from |dev|, or from all devices if |dev| is NULL. */
+static int disconnect_stream(struct cras_rstream *stream,
+			     struct cras_iodev *dev)
+{
+	return disconnect_streams(&stream, 1, dev);
+}
+
+/* Allocates an array that can hold all the streams in the stream list.
+ * Returns NULL on allocation failure. */
+static struct cras_rstream **alloc_stream_array()
+{
+	struct cras_rstream *stream;
+	unsigned int num_streams = 1;
+
+	DL_FOREACH (stream_list_get(stream_list), stream)
+		num_streams++;
+	return (struct cras_rstream **)calloc(num_streams,
+					      sizeof(struct cras_rstream *));
+}
+
+/* Drains |stream| in every thread it may be attached to. Returns the number
+ * of milliseconds left until it is drained from all of them. */
+static int drain_stream(struct cras_rstream *stream)
+{
+	struct dev_thread *dt;
+	int ms_left, rc;
+
+	ms_left = audio_thread_drain_stream(audio_thread, stream);
+	DL_FOREACH (dev_threads, dt) {
+		rc = audio_thread_drain_stream(dt->thread, stream);
+		ms_left = MAX(ms_left, rc);
+	}
+	return ms_left;
+}
+
+/* Adds |streams| to the open devices, through the thread running each one,
+ * with one message per thread. A stream attached to devices of different
+ * threads shares its buffer between them through the per device offsets of
+ * its buffer_share. */
+static int add_streams_to_threads(struct cras_rstream **streams,
+				  unsigned int num_streams,
+				  struct cras_iodev **iodevs,
+				  unsigned int num_iodevs)
+{
+	struct cras_iodev **group;
+	struct audio_thread *thread;
+	unsigned int i, j, num_group;
+	int rc = 0;
+
+	if (!dev_threads)
+		return audio_thread_add_streams(audio_thread, streams,
+						num_streams, iodevs,
+						num_iodevs);
+
+	group = (struct cras_iodev **)calloc(num_iodevs, sizeof(*group));
+	if (!group)
+		return -ENOMEM;
+
+	for (i = 0; i < num_iodevs && rc == 0; i++) {
+		thread = dev_audio_thread(iodevs[i]);
+
+		/* Skip the threads already handled. */
+		for (j = 0; j < i; j++)
+			if (dev_audio_thread(iodevs[j]) == thread)
+				break;
+		if (j < i)
+			continue;
+
+		num_group = 0;
+		for (j = i; j < num_iodevs; j++)
+			if (dev_audio_thread(iodevs[j]) == thread)
+				group[num_group++] = iodevs[j];
+		rc = audio_thread_add_streams(thread, streams, num_streams,
+					      group, num_group);
+	}
+
+	free(group);
+	return rc;
+}
+
 static struct cras_iodev *find_dev(size_t dev_index)
 {
 	struct cras_iodev *dev;
@@ -324,7 +504,7 @@ static void sys_mute_change(void *context, int muted, int user_muted,
 			cras_iodev_set_mute(dev);
 		} else {
 			audio_thread_dev_start_ramp(
-				audio_thread, dev->info.idx,
+				dev_audio_thread(dev), dev->info.idx,
 				(should_mute ?
 					 CRAS_IODEV_RAMP_REQUEST_DOWN_MUTE :
 					 CRAS_IODEV_RAMP_REQUEST_UP_UNMUTE));
@@ -336,7 +516,8 @@ static void remove_all_streams_from_dev(struct cras_iodev *dev)
 {
 	struct cras_rstream *rstream;
 
-	audio_thread_rm_open_dev(audio_thread, dev->direction, dev->info.idx);
+	audio_thread_rm_open_dev(dev_audio_thread(dev), dev->direction,
+				 dev->info.idx);
 
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
 		if (rstream->apm_list == NULL)
@@ -388,6 +569,7 @@ static int close_dev_without_idle_check(struct cras_iodev *dev)
 	remove_all_streams_from_dev(dev);
 	dev->idle_timeout.tv_sec = 0;
 	cras_iodev_close(dev);
+	stop_dev_thread(dev);
 	possibly_disable_echo_reference(dev);
 	return 0;
 }
@@ -466,6 +648,7 @@ static void cancel_pending_init_retries(unsigned int dev_idx)
 /* Open the device potentially filling the output with a pre buffer. */
 static int init_device(struct cras_iodev *dev, struct cras_rstream *rstream)
 {
+	struct audio_thread *thread;
 	int rc;
 
 	cras_iodev_exit_idle(dev);
@@ -474,13 +657,22 @@ static int init_device(struct cras_iodev *dev, struct cras_rstream *rstream)
 		return 0;
 	cancel_pending_init_retries(dev->info.idx);
 
+	/* Callbacks the device adds while opening are polled by the thread
+	 * that runs it. */
+	thread = start_dev_thread(dev);
+	audio_thread_set_callback_owner(thread);
 	rc = cras_iodev_open(dev, rstream->cb_threshold, &rstream->format);
-	if (rc)
+	audio_thread_set_callback_owner(NULL);
+	if (rc) {
+		stop_dev_thread(dev);
 		return rc;
+	}
 
-	rc = audio_thread_add_open_dev(audio_thread, dev);
-	if (rc)
+	rc = audio_thread_add_open_dev(thread, dev);
+	if (rc) {
 		cras_iodev_close(dev);
+		stop_dev_thread(dev);
+	}
 
 	possibly_enable_echo_reference(dev);
 
@@ -491,24 +683,38 @@ static void suspend_devs()
 {
 	struct enabled_dev *edev;
 	struct cras_rstream *rstream;
+	struct cras_rstream **streams;
+	unsigned int num_streams = 0;
 
+	/* Detach the streams that aren't pinned with one message to each
+	 * thread. */
+	streams = alloc_stream_array();
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
-		if (rstream->is_pinned) {
-			struct cras_iodev *dev;
-
-			if ((rstream->flags & HOTWORD_STREAM) == HOTWORD_STREAM)
-				continue;
-
-			dev = find_dev(rstream->pinned_dev_idx);
-			if (dev) {
-				audio_thread_disconnect_stream(audio_thread,
-							       rstream, dev);
-				if (!cras_iodev_list_dev_is_enabled(dev))
-					close_dev(dev);
-			}
-		} else {
-			audio_thread_disconnect_stream(audio_thread, rstream,
-						       NULL);
+		if (rstream->is_pinned)
+			continue;
+		if (streams)
+			streams[num_streams++] = rstream;
+		else
+			disconnect_stream(rstream, NULL);
+	}
+	if (streams) {
+		disconnect_streams(streams, num_streams, NULL);
+		free(streams);
+	}
+
+	DL_FOREACH (stream_list_get(stream_list), rstream) {
+		struct cras_iodev *dev;
+
+		if (!rstream->is_pinned)
+			continue;
+		if ((rstream->flags & HOTWORD_STREAM) == HOTWORD_STREAM)
+			continue;
+
+		dev = find_dev(rstream->pinned_dev_idx);
+		if (dev) {
+			disconnect_stream(rstream, dev);
+			if (!cras_iodev_list_dev_is_enabled(dev))
+				close_dev(dev);
 		}
 	}
 	stream_list_suspended = 1;
@@ -522,6 +728,7 @@ static void suspend_devs()
 }
 
 static int stream_added_cb(struct cras_rstream *rstream);
+static int default_streams_added(enum CRAS_STREAM_DIRECTION dir);
 
 static void resume_devs()
 {
@@ -547,9 +754,16 @@ static void resume_devs()
 		}
 	}
 
+	/* Streams that aren't pinned all go to the enabled devices, add them
+	 * in a batch. */
+	default_streams_added(CRAS_STREAM_OUTPUT);
+	default_streams_added(CRAS_STREAM_INPUT);
+
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
 		if ((rstream->flags & HOTWORD_STREAM) == HOTWORD_STREAM)
 			continue;
+		if (!rstream->is_pinned)
+			continue;
 		stream_added_cb(rstream);
 	}
 }
@@ -618,31 +832,44 @@ static void possibly_enable_fallback(enum CRAS_STREAM_DIRECTION dir, bool error)
 }
 
 /*
- * Adds stream to one or more open iodevs. If the stream has processing effect
+ * Adds streams to one or more open iodevs. If a stream has processing effect
  * turned on, create new APM instance and add to the list. This makes sure the
  * time consuming APM creation happens in main thread.
  */
+static int add_streams_to_open_devs(struct cras_rstream **streams,
+				    unsigned int num_streams,
+				    struct cras_iodev **iodevs,
+				    unsigned int num_iodevs)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < num_streams; i++) {
+		if (!streams[i]->apm_list)
+			continue;
+		for (j = 0; j < num_iodevs; j++)
+			cras_apm_list_add_apm(streams[i]->apm_list, iodevs[j],
+					      iodevs[j]->format,
+					      cras_iodev_is_aec_use_case(
+						      iodevs[j]->active_node));
+	}
+	return add_streams_to_threads(streams, num_streams, iodevs,
+				      num_iodevs);
+}
+
 static int add_stream_to_open_devs(struct cras_rstream *stream,
 				   struct cras_iodev **iodevs,
 				   unsigned int num_iodevs)
 {
-	int i;
-	if (stream->apm_list) {
-		for (i = 0; i < num_iodevs; i++)
-			cras_apm_list_add_apm(stream->apm_list, iodevs[i],
-					      iodevs[i]->format,
-					      cras_iodev_is_aec_use_case(
-						      iodevs[i]->active_node));
-	}
-	return audio_thread_add_stream(audio_thread, stream, iodevs,
-				       num_iodevs);
+	return add_streams_to_open_devs(&stream, 1, iodevs, num_iodevs);
 }
 
 static int init_and_attach_streams(struct cras_iodev *dev)
 {
-	int rc;
+	int rc = 0;
 	enum CRAS_STREAM_DIRECTION dir = dev->direction;
 	struct cras_rstream *stream;
+	struct cras_rstream **streams;
+	unsigned int num_streams = 0;
 	int dev_enabled = cras_iodev_list_dev_is_enabled(dev);
 
 	/* If called after suspend, for example bluetooth
@@ -650,6 +877,10 @@ static int init_and_attach_streams(struct cras_iodev *dev)
 	if (stream_list_suspended)
 		return 0;
 
+	streams = alloc_stream_array();
+	if (!streams)
+		return -ENOMEM;
+
 	/* If there are active streams to attach to this device,
 	 * open it. */
 	DL_FOREACH (stream_list_get(stream_list), stream) {
@@ -685,11 +916,17 @@ static int init_and_attach_streams(struct cras_iodev *dev)
 		if (rc) {
 			syslog(LOG_ERR, "Enable %s failed, rc = %d",
 			       dev->info.name, rc);
-			return rc;
+			break;
 		}
-		add_stream_to_open_devs(stream, &dev, 1);
+		streams[num_streams++] = stream;
 	}
-	return 0;
+
+	/* Attach all the streams in one go rather than waking the audio
+	 * thread for each of them. */
+	if (num_streams)
+		add_streams_to_open_devs(streams, num_streams, &dev, 1);
+	free(streams);
+	return rc;
 }
 
 static void init_device_cb(struct cras_timer *timer, void *arg)
@@ -738,7 +975,7 @@ static int init_pinned_device(struct cras_iodev *dev,
 
 	cras_iodev_exit_idle(dev);
 
-	if (audio_thread_is_dev_open(audio_thread, dev))
+	if (audio_thread_is_dev_open(dev_audio_thread(dev), dev))
 		return 0;
 
 	/* Make sure the active node is configured properly, it could be
@@ -856,6 +1093,66 @@ static int stream_added_cb(struct cras_rstream *rstream)
 	return 0;
 }
 
+/* Adds all the streams of |dir| that aren't pinned to the enabled devices,
+ * like stream_added_cb() does for each of them but with a single message to
+ * each audio thread. */
+static int default_streams_added(enum CRAS_STREAM_DIRECTION dir)
+{
+	struct enabled_dev *edev;
+	struct cras_iodev *iodevs[10];
+	struct cras_rstream *rstream;
+	struct cras_rstream **streams;
+	unsigned int num_iodevs, num_streams = 0;
+	int rc = 0;
+
+	streams = alloc_stream_array();
+	DL_FOREACH (stream_list_get(stream_list), rstream) {
+		if (rstream->direction != dir || rstream->is_pinned)
+			continue;
+		if ((rstream->flags & HOTWORD_STREAM) == HOTWORD_STREAM)
+			continue;
+		if (!streams) {
+			stream_added_cb(rstream);
+			continue;
+		}
+		streams[num_streams++] = rstream;
+	}
+	if (num_streams == 0)
+		goto out;
+
+	num_iodevs = 0;
+	DL_FOREACH (enabled_devs[dir], edev) {
+		if (num_iodevs >= ARRAY_SIZE(iodevs)) {
+			syslog(LOG_ERR, "too many enabled devices");
+			break;
+		}
+
+		rc = init_device(edev->dev, streams[0]);
+		if (rc) {
+			syslog(LOG_ERR, "Init %s failed, rc = %d",
+			       edev->dev->info.name, rc);
+			schedule_init_device_retry(edev->dev);
+			continue;
+		}
+
+		iodevs[num_iodevs++] = edev->dev;
+	}
+	if (num_iodevs) {
+		rc = add_streams_to_open_devs(streams, num_streams, iodevs,
+					      num_iodevs);
+		if (rc)
+			syslog(LOG_ERR, "adding streams to thread fail");
+	} else {
+		/* The fallback device attaches the streams when enabled. */
+		possibly_enable_fallback(dir, true);
+		rc = 0;
+	}
+
+out:
+	free(streams);
+	return rc;
+}
+
 static int possibly_close_enabled_devs(enum CRAS_STREAM_DIRECTION dir)
 {
 	struct enabled_dev *edev;
@@ -905,7 +1202,7 @@ static int stream_removed_cb(struct cras_rstream *rstream)
 	enum CRAS_STREAM_DIRECTION direction = rstream->direction;
 	int rc;
 
-	rc = audio_thread_drain_stream(audio_thread, rstream);
+	rc = drain_stream(rstream);
 	if (rc)
 		return rc;
 
@@ -974,7 +1271,7 @@ static int disable_device(struct enabled_dev *edev, bool force)
 			continue;
 		if (stream->is_pinned && !force)
 			continue;
-		audio_thread_disconnect_stream(audio_thread, stream, dev);
+		disconnect_stream(stream, dev);
 	}
 	/* If this is a force disable call, that guarantees pinned streams have
 	 * all been detached. Otherwise check with stream_list to see if
@@ -1012,7 +1309,7 @@ static int force_close_pinned_only_device(struct cras_iodev *dev)
 			continue;
 		if (dev->info.idx != rstream->pinned_dev_idx)
 			continue;
-		audio_thread_disconnect_stream(audio_thread, rstream, dev);
+		disconnect_stream(rstream, dev);
 	}
 
 	close_dev(dev);
@@ -1070,6 +1367,13 @@ void cras_iodev_list_init()
 
 void cras_iodev_list_deinit()
 {
+	struct dev_thread *dt;
+
+	DL_FOREACH (dev_threads, dt) {
+		DL_DELETE(dev_threads, dt);
+		audio_thread_destroy(dt->thread);
+		free(dt);
+	}
 	audio_thread_destroy(audio_thread);
 	loopback_iodev_destroy(loopdev_post_dsp);
 	loopback_iodev_destroy(loopdev_post_mix);
@@ -1185,8 +1489,7 @@ void cras_iodev_list_suspend_dev(unsigned int dev_idx)
 		if ((dev->is_enabled && !rstream->is_pinned) ||
 		    (rstream->is_pinned &&
 		     (dev->info.idx != rstream->pinned_dev_idx)))
-			audio_thread_disconnect_stream(audio_thread, rstream,
-						       dev);
+			disconnect_stream(rstream, dev);
 	}
 	close_dev(dev);
 	dev->update_active_node(dev, dev->active_node->idx, 0);
@@ -1413,10 +1716,8 @@ int cras_iodev_list_suspend_hotword_streams()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
-					       hotword_dev);
-		audio_thread_add_stream(audio_thread, stream,
-					&empty_hotword_dev, 1);
+		disconnect_stream(stream, hotword_dev);
+		add_streams_to_threads(&stream, 1, &empty_hotword_dev, 1);
 	}
 	close_pinned_device(hotword_dev);
 	hotword_suspended = 1;
@@ -1449,9 +1750,8 @@ int cras_iodev_list_resume_hotword_stream()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
-					       empty_hotword_dev);
-		audio_thread_add_stream(audio_thread, stream, &hotword_dev, 1);
+		disconnect_stream(stream, empty_hotword_dev);
+		add_streams_to_threads(&stream, 1, &hotword_dev, 1);
 	}
 	close_pinned_device(empty_hotword_dev);
 	hotword_suspended = 0;
@@ -57,6 +57,17 @@ void cras_scale_buffer(snd_pcm_format_t fmt, uint8_t *buff, unsigned int count,
 	ops->scale_buffer(fmt, buff, count, scaler);
 }
 
+void cras_scale_buffer_check(snd_pcm_format_t fmt, uint8_t *buff,
+			     unsigned int frame, float scaler,
+			     float increment, float target, int channel,
+			     int *is_non_empty)
+{
+	if (ops->scale_buffer_check(fmt, buff, frame * channel, scaler,
+				    increment, target, channel,
+				    is_non_empty != NULL))
+		*is_non_empty = 1;
+}
+
 void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		  unsigned int count, unsigned int index, int mute,
 		  float mix_vol)
@@ -76,3 +87,10 @@ size_t cras_mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count)
 {
 	return ops->mute_buffer(dst, frame_bytes, count);
 }
+
+float cras_mix_fir_interp_f32(const float *src, const float *coef0,
+			      const float *coef1, float frac,
+			      unsigned int taps)
+{
+	return ops->fir_interp_f32(src, coef0, coef1, frac, taps);
+}
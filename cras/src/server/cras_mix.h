@@ -6,16 +6,11 @@
 #ifndef _CRAS_MIX_H
 #define _CRAS_MIX_H
 
+#include "cras_cpu_flags.h"
 #include "cras_types.h"
 
 struct cras_audio_shm;
 
-/* SIMD optimisation flags */
-#define CPU_X86_SSE4_2 1
-#define CPU_X86_AVX 2
-#define CPU_X86_AVX2 4
-#define CPU_X86_FMA 8
-
 void cras_mix_init(unsigned int flags);
 
 /* Scale the given buffer with the provided scaler and increment.
@@ -44,6 +39,25 @@ void cras_scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 void cras_scale_buffer(snd_pcm_format_t fmt, uint8_t *buff, unsigned int count,
 		       float scaler);
 
+/* Scales the buffer like cras_scale_buffer_increment() and finds out whether
+ * it was silent before scaling. With a constant scaler, increment 0, both are
+ * done in one pass over the samples.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    buff - Buffer of samples to scale.
+ *    frame - The number of frames to render.
+ *    scaler - Amount to scale samples (0.0 - 1.0).
+ *    increment - The increment(+/-) of scaler at each frame, or 0.
+ *    target - The value at which to clip the scaler.
+ *    channel - Number of samples in a frame.
+ *    is_non_empty - Set to 1 if any sample was non-zero before scaling,
+ *        left untouched otherwise. NULL to skip the check.
+ */
+void cras_scale_buffer_check(snd_pcm_format_t fmt, uint8_t *buff,
+			     unsigned int frame, float scaler,
+			     float increment, float target, int channel,
+			     int *is_non_empty);
+
 /* Add src buffer to dst, scaling and setting mute.
  * Args:
  *    fmt - The format (SND_PCM_FORMAT_*)
@@ -80,4 +94,19 @@ void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
  */
 size_t cras_mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count);
 
+/* Runs two FIR filters over the same float samples and linearly interpolates
+ * between their outputs. This is the inner loop of the polyphase resampler.
+ * Args:
+ *    src - The |taps| samples under the filters.
+ *    coef0 - Coefficients of the first filter.
+ *    coef1 - Coefficients of the second filter.
+ *    frac - Weight of the second filter output, 0.0 - 1.0.
+ *    taps - The number of coefficients of each filter.
+ * Returns:
+ *    The interpolated output sample.
+ */
+float cras_mix_fir_interp_f32(const float *src, const float *coef0,
+			      const float *coef1, float frac,
+			      unsigned int taps);
+
 #endif /* _CRAS_MIX_H */
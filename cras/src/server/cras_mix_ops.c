@@ -5,6 +5,16 @@
 
 #include <stdint.h>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "cras_system_state.h"
 #include "cras_mix_ops.h"
 
@@ -33,6 +43,332 @@ static inline int need_to_scale(float scaler)
 	return (scaler < 0.99 || scaler > 1.01);
 }
 
+#if defined(__SSE4_1__)
+/*
+ * SSE4.1 kernels, built into all the x86 variants. Four samples are moved
+ * into 32 bit lanes, mixed there and moved back, giving the same results as
+ * the scalar loops below.
+ */
+
+/* Moves four samples of |stride| bytes apart into 32 bit lanes. */
+static inline __m128i gather_s16(const uint8_t *p, unsigned int stride)
+{
+	return _mm_setr_epi32(*(const int16_t *)p,
+			      *(const int16_t *)(p + stride),
+			      *(const int16_t *)(p + 2 * stride),
+			      *(const int16_t *)(p + 3 * stride));
+}
+
+static inline __m128i gather_s32(const uint8_t *p, unsigned int stride)
+{
+	return _mm_setr_epi32(*(const int32_t *)p,
+			      *(const int32_t *)(p + stride),
+			      *(const int32_t *)(p + 2 * stride),
+			      *(const int32_t *)(p + 3 * stride));
+}
+
+static inline int32_t read_s24_3le_as_s32(const uint8_t *p)
+{
+	return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+			 (uint32_t)p[2] << 24);
+}
+
+/* Reads four packed 24 bit samples as S32_LE, without touching the bytes
+ * past the last sample. */
+static inline __m128i load_s24_3le(const uint8_t *p)
+{
+	const __m128i shuf = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7,
+					   8, -1, 9, 10, 11);
+	int32_t tail;
+	__m128i v;
+
+	memcpy(&tail, p + 8, sizeof(tail));
+	v = _mm_insert_epi32(_mm_loadl_epi64((const __m128i *)p), tail, 2);
+	return _mm_shuffle_epi8(v, shuf);
+}
+
+/* Writes the low 24 bits of each lane as four packed samples. */
+static inline void store_s24_3le(uint8_t *p, __m128i v)
+{
+	const __m128i shuf = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+					   14, -1, -1, -1, -1);
+	int32_t tail;
+
+	v = _mm_shuffle_epi8(v, shuf);
+	_mm_storel_epi64((__m128i *)p, v);
+	tail = _mm_extract_epi32(v, 2);
+	memcpy(p + 8, &tail, sizeof(tail));
+}
+
+static inline __m128i gather_s24_3le(const uint8_t *p, unsigned int stride)
+{
+	return _mm_setr_epi32(read_s24_3le_as_s32(p),
+			      read_s24_3le_as_s32(p + stride),
+			      read_s24_3le_as_s32(p + 2 * stride),
+			      read_s24_3le_as_s32(p + 3 * stride));
+}
+
+static inline void scatter_s24_3le(uint8_t *p, unsigned int stride,
+				   __m128i v)
+{
+	int32_t lanes[4];
+	unsigned int i;
+
+	_mm_storeu_si128((__m128i *)lanes, v);
+	for (i = 0; i < 4; i++, p += stride) {
+		p[0] = lanes[i] & 0xff;
+		p[1] = (lanes[i] >> 8) & 0xff;
+		p[2] = (lanes[i] >> 16) & 0xff;
+	}
+}
+
+static inline void scatter_s32(uint8_t *p, unsigned int stride, __m128i v)
+{
+	*(int32_t *)p = _mm_extract_epi32(v, 0);
+	*(int32_t *)(p + stride) = _mm_extract_epi32(v, 1);
+	*(int32_t *)(p + 2 * stride) = _mm_extract_epi32(v, 2);
+	*(int32_t *)(p + 3 * stride) = _mm_extract_epi32(v, 3);
+}
+
+/* Converts to S32 with truncation, saturating the values out of range like
+ * the int64_t clipping in the scalar code. */
+static inline __m128i cvtt_sat_s32(__m128 v)
+{
+	__m128 over = _mm_cmpge_ps(v, _mm_set1_ps(2147483648.0f));
+
+	/* Lanes below INT32_MIN already convert to INT32_MIN. */
+	return _mm_blendv_epi8(_mm_cvttps_epi32(v),
+			       _mm_set1_epi32(INT32_MAX),
+			       _mm_castps_si128(over));
+}
+
+static inline __m128i clip_s24(__m128i v)
+{
+	return _mm_min_epi32(_mm_max_epi32(v, _mm_set1_epi32(-0x800000)),
+			     _mm_set1_epi32(0x7fffff));
+}
+
+/* Adds with S32 saturation. */
+static inline __m128i adds_s32(__m128i a, __m128i b)
+{
+	__m128i sum = _mm_add_epi32(a, b);
+	__m128i overflow = _mm_and_si128(_mm_xor_si128(a, sum),
+					 _mm_xor_si128(b, sum));
+	__m128i sat = _mm_xor_si128(_mm_srai_epi32(a, 31),
+				    _mm_set1_epi32(INT32_MAX));
+
+	return _mm_blendv_epi8(sum, sat, _mm_srai_epi32(overflow, 31));
+}
+
+/* Mixes |count| samples of |src| scaled by |scaler| into |dst|, four at a
+ * time. Returns the number of samples done, the rest is left to the scalar
+ * loop. */
+static unsigned int stride_s16_sse(uint8_t *dst, const uint8_t *src,
+				   unsigned int dst_stride,
+				   unsigned int src_stride, unsigned int count,
+				   float scaler)
+{
+	const int scale = need_to_scale(scaler);
+	const __m128 vscaler = _mm_set1_ps(scaler);
+	__m128i d, s, sum;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = gather_s16(dst, dst_stride);
+		s = gather_s16(src, src_stride);
+		if (scale)
+			sum = _mm_cvttps_epi32(_mm_add_ps(
+				_mm_cvtepi32_ps(d),
+				_mm_mul_ps(_mm_cvtepi32_ps(s), vscaler)));
+		else
+			sum = _mm_add_epi32(d, s);
+		sum = _mm_packs_epi32(sum, sum);
+		*(int16_t *)dst = _mm_extract_epi16(sum, 0);
+		*(int16_t *)(dst + dst_stride) = _mm_extract_epi16(sum, 1);
+		*(int16_t *)(dst + 2 * dst_stride) = _mm_extract_epi16(sum, 2);
+		*(int16_t *)(dst + 3 * dst_stride) = _mm_extract_epi16(sum, 3);
+		dst += 4 * dst_stride;
+		src += 4 * src_stride;
+	}
+	return i;
+}
+
+static unsigned int stride_s24_sse(uint8_t *dst, const uint8_t *src,
+				   unsigned int dst_stride,
+				   unsigned int src_stride, unsigned int count,
+				   float scaler)
+{
+	const int scale = need_to_scale(scaler);
+	const __m128 vscaler = _mm_set1_ps(scaler);
+	__m128i d, s;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = gather_s32(dst, dst_stride);
+		s = gather_s32(src, src_stride);
+		if (scale) {
+			/* Same as scale_s24_le(). */
+			s = _mm_cvttps_epi32(_mm_mul_ps(
+				_mm_cvtepi32_ps(_mm_slli_epi32(s, 8)),
+				vscaler));
+			s = _mm_srli_epi32(s, 8);
+		}
+		scatter_s32(dst, dst_stride, clip_s24(_mm_add_epi32(d, s)));
+		dst += 4 * dst_stride;
+		src += 4 * src_stride;
+	}
+	return i;
+}
+
+static unsigned int stride_s32_sse(uint8_t *dst, const uint8_t *src,
+				   unsigned int dst_stride,
+				   unsigned int src_stride, unsigned int count,
+				   float scaler)
+{
+	const int scale = need_to_scale(scaler);
+	const __m128 vscaler = _mm_set1_ps(scaler);
+	__m128i d, s, sum;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = gather_s32(dst, dst_stride);
+		s = gather_s32(src, src_stride);
+		if (scale)
+			sum = cvtt_sat_s32(_mm_add_ps(
+				_mm_cvtepi32_ps(d),
+				_mm_mul_ps(_mm_cvtepi32_ps(s), vscaler)));
+		else
+			sum = adds_s32(d, s);
+		scatter_s32(dst, dst_stride, sum);
+		dst += 4 * dst_stride;
+		src += 4 * src_stride;
+	}
+	return i;
+}
+
+static unsigned int stride_s24_3le_sse(uint8_t *dst, const uint8_t *src,
+				       unsigned int dst_stride,
+				       unsigned int src_stride,
+				       unsigned int count, float scaler)
+{
+	const int scale = need_to_scale(scaler);
+	const __m128 vscaler = _mm_set1_ps(scaler);
+	__m128i d, s, sum;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = gather_s24_3le(dst, dst_stride);
+		s = gather_s24_3le(src, src_stride);
+		if (scale)
+			sum = _mm_srai_epi32(
+				cvtt_sat_s32(_mm_add_ps(
+					_mm_cvtepi32_ps(d),
+					_mm_mul_ps(_mm_cvtepi32_ps(s),
+						   vscaler))),
+				8);
+		else
+			sum = clip_s24(_mm_add_epi32(_mm_srai_epi32(d, 8),
+						     _mm_srai_epi32(s, 8)));
+		scatter_s24_3le(dst, dst_stride, sum);
+		dst += 4 * dst_stride;
+		src += 4 * src_stride;
+	}
+	return i;
+}
+
+/* Mixes packed 24 bit samples. The samples are kept as S32 with the low
+ * byte clear, so they convert to float exactly and the sum of two of them
+ * shifted down by eight is the sum of the 24 bit values. */
+static unsigned int add_s24_3le_sse(uint8_t *dst, const uint8_t *src,
+				    unsigned int count, float vol)
+{
+	const __m128 vvol = _mm_set1_ps(vol);
+	__m128i d, s;
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		d = _mm_srai_epi32(load_s24_3le(dst), 8);
+		s = load_s24_3le(src);
+		if (vol > MAX_VOLUME_TO_SCALE)
+			s = _mm_srai_epi32(s, 8);
+		else
+			s = _mm_srai_epi32(
+				_mm_cvttps_epi32(_mm_mul_ps(
+					_mm_cvtepi32_ps(s), vvol)),
+				8);
+		store_s24_3le(dst, clip_s24(_mm_add_epi32(d, s)));
+		dst += 12;
+		src += 12;
+	}
+	return i;
+}
+
+/* Scales |count| packed 24 bit samples from |src| into |dst|, which may be
+ * the same buffer. |scalers| has the scaler of each of the four lanes. */
+static inline void scale_s24_3le_sse(uint8_t *dst, const uint8_t *src,
+				     __m128 scalers)
+{
+	__m128 v = _mm_cvtepi32_ps(load_s24_3le(src));
+
+	v = _mm_mul_ps(v, scalers);
+	store_s24_3le(dst, _mm_srai_epi32(_mm_cvttps_epi32(v), 8));
+}
+
+static unsigned int copy_scaled_s24_3le_sse(uint8_t *dst, const uint8_t *src,
+					    unsigned int count, float scaler)
+{
+	const __m128 vscaler = _mm_set1_ps(scaler);
+	unsigned int i;
+
+	for (i = 0; i + 4 <= count; i += 4, dst += 12, src += 12)
+		scale_s24_3le_sse(dst, src, vscaler);
+	return i;
+}
+#endif
+
+/* Returns non-zero if any of the |bytes| bytes at |buf| is non-zero. Checks
+ * 64 bytes at a time so silence is found with few branches. */
+static int buffer_is_non_empty(const uint8_t *buf, size_t bytes)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 64 <= bytes; i += 64) {
+		__m256i v = _mm256_or_si256(
+			_mm256_loadu_si256((const __m256i *)(buf + i)),
+			_mm256_loadu_si256((const __m256i *)(buf + i + 32)));
+		if (!_mm256_testz_si256(v, v))
+			return 1;
+	}
+#elif defined(__SSE4_1__)
+	for (; i + 64 <= bytes; i += 64) {
+		const __m128i *p = (const __m128i *)(buf + i);
+		__m128i v = _mm_or_si128(
+			_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+			_mm_or_si128(_mm_loadu_si128(p + 2),
+				     _mm_loadu_si128(p + 3)));
+		if (!_mm_testz_si128(v, v))
+			return 1;
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 64 <= bytes; i += 64) {
+		uint64x2_t v = vreinterpretq_u64_u8(
+			vorrq_u8(vorrq_u8(vld1q_u8(buf + i),
+					  vld1q_u8(buf + i + 16)),
+				 vorrq_u8(vld1q_u8(buf + i + 32),
+					  vld1q_u8(buf + i + 48))));
+		if (vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1))
+			return 1;
+	}
+#endif
+
+	for (; i < bytes; i++) {
+		if (buf[i])
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Signed 16 bit little endian functions.
  */
@@ -140,6 +476,22 @@ static void cras_scale_buffer_s16_le(uint8_t *buffer, unsigned int count,
 		out[i] *= scaler;
 }
 
+/* Scales like cras_scale_buffer_s16_le() and returns non-zero if any sample
+ * was non-zero before scaling. */
+static int scale_check_s16_le(uint8_t *buffer, unsigned int count,
+			      float scaler)
+{
+	int16_t *out = (int16_t *)buffer;
+	int16_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		seen |= out[i];
+		out[i] *= scaler;
+	}
+	return seen != 0;
+}
+
 static void cras_mix_add_s16_le(uint8_t *dst, uint8_t *src, unsigned int count,
 				unsigned int index, int mute, float mix_vol)
 {
@@ -165,6 +517,16 @@ static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+#if defined(__SSE4_1__)
+	if (dst_stride != 2 || src_stride != 2) {
+		i = stride_s16_sse(dst, src, dst_stride, src_stride, count,
+				   scaler);
+		dst += i * dst_stride;
+		src += i * src_stride;
+		count -= i;
+	}
+#endif
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 2) {
 		for (i = 0; i < count; i++) {
@@ -331,6 +693,22 @@ static void cras_scale_buffer_s24_le(uint8_t *buffer, unsigned int count,
 		out[i] = scale_s24_le(out[i], scaler);
 }
 
+/* Scales like cras_scale_buffer_s24_le() and returns non-zero if any sample
+ * was non-zero before scaling. */
+static int scale_check_s24_le(uint8_t *buffer, unsigned int count,
+			      float scaler)
+{
+	int32_t *out = (int32_t *)buffer;
+	int32_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		seen |= out[i];
+		out[i] = scale_s24_le(out[i], scaler);
+	}
+	return seen != 0;
+}
+
 static void cras_mix_add_s24_le(uint8_t *dst, uint8_t *src, unsigned int count,
 				unsigned int index, int mute, float mix_vol)
 {
@@ -356,6 +734,16 @@ static void cras_mix_add_scale_stride_s24_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+#if defined(__SSE4_1__)
+	if (dst_stride != src_stride || dst_stride != 4) {
+		i = stride_s24_sse(dst, src, dst_stride, src_stride, count,
+				   scaler);
+		dst += i * dst_stride;
+		src += i * src_stride;
+		count -= i;
+	}
+#endif
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
 		for (i = 0; i < count; i++) {
@@ -499,6 +887,22 @@ static void cras_scale_buffer_s32_le(uint8_t *buffer, unsigned int count,
 		out[i] *= scaler;
 }
 
+/* Scales like cras_scale_buffer_s32_le() and returns non-zero if any sample
+ * was non-zero before scaling. */
+static int scale_check_s32_le(uint8_t *buffer, unsigned int count,
+			      float scaler)
+{
+	int32_t *out = (int32_t *)buffer;
+	int32_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		seen |= out[i];
+		out[i] *= scaler;
+	}
+	return seen != 0;
+}
+
 static void cras_mix_add_s32_le(uint8_t *dst, uint8_t *src, unsigned int count,
 				unsigned int index, int mute, float mix_vol)
 {
@@ -524,6 +928,16 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 {
 	unsigned int i;
 
+#if defined(__SSE4_1__)
+	if (dst_stride != src_stride || dst_stride != 4) {
+		i = stride_s32_sse(dst, src, dst_stride, src_stride, count,
+				   scaler);
+		dst += i * dst_stride;
+		src += i * src_stride;
+		count -= i;
+	}
+#endif
+
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
 		for (i = 0; i < count; i++) {
@@ -532,7 +946,8 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 				sum = *(int32_t *)dst +
 				      *(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)(*(int32_t *)dst) +
+				      *(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -548,7 +963,8 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 				sum = *(int32_t *)dst +
 				      *(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)(*(int32_t *)dst) +
+				      *(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -579,6 +995,52 @@ static inline void convert_single_s32le_to_s243le(uint8_t *dst,
 	memcpy(dst, (uint8_t *)src + 1, 3);
 }
 
+#if defined(__SSE4_1__)
+static void scale_inc_s24_3le_sse(uint8_t *buffer, unsigned int count,
+				  float scaler, float increment, float target,
+				  int step)
+{
+	float lanes[4];
+	float applied_scaler;
+	unsigned int i, lane = 0;
+	int32_t frame;
+	int j = 0;
+
+	/* Like the scalar loop, only whole frames are scaled. */
+	count -= count % step;
+	for (i = 0; i < count; i++) {
+		applied_scaler = scaler;
+		if ((applied_scaler > target && increment > 0) ||
+		    (applied_scaler < target && increment < 0))
+			applied_scaler = target;
+
+		/* Scaling by exactly one or zero keeps the samples or clears
+		 * them, as the scalar loop does at the volume limits. */
+		if (applied_scaler > MAX_VOLUME_TO_SCALE)
+			applied_scaler = 1.0f;
+		else if (applied_scaler < MIN_VOLUME_TO_SCALE)
+			applied_scaler = 0.0f;
+
+		lanes[lane++] = applied_scaler;
+		if (lane == 4) {
+			scale_s24_3le_sse(buffer, buffer, _mm_loadu_ps(lanes));
+			buffer += 12;
+			lane = 0;
+		}
+		if (++j == step) {
+			j = 0;
+			scaler += increment;
+		}
+	}
+
+	for (i = 0; i < lane; i++, buffer += 3) {
+		convert_single_s243le_to_s32le(&frame, buffer);
+		frame *= lanes[i];
+		convert_single_s32le_to_s243le(buffer, &frame);
+	}
+}
+#endif
+
 static void cras_mix_add_clip_s24_3le(uint8_t *dst, const uint8_t *src,
 				      size_t count)
 {
@@ -587,6 +1049,13 @@ static void cras_mix_add_clip_s24_3le(uint8_t *dst, const uint8_t *src,
 	int32_t src_frame;
 	size_t i;
 
+#if defined(__SSE4_1__)
+	i = add_s24_3le_sse(dst, src, count, 1.0f);
+	dst += 3 * i;
+	src += 3 * i;
+	count -= i;
+#endif
+
 	for (i = 0; i < count; i++, dst += 3, src += 3) {
 		convert_single_s243le_to_s32le(&dst_frame, dst);
 		convert_single_s243le_to_s32le(&src_frame, src);
@@ -613,6 +1082,13 @@ static void scale_add_clip_s24_3le(uint8_t *dst, const uint8_t *src,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s24_3le(dst, src, count);
 
+#if defined(__SSE4_1__)
+	i = add_s24_3le_sse(dst, src, count, vol);
+	dst += 3 * i;
+	src += 3 * i;
+	count -= i;
+#endif
+
 	for (i = 0; i < count; i++, dst += 3, src += 3) {
 		convert_single_s243le_to_s32le(&dst_frame, dst);
 		convert_single_s243le_to_s32le(&src_frame, src);
@@ -639,6 +1115,13 @@ static void copy_scaled_s24_3le(uint8_t *dst, const uint8_t *src, size_t count,
 		return;
 	}
 
+#if defined(__SSE4_1__)
+	i = copy_scaled_s24_3le_sse(dst, src, count, volume_scaler);
+	dst += 3 * i;
+	src += 3 * i;
+	count -= i;
+#endif
+
 	for (i = 0; i < count; i++, dst += 3, src += 3) {
 		convert_single_s243le_to_s32le(&frame, src);
 		frame *= volume_scaler;
@@ -658,6 +1141,11 @@ static void cras_scale_buffer_inc_s24_3le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#if defined(__SSE4_1__)
+	return scale_inc_s24_3le_sse(buffer, count, scaler, increment, target,
+				     step);
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			float applied_scaler = scaler;
@@ -698,6 +1186,12 @@ static void cras_scale_buffer_s24_3le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#if defined(__SSE4_1__)
+	i = copy_scaled_s24_3le_sse(buffer, buffer, count, scaler);
+	buffer += 3 * i;
+	count -= i;
+#endif
+
 	for (i = 0; i < count; i++, buffer += 3) {
 		convert_single_s243le_to_s32le(&frame, buffer);
 		frame *= scaler;
@@ -733,6 +1227,13 @@ static void cras_mix_add_scale_stride_s24_3le(uint8_t *dst, uint8_t *src,
 	int32_t dst_frame;
 	int32_t src_frame;
 
+#if defined(__SSE4_1__)
+	i = stride_s24_3le_sse(dst, src, dst_stride, src_stride, count, scaler);
+	dst += i * dst_stride;
+	src += i * src_stride;
+	count -= i;
+#endif
+
 	for (i = 0; i < count; i++) {
 		convert_single_s243le_to_s32le(&dst_frame, dst);
 		convert_single_s243le_to_s32le(&src_frame, src);
@@ -790,6 +1291,63 @@ static void scale_buffer(snd_pcm_format_t fmt, uint8_t *buff,
 	}
 }
 
+static unsigned int sample_bytes(snd_pcm_format_t fmt)
+{
+	int width = snd_pcm_format_physical_width(fmt);
+
+	return width > 0 ? width / 8 : 0;
+}
+
+/* A constant scaler is applied in the same pass as the check, ramps are
+ * short so they check first and reuse the ramp kernels. */
+static int scale_buffer_check(snd_pcm_format_t fmt, uint8_t *buff,
+			      unsigned int count, float scaler,
+			      float increment, float target, int step,
+			      int check)
+{
+	size_t bytes = (size_t)count * sample_bytes(fmt);
+	int non_empty;
+
+	if (!check) {
+		if (increment != 0.0f)
+			scale_buffer_increment(fmt, buff, count, scaler,
+					       increment, target, step);
+		else
+			scale_buffer(fmt, buff, count, scaler);
+		return 0;
+	}
+
+	if (increment != 0.0f) {
+		non_empty = buffer_is_non_empty(buff, bytes);
+		scale_buffer_increment(fmt, buff, count, scaler, increment,
+				       target, step);
+		return non_empty;
+	}
+
+	if (scaler > MAX_VOLUME_TO_SCALE)
+		return buffer_is_non_empty(buff, bytes);
+
+	if (scaler < MIN_VOLUME_TO_SCALE) {
+		non_empty = buffer_is_non_empty(buff, bytes);
+		if (non_empty)
+			memset(buff, 0, bytes);
+		return non_empty;
+	}
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return scale_check_s16_le(buff, count, scaler);
+	case SND_PCM_FORMAT_S24_LE:
+		return scale_check_s24_le(buff, count, scaler);
+	case SND_PCM_FORMAT_S32_LE:
+		return scale_check_s32_le(buff, count, scaler);
+	default:
+		non_empty = buffer_is_non_empty(buff, bytes);
+		scale_buffer(fmt, buff, count, scaler);
+		return non_empty;
+	}
+}
+
 static void mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		    unsigned int count, unsigned int index, int mute,
 		    float mix_vol)
@@ -841,10 +1399,83 @@ static size_t mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count)
 	return count;
 }
 
+/*
+ * Float FIR kernels.
+ */
+
+static float fir_interp_f32(const float *src, const float *coef0,
+			    const float *coef1, float frac, unsigned int taps)
+{
+	unsigned int i = 0;
+	float sum0 = 0.0f, sum1 = 0.0f;
+
+#if defined(__AVX__)
+	__m256 acc0 = _mm256_setzero_ps();
+	__m256 acc1 = _mm256_setzero_ps();
+	__m128 lo0, lo1;
+
+	for (; i + 8 <= taps; i += 8) {
+		__m256 x = _mm256_loadu_ps(src + i);
+#if defined(__FMA__)
+		acc0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(coef0 + i), acc0);
+		acc1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(coef1 + i), acc1);
+#else
+		acc0 = _mm256_add_ps(
+			acc0, _mm256_mul_ps(x, _mm256_loadu_ps(coef0 + i)));
+		acc1 = _mm256_add_ps(
+			acc1, _mm256_mul_ps(x, _mm256_loadu_ps(coef1 + i)));
+#endif
+	}
+	lo0 = _mm_add_ps(_mm256_castps256_ps128(acc0),
+			 _mm256_extractf128_ps(acc0, 1));
+	lo1 = _mm_add_ps(_mm256_castps256_ps128(acc1),
+			 _mm256_extractf128_ps(acc1, 1));
+	lo0 = _mm_add_ps(lo0, _mm_movehl_ps(lo0, lo0));
+	lo1 = _mm_add_ps(lo1, _mm_movehl_ps(lo1, lo1));
+	sum0 = _mm_cvtss_f32(_mm_add_ss(lo0, _mm_shuffle_ps(lo0, lo0, 1)));
+	sum1 = _mm_cvtss_f32(_mm_add_ss(lo1, _mm_shuffle_ps(lo1, lo1, 1)));
+#elif defined(__SSE__)
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+
+	for (; i + 4 <= taps; i += 4) {
+		__m128 x = _mm_loadu_ps(src + i);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(x, _mm_loadu_ps(coef0 + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(x, _mm_loadu_ps(coef1 + i)));
+	}
+	acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+	acc1 = _mm_add_ps(acc1, _mm_movehl_ps(acc1, acc1));
+	sum0 = _mm_cvtss_f32(_mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1)));
+	sum1 = _mm_cvtss_f32(_mm_add_ss(acc1, _mm_shuffle_ps(acc1, acc1, 1)));
+#elif defined(__ARM_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0.0f);
+	float32x4_t acc1 = vdupq_n_f32(0.0f);
+	float32x2_t half0, half1;
+
+	for (; i + 4 <= taps; i += 4) {
+		float32x4_t x = vld1q_f32(src + i);
+		acc0 = vmlaq_f32(acc0, x, vld1q_f32(coef0 + i));
+		acc1 = vmlaq_f32(acc1, x, vld1q_f32(coef1 + i));
+	}
+	half0 = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+	half1 = vadd_f32(vget_low_f32(acc1), vget_high_f32(acc1));
+	sum0 = vget_lane_f32(vpadd_f32(half0, half0), 0);
+	sum1 = vget_lane_f32(vpadd_f32(half1, half1), 0);
+#endif
+
+	for (; i < taps; i++) {
+		sum0 += src[i] * coef0[i];
+		sum1 += src[i] * coef1[i];
+	}
+	return sum0 + (sum1 - sum0) * frac;
+}
+
 const struct cras_mix_ops OPS(mixer_ops) = {
 	.scale_buffer = scale_buffer,
 	.scale_buffer_increment = scale_buffer_increment,
+	.scale_buffer_check = scale_buffer_check,
 	.add = mix_add,
 	.add_scale_stride = mix_add_scale_stride,
 	.mute_buffer = mix_mute_buffer,
+	.fir_interp_f32 = fir_interp_f32,
 };
@@ -25,9 +25,12 @@ extern const struct cras_mix_ops mixer_ops_fma;
  * Members:
  *   scale_buffer_increment: See cras_scale_buffer_increment.
  *   scale_buffer: See cras_scale_buffer.
+ *   scale_buffer_check: See cras_scale_buffer_check, returns non-zero if
+ *       |check| is set and any sample was non-zero before scaling.
  *   add: See cras_mix_add.
  *   add_scale_stride: See cras_mix_add_scale_stride.
  *   mute_buffer: cras_mix_mute_buffer.
+ *   fir_interp_f32: See cras_mix_fir_interp_f32.
  */
 struct cras_mix_ops {
 	void (*scale_buffer_increment)(snd_pcm_format_t fmt, uint8_t *buff,
@@ -35,6 +38,10 @@ struct cras_mix_ops {
 				       float increment, float target, int step);
 	void (*scale_buffer)(snd_pcm_format_t fmt, uint8_t *buff,
 			     unsigned int count, float scaler);
+	int (*scale_buffer_check)(snd_pcm_format_t fmt, uint8_t *buff,
+				  unsigned int count, float scaler,
+				  float increment, float target, int step,
+				  int check);
 	void (*add)(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		    unsigned int count, unsigned int index, int mute,
 		    float mix_vol);
@@ -43,5 +50,8 @@ struct cras_mix_ops {
 				 unsigned int dst_stride,
 				 unsigned int src_stride, float scaler);
 	size_t (*mute_buffer)(uint8_t *dst, size_t frame_bytes, size_t count);
+	float (*fir_interp_f32)(const float *src, const float *coef0,
+				const float *coef1, float frac,
+				unsigned int taps);
 };
 #endif
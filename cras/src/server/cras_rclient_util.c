@@ -134,7 +134,8 @@ int rclient_handle_client_stream_connect(struct cras_rclient *client,
 	struct cras_rstream_config stream_config;
 	int rc, header_fd, samples_fd;
 	size_t samples_size;
-	int stream_fds[2];
+	int stream_fds[3];
+	unsigned int num_fds = 2;
 
 	rc = rclient_validate_stream_connect_params(client, msg, aud_fd,
 						    client_shm_fd);
@@ -189,8 +190,13 @@ int rclient_handle_client_stream_connect(struct cras_rclient *client,
 	/* If we're using client-provided shm, samples_fd here refers to the
 	 * same shm area as client_shm_fd */
 	stream_fds[1] = samples_fd;
+	/* The eventfd tells the client the server accepted SHM_WAKEUP. */
+	stream_fds[2] = cras_rstream_get_wake_fd(stream);
+	if (stream_fds[2] >= 0)
+		num_fds++;
 
-	rc = client->ops->send_message_to_client(client, reply, stream_fds, 2);
+	rc = client->ops->send_message_to_client(client, reply, stream_fds,
+						 num_fds);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Failed to send connected messaged\n");
 		stream_list_rm(cras_iodev_list_get_stream_list(),
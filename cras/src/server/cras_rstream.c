@@ -5,6 +5,7 @@
 
 #include <fcntl.h>
 #include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <syslog.h>
@@ -18,6 +19,7 @@
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "cras_system_state.h"
+#include "cras_util.h"
 
 static bool cras_rstream_config_is_client_shm_stream(
 	const struct cras_rstream_config *config)
@@ -26,6 +28,41 @@ static bool cras_rstream_config_is_client_shm_stream(
 	       config->client_shm_size > 0;
 }
 
+/* Lays the samples area of a SHM_RING stream out as a ring. The ring spans
+ * the whole samples area, rounded down to a multiple of the callback
+ * threshold so full callbacks don't wrap. Capture streams and streams using
+ * client provided shm keep the double buffer. PULL_MODE is only kept with a
+ * ring, and starts with the callback threshold as its low watermark. */
+static void setup_shm_ring(struct cras_rstream *stream, bool client_shm_stream)
+{
+	uint32_t requested = stream->flags & (SHM_RING | PULL_MODE);
+	uint32_t frames;
+
+	stream->flags &= ~(SHM_RING | PULL_MODE);
+	if (!(requested & SHM_RING))
+		return;
+
+	if (stream->direction != CRAS_STREAM_OUTPUT || client_shm_stream ||
+	    stream->cb_threshold == 0)
+		return;
+
+	/* The ring size must be a power of two, use the largest that fits and
+	 * still holds a callback worth of frames. */
+	frames = cras_shm_samples_size(stream->shm) /
+		 stream->shm->config.frame_bytes;
+	if (frames < stream->cb_threshold)
+		return;
+	frames = 1u << (31 - __builtin_clz(frames));
+	if (frames < stream->cb_threshold ||
+	    cras_shm_set_ring(stream->shm, frames))
+		return;
+
+	stream->flags |= requested;
+	if (requested & PULL_MODE)
+		cras_shm_ring_set_low_watermark(stream->shm,
+						stream->cb_threshold);
+}
+
 /* Setup the shared memory area used for audio samples. config->client_shm_fd
  * must be closed after calling this function.
  */
@@ -86,6 +123,7 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 				   &stream->shm);
 	if (rc)
 		return rc;
+	cras_audio_shm_prefault(stream->shm, samples_prot);
 
 	cras_shm_set_frame_bytes(stream->shm, frame_bytes);
 	cras_shm_set_used_size(stream->shm, used_size);
@@ -94,6 +132,7 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 			cras_shm_set_buffer_offset(stream->shm, i,
 						   config->buffer_offsets[i]);
 	}
+	setup_shm_ring(stream, client_shm_stream);
 
 	stream->audio_area =
 		cras_audio_area_create(stream->format.num_channels);
@@ -261,6 +300,48 @@ static int read_and_handle_client_message(struct cras_rstream *stream)
 	return rc;
 }
 
+/*
+ * Handles the reply to the last request of a SHM_WAKEUP stream, if the client
+ * has written it to shm.
+ * Returns:
+ *   0 if there is no reply yet, 1 if the reply was handled, or the negative
+ *   error code from the client.
+ */
+static int handle_shm_reply(struct cras_rstream *stream)
+{
+	uint32_t frames;
+	int rc;
+
+	rc = cras_shm_wake_get_reply(stream->shm, &frames);
+	if (rc != 0)
+		clear_pending_reply(stream);
+	return rc;
+}
+
+/* Creates the eventfd a SHM_WAKEUP stream signals replies on. Falls back to
+ * audio messages if that fails. PULL_MODE streams never reply, so they don't
+ * need it. */
+static void setup_wake_fd(struct cras_rstream *stream)
+{
+	stream->wake_fd = -1;
+	if (!(stream->flags & SHM_WAKEUP))
+		return;
+
+	if (stream_is_server_only(stream) || cras_rstream_is_pull(stream)) {
+		stream->flags &= ~SHM_WAKEUP;
+		return;
+	}
+
+	/* The audio thread never reads it. Edge triggered epoll reports every
+	 * write, and the counter can't realistically overflow. */
+	stream->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (stream->wake_fd < 0) {
+		syslog(LOG_WARNING, "stream %x: eventfd failed %d",
+		       stream->stream_id, errno);
+		stream->flags &= ~SHM_WAKEUP;
+	}
+}
+
 /* Exported functions */
 
 int cras_rstream_create(struct cras_rstream_config *config,
@@ -292,6 +373,7 @@ int cras_rstream_create(struct cras_rstream_config *config,
 	stream->num_missed_cb = 0;
 	stream->is_pinned = (config->dev_idx != NO_DEVICE);
 	stream->pinned_dev_idx = config->dev_idx;
+	cras_pi_mutex_init(&stream->lock);
 
 	rc = setup_shm_area(stream, config);
 	if (rc < 0) {
@@ -302,6 +384,7 @@ int cras_rstream_create(struct cras_rstream_config *config,
 
 	stream->fd = config->audio_fd;
 	config->audio_fd = -1;
+	setup_wake_fd(stream);
 	stream->buf_state = buffer_share_create(stream->buffer_frames);
 	stream->apm_list =
 		(stream->direction == CRAS_STREAM_INPUT) ?
@@ -326,11 +409,14 @@ void cras_rstream_destroy(struct cras_rstream *stream)
 	cras_server_metrics_stream_destroy(stream);
 	cras_system_state_stream_removed(stream->direction);
 	close(stream->fd);
+	if (stream->wake_fd >= 0)
+		close(stream->wake_fd);
 	cras_audio_shm_destroy(stream->shm);
 	cras_audio_area_destroy(stream->audio_area);
 	buffer_share_destroy(stream->buf_state);
 	if (stream->apm_list)
 		cras_apm_list_destroy(stream->apm_list);
+	pthread_mutex_destroy(&stream->lock);
 	free(stream);
 }
 
@@ -384,6 +470,13 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 
 	stream->last_fetch_ts = *now;
 
+	if (stream->flags & SHM_WAKEUP) {
+		cras_shm_wake_request(stream->shm, AUDIO_MESSAGE_REQUEST_DATA,
+				      stream->cb_threshold);
+		set_pending_reply(stream);
+		return 0;
+	}
+
 	init_audio_message(&msg, AUDIO_MESSAGE_REQUEST_DATA,
 			   stream->cb_threshold);
 	rc = write(stream->fd, &msg, sizeof(msg));
@@ -408,6 +501,13 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 		return 0;
 	}
 
+	if (stream->flags & SHM_WAKEUP) {
+		cras_shm_wake_request(stream->shm, AUDIO_MESSAGE_DATA_READY,
+				      count);
+		set_pending_reply(stream);
+		return 0;
+	}
+
 	init_audio_message(&msg, AUDIO_MESSAGE_DATA_READY, count);
 	rc = write(stream->fd, &msg, sizeof(msg));
 	if (rc < 0)
@@ -418,6 +518,36 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 	return rc;
 }
 
+int cras_rstream_check_low_watermark(struct cras_rstream *stream)
+{
+	struct audio_message msg;
+	uint32_t low_watermark = cras_shm_ring_low_watermark(stream->shm);
+	int rc;
+
+	if (cras_shm_ring_queued(stream->shm) > low_watermark) {
+		stream->low_watermark_notified = 0;
+		return 0;
+	}
+
+	if (low_watermark == 0 || stream->low_watermark_notified)
+		return 0;
+
+	init_audio_message(&msg, AUDIO_MESSAGE_REQUEST_DATA,
+			   cras_shm_ring_free(stream->shm));
+	rc = write(stream->fd, &msg, sizeof(msg));
+	if (rc < 0)
+		return -errno;
+
+	stream->low_watermark_notified = 1;
+	return 0;
+}
+
+void cras_rstream_record_underrun(struct cras_rstream *stream,
+				  unsigned int frames)
+{
+	cras_shm_ring_underrun(stream->shm, frames);
+}
+
 void cras_rstream_dev_attach(struct cras_rstream *rstream, unsigned int dev_id,
 			     void *dev_ptr)
 {
@@ -529,6 +659,14 @@ int cras_rstream_flush_old_audio_messages(struct cras_rstream *stream)
 	if (stream_is_server_only(stream))
 		return 0;
 
+	if (stream->flags & SHM_WAKEUP) {
+		err = handle_shm_reply(stream);
+		if (err < 0)
+			syslog(LOG_ERR, "Error reply from client: rc: %d",
+			       err);
+		return 0;
+	}
+
 	pollfd.fd = stream->fd;
 	pollfd.events = POLLIN;
 
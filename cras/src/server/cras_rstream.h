@@ -9,6 +9,8 @@
 #ifndef CRAS_RSTREAM_H_
 #define CRAS_RSTREAM_H_
 
+#include <pthread.h>
+
 #include "buffer_share.h"
 #include "cras_apm_list.h"
 #include "cras_shm.h"
@@ -39,6 +41,7 @@ struct master_dev_info {
  *    direction - input or output.
  *    flags - Indicative of what special handling is needed.
  *    fd - Socket for requesting and sending audio buffer events.
+ *    wake_fd - Eventfd the client signals replies on, for SHM_WAKEUP streams.
  *    buffer_frames - Buffer size in frames.
  *    cb_threshold - Callback client when this much is left.
  *    master_dev_info - The info of the master device this stream attaches to.
@@ -61,6 +64,10 @@ struct master_dev_info {
  *    is_pinned - True if the stream is a pinned stream, false otherwise.
  *    pinned_dev_idx - device the stream is pinned, 0 if none.
  *    triggered - True if already notified TRIGGER_ONLY stream, false otherwise.
+ *    low_watermark_notified - True once a PULL_MODE stream was told its ring
+ *      is at the low watermark, until it is refilled above it.
+ *    lock - Serializes access from audio threads running different devices
+ *      the stream is attached to.
  */
 struct cras_rstream {
 	cras_stream_id_t stream_id;
@@ -69,6 +76,7 @@ struct cras_rstream {
 	enum CRAS_STREAM_DIRECTION direction;
 	uint32_t flags;
 	int fd;
+	int wake_fd;
 	size_t buffer_frames;
 	size_t cb_threshold;
 	int is_draining;
@@ -91,6 +99,8 @@ struct cras_rstream {
 	int is_pinned;
 	uint32_t pinned_dev_idx;
 	int triggered;
+	int low_watermark_notified;
+	pthread_mutex_t lock;
 	struct cras_rstream *prev, *next;
 };
 
@@ -188,6 +198,28 @@ static inline void cras_rstream_set_is_draining(struct cras_rstream *stream,
 	stream->is_draining = is_draining;
 }
 
+/* Returns true if the client writes samples at its own pace, see PULL_MODE. */
+static inline int cras_rstream_is_pull(const struct cras_rstream *stream)
+{
+	return !!(stream->flags & PULL_MODE);
+}
+
+/* Locks the stream against the other audio threads it is attached to. Only
+ * one stream is ever locked at a time, so there is no lock ordering. The
+ * APM lock may be taken while it is held, never the other way around. The
+ * lock inherits priority, so a thread holding it isn't preempted by another
+ * audio thread waiting for it. */
+static inline void cras_rstream_lock(struct cras_rstream *stream)
+{
+	pthread_mutex_lock(&stream->lock);
+}
+
+/* Unlocks a stream locked with cras_rstream_lock. */
+static inline void cras_rstream_unlock(struct cras_rstream *stream)
+{
+	pthread_mutex_unlock(&stream->lock);
+}
+
 /* Gets the shm fds used for the stream shm */
 static inline int cras_rstream_get_shm_fds(const struct cras_rstream *stream,
 					   int *header_fd, int *samples_fd)
@@ -201,6 +233,19 @@ static inline int cras_rstream_get_shm_fds(const struct cras_rstream *stream,
 	return 0;
 }
 
+/* Gets the eventfd of a SHM_WAKEUP stream, or -1 if the stream uses audio
+ * messages. */
+static inline int cras_rstream_get_wake_fd(const struct cras_rstream *stream)
+{
+	return (stream->flags & SHM_WAKEUP) ? stream->wake_fd : -1;
+}
+
+/* Gets the fd that client replies wake the audio thread up on. */
+static inline int cras_rstream_get_reply_fd(const struct cras_rstream *stream)
+{
+	return (stream->flags & SHM_WAKEUP) ? stream->wake_fd : stream->fd;
+}
+
 /* Gets the size of the shm area used for samples for this stream. */
 static inline size_t
 cras_rstream_get_samples_shm_size(const struct cras_rstream *stream)
@@ -252,6 +297,19 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 /* Tells a capture client that count frames are ready. */
 int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count);
 
+/* Tells the client of a PULL_MODE stream that the frames queued in its ring
+ * dropped to the low watermark. Notifies once each time the level crosses
+ * the watermark, and never expects a reply.
+ * Returns:
+ *    0 on success, or a negative error code if the message couldn't be sent.
+ */
+int cras_rstream_check_low_watermark(struct cras_rstream *stream);
+
+/* Records that |frames| frames of silence were played in place of a
+ * PULL_MODE stream that didn't have enough frames queued. */
+void cras_rstream_record_underrun(struct cras_rstream *stream,
+				  unsigned int frames);
+
 /* Let the rstream know when a device is added or removed. */
 void cras_rstream_dev_attach(struct cras_rstream *rstream, unsigned int dev_id,
 			     void *dev_ptr);
@@ -37,6 +37,7 @@
 #include "cras_audio_thread_monitor.h"
 #include "cras_config.h"
 #include "cras_device_monitor.h"
+#include "cras_fmt_conv_pool.h"
 #include "cras_hotword_handler.h"
 #include "cras_iodev_list.h"
 #include "cras_main_message.h"
@@ -53,6 +54,7 @@
 #include "cras_udev.h"
 #include "cras_util.h"
 #include "cras_mix.h"
+#include "dsp_util.h"
 #include "utlist.h"
 
 /* Store a list of clients that are attached to the server.
@@ -449,8 +451,9 @@ int cras_server_init()
 	/* Initialize global observer. */
 	cras_observer_server_init();
 
-	/* init mixer with CPU capabilities */
+	/* init mixer and DSP kernels with CPU capabilities */
 	cras_mix_init(cpu_get_flags());
+	dsp_util_init(cpu_get_flags());
 
 	/* Allow clients to register callbacks for file descriptors.
 	 * add_select_fd and rm_select_fd will add and remove file descriptors
@@ -708,6 +711,7 @@ bail:
 	cleanup_server_sockets();
 	free(pollfds);
 	cras_observer_server_free();
+	cras_fmt_conv_pool_drain();
 	return rc;
 }
 
@@ -23,6 +23,7 @@
 const char kBusyloop[] = "Cras.Busyloop";
 const char kDeviceTypeInput[] = "Cras.DeviceTypeInput";
 const char kDeviceTypeOutput[] = "Cras.DeviceTypeOutput";
+const char kFmtConvPoolHitRate[] = "Cras.FmtConvPoolHitRate";
 const char kHighestDeviceDelayInput[] = "Cras.HighestDeviceDelayInput";
 const char kHighestDeviceDelayOutput[] = "Cras.HighestDeviceDelayOutput";
 const char kHighestInputHardwareLevel[] = "Cras.HighestInputHardwareLevel";
@@ -44,6 +45,8 @@ const char kMissedCallbackSecondTimeInput[] =
 const char kMissedCallbackSecondTimeOutput[] =
 	"Cras.MissedCallbackSecondTimeOutput";
 const char kNoCodecsFoundMetric[] = "Cras.NoCodecsFoundAtBoot";
+const char kOutputStageTime[] = "Cras.OutputStageTime";
+const char kOutputStageMaxTime[] = "Cras.OutputStageMaxTime";
 const char kStreamTimeoutMilliSeconds[] = "Cras.StreamTimeoutMilliSeconds";
 const char kStreamCallbackThreshold[] = "Cras.StreamCallbackThreshold";
 const char kStreamClientTypeInput[] = "Cras.StreamClientTypeInput";
@@ -88,6 +91,7 @@ enum CRAS_SERVER_METRICS_TYPE {
 	BT_WIDEBAND_SELECTED_CODEC,
 	BUSYLOOP,
 	DEVICE_RUNTIME,
+	FMT_CONV_POOL_HIT_RATE,
 	HIGHEST_DEVICE_DELAY_INPUT,
 	HIGHEST_DEVICE_DELAY_OUTPUT,
 	HIGHEST_INPUT_HW_LEVEL,
@@ -102,6 +106,7 @@ enum CRAS_SERVER_METRICS_TYPE {
 	MISSED_CB_SECOND_TIME_INPUT,
 	MISSED_CB_SECOND_TIME_OUTPUT,
 	NUM_UNDERRUNS,
+	OUTPUT_STAGE_TIME,
 	STREAM_CONFIG,
 	STREAM_RUNTIME
 };
@@ -164,12 +169,19 @@ struct cras_server_metrics_timespec_data {
 	unsigned count;
 };
 
+struct cras_server_metrics_stage_data {
+	enum CRAS_OUTPUT_STAGE stage;
+	unsigned avg_ns;
+	unsigned max_ns;
+};
+
 union cras_server_metrics_data {
 	unsigned value;
 	struct cras_server_metrics_stream_config stream_config;
 	struct cras_server_metrics_device_data device_data;
 	struct cras_server_metrics_stream_data stream_data;
 	struct cras_server_metrics_timespec_data timespec_data;
+	struct cras_server_metrics_stage_data stage_data;
 };
 
 /*
@@ -842,6 +854,46 @@ int cras_server_metrics_stream_destroy(const struct cras_rstream *stream)
 	return rc;
 }
 
+int cras_server_metrics_output_stage_time(enum CRAS_OUTPUT_STAGE stage,
+					  unsigned avg_ns, unsigned max_ns)
+{
+	struct cras_server_metrics_message msg;
+	union cras_server_metrics_data data;
+	int err;
+
+	data.stage_data.stage = stage;
+	data.stage_data.avg_ns = avg_ns;
+	data.stage_data.max_ns = max_ns;
+	init_server_metrics_msg(&msg, OUTPUT_STAGE_TIME, data);
+
+	err = cras_server_metrics_message_send(
+		(struct cras_main_message *)&msg);
+	if (err < 0) {
+		syslog(LOG_ERR,
+		       "Failed to send metrics message: OUTPUT_STAGE_TIME");
+		return err;
+	}
+	return 0;
+}
+
+int cras_server_metrics_fmt_conv_pool_hit_rate(unsigned percent)
+{
+	struct cras_server_metrics_message msg;
+	union cras_server_metrics_data data;
+	int err;
+
+	data.value = percent;
+	init_server_metrics_msg(&msg, FMT_CONV_POOL_HIT_RATE, data);
+	err = cras_server_metrics_message_send(
+		(struct cras_main_message *)&msg);
+	if (err < 0) {
+		syslog(LOG_ERR,
+		       "Failed to send metrics message: FMT_CONV_POOL_HIT_RATE");
+		return err;
+	}
+	return 0;
+}
+
 int cras_server_metrics_busyloop(struct timespec *ts, unsigned count)
 {
 	struct cras_server_metrics_message msg;
@@ -902,6 +954,41 @@ static void metrics_busyloop(struct cras_server_metrics_timespec_data data)
 	cras_metrics_log_histogram(metrics_name, data.count, 0, 1000, 20);
 }
 
+static const char *metrics_output_stage_str(enum CRAS_OUTPUT_STAGE stage)
+{
+	switch (stage) {
+	case CRAS_OUTPUT_STAGE_MIX:
+		return "Mix";
+	case CRAS_OUTPUT_STAGE_FMT_CONV:
+		return "FmtConv";
+	case CRAS_OUTPUT_STAGE_DSP:
+		return "Dsp";
+	case CRAS_OUTPUT_STAGE_VOLUME:
+		return "Volume";
+	case CRAS_OUTPUT_STAGE_LOOPBACK:
+		return "Loopback";
+	case CRAS_OUTPUT_STAGE_HW_WRITE:
+		return "HwWrite";
+	default:
+		return "InvalidStage";
+	}
+}
+
+static void
+metrics_output_stage_time(struct cras_server_metrics_stage_data data)
+{
+	char metrics_name[METRICS_NAME_BUFFER_SIZE];
+
+	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE, "%s.%s",
+		 kOutputStageTime, metrics_output_stage_str(data.stage));
+	cras_metrics_log_histogram(metrics_name, data.avg_ns, 1, 10000000, 50);
+
+	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE, "%s.%s",
+		 kOutputStageMaxTime, metrics_output_stage_str(data.stage));
+	cras_metrics_log_histogram(metrics_name, data.max_ns, 1, 100000000,
+				   50);
+}
+
 /*
  * Logs metrics for each group it belongs to. The UMA does not merge subgroups
  * automatically so we need to log them separately.
@@ -1005,6 +1092,10 @@ static void handle_metrics_message(struct cras_main_message *msg, void *arg)
 	case DEVICE_RUNTIME:
 		metrics_device_runtime(metrics_msg->data.device_data);
 		break;
+	case FMT_CONV_POOL_HIT_RATE:
+		cras_metrics_log_histogram(kFmtConvPoolHitRate,
+					   metrics_msg->data.value, 0, 100, 20);
+		break;
 	case HIGHEST_DEVICE_DELAY_INPUT:
 		cras_metrics_log_histogram(kHighestDeviceDelayInput,
 					   metrics_msg->data.value, 1, 10000,
@@ -1075,6 +1166,9 @@ static void handle_metrics_message(struct cras_main_message *msg, void *arg)
 					   metrics_msg->data.value, 0, 1000,
 					   10);
 		break;
+	case OUTPUT_STAGE_TIME:
+		metrics_output_stage_time(metrics_msg->data.stage_data);
+		break;
 	case STREAM_CONFIG:
 		metrics_stream_config(metrics_msg->data.stream_config);
 		break;
@@ -57,6 +57,15 @@ int cras_server_metrics_stream_create(const struct cras_rstream_config *config);
 /* Logs information when a stream destroys. */
 int cras_server_metrics_stream_destroy(const struct cras_rstream *stream);
 
+/* Logs the average and longest time per block, in nanoseconds, of a stage of
+ * the output path of a device. */
+int cras_server_metrics_output_stage_time(enum CRAS_OUTPUT_STAGE stage,
+					  unsigned avg_ns, unsigned max_ns);
+
+/* Logs the share of format converters handed out from the pool, in percent
+ * of the last lookups. */
+int cras_server_metrics_fmt_conv_pool_hit_rate(unsigned percent);
+
 /* Logs the number of busyloops for different time periods. */
 int cras_server_metrics_busyloop(struct timespec *ts, unsigned count);
 
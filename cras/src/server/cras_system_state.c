@@ -50,6 +50,18 @@ struct card_list {
  *    main_thread_tid - The thread id of the main thread.
  *    bt_fix_a2dp_packet_size - The flag to override A2DP packet size set by
  *      Blueetoh peer devices to a smaller default value.
+ *    float_mix_bus - The flag to mix output streams on a float32 bus before
+ *      quantizing to the device format.
+ *    polyphase_resampler - The flag to resample streams with the polyphase
+ *      resampler instead of speex and the linear resampler.
+ *    per_device_threads - The flag to run each open device in its own audio
+ *      thread.
+ *    apm_sharing - The flag to let capture streams with the same effects on
+ *      a device share one APM instance.
+ *    apm_worker - The flag to run APM processing in a worker thread instead
+ *      of the audio thread.
+ *    a2dp_encoder_thread - The flag to encode A2DP packets in a thread of
+ *      each A2DP device instead of the audio thread.
  */
 static struct {
 	struct cras_server_state *exp_state;
@@ -74,6 +86,12 @@ static struct {
 	struct cras_audio_thread_snapshot_buffer snapshot_buffer;
 	pthread_t main_thread_tid;
 	bool bt_fix_a2dp_packet_size;
+	bool float_mix_bus;
+	bool polyphase_resampler;
+	bool per_device_threads;
+	bool apm_sharing;
+	bool apm_worker;
+	bool a2dp_encoder_thread;
 } state;
 
 /*
@@ -149,6 +167,12 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 	state.main_thread_tid = pthread_self();
 
 	state.bt_fix_a2dp_packet_size = false;
+	state.float_mix_bus = !!board_config.float_mix_bus_enabled;
+	state.polyphase_resampler = !!board_config.polyphase_resampler_enabled;
+	state.per_device_threads = !!board_config.per_device_threads_enabled;
+	state.apm_sharing = !!board_config.apm_sharing_enabled;
+	state.apm_worker = !!board_config.apm_worker_enabled;
+	state.a2dp_encoder_thread = !!board_config.a2dp_encoder_thread_enabled;
 }
 
 void cras_system_state_set_internal_ucm_suffix(const char *internal_ucm_suffix)
@@ -349,6 +373,66 @@ bool cras_system_get_bt_fix_a2dp_packet_size_enabled()
 	return state.bt_fix_a2dp_packet_size;
 }
 
+void cras_system_set_float_mix_bus_enabled(bool enabled)
+{
+	state.float_mix_bus = enabled;
+}
+
+bool cras_system_get_float_mix_bus_enabled()
+{
+	return state.float_mix_bus;
+}
+
+void cras_system_set_polyphase_resampler_enabled(bool enabled)
+{
+	state.polyphase_resampler = enabled;
+}
+
+bool cras_system_get_polyphase_resampler_enabled()
+{
+	return state.polyphase_resampler;
+}
+
+void cras_system_set_per_device_threads_enabled(bool enabled)
+{
+	state.per_device_threads = enabled;
+}
+
+bool cras_system_get_per_device_threads_enabled()
+{
+	return state.per_device_threads;
+}
+
+void cras_system_set_apm_sharing_enabled(bool enabled)
+{
+	state.apm_sharing = enabled;
+}
+
+bool cras_system_get_apm_sharing_enabled()
+{
+	return state.apm_sharing;
+}
+
+void cras_system_set_apm_worker_enabled(bool enabled)
+{
+	state.apm_worker = enabled;
+}
+
+bool cras_system_get_apm_worker_enabled()
+{
+	return state.apm_worker;
+}
+
+void cras_system_set_a2dp_encoder_thread_enabled(bool enabled)
+{
+	state.a2dp_encoder_thread = enabled;
+}
+
+bool cras_system_get_a2dp_encoder_thread_enabled()
+{
+	return state.a2dp_encoder_thread;
+}
+
 int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 {
 	struct card_list *card;
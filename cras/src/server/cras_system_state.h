@@ -128,6 +128,42 @@ void cras_system_set_bt_fix_a2dp_packet_size_enabled(bool enabled);
 /* Gets the flag of Bluetooth fixed A2DP packet size. */
 bool cras_system_get_bt_fix_a2dp_packet_size_enabled();
 
+/* Sets the flag to mix output streams on a float32 bus. */
+void cras_system_set_float_mix_bus_enabled(bool enabled);
+
+/* Gets the flag to mix output streams on a float32 bus. */
+bool cras_system_get_float_mix_bus_enabled();
+
+/* Sets the flag to use the polyphase resampler for stream conversion. */
+void cras_system_set_polyphase_resampler_enabled(bool enabled);
+
+/* Gets the flag to use the polyphase resampler for stream conversion. */
+bool cras_system_get_polyphase_resampler_enabled();
+
+/* Sets the flag to run each open device in its own audio thread. */
+void cras_system_set_per_device_threads_enabled(bool enabled);
+
+/* Gets the flag to run each open device in its own audio thread. */
+bool cras_system_get_per_device_threads_enabled();
+
+/* Sets the flag to share APM instances between capture streams. */
+void cras_system_set_apm_sharing_enabled(bool enabled);
+
+/* Gets the flag to share APM instances between capture streams. */
+bool cras_system_get_apm_sharing_enabled();
+
+/* Sets the flag to run APM processing in a worker thread. */
+void cras_system_set_apm_worker_enabled(bool enabled);
+
+/* Gets the flag to run APM processing in a worker thread. */
+bool cras_system_get_apm_worker_enabled();
+
+/* Sets the flag to encode A2DP packets in a thread of their own. */
+void cras_system_set_a2dp_encoder_thread_enabled(bool enabled);
+
+/* Gets the flag to encode A2DP packets in a thread of their own. */
+bool cras_system_get_a2dp_encoder_thread_enabled();
+
 /* Adds a card at the given index to the system.  When a new card is found
  * (through a udev event notification) this will add the card to the system,
  * causing its devices to become available for playback/capture.
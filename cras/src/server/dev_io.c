@@ -3,6 +3,7 @@
  * found in the LICENSE file.
  */
 
+#include <limits.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <syslog.h>
@@ -16,6 +17,7 @@
 #include "cras_server_metrics.h"
 #include "dev_stream.h"
 #include "input_data.h"
+#include "mix_bus.h"
 #include "polled_interval_checker.h"
 #include "rate_estimator.h"
 #include "utlist.h"
@@ -44,9 +46,13 @@ static const int MIN_EMPTY_PERIOD_SEC = 30;
  */
 static const int DROP_FRAMES_THRESHOLD_MS = 50;
 
-/* The number of devices playing/capturing non-empty stream(s). */
+/* The number of devices playing/capturing non-empty stream(s), summed over
+ * all audio threads. */
 static int non_empty_device_count = 0;
 
+/* The part of non_empty_device_count counted by this audio thread. */
+static __thread int thread_non_empty_device_count = 0;
+
 /* Gets the master device which the stream is attached to. */
 static inline struct cras_iodev *get_master_dev(const struct dev_stream *stream)
 {
@@ -94,15 +100,25 @@ static inline int count_non_empty_dev(struct open_dev *adevs)
 
 static void check_non_empty_state_transition(struct open_dev *adevs)
 {
-	int new_non_empty_dev_count = count_non_empty_dev(adevs);
+	int new_thread_count = count_non_empty_dev(adevs);
+	int old_non_empty_dev_count, new_non_empty_dev_count;
+
+	if (new_thread_count == thread_non_empty_device_count)
+		return;
+
+	old_non_empty_dev_count = __atomic_fetch_add(
+		&non_empty_device_count,
+		new_thread_count - thread_non_empty_device_count,
+		__ATOMIC_RELAXED);
+	new_non_empty_dev_count = old_non_empty_dev_count + new_thread_count -
+				  thread_non_empty_device_count;
+	thread_non_empty_device_count = new_thread_count;
 
 	// If we have transitioned to or from a state with 0 non-empty devices,
 	// notify the main thread to update system state.
-	if ((non_empty_device_count == 0) != (new_non_empty_dev_count == 0))
+	if ((old_non_empty_dev_count == 0) != (new_non_empty_dev_count == 0))
 		cras_non_empty_audio_send_msg(new_non_empty_dev_count > 0 ? 1 :
 									    0);
-
-	non_empty_device_count = new_non_empty_dev_count;
 }
 
 /* Checks whether it is time to fetch. */
@@ -125,6 +141,96 @@ static bool is_time_to_fetch(const struct dev_stream *dev_stream,
 	return 0;
 }
 
+/* Pull streams are never asked for samples. The client keeps the ring filled
+ * at its own pace, and is only told when it drops to the low watermark. This
+ * also covers streams not running yet, so an empty ring gets filled.
+ * Called with the stream locked. */
+static void notify_pull_stream(struct dev_stream *dev_stream)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	int rc;
+
+	if (cras_rstream_get_is_draining(rstream))
+		return;
+
+	rc = cras_rstream_check_low_watermark(rstream);
+	if (rc < 0) {
+		syslog(LOG_ERR, "notify err: %d for %x", rc,
+		       cras_rstream_id(rstream));
+		cras_rstream_set_is_draining(rstream, 1);
+	}
+}
+
+/* Asks a stream for more data if it has room and it is time to fetch.
+ * Called with the stream locked.
+ * Args:
+ *    dev_stream - The stream on the output device.
+ *    delay - The delay of the output device in frames.
+ */
+static void fetch_stream(struct dev_stream *dev_stream, int delay)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	struct cras_audio_shm *shm = cras_rstream_shm(rstream);
+	struct timespec now;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	if (dev_stream_is_pending_reply(dev_stream)) {
+		dev_stream_flush_old_audio_messages(dev_stream);
+		cras_rstream_record_fetch_interval(dev_stream->stream, &now);
+	}
+
+	if (cras_rstream_is_pull(rstream)) {
+		notify_pull_stream(dev_stream);
+		return;
+	}
+
+	if (!dev_stream_is_running(dev_stream))
+		return;
+
+	if (!is_time_to_fetch(dev_stream, now))
+		return;
+
+	if (cras_shm_get_frames(shm) < 0)
+		cras_rstream_set_is_draining(rstream, 1);
+
+	if (cras_rstream_get_is_draining(dev_stream->stream))
+		return;
+
+	/*
+	 * Skip fetching if client still has not replied yet.
+	 */
+	if (cras_rstream_is_pending_reply(rstream)) {
+		ATLOG(atlog, AUDIO_THREAD_STREAM_FETCH_PENDING,
+		      cras_rstream_id(rstream), 0, 0);
+		return;
+	}
+
+	/*
+	 * Skip fetching if there are enough frames in shared memory.
+	 */
+	if (!cras_shm_is_buffer_available(shm)) {
+		ATLOG(atlog, AUDIO_THREAD_STREAM_SKIP_CB,
+		      cras_rstream_id(rstream), shm->header->write_offset[0],
+		      shm->header->write_offset[1]);
+		dev_stream_update_next_wake_time(dev_stream);
+		return;
+	}
+
+	dev_stream_set_delay(dev_stream, delay);
+
+	ATLOG(atlog, AUDIO_THREAD_FETCH_STREAM, rstream->stream_id,
+	      cras_rstream_get_cb_threshold(rstream), delay);
+
+	rc = dev_stream_request_playback_samples(dev_stream, &now);
+	if (rc < 0) {
+		syslog(LOG_ERR, "fetch err: %d for %x", rc,
+		       cras_rstream_id(rstream));
+		cras_rstream_set_is_draining(rstream, 1);
+	}
+}
+
 /* Asks any stream with room for more data. Sets the time stamp for all streams.
  * Args:
  *    adev - The output device streams are attached to.
@@ -136,7 +242,6 @@ static int fetch_streams(struct open_dev *adev)
 {
 	struct dev_stream *dev_stream;
 	struct cras_iodev *odev = adev->dev;
-	int rc;
 	int delay;
 
 	delay = cras_iodev_delay_frames(odev);
@@ -144,62 +249,9 @@ static int fetch_streams(struct open_dev *adev)
 		return delay;
 
 	DL_FOREACH (adev->dev->streams, dev_stream) {
-		struct cras_rstream *rstream = dev_stream->stream;
-		struct cras_audio_shm *shm = cras_rstream_shm(rstream);
-		struct timespec now;
-
-		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
-
-		if (dev_stream_is_pending_reply(dev_stream)) {
-			dev_stream_flush_old_audio_messages(dev_stream);
-			cras_rstream_record_fetch_interval(dev_stream->stream,
-							   &now);
-		}
-
-		if (!dev_stream_is_running(dev_stream))
-			continue;
-
-		if (!is_time_to_fetch(dev_stream, now))
-			continue;
-
-		if (cras_shm_get_frames(shm) < 0)
-			cras_rstream_set_is_draining(rstream, 1);
-
-		if (cras_rstream_get_is_draining(dev_stream->stream))
-			continue;
-
-		/*
-		 * Skip fetching if client still has not replied yet.
-		 */
-		if (cras_rstream_is_pending_reply(rstream)) {
-			ATLOG(atlog, AUDIO_THREAD_STREAM_FETCH_PENDING,
-			      cras_rstream_id(rstream), 0, 0);
-			continue;
-		}
-
-		/*
-		 * Skip fetching if there are enough frames in shared memory.
-		 */
-		if (!cras_shm_is_buffer_available(shm)) {
-			ATLOG(atlog, AUDIO_THREAD_STREAM_SKIP_CB,
-			      cras_rstream_id(rstream),
-			      shm->header->write_offset[0],
-			      shm->header->write_offset[1]);
-			dev_stream_update_next_wake_time(dev_stream);
-			continue;
-		}
-
-		dev_stream_set_delay(dev_stream, delay);
-
-		ATLOG(atlog, AUDIO_THREAD_FETCH_STREAM, rstream->stream_id,
-		      cras_rstream_get_cb_threshold(rstream), delay);
-
-		rc = dev_stream_request_playback_samples(dev_stream, &now);
-		if (rc < 0) {
-			syslog(LOG_ERR, "fetch err: %d for %x", rc,
-			       cras_rstream_id(rstream));
-			cras_rstream_set_is_draining(rstream, 1);
-		}
+		cras_rstream_lock(dev_stream->stream);
+		fetch_stream(dev_stream, delay);
+		cras_rstream_unlock(dev_stream->stream);
 	}
 
 	return 0;
@@ -240,7 +292,12 @@ static unsigned int set_stream_delay(struct open_dev *adev)
 		if (stream->stream->flags & TRIGGER_ONLY)
 			continue;
 
-		dev_stream_set_delay(stream, delay);
+		/* Samples processed by the APM worker come back later. */
+		dev_stream_set_delay(
+			stream,
+			delay + input_data_get_delay_frames(
+					adev->dev->input_data, stream->stream,
+					adev->dev->format->frame_rate));
 	}
 
 	return 0;
@@ -452,8 +509,11 @@ static int capture_to_streams(struct open_dev *adev)
 	struct dev_stream *cap_limit_stream;
 	struct dev_stream *stream;
 
-	DL_FOREACH (adev->dev->streams, stream)
+	DL_FOREACH (adev->dev->streams, stream) {
+		cras_rstream_lock(stream->stream);
 		dev_stream_flush_old_audio_messages(stream);
+		cras_rstream_unlock(stream->stream);
+	}
 
 	rc = cras_iodev_frames_queued(idev, &hw_tstamp);
 	if (rc < 0)
@@ -488,6 +548,7 @@ static int capture_to_streams(struct open_dev *adev)
 
 	while (remainder > 0) {
 		struct cras_audio_area *area = NULL;
+		struct dev_stream_capture_cache cache;
 		unsigned int nread, total_read;
 
 		nread = remainder;
@@ -496,6 +557,10 @@ static int capture_to_streams(struct open_dev *adev)
 		if (rc < 0 || nread == 0)
 			return rc;
 
+		/* Followers copy what their group leader converts from this
+		 * input buffer, the cache is only valid for it. */
+		cache.num_groups = 0;
+
 		DL_FOREACH (adev->dev->streams, stream) {
 			unsigned int this_read;
 			unsigned int area_offset;
@@ -505,6 +570,7 @@ static int capture_to_streams(struct open_dev *adev)
 			    stream->stream->triggered)
 				continue;
 
+			cras_rstream_lock(stream->stream);
 			input_data_get_for_stream(idev->input_data,
 						  stream->stream,
 						  idev->buf_state, &area,
@@ -525,11 +591,12 @@ static int capture_to_streams(struct open_dev *adev)
 
 			this_read =
 				dev_stream_capture(stream, area, area_offset,
-						   software_gain_scaler);
+						   software_gain_scaler, &cache);
 
 			input_data_put_for_stream(idev->input_data,
 						  stream->stream,
 						  idev->buf_state, this_read);
+			cras_rstream_unlock(stream->stream);
 		}
 
 		rc = cras_iodev_put_input_buffer(idev);
@@ -577,46 +644,69 @@ static int write_streams(struct open_dev **odevs, struct open_dev *adev,
 	/* Mix as much as we can, the minimum fill level of any stream. */
 	DL_FOREACH (adev->dev->streams, curr) {
 		int dev_frames;
+		bool remove = false;
 
 		/* Skip stream which hasn't started running yet. */
 		if (!dev_stream_is_running(curr))
 			continue;
 
-		/* If this is a single output dev stream, updates the latest
-		 * number of frames for playback. */
-		if (dev_stream_attached_devs(curr) == 1)
+		cras_rstream_lock(curr->stream);
+
+		/* If this is a single output dev stream, or the only output
+		 * device of this thread, updates the latest number of frames
+		 * for playback. */
+		if (dev_stream_attached_devs(curr) == 1 || !(*odevs)->next)
 			dev_stream_update_frames(curr);
 
 		dev_frames = dev_stream_playback_frames(curr);
 		if (dev_frames < 0) {
-			dev_io_remove_stream(odevs, curr->stream, NULL);
-			continue;
-		}
-		ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_STREAM,
-		      curr->stream->stream_id, dev_frames,
-		      dev_stream_is_pending_reply(curr));
-		if (cras_rstream_get_is_draining(curr->stream)) {
-			drain_limit = MIN((size_t)dev_frames, drain_limit);
-			if (!dev_frames)
-				dev_io_remove_stream(odevs, curr->stream, NULL);
+			remove = true;
 		} else {
-			write_limit = MIN((size_t)dev_frames, write_limit);
-			num_playing++;
+			ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_STREAM,
+			      curr->stream->stream_id, dev_frames,
+			      dev_stream_is_pending_reply(curr));
+			if (cras_rstream_get_is_draining(curr->stream)) {
+				drain_limit =
+					MIN((size_t)dev_frames, drain_limit);
+				remove = !dev_frames;
+			} else if (cras_rstream_is_pull(curr->stream)) {
+				/* Don't hold other streams back on a pull
+				 * stream running dry, pad it with up to what
+				 * an underrun of the device would. */
+				write_limit = MIN(MAX((size_t)dev_frames,
+						      odev->min_cb_level),
+						  write_limit);
+				num_playing++;
+			} else {
+				write_limit =
+					MIN((size_t)dev_frames, write_limit);
+				num_playing++;
+			}
 		}
+
+		cras_rstream_unlock(curr->stream);
+		if (remove)
+			dev_io_remove_stream(odevs, curr->stream, NULL);
 	}
 
 	if (!num_playing)
 		write_limit = drain_limit;
 
-	if (write_limit > max_offset)
-		memset(dst + max_offset * frame_bytes, 0,
-		       (write_limit - max_offset) * frame_bytes);
+	if (write_limit > max_offset) {
+		if (adev->mix_bus)
+			mix_bus_zero(adev->mix_bus, max_offset,
+				     write_limit - max_offset);
+		else
+			memset(dst + max_offset * frame_bytes, 0,
+			       (write_limit - max_offset) * frame_bytes);
+	}
 
 	ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_MIX, write_limit, max_offset,
 	      0);
 
 	DL_FOREACH (adev->dev->streams, curr) {
 		unsigned int offset;
+		unsigned int silence = 0;
 		int nwritten;
 
 		if (!dev_stream_is_running(curr))
@@ -625,16 +715,36 @@ static int write_streams(struct open_dev **odevs, struct open_dev *adev,
 		offset = cras_iodev_stream_offset(odev, curr);
 		if (offset >= write_limit)
 			continue;
-		nwritten = dev_stream_mix(curr, odev->format,
-					  dst + frame_bytes * offset,
-					  write_limit - offset);
+		cras_rstream_lock(curr->stream);
+		if (adev->mix_bus)
+			nwritten = dev_stream_mix_bus(curr, odev->format,
+						      adev->mix_bus, offset,
+						      write_limit - offset);
+		else
+			nwritten = dev_stream_mix(curr, odev->format,
+						  dst + frame_bytes * offset,
+						  write_limit - offset);
+		/* What a pull stream couldn't provide is played as silence.
+		 * The device buffer is zeroed past |max_offset| and holds
+		 * the other streams below it, so only the position in the
+		 * device buffer skips the missing frames. The read offset in
+		 * the stream's shm stays at what was mixed. The underrun is
+		 * counted once, on the master device. */
+		if (nwritten >= 0 && cras_rstream_is_pull(curr->stream) &&
+		    (unsigned int)nwritten < write_limit - offset) {
+			silence = write_limit - offset - nwritten;
+			if (curr->dev_id == curr->stream->master_dev.dev_id)
+				cras_rstream_record_underrun(curr->stream,
+							     silence);
+		}
+		cras_rstream_unlock(curr->stream);
 
 		if (nwritten < 0) {
 			dev_io_remove_stream(odevs, curr->stream, NULL);
 			continue;
 		}
 
-		cras_iodev_stream_written(odev, curr, nwritten);
+		cras_iodev_stream_written(odev, curr, nwritten + silence);
 	}
 
 	write_limit = cras_iodev_all_streams_written(odev);
@@ -696,6 +806,7 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 	int *non_empty_ptr = NULL;
 	uint8_t *dst = NULL;
 	struct cras_audio_area *area = NULL;
+	struct timespec stage_ts;
 
 	/* Possibly fill zeros for no_stream state and possibly transit state.
 	 */
@@ -744,9 +855,12 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 
 		/* TODO(dgreid) - This assumes interleaved audio. */
 		dst = area->channels[0].buf;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &stage_ts);
 		written = write_streams(odevs, adev, dst, frames);
 		if (written < 0) /* pcm has been closed */
 			return (int)written;
+		cras_iodev_stage_time_add(odev, CRAS_OUTPUT_STAGE_MIX,
+					  &stage_ts);
 
 		if (written < (snd_pcm_sframes_t)frames)
 			/* Got all the samples from client that we can, but it
@@ -769,8 +883,21 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 			pic_interval_reset(adev->non_empty_check_pi);
 		}
 
-		rc = cras_iodev_put_output_buffer(
-			odev, dst, written, non_empty_ptr, output_converter);
+		if (adev->mix_bus) {
+			/* Streams keep their offsets past the committed
+			 * frames, keep what they mixed there for next time. */
+			unsigned int queued =
+				written + cras_iodev_max_stream_offset(odev);
+
+			rc = cras_iodev_put_output_mix_bus(
+				odev, adev->mix_bus, dst, written,
+				non_empty_ptr, output_converter);
+			mix_bus_consume(adev->mix_bus, written, queued);
+		} else {
+			rc = cras_iodev_put_output_buffer(odev, dst, written,
+							  non_empty_ptr,
+							  output_converter);
+		}
 
 		if (rc < 0)
 			return rc;
@@ -893,7 +1020,9 @@ int dev_io_send_captured_samples(struct open_dev *idev_list)
 
 		/* Post samples to rstream if there are enough samples. */
 		DL_FOREACH (adev->dev->streams, stream) {
+			cras_rstream_lock(stream->stream);
 			dev_stream_capture_update_rstream(stream);
+			cras_rstream_unlock(stream->stream);
 		}
 
 		/* Set wake_ts for this device. */
@@ -946,10 +1075,18 @@ static void dev_io_check_dev_stream_start(struct open_dev *adev)
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	DL_FOREACH (adev->dev->streams, dev_stream) {
-		if (!is_time_to_fetch(dev_stream, now))
+		if (dev_stream_is_running(dev_stream))
 			continue;
-		if (!dev_stream_is_running(dev_stream))
-			cras_iodev_start_stream(adev->dev, dev_stream);
+		/* Pull streams start once the client queued something. */
+		if (cras_rstream_is_pull(dev_stream->stream)) {
+			if (!cras_shm_get_frames(dev_stream->stream->shm))
+				continue;
+		} else if (!is_time_to_fetch(dev_stream, now)) {
+			continue;
+		}
+		cras_rstream_lock(dev_stream->stream);
+		cras_iodev_start_stream(adev->dev, dev_stream);
+		cras_rstream_unlock(dev_stream->stream);
 	}
 }
 
@@ -984,8 +1121,11 @@ int dev_io_playback_write(struct open_dev **odevs,
 	adev = *odevs;
 	if (adev && adev->next) {
 		DL_FOREACH (*odevs, adev) {
-			DL_FOREACH (adev->dev->streams, curr)
+			DL_FOREACH (adev->dev->streams, curr) {
+				cras_rstream_lock(curr->stream);
 				dev_stream_update_frames(curr);
+				cras_rstream_unlock(curr->stream);
+			}
 		}
 	}
 
@@ -1040,7 +1180,9 @@ int dev_io_playback_write(struct open_dev **odevs,
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 		DL_FOREACH (adev->dev->streams, stream) {
+			cras_rstream_lock(stream->stream);
 			dev_stream_playback_update_rstream(stream);
+			cras_rstream_unlock(stream->stream);
 		}
 	}
 
@@ -1183,6 +1325,21 @@ struct open_dev *dev_io_find_open_dev(struct open_dev *odev_list,
 	return NULL;
 }
 
+/* Logs the average and longest time per block of each output stage. */
+static void log_output_stage_times(const struct cras_iodev *odev)
+{
+	const struct cras_iodev_stage_stats *stats = &odev->stage_stats;
+	unsigned int stage;
+
+	if (!stats->num_blocks)
+		return;
+
+	for (stage = 0; stage < CRAS_NUM_OUTPUT_STAGES; stage++)
+		cras_server_metrics_output_stage_time(
+			stage, stats->total_ns[stage] / stats->num_blocks,
+			MIN(stats->max_ns[stage], UINT_MAX));
+}
+
 void dev_io_rm_open_dev(struct open_dev **odev_list, struct open_dev *dev_to_rm)
 {
 	struct open_dev *odev;
@@ -1211,19 +1368,28 @@ void dev_io_rm_open_dev(struct open_dev **odev_list, struct open_dev *dev_to_rm)
 	cras_server_metrics_highest_hw_level(dev_to_rm->dev->highest_hw_level,
 					     dev_to_rm->dev->direction);
 
+	/* Metrics logs the time spent in each stage of the output path. */
+	if (dev_to_rm->dev->direction == CRAS_STREAM_OUTPUT)
+		log_output_stage_times(dev_to_rm->dev);
+
 	check_non_empty_state_transition(*odev_list);
 
 	ATLOG(atlog, AUDIO_THREAD_DEV_REMOVED, dev_to_rm->dev->info.idx, 0, 0);
 
 	DL_FOREACH (dev_to_rm->dev->streams, dev_stream) {
-		cras_iodev_rm_stream(dev_to_rm->dev, dev_stream->stream);
+		struct cras_rstream *stream = dev_stream->stream;
+
+		cras_rstream_lock(stream);
+		cras_iodev_rm_stream(dev_to_rm->dev, stream);
 		dev_stream_destroy(dev_stream);
+		cras_rstream_unlock(stream);
 	}
 
 	if (dev_to_rm->empty_pi)
 		pic_polled_interval_destroy(&dev_to_rm->empty_pi);
 	if (dev_to_rm->non_empty_check_pi)
 		pic_polled_interval_destroy(&dev_to_rm->non_empty_check_pi);
+	mix_bus_destroy(dev_to_rm->mix_bus);
 	free(dev_to_rm);
 }
 
@@ -1232,9 +1398,11 @@ static void delete_stream_from_dev(struct cras_iodev *dev,
 {
 	struct dev_stream *out;
 
+	cras_rstream_lock(stream);
 	out = cras_iodev_rm_stream(dev, stream);
 	if (out)
 		dev_stream_destroy(out);
+	cras_rstream_unlock(stream);
 }
 
 int dev_io_append_stream(struct open_dev **dev_list,
@@ -1252,6 +1420,9 @@ int dev_io_append_stream(struct open_dev **dev_list,
 	int level;
 	int rc = 0;
 
+	/* The stream may already be running on devices of other threads. */
+	cras_rstream_lock(stream);
+
 	for (i = 0; i < num_iodevs; i++) {
 		DL_SEARCH_SCALAR(*dev_list, open_dev, dev, iodevs[i]);
 		if (!open_dev)
@@ -1389,6 +1560,8 @@ int dev_io_append_stream(struct open_dev **dev_list,
 		}
 	}
 
+	cras_rstream_unlock(stream);
+
 	return rc;
 }
 
@@ -13,6 +13,8 @@
 #include "cras_types.h"
 #include "polled_interval_checker.h"
 
+struct mix_bus;
+
 /*
  * Open input/output devices.
  *    dev - The device.
@@ -24,6 +26,8 @@
  *    last_non_empty_ts - The last time we know the device played/captured
  *        non-empty (zero) audio.
  *    coarse_rate_adjust - Hack for when the sample rate needs heavy correction.
+ *    mix_bus - Float bus streams are mixed into before being quantized to the
+ *        device format. NULL if the device mixes in its own format.
  */
 struct open_dev {
 	struct cras_iodev *dev;
@@ -33,6 +37,7 @@ struct open_dev {
 	struct polled_interval *non_empty_check_pi;
 	struct polled_interval *empty_pi;
 	int coarse_rate_adjust;
+	struct mix_bus *mix_bus;
 	struct open_dev *prev, *next;
 };
 
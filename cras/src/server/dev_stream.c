@@ -3,16 +3,20 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
 #include "byte_buffer.h"
 #include "cras_fmt_conv.h"
+#include "cras_fmt_conv_pool.h"
 #include "dev_stream.h"
 #include "cras_audio_area.h"
 #include "cras_mix.h"
 #include "cras_server_metrics.h"
 #include "cras_shm.h"
+#include "cras_system_state.h"
+#include "mix_bus.h"
 
 /* Adjust device's sample rate by this step faster or slower. Used
  * to make sure multiple active device has stable buffer level.
@@ -70,6 +74,7 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	int rc = 0;
 	unsigned int max_frames, dev_frames, buf_bytes;
 	const struct cras_audio_format *ofmt;
+	enum CRAS_RESAMPLER_BACKEND backend;
 
 	out = calloc(1, sizeof(*out));
 	out->dev_id = dev_id;
@@ -81,8 +86,13 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 					       stream_fmt->frame_rate,
 					       dev_fmt->frame_rate);
 
+	backend = cras_system_get_polyphase_resampler_enabled() ?
+			  CRAS_RESAMPLER_POLYPHASE :
+			  CRAS_RESAMPLER_SPEEX;
+
 	if (stream->direction == CRAS_STREAM_OUTPUT) {
 		rc = config_format_converter(&out->conv, stream->direction,
+					     stream->stream_type, backend,
 					     stream_fmt, dev_fmt, max_frames);
 	} else {
 		/*
@@ -93,6 +103,7 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 		ofmt = cras_rstream_post_processing_format(stream, dev_ptr) ?:
 			       dev_fmt,
 		rc = config_format_converter(&out->conv, stream->direction,
+					     stream->stream_type, backend,
 					     ofmt, stream_fmt, max_frames);
 	}
 	if (rc) {
@@ -130,6 +141,86 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	return out;
 }
 
+/* Only the streams this device is the master of run the linear resampler at
+ * the nominal ratio, others follow the rate of their own master device.
+ * Trigger only streams skip reads once triggered, so they can't keep up. */
+static int capture_conv_shareable(const struct dev_stream *dev_stream)
+{
+	return dev_stream->dev_id == dev_stream->stream->master_dev.dev_id &&
+	       !(dev_stream->stream->flags & TRIGGER_ONLY);
+}
+
+/* Returns the converter that runs for |dev_stream|, the one of its leader if
+ * it copies the conversion of another stream. */
+static struct cras_fmt_conv *capture_conv(const struct dev_stream *dev_stream)
+{
+	if (dev_stream->capture_leader)
+		return dev_stream->capture_leader->conv;
+	return dev_stream->conv;
+}
+
+/* Adds |dev_stream| to the followers of |leader|, after the others so the
+ * list keeps the order of the device streams. */
+static void capture_group_join(struct dev_stream *dev_stream,
+			       struct dev_stream *leader)
+{
+	struct dev_stream **tail = &leader->capture_followers;
+
+	while (*tail)
+		tail = &(*tail)->capture_next;
+	*tail = dev_stream;
+	dev_stream->capture_next = NULL;
+	dev_stream->capture_leader = leader;
+}
+
+/* Removes the follower |dev_stream| from its group. */
+static void capture_group_unlink(struct dev_stream *dev_stream)
+{
+	struct dev_stream **link;
+
+	link = &dev_stream->capture_leader->capture_followers;
+
+	while (*link != dev_stream)
+		link = &(*link)->capture_next;
+	*link = dev_stream->capture_next;
+	dev_stream->capture_next = NULL;
+	dev_stream->capture_leader = NULL;
+}
+
+/* Makes the follower |dev_stream| run its own converter again. The converter
+ * sat idle while the leader's ran, start it over instead of resuming from
+ * stale history. */
+static void capture_group_leave(struct dev_stream *dev_stream)
+{
+	capture_group_unlink(dev_stream);
+	cras_fmt_conv_reset(dev_stream->conv);
+}
+
+/* Hands the group led by |dev_stream| to its first follower when it goes
+ * away. The new leader takes over the converter that has been running, its
+ * own idle one goes with |dev_stream|. */
+static void capture_group_promote(struct dev_stream *dev_stream)
+{
+	struct dev_stream *next = dev_stream->capture_followers;
+	struct cras_fmt_conv *conv;
+	struct dev_stream *follower;
+
+	if (!next)
+		return;
+
+	conv = next->conv;
+	next->conv = dev_stream->conv;
+	dev_stream->conv = conv;
+
+	next->capture_leader = NULL;
+	next->capture_followers = next->capture_next;
+	next->capture_next = NULL;
+	for (follower = next->capture_followers; follower;
+	     follower = follower->capture_next)
+		follower->capture_leader = next;
+	dev_stream->capture_followers = NULL;
+}
+
 void dev_stream_destroy(struct dev_stream *dev_stream)
 {
 	void *dev_ptr =
@@ -137,9 +228,13 @@ void dev_stream_destroy(struct dev_stream *dev_stream)
 	/* Stops the APM and then unlink the dev stream pair. */
 	cras_apm_list_stop_apm(dev_stream->stream->apm_list, dev_ptr);
 	cras_rstream_dev_detach(dev_stream->stream, dev_stream->dev_id);
+	if (dev_stream->capture_leader)
+		capture_group_unlink(dev_stream);
+	else
+		capture_group_promote(dev_stream);
 	if (dev_stream->conv) {
 		cras_audio_area_destroy(dev_stream->conv_area);
-		cras_fmt_conv_destroy(&dev_stream->conv);
+		cras_fmt_conv_pool_put(&dev_stream->conv);
 		byte_buffer_destroy(&dev_stream->conv_buffer);
 	}
 	free(dev_stream);
@@ -165,9 +260,12 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 	}
 }
 
-int dev_stream_mix(struct dev_stream *dev_stream,
-		   const struct cras_audio_format *fmt, uint8_t *dst,
-		   unsigned int num_to_write)
+/* Renders frames of the stream either into the interleaved buffer |dst| or
+ * into |bus| at |bus_offset| when |bus| is not NULL. */
+static int mix_stream(struct dev_stream *dev_stream,
+		      const struct cras_audio_format *fmt, uint8_t *dst,
+		      struct mix_bus *bus, unsigned int bus_offset,
+		      unsigned int num_to_write)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	uint8_t *src;
@@ -210,10 +308,18 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 			dev_frames = MIN(frames, num_to_write - fr_written);
 			read_frames = dev_frames;
 		}
-		num_samples = dev_frames * fmt->num_channels;
-		cras_mix_add(fmt->format, target, src, num_samples, 1,
-			     cras_rstream_get_mute(rstream), mix_vol);
-		target += dev_frames * cras_get_format_bytes(fmt);
+		if (bus) {
+			/* A muted stream adds nothing to the bus. */
+			if (!cras_rstream_get_mute(rstream))
+				mix_bus_add(bus, bus_offset + fr_written,
+					    fmt->format, src, dev_frames,
+					    mix_vol);
+		} else {
+			num_samples = dev_frames * fmt->num_channels;
+			cras_mix_add(fmt->format, target, src, num_samples, 1,
+				     cras_rstream_get_mute(rstream), mix_vol);
+			target += dev_frames * cras_get_format_bytes(fmt);
+		}
 		fr_written += dev_frames;
 		fr_read += read_frames;
 	}
@@ -224,6 +330,21 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	return fr_written;
 }
 
+int dev_stream_mix(struct dev_stream *dev_stream,
+		   const struct cras_audio_format *fmt, uint8_t *dst,
+		   unsigned int num_to_write)
+{
+	return mix_stream(dev_stream, fmt, dst, NULL, 0, num_to_write);
+}
+
+int dev_stream_mix_bus(struct dev_stream *dev_stream,
+		       const struct cras_audio_format *fmt,
+		       struct mix_bus *bus, unsigned int offset,
+		       unsigned int num_to_write)
+{
+	return mix_stream(dev_stream, fmt, NULL, bus, offset, num_to_write);
+}
+
 /* Copy from the captured buffer to the temporary format converted buffer. */
 static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 					  const uint8_t *source_samples,
@@ -265,6 +386,125 @@ static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 	return total_read;
 }
 
+/* Finds the conversion |leader| did on this input buffer, or NULL if there is
+ * none. */
+static const struct dev_stream_capture_group *
+capture_find_group(const struct dev_stream_capture_cache *cache,
+		   const struct dev_stream *leader)
+{
+	unsigned int i;
+
+	if (!cache)
+		return NULL;
+
+	for (i = 0; i < cache->num_groups; i++)
+		if (cache->groups[i].leader == leader)
+			return &cache->groups[i];
+	return NULL;
+}
+
+/* Finds a conversion from |src| on this input buffer that |dev_stream|, which
+ * hasn't captured yet, can join. */
+static const struct dev_stream_capture_group *
+capture_find_joinable(const struct dev_stream_capture_cache *cache,
+		      const struct dev_stream *dev_stream, const uint8_t *src)
+{
+	const struct dev_stream_capture_group *group;
+	unsigned int i;
+
+	if (!cache || dev_stream->capture_started ||
+	    !capture_conv_shareable(dev_stream))
+		return NULL;
+
+	for (i = 0; i < cache->num_groups; i++) {
+		group = &cache->groups[i];
+		if (group->src == src &&
+		    cras_fmt_conv_same_chain(group->leader->conv,
+					     dev_stream->conv) &&
+		    buf_available(dev_stream->conv_buffer) >= group->bytes)
+			return group;
+	}
+	return NULL;
+}
+
+/* Records the conversion |dev_stream| just did for its followers and for
+ * streams that may join it. */
+static void capture_add_group(struct dev_stream_capture_cache *cache,
+			      struct dev_stream *dev_stream, const uint8_t *src,
+			      unsigned int read_frames, unsigned int start,
+			      unsigned int bytes)
+{
+	struct dev_stream_capture_group *group;
+
+	if (!cache || !capture_conv_shareable(dev_stream) ||
+	    cache->num_groups == DEV_STREAM_MAX_CAPTURE_GROUPS)
+		return;
+
+	group = &cache->groups[cache->num_groups++];
+	group->leader = dev_stream;
+	group->src = src;
+	group->read_frames = read_frames;
+	group->start = start;
+	group->bytes = bytes;
+}
+
+/* Appends the samples converted by the leader of |group| to the conv_buffer
+ * of |dev_stream|. */
+static void capture_copy_from_group(struct dev_stream *dev_stream,
+				    const struct dev_stream_capture_group *group)
+{
+	const struct byte_buffer *src_buf = group->leader->conv_buffer;
+	unsigned int pos = group->start;
+	unsigned int left = group->bytes;
+	unsigned int writable;
+	unsigned int n;
+	uint8_t *dst;
+
+	dev_stream->conv_area->num_channels =
+		cras_fmt_conv_out_format(dev_stream->conv)->num_channels;
+
+	while (left) {
+		dst = buf_write_pointer_size(dev_stream->conv_buffer,
+					     &writable);
+		n = MIN(left, writable);
+		n = MIN(n, src_buf->used_size - pos);
+		if (n == 0)
+			break;
+		memcpy(dst, &src_buf->bytes[pos], n);
+		buf_increment_write(dev_stream->conv_buffer, n);
+		pos = (pos + n) % src_buf->used_size;
+		left -= n;
+	}
+}
+
+/* Returns the conversion of this input buffer that |dev_stream| copies, or
+ * NULL if it converts on its own. A follower whose leader didn't convert the
+ * same samples, which the shared sizing should prevent, leaves the group. */
+static const struct dev_stream_capture_group *
+capture_group_for_read(const struct dev_stream_capture_cache *cache,
+		       struct dev_stream *dev_stream, const uint8_t *src)
+{
+	const struct dev_stream_capture_group *group;
+
+	if (!dev_stream->capture_leader) {
+		group = capture_find_joinable(cache, dev_stream, src);
+		if (group)
+			capture_group_join(dev_stream, group->leader);
+		return group;
+	}
+
+	group = capture_find_group(cache, dev_stream->capture_leader);
+	if (group && group->src == src && capture_conv_shareable(dev_stream) &&
+	    capture_conv_shareable(group->leader) &&
+	    buf_available(dev_stream->conv_buffer) >= group->bytes)
+		return group;
+
+	syslog(LOG_WARNING, "Stream %x stops sharing capture conversion",
+	       dev_stream->stream->stream_id);
+	capture_group_leave(dev_stream);
+	return NULL;
+}
+
 /* Copy from the converted buffer to the stream shm.  These have the same format
  * at this point. */
 static unsigned int
@@ -332,7 +572,8 @@ capture_copy_converted_to_stream(struct dev_stream *dev_stream,
 unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				const struct cras_audio_area *area,
 				unsigned int area_offset,
-				float software_gain_scaler)
+				float software_gain_scaler,
+				struct dev_stream_capture_cache *cache)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	struct cras_audio_shm *shm;
@@ -341,17 +582,32 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 
 	/* Check if format conversion is needed. */
 	if (cras_fmt_conversion_needed(dev_stream->conv)) {
+		const struct dev_stream_capture_group *group;
 		unsigned int format_bytes, fr_to_capture;
+		unsigned int start, queued;
+		const uint8_t *src;
 
 		fr_to_capture = dev_stream_capture_avail(dev_stream);
 		fr_to_capture = MIN(fr_to_capture, area->frames - area_offset);
 
 		format_bytes = cras_get_format_bytes(
 			cras_fmt_conv_in_format(dev_stream->conv));
-		nread = capture_with_fmt_conv(
-			dev_stream,
-			area->channels[0].buf + area_offset * format_bytes,
-			fr_to_capture);
+		src = area->channels[0].buf + area_offset * format_bytes;
+
+		group = capture_group_for_read(cache, dev_stream, src);
+		if (group) {
+			capture_copy_from_group(dev_stream, group);
+			nread = group->read_frames;
+		} else {
+			start = dev_stream->conv_buffer->write_idx;
+			queued = buf_queued(dev_stream->conv_buffer);
+			nread = capture_with_fmt_conv(dev_stream, src,
+						      fr_to_capture);
+			capture_add_group(
+				cache, dev_stream, src, nread, start,
+				buf_queued(dev_stream->conv_buffer) - queued);
+		}
+		dev_stream->capture_started = 1;
 
 		capture_copy_converted_to_stream(dev_stream, rstream,
 						 software_gain_scaler);
@@ -414,11 +670,13 @@ unsigned int dev_stream_cb_threshold(const struct dev_stream *dev_stream)
 		return cras_fmt_conv_in_frames_to_out(dev_stream->conv,
 						      cb_threshold);
 	else
-		return cras_fmt_conv_out_frames_to_in(dev_stream->conv,
+		return cras_fmt_conv_out_frames_to_in(capture_conv(dev_stream),
 						      cb_threshold);
 }
 
-unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
+/* Returns the number of frames in the stream format |dev_stream| can take,
+ * limited by the room in its shm and in its conv_buffer. */
+static unsigned int capture_out_avail(const struct dev_stream *dev_stream)
 {
 	struct cras_audio_shm *shm;
 	struct cras_rstream *rstream = dev_stream->stream;
@@ -449,11 +707,28 @@ unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
 	else
 		frames_avail -= conv_buf_level;
 
-	frames_avail =
-		MIN(frames_avail,
-		    buf_available(dev_stream->conv_buffer) / format_bytes);
+	return MIN(frames_avail,
+		   buf_available(dev_stream->conv_buffer) / format_bytes);
+}
+
+unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
+{
+	const struct dev_stream *leader;
+	const struct dev_stream *follower;
+	unsigned int frames_avail;
+
+	if (!dev_stream->conv)
+		return capture_out_avail(dev_stream);
 
-	return cras_fmt_conv_out_frames_to_in(dev_stream->conv, frames_avail);
+	/* A group converts once for all its streams, so only as much as each
+	 * of them can take. That keeps them reading the same samples. */
+	leader = dev_stream->capture_leader ?: dev_stream;
+	frames_avail = capture_out_avail(leader);
+	for (follower = leader->capture_followers; follower;
+	     follower = follower->capture_next)
+		frames_avail = MIN(frames_avail, capture_out_avail(follower));
+
+	return cras_fmt_conv_out_frames_to_in(leader->conv, frames_avail);
 }
 
 /* TODO(dgreid) remove this hack to reset the time if needed. */
@@ -608,8 +883,8 @@ void dev_stream_set_delay(const struct dev_stream *dev_stream,
 					    &shm->header->ts);
 	} else {
 		shm = cras_rstream_shm(rstream);
-		stream_frames = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
-							       delay_frames);
+		stream_frames = cras_fmt_conv_in_frames_to_out(
+			capture_conv(dev_stream), delay_frames);
 		if (cras_shm_frames_written(shm) == 0)
 			cras_set_capture_timestamp(rstream->format.frame_rate,
 						   stream_frames,
@@ -639,14 +914,14 @@ int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
 	 * let client response wake audio thread up. */
 	if (stream_uses_input(stream) && (stream->flags & USE_DEV_TIMING) &&
 	    cras_rstream_is_pending_reply(stream))
-		return stream->fd;
+		return cras_rstream_get_reply_fd(stream);
 
 	if (!stream_uses_output(stream) ||
 	    !cras_rstream_is_pending_reply(stream) ||
 	    cras_rstream_get_is_draining(stream))
 		return -1;
 
-	return stream->fd;
+	return cras_rstream_get_reply_fd(stream);
 }
 
 /*
@@ -18,6 +18,7 @@
 struct cras_audio_area;
 struct cras_fmt_conv;
 struct cras_iodev;
+struct mix_bus;
 
 /*
  * Linked list of streams of audio from/to a client.
@@ -33,6 +34,12 @@ struct cras_iodev;
  *                 into device. For output stream, it should be set to true
  *                 just before its first fetch to avoid affecting other existing
  *                 streams.
+ *    capture_leader - For input, the stream of the same device whose
+ *        conversion this one copies, NULL if it runs its own converter.
+ *    capture_followers - For input, the streams copying the conversion of
+ *        this one, linked through capture_next in the order they joined.
+ *    capture_next - The next follower of the same leader.
+ *    capture_started - Set once the stream has captured from the device.
  */
 struct dev_stream {
 	unsigned int dev_id;
@@ -44,6 +51,43 @@ struct dev_stream {
 	size_t dev_rate;
 	struct dev_stream *prev, *next;
 	int is_running;
+	struct dev_stream *capture_leader;
+	struct dev_stream *capture_followers;
+	struct dev_stream *capture_next;
+	int capture_started;
+};
+
+/* Maximum number of conversion groups tracked per capture read. */
+#define DEV_STREAM_MAX_CAPTURE_GROUPS 4
+
+/*
+ * Samples converted by the leader of a capture group from one input buffer,
+ * which the followers of the group copy instead of converting again.
+ * Args:
+ *    leader - The dev_stream that ran the conversion.
+ *    src - The device samples the conversion read from.
+ *    read_frames - The number of frames the conversion consumed.
+ *    start - Offset of the converted bytes in the conv_buffer of leader.
+ *    bytes - The number of converted bytes.
+ */
+struct dev_stream_capture_group {
+	struct dev_stream *leader;
+	const uint8_t *src;
+	unsigned int read_frames;
+	unsigned int start;
+	unsigned int bytes;
+};
+
+/*
+ * The conversion groups of one device read. Must be zeroed before the first
+ * stream captures from a new input buffer.
+ * Args:
+ *    num_groups - The number of valid entries in groups.
+ *    groups - The conversion done so far for this input buffer.
+ */
+struct dev_stream_capture_cache {
+	unsigned int num_groups;
+	struct dev_stream_capture_group groups[DEV_STREAM_MAX_CAPTURE_GROUPS];
 };
 
 struct dev_stream *dev_stream_create(struct cras_rstream *stream,
@@ -85,17 +129,38 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 		   unsigned int num_to_write);
 
 /*
- * Reads froms from the source into the dev_stream.
+ * Renders count frames from shm into the float mix bus of the device.
+ * Args:
+ *    dev_stream - The struct holding the stream to mix.
+ *    format - The format of the audio device.
+ *    bus - The mix bus to accumulate into.
+ *    offset - The frame offset in the bus to start mixing at.
+ *    num_to_write - The number of frames written.
+ */
+int dev_stream_mix_bus(struct dev_stream *dev_stream,
+		       const struct cras_audio_format *fmt,
+		       struct mix_bus *bus, unsigned int offset,
+		       unsigned int num_to_write);
+
+/*
+ * Reads froms from the source into the dev_stream. A stream that starts on a
+ * device where another stream converts the same samples with the same
+ * conversion chain joins that stream's group across reads: the leader converts,
+ * sized for every member, and the followers copy its output through |cache|.
+ * Only the copy to the stream shm and the software gain are per stream.
  * Args:
  *    dev_stream - The struct holding the stream to mix to.
  *    area - The area to copy audio from.
  *    area_offset - The offset at which to start reading from area.
  *    software_gain_scaler - The software gain scaler.
+ *    cache - The conversions done for this input buffer, or NULL to convert
+ *        without sharing.
  */
 unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				const struct cras_audio_area *area,
 				unsigned int area_offset,
-				float software_gain_scaler);
+				float software_gain_scaler,
+				struct dev_stream_capture_cache *cache);
 
 /* Returns the number of iodevs this stream has attached to. */
 int dev_stream_attached_devs(const struct dev_stream *dev_stream);
@@ -195,7 +260,8 @@ static inline void dev_stream_set_running(struct dev_stream *dev_stream)
 static inline const struct timespec *
 dev_stream_next_cb_ts(const struct dev_stream *dev_stream)
 {
-	if (dev_stream->stream->flags & USE_DEV_TIMING)
+	/* PULL_MODE streams are never called back. */
+	if (dev_stream->stream->flags & (USE_DEV_TIMING | PULL_MODE))
 		return NULL;
 
 	return &dev_stream->stream->next_cb_ts;
@@ -165,7 +165,11 @@ int input_data_get_for_stream(struct input_data *data,
 		apm_processed = cras_apm_list_process(apm, data->fbuffer,
 						      stream_offset);
 		if (apm_processed < 0) {
-			cras_apm_list_remove_apm(stream->apm_list, apm);
+			/* The APM list belongs to the main thread, only stop
+			 * using the APM and pass the input through as is. */
+			cras_apm_list_stop_apm(stream->apm_list, data->dev_ptr);
+			*area = data->area;
+			*offset = MIN(stream_offset, data->area->frames);
 			return 0;
 		}
 		buffer_share_offset_update(offsets, stream->stream_id,
@@ -208,3 +212,21 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 
 	return idev_sw_gain_scaler * cras_rstream_get_volume_scaler(stream);
 }
+
+unsigned int input_data_get_delay_frames(struct input_data *data,
+					 struct cras_rstream *stream,
+					 unsigned int dev_rate)
+{
+	struct cras_apm *apm;
+	unsigned int frames;
+
+	apm = cras_apm_list_get_active_apm(stream, data->dev_ptr);
+	if (apm == NULL)
+		return 0;
+
+	frames = cras_apm_list_get_delay_frames(apm);
+	if (frames == 0)
+		return 0;
+	return cras_frames_at_rate(cras_apm_list_get_format(apm)->frame_rate,
+				   frames, dev_rate);
+}
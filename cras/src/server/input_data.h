@@ -92,4 +92,17 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 					  float idev_sw_gain_scaler,
 					  struct cras_rstream *stream);
 
+/*
+ * Gets the delay the APM processing adds to the samples |stream| reads.
+ * Args:
+ *    data - The input data that holds pointer to APM instance.
+ *    stream - The stream to get the APM delay of.
+ *    dev_rate - The frame rate of the input device.
+ * Returns:
+ *    The delay in frames at |dev_rate|, 0 if |stream| has no active APM.
+ */
+unsigned int input_data_get_delay_frames(struct input_data *data,
+					 struct cras_rstream *stream,
+					 unsigned int dev_rate);
+
 #endif /* INPUT_DATA_H_ */
@@ -16,6 +16,7 @@
  *    to_times_100 - The numerator of the rate factor used for SRC.
  *    from_times_100 - The denominator of the rate factor used for SRC.
  *    f - The rate factor used for linear resample.
+ *    is_float - Set if samples are float instead of S16_LE.
  */
 struct linear_resampler {
 	unsigned int num_channels;
@@ -25,6 +26,7 @@ struct linear_resampler {
 	unsigned int to_times_100;
 	unsigned int from_times_100;
 	float f;
+	int is_float;
 };
 
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
@@ -50,6 +52,11 @@ void linear_resampler_destroy(struct linear_resampler *lr)
 		free(lr);
 }
 
+void linear_resampler_set_float(struct linear_resampler *lr, int is_float)
+{
+	lr->is_float = is_float;
+}
+
 void linear_resampler_set_rates(struct linear_resampler *lr, float from,
 				float to)
 {
@@ -106,6 +113,26 @@ int linear_resampler_needed(struct linear_resampler *lr)
 	return lr->from_times_100 != lr->to_times_100;
 }
 
+/* Interpolates one frame of float samples at |src_pos| into |dst_idx|. */
+static inline void resample_float(struct linear_resampler *lr, uint8_t *src,
+				  unsigned int src_idx, float src_pos,
+				  int is_last, uint8_t *dst,
+				  unsigned int dst_idx)
+{
+	const float *in = (const float *)(src + src_idx * lr->format_bytes);
+	float *out = (float *)(dst + dst_idx * lr->format_bytes);
+	int ch;
+
+	if (is_last) {
+		for (ch = 0; ch < lr->num_channels; ch++)
+			out[ch] = in[ch];
+		return;
+	}
+	for (ch = 0; ch < lr->num_channels; ch++)
+		out[ch] = in[ch] + (src_pos - src_idx) *
+					   (in[lr->num_channels + ch] - in[ch]);
+}
+
 unsigned int linear_resampler_resample(struct linear_resampler *lr,
 				       uint8_t *src, unsigned int *src_frames,
 				       uint8_t *dst, unsigned dst_frames)
@@ -139,6 +166,13 @@ unsigned int linear_resampler_resample(struct linear_resampler *lr,
 			break;
 		}
 
+		if (lr->is_float) {
+			resample_float(lr, src, src_idx, src_pos,
+				       src_idx == *src_frames - 1, dst,
+				       dst_idx);
+			continue;
+		}
+
 		in = (int16_t *)(src + src_idx * lr->format_bytes);
 		out = (int16_t *)(dst + dst_idx * lr->format_bytes);
 
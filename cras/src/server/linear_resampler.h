@@ -28,6 +28,10 @@ struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 void linear_resampler_set_rates(struct linear_resampler *lr, float from,
 				float to);
 
+/* Sets whether the samples are float instead of S16_LE. The format_bytes
+ * given at creation must match the sample type. */
+void linear_resampler_set_float(struct linear_resampler *lr, int is_float);
+
 /* Converts the frames count from output rate to input rate. */
 unsigned int linear_resampler_out_frames_to_in(struct linear_resampler *lr,
 					       unsigned int frames);
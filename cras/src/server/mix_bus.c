@@ -0,0 +1,308 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mix_bus.h"
+
+/* Full scale of each integer format, as float. */
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+
+/* Seed of the dither noise generator, any non-zero value works. */
+#define DITHER_SEED 0x2545f491
+
+/* Xorshift32, cheap enough to run once per sample in the audio thread. */
+static inline uint32_t dither_rand(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/* Returns triangular noise in (-1.0, 1.0) LSB. */
+static inline float tpdf_noise(uint32_t *state)
+{
+	float a = (float)(dither_rand(state) >> 8) / 16777216.0f;
+	float b = (float)(dither_rand(state) >> 8) / 16777216.0f;
+
+	return a - b;
+}
+
+static inline int32_t clip_round(float value, float max, float min)
+{
+	if (value >= max)
+		return (int32_t)max;
+	if (value <= min)
+		return (int32_t)min;
+	return (int32_t)(value + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+static inline int32_t read_s24_3le(const uint8_t *src)
+{
+	int32_t value;
+
+	value = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 |
+			  (uint32_t)src[2] << 24);
+	return value >> 8;
+}
+
+static inline void write_s24_3le(uint8_t *dst, int32_t value)
+{
+	dst[0] = value & 0xff;
+	dst[1] = (value >> 8) & 0xff;
+	dst[2] = (value >> 16) & 0xff;
+}
+
+/* Reads interleaved sample |idx| of |src| as a float in [-1.0, 1.0). */
+static inline float read_sample(snd_pcm_format_t format, const uint8_t *src,
+				size_t idx)
+{
+	int32_t s24;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		return ((const int16_t *)src)[idx] / S16_SCALE;
+	case SND_PCM_FORMAT_S24_LE:
+		/* Only the lower 24 bits are valid, sign extend them. */
+		s24 = (int32_t)((uint32_t)((const int32_t *)src)[idx] << 8);
+		return (s24 >> 8) / S24_SCALE;
+	case SND_PCM_FORMAT_S32_LE:
+		return ((const int32_t *)src)[idx] / S32_SCALE;
+	case SND_PCM_FORMAT_S24_3LE:
+		return read_s24_3le(src + idx * 3) / S24_SCALE;
+	default:
+		return 0.0f;
+	}
+}
+
+int mix_bus_format_supported(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+struct mix_bus *mix_bus_create(unsigned int num_channels,
+			       unsigned int max_frames)
+{
+	struct mix_bus *bus;
+	unsigned int i;
+
+	if (num_channels == 0 || max_frames == 0)
+		return NULL;
+
+	bus = (struct mix_bus *)calloc(1, sizeof(*bus));
+	if (!bus)
+		return NULL;
+
+	bus->planes = (float **)calloc(num_channels, sizeof(*bus->planes));
+	if (!bus->planes)
+		goto create_fail;
+
+	for (i = 0; i < num_channels; i++) {
+		bus->planes[i] = (float *)calloc(max_frames, sizeof(float));
+		if (!bus->planes[i])
+			goto create_fail;
+	}
+
+	bus->num_channels = num_channels;
+	bus->max_frames = max_frames;
+	bus->dither_seed = DITHER_SEED;
+	return bus;
+
+create_fail:
+	bus->num_channels = num_channels;
+	mix_bus_destroy(bus);
+	return NULL;
+}
+
+void mix_bus_destroy(struct mix_bus *bus)
+{
+	unsigned int i;
+
+	if (!bus)
+		return;
+	if (bus->planes) {
+		for (i = 0; i < bus->num_channels; i++)
+			free(bus->planes[i]);
+		free(bus->planes);
+	}
+	free(bus);
+}
+
+void mix_bus_zero(struct mix_bus *bus, unsigned int offset,
+		  unsigned int frames)
+{
+	unsigned int ch;
+
+	if (offset >= bus->max_frames)
+		return;
+	if (frames > bus->max_frames - offset)
+		frames = bus->max_frames - offset;
+
+	for (ch = 0; ch < bus->num_channels; ch++)
+		memset(bus->planes[ch] + offset, 0, frames * sizeof(float));
+}
+
+void mix_bus_consume(struct mix_bus *bus, unsigned int frames,
+		     unsigned int queued)
+{
+	unsigned int ch;
+
+	if (queued > bus->max_frames)
+		queued = bus->max_frames;
+	if (frames >= queued)
+		return;
+
+	for (ch = 0; ch < bus->num_channels; ch++)
+		memmove(bus->planes[ch], bus->planes[ch] + frames,
+			(queued - frames) * sizeof(float));
+}
+
+void mix_bus_add(struct mix_bus *bus, unsigned int offset,
+		 snd_pcm_format_t format, const uint8_t *src,
+		 unsigned int frames, float scaler)
+{
+	unsigned int ch, i;
+	size_t idx;
+	float *plane;
+
+	if (offset >= bus->max_frames)
+		return;
+	if (frames > bus->max_frames - offset)
+		frames = bus->max_frames - offset;
+
+	for (ch = 0; ch < bus->num_channels; ch++) {
+		plane = bus->planes[ch] + offset;
+		idx = ch;
+		for (i = 0; i < frames; i++, idx += bus->num_channels)
+			plane[i] += read_sample(format, src, idx) * scaler;
+	}
+}
+
+int mix_bus_is_non_empty(const struct mix_bus *bus, unsigned int frames)
+{
+	unsigned int ch, i;
+	const float *plane;
+
+	if (frames > bus->max_frames)
+		frames = bus->max_frames;
+
+	for (ch = 0; ch < bus->num_channels; ch++) {
+		plane = bus->planes[ch];
+		for (i = 0; i < frames; i++)
+			if (plane[i] != 0.0f)
+				return 1;
+	}
+	return 0;
+}
+
+void mix_bus_scale(struct mix_bus *bus, unsigned int frames, float scaler)
+{
+	unsigned int ch, i;
+	float *plane;
+
+	if (frames > bus->max_frames)
+		frames = bus->max_frames;
+
+	for (ch = 0; ch < bus->num_channels; ch++) {
+		plane = bus->planes[ch];
+		for (i = 0; i < frames; i++)
+			plane[i] *= scaler;
+	}
+}
+
+void mix_bus_scale_increment(struct mix_bus *bus, unsigned int frames,
+			     float scaler, float increment, float target)
+{
+	unsigned int ch, i;
+	float s;
+
+	if (frames > bus->max_frames)
+		frames = bus->max_frames;
+
+	for (ch = 0; ch < bus->num_channels; ch++) {
+		s = scaler;
+		for (i = 0; i < frames; i++) {
+			bus->planes[ch][i] *= s;
+			s += increment;
+			if ((increment > 0 && s > target) ||
+			    (increment < 0 && s < target))
+				s = target;
+		}
+	}
+}
+
+void mix_bus_quantize(struct mix_bus *bus, snd_pcm_format_t format,
+		      uint8_t *dst, unsigned int frames)
+{
+	unsigned int ch, i;
+	unsigned int num_channels = bus->num_channels;
+	const float *plane;
+	float value;
+	size_t idx;
+
+	if (frames > bus->max_frames)
+		frames = bus->max_frames;
+
+	for (ch = 0; ch < num_channels; ch++) {
+		plane = bus->planes[ch];
+		idx = ch;
+		switch (format) {
+		case SND_PCM_FORMAT_S16_LE:
+			for (i = 0; i < frames; i++, idx += num_channels) {
+				value = plane[i] * S16_SCALE;
+				/* Keep digital silence free of noise. */
+				if (value != 0.0f)
+					value += tpdf_noise(&bus->dither_seed);
+				((int16_t *)dst)[idx] = (int16_t)clip_round(
+					value, INT16_MAX, INT16_MIN);
+			}
+			break;
+		case SND_PCM_FORMAT_S24_LE:
+			for (i = 0; i < frames; i++, idx += num_channels)
+				((int32_t *)dst)[idx] =
+					clip_round(plane[i] * S24_SCALE,
+						   0x007fffff, -0x00800000);
+			break;
+		case SND_PCM_FORMAT_S32_LE:
+			for (i = 0; i < frames; i++, idx += num_channels) {
+				/* INT32_MAX is not representable in float,
+				 * clip in double to avoid an overflow. */
+				double d = (double)plane[i] * S32_SCALE;
+				if (d >= INT32_MAX)
+					((int32_t *)dst)[idx] = INT32_MAX;
+				else if (d <= INT32_MIN)
+					((int32_t *)dst)[idx] = INT32_MIN;
+				else
+					((int32_t *)dst)[idx] = (int32_t)(
+						d + (d >= 0.0 ? 0.5 : -0.5));
+			}
+			break;
+		case SND_PCM_FORMAT_S24_3LE:
+			for (i = 0; i < frames; i++, idx += num_channels)
+				write_s24_3le(dst + idx * 3,
+					      clip_round(plane[i] * S24_SCALE,
+							 0x007fffff,
+							 -0x00800000));
+			break;
+		default:
+			return;
+		}
+	}
+}
@@ -0,0 +1,104 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The mix bus is an optional float32 planar accumulation buffer owned by an
+ * open output device. When it is used, streams are mixed in float, volume,
+ * ramping and DSP run on the float planes, and the result is quantized to the
+ * device sample format once, right before it is handed to the hardware.
+ */
+
+#ifndef MIX_BUS_H_
+#define MIX_BUS_H_
+
+#include <stdint.h>
+
+#include "cras_audio_format.h"
+
+/*
+ * Members:
+ *    planes - One buffer of |max_frames| samples per channel. Sample values
+ *        are normalized to [-1.0, 1.0).
+ *    num_channels - Number of channels in the bus.
+ *    max_frames - Number of frames each plane can hold.
+ *    dither_seed - State of the noise generator used by the TPDF dither.
+ */
+struct mix_bus {
+	float **planes;
+	unsigned int num_channels;
+	unsigned int max_frames;
+	uint32_t dither_seed;
+};
+
+/* Returns non-zero if the mix bus can quantize to the given sample format. */
+int mix_bus_format_supported(snd_pcm_format_t format);
+
+/*
+ * Creates a mix bus.
+ * Args:
+ *    num_channels - Number of channels of the device.
+ *    max_frames - Maximum number of frames the bus needs to hold, normally
+ *        the buffer size of the device.
+ * Returns:
+ *    A pointer to the new mix bus, or NULL on error.
+ */
+struct mix_bus *mix_bus_create(unsigned int num_channels,
+			       unsigned int max_frames);
+
+/* Destroys a mix bus created with mix_bus_create. */
+void mix_bus_destroy(struct mix_bus *bus);
+
+/* Zeros |frames| frames of every plane starting at |offset|. */
+void mix_bus_zero(struct mix_bus *bus, unsigned int offset,
+		  unsigned int frames);
+
+/*
+ * Marks |frames| frames at the head of the bus as consumed. Frames between
+ * |frames| and |queued| have already been mixed by some streams but not
+ * written to the device yet, so they are moved to the head of the bus to be
+ * completed on the next write.
+ */
+void mix_bus_consume(struct mix_bus *bus, unsigned int frames,
+		     unsigned int queued);
+
+/*
+ * Accumulates interleaved integer samples into the bus.
+ * Args:
+ *    bus - The bus to mix into.
+ *    offset - Frame offset in the bus to start mixing at.
+ *    format - Sample format of |src|.
+ *    src - Interleaved samples with bus->num_channels channels.
+ *    frames - Number of frames to mix.
+ *    scaler - Volume scaler applied to |src| before adding.
+ */
+void mix_bus_add(struct mix_bus *bus, unsigned int offset,
+		 snd_pcm_format_t format, const uint8_t *src,
+		 unsigned int frames, float scaler);
+
+/* Returns non-zero if any of the first |frames| frames is not silent. */
+int mix_bus_is_non_empty(const struct mix_bus *bus, unsigned int frames);
+
+/* Scales the first |frames| frames of the bus by |scaler|. */
+void mix_bus_scale(struct mix_bus *bus, unsigned int frames, float scaler);
+
+/*
+ * Scales the first |frames| frames of the bus by a scaler that starts at
+ * |scaler| and moves by |increment| every frame, clipped at |target|.
+ * Matches the semantic of cras_scale_buffer_increment.
+ */
+void mix_bus_scale_increment(struct mix_bus *bus, unsigned int frames,
+			     float scaler, float increment, float target);
+
+/*
+ * Converts the first |frames| frames of the bus into interleaved samples of
+ * |format|, with clipping. TPDF dither is added when quantizing to 16 bits.
+ * Args:
+ *    bus - The bus to read from.
+ *    format - The sample format to write.
+ *    dst - Destination buffer for bus->num_channels interleaved channels.
+ *    frames - Number of frames to convert.
+ */
+void mix_bus_quantize(struct mix_bus *bus, snd_pcm_format_t format,
+		      uint8_t *dst, unsigned int frames);
+
+#endif /* MIX_BUS_H_ */
@@ -0,0 +1,312 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "cras_mix.h"
+#include "polyphase_resampler.h"
+
+/* Filters are padded to a multiple of this so the SIMD kernels never run
+ * their scalar tail. */
+#define TAPS_ALIGN 8
+/* Upper bound of the filter length, reached when downsampling by a large
+ * factor. */
+#define MAX_TAPS 256
+/* Frames of input buffered on top of the filter length before the history
+ * needs to be moved back to the start. */
+#define HISTORY_BLOCK_FRAMES 1024
+
+/* A polyphase resampler.
+ * Members:
+ *    num_channels - The number of channels in one frame.
+ *    num_taps - The length of each filter phase.
+ *    num_phases - The number of filter phases per input frame.
+ *    coefs - (num_phases + 1) filters of num_taps coefficients. The extra
+ *        one is phase 0 delayed by a frame, to interpolate past the last
+ *        phase.
+ *    history - Deinterleaved input samples, one buffer per channel.
+ *    capacity - The number of frames each history buffer can hold.
+ *    buffered - The number of frames in the history buffers.
+ *    pos - Position of the next output frame in the history, in frames.
+ *    step - Input frames advanced per output frame.
+ */
+struct polyphase_resampler {
+	unsigned int num_channels;
+	unsigned int num_taps;
+	unsigned int num_phases;
+	float *coefs;
+	float **history;
+	unsigned int capacity;
+	unsigned int buffered;
+	double pos;
+	double step;
+};
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/* Kaiser windowed sinc at |t| frames from the center of a filter that spans
+ * |half| frames each side, with |cutoff| relative to the input Nyquist. */
+static double windowed_sinc(double t, double half, double cutoff, double beta)
+{
+	double u = t / half;
+	double x = M_PI * cutoff * t;
+	double sinc = (fabs(x) < 1e-9) ? 1.0 : sin(x) / x;
+
+	if (fabs(u) >= 1.0)
+		return 0.0;
+	return cutoff * sinc * bessel_i0(beta * sqrt(1.0 - u * u)) /
+	       bessel_i0(beta);
+}
+
+static void design_filters(struct polyphase_resampler *pr, double cutoff,
+			   double beta)
+{
+	unsigned int half = pr->num_taps / 2;
+	unsigned int phase, k;
+	float *coef;
+	double sum;
+
+	/* Phase j computes the output |j / num_phases| frames after the
+	 * input frame at index half - 1 of the filter. */
+	for (phase = 0; phase <= pr->num_phases; phase++) {
+		coef = pr->coefs + phase * pr->num_taps;
+		sum = 0.0;
+		for (k = 0; k < pr->num_taps; k++) {
+			coef[k] = windowed_sinc((double)phase / pr->num_phases +
+							half - 1.0 - k,
+						half, cutoff, beta);
+			sum += coef[k];
+		}
+		/* Unity gain at DC for every phase. */
+		for (k = 0; k < pr->num_taps; k++)
+			coef[k] /= sum;
+	}
+}
+
+/* Drops the history no longer under the filter. */
+static void compact_history(struct polyphase_resampler *pr)
+{
+	unsigned int half = pr->num_taps / 2;
+	unsigned int drop, ch;
+
+	drop = MIN((unsigned int)pr->pos - (half - 1), pr->buffered);
+	if (drop == 0)
+		return;
+
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memmove(pr->history[ch], pr->history[ch] + drop,
+			(pr->buffered - drop) * sizeof(float));
+	pr->buffered -= drop;
+	pr->pos -= drop;
+}
+
+static void load_history(struct polyphase_resampler *pr, const float *src,
+			 unsigned int frames)
+{
+	unsigned int ch, i;
+	float *dst;
+
+	for (ch = 0; ch < pr->num_channels; ch++) {
+		dst = pr->history[ch] + pr->buffered;
+		for (i = 0; i < frames; i++)
+			dst[i] = src[i * pr->num_channels + ch];
+	}
+	pr->buffered += frames;
+}
+
+/* Returns the number of history frames needed to produce |frames| more
+ * output frames. */
+static unsigned int frames_needed(const struct polyphase_resampler *pr,
+				  unsigned int frames)
+{
+	unsigned int last = (unsigned int)(pr->pos + (frames - 1) * pr->step);
+
+	return last - (pr->num_taps / 2 - 1) + pr->num_taps;
+}
+
+struct polyphase_resampler *
+polyphase_resampler_create(unsigned int num_channels, float src_rate,
+			   float dst_rate, unsigned int num_taps,
+			   unsigned int num_phases, float kaiser_beta)
+{
+	struct polyphase_resampler *pr;
+	double ratio, cutoff;
+	unsigned int ch;
+
+	if (num_channels == 0 || num_taps < 2 || num_phases == 0 ||
+	    src_rate <= 0 || dst_rate <= 0)
+		return NULL;
+
+	pr = (struct polyphase_resampler *)calloc(1, sizeof(*pr));
+	if (!pr)
+		return NULL;
+
+	/* Keep the transition band the same width relative to the output
+	 * Nyquist by stretching the filter when downsampling. */
+	ratio = MIN(1.0, (double)dst_rate / src_rate);
+	num_taps = (unsigned int)ceil(num_taps / ratio);
+	num_taps = (num_taps + TAPS_ALIGN - 1) / TAPS_ALIGN * TAPS_ALIGN;
+	num_taps = MIN(num_taps, MAX_TAPS);
+	/* Leave room for the transition band of the window below Nyquist. */
+	cutoff = ratio * (1.0 - 3.0 * ratio / num_taps);
+
+	pr->num_channels = num_channels;
+	pr->num_taps = num_taps;
+	pr->num_phases = num_phases;
+	pr->capacity = num_taps + HISTORY_BLOCK_FRAMES;
+
+	pr->coefs = (float *)calloc((num_phases + 1) * num_taps, sizeof(float));
+	pr->history = (float **)calloc(num_channels, sizeof(*pr->history));
+	if (!pr->coefs || !pr->history)
+		goto create_fail;
+	for (ch = 0; ch < num_channels; ch++) {
+		pr->history[ch] = (float *)calloc(pr->capacity, sizeof(float));
+		if (!pr->history[ch])
+			goto create_fail;
+	}
+
+	design_filters(pr, cutoff, kaiser_beta);
+
+	polyphase_resampler_reset(pr);
+	polyphase_resampler_set_rates(pr, src_rate, dst_rate);
+
+	return pr;
+
+create_fail:
+	polyphase_resampler_destroy(pr);
+	return NULL;
+}
+
+void polyphase_resampler_destroy(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	if (!pr)
+		return;
+	if (pr->history) {
+		for (ch = 0; ch < pr->num_channels; ch++)
+			free(pr->history[ch]);
+		free(pr->history);
+	}
+	free(pr->coefs);
+	free(pr);
+}
+
+void polyphase_resampler_reset(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memset(pr->history[ch], 0, pr->capacity * sizeof(float));
+	/* Start with silence under the first half of the filter so the first
+	 * output is aligned with the first input frame. */
+	pr->buffered = pr->num_taps / 2 - 1;
+	pr->pos = pr->buffered;
+}
+
+void polyphase_resampler_set_rates(struct polyphase_resampler *pr,
+				   double src_rate, double dst_rate)
+{
+	pr->step = src_rate / dst_rate;
+}
+
+unsigned int
+polyphase_resampler_out_frames_to_in(struct polyphase_resampler *pr,
+				     unsigned int frames)
+{
+	unsigned int needed;
+
+	if (frames == 0)
+		return 0;
+
+	needed = frames_needed(pr, frames);
+	return needed > pr->buffered ? needed - pr->buffered : 0;
+}
+
+unsigned int
+polyphase_resampler_in_frames_to_out(struct polyphase_resampler *pr,
+				     unsigned int frames)
+{
+	double limit;
+	unsigned int out;
+
+	/* Output frame k can be computed while floor(pos + k * step) is
+	 * before the last input frame minus half of the filter, that is
+	 * while pos + k * step < limit. ceil() of the quotient is exact in
+	 * real arithmetic but rounding can push a quotient that is a whole
+	 * number just above it, so check the last frame the same way
+	 * resample() will and never promise one it won't produce. */
+	limit = (double)pr->buffered + frames - pr->num_taps / 2;
+	if (limit <= pr->pos)
+		return 0;
+	out = (unsigned int)ceil((limit - pr->pos) / pr->step);
+	if (out && pr->pos + (out - 1) * pr->step >= limit)
+		out--;
+	return out;
+}
+
+unsigned int polyphase_resampler_resample(struct polyphase_resampler *pr,
+					  const float *src,
+					  unsigned int *src_frames, float *dst,
+					  unsigned int dst_frames)
+{
+	unsigned int in_idx = 0, out_idx = 0;
+	unsigned int start, needed, count, phase, ch;
+	unsigned int num_channels = pr->num_channels;
+	unsigned int num_taps = pr->num_taps;
+	const float *coef;
+	double pos;
+	float frac;
+
+	compact_history(pr);
+
+	while (out_idx < dst_frames) {
+		start = (unsigned int)pr->pos - (num_taps / 2 - 1);
+		if (start + num_taps > pr->buffered) {
+			if (in_idx == *src_frames)
+				break;
+			if (pr->buffered == pr->capacity) {
+				compact_history(pr);
+				continue;
+			}
+			needed = frames_needed(pr, dst_frames - out_idx);
+			count = MIN(*src_frames - in_idx,
+				    needed - pr->buffered);
+			count = MIN(count, pr->capacity - pr->buffered);
+			load_history(pr, src + in_idx * num_channels, count);
+			in_idx += count;
+			continue;
+		}
+
+		pos = (pr->pos - floor(pr->pos)) * pr->num_phases;
+		phase = (unsigned int)pos;
+		frac = pos - phase;
+		coef = pr->coefs + phase * num_taps;
+		for (ch = 0; ch < num_channels; ch++)
+			dst[out_idx * num_channels + ch] =
+				cras_mix_fir_interp_f32(pr->history[ch] + start,
+							coef, coef + num_taps,
+							frac, num_taps);
+		out_idx++;
+		pr->pos += pr->step;
+	}
+
+	*src_frames = in_idx;
+	return out_idx;
+}
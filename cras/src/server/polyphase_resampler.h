@@ -0,0 +1,79 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A polyphase FIR resampler for interleaved float samples. The filter bank
+ * is designed once for the nominal ratio, and the output position moves
+ * through the input by an arbitrary step, interpolating between adjacent
+ * phases. This lets the rate estimator drift be folded into the nominal
+ * ratio so both are handled in a single pass.
+ */
+
+#ifndef POLYPHASE_RESAMPLER_H_
+#define POLYPHASE_RESAMPLER_H_
+
+struct polyphase_resampler;
+
+/* Creates a polyphase resampler.
+ * Args:
+ *    num_channels - The number of channels in each frame.
+ *    src_rate - The nominal rate to resample from.
+ *    dst_rate - The nominal rate to resample to.
+ *    num_taps - Length of each filter phase in frames when upsampling. It is
+ *        stretched by the decimation factor when downsampling.
+ *    num_phases - The number of filter phases per input frame.
+ *    kaiser_beta - Shape of the Kaiser window, trades stop band attenuation
+ *        against transition width.
+ * Returns:
+ *    A pointer to the new resampler, or NULL on error.
+ */
+struct polyphase_resampler *
+polyphase_resampler_create(unsigned int num_channels, float src_rate,
+			   float dst_rate, unsigned int num_taps,
+			   unsigned int num_phases, float kaiser_beta);
+
+/* Destroys a polyphase resampler. */
+void polyphase_resampler_destroy(struct polyphase_resampler *pr);
+
+/* Drops the buffered input so the next output is aligned with the next
+ * input frame, as if the resampler was just created. The rates are kept. */
+void polyphase_resampler_reset(struct polyphase_resampler *pr);
+
+/* Changes the effective rates without redesigning the filters. Used to apply
+ * the small corrections from the rate estimator on top of the nominal ratio.
+ * Args:
+ *    src_rate - The rate to resample from.
+ *    dst_rate - The rate to resample to.
+ */
+void polyphase_resampler_set_rates(struct polyphase_resampler *pr,
+				   double src_rate, double dst_rate);
+
+/* Returns the number of input frames needed to produce |frames| output
+ * frames, accounting for the input already held by the resampler. */
+unsigned int
+polyphase_resampler_out_frames_to_in(struct polyphase_resampler *pr,
+				     unsigned int frames);
+
+/* Returns the number of output frames that can be produced once |frames|
+ * more input frames are given to the resampler. */
+unsigned int
+polyphase_resampler_in_frames_to_out(struct polyphase_resampler *pr,
+				     unsigned int frames);
+
+/* Resamples interleaved float frames.
+ * Args:
+ *    pr - The polyphase resampler.
+ *    src - The input buffer.
+ *    src_frames - The number of frames in the input buffer, filled with the
+ *        number of frames consumed on return.
+ *    dst - The output buffer.
+ *    dst_frames - The number of frames the output buffer can hold.
+ * Returns:
+ *    The number of frames written to |dst|.
+ */
+unsigned int polyphase_resampler_resample(struct polyphase_resampler *pr,
+					  const float *src,
+					  unsigned int *src_frames, float *dst,
+					  unsigned int dst_frames);
+
+#endif /* POLYPHASE_RESAMPLER_H_ */
@@ -125,6 +125,38 @@ TEST(A2dpEncode, WriteA2dp) {
   ASSERT_EQ(0, a2dp.seq_num);
 }
 
+TEST(A2dpEncode, TakePacket) {
+  uint8_t packet[A2DP_BUF_SIZE_BYTES];
+  size_t size = 0;
+  int frames;
+
+  ResetStubData();
+  init_a2dp(&a2dp, &sbc);
+
+  set_sbc_codec_encoded_out(15);
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+
+  // 13 + 15 used, room for another frame of 5.
+  frames = a2dp_take_packet(&a2dp, packet, &size, (size_t)40);
+  ASSERT_EQ(0, frames);
+  ASSERT_EQ(28, a2dp.a2dp_buf_used);
+
+  set_sbc_codec_encoded_out(10);
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+
+  frames = a2dp_take_packet(&a2dp, packet, &size, (size_t)40);
+  ASSERT_EQ(10, frames);
+  ASSERT_EQ(38, size);
+  // Sequence number of the packet taken, and the next one started.
+  ASSERT_EQ(0, packet[2]);
+  ASSERT_EQ(0, packet[3]);
+  ASSERT_EQ(1, a2dp.seq_num);
+  ASSERT_EQ(13, a2dp.a2dp_buf_used);
+  ASSERT_EQ(0, a2dp.samples);
+
+  destroy_a2dp(&a2dp);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -5,6 +5,8 @@
 #include <gtest/gtest.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 extern "C" {
 #include "cras_a2dp_iodev.c"
@@ -52,6 +54,9 @@ static const char* cras_bt_device_name_ret;
 static unsigned int cras_bt_transport_write_mtu_ret;
 static int cras_iodev_fill_odev_zeros_called;
 static unsigned int cras_iodev_fill_odev_zeros_frames;
+static int cras_bt_transport_fd_ret;
+static bool cras_system_get_a2dp_encoder_thread_enabled_ret;
+static unsigned int cras_set_thread_priority_called;
 
 void ResetStubData() {
   cras_bt_device_append_iodev_called = 0;
@@ -73,6 +78,8 @@ void ResetStubData() {
   /* Fake the MTU value. min_buffer_level will be derived from this value. */
   cras_bt_transport_write_mtu_ret = 950;
   cras_iodev_fill_odev_zeros_called = 0;
+  cras_bt_transport_fd_ret = 0;
+  cras_system_get_a2dp_encoder_thread_enabled_ret = false;
 
   fake_transport = reinterpret_cast<struct cras_bt_transport*>(0x123);
 
@@ -588,6 +595,120 @@ TEST_F(A2dpIodev, NoStreamState) {
   a2dp_iodev_destroy(iodev);
 }
 
+TEST_F(A2dpIodev, EncoderThread) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  struct timespec tstamp;
+  struct a2dp_io* a2dpio;
+  uint8_t packet[A2DP_BUF_SIZE_BYTES];
+  unsigned frames;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  cras_bt_transport_fd_ret = sock[0];
+  cras_system_get_a2dp_encoder_thread_enabled_ret = true;
+  cras_set_thread_priority_called = 0;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  ASSERT_NE((void*)NULL, a2dpio->encoder);
+  ASSERT_NE(write_callback, (void*)NULL);
+
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  frames = 1500;
+  iodev->get_buffer(iodev, &area, &frames);
+  ASSERT_EQ(1500, frames);
+  ASSERT_EQ(a2dpio->encoder->pcm, area->channels[0].buf);
+  EXPECT_EQ(0, iodev->put_buffer(iodev, 1000));
+
+  /* The encoder thread builds one packet of 896 frames ahead. */
+  for (int i = 0; i < 1000; i++) {
+    if (__atomic_load_n(&a2dpio->encoder->packets_built, __ATOMIC_ACQUIRE))
+      break;
+    usleep(1000);
+  }
+  ASSERT_EQ(1, __atomic_load_n(&a2dpio->encoder->packets_built,
+                               __ATOMIC_ACQUIRE));
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+
+  /* The socket write callback only sends the built packet. */
+  write_callback(write_callback_data, POLLOUT);
+  EXPECT_EQ(1, a2dpio->encoder->packets_sent);
+  EXPECT_EQ(896, recv(sock[1], packet, sizeof(packet), MSG_DONTWAIT));
+  EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_GT(a2dpio->next_flush_time.tv_nsec, 0);
+  EXPECT_EQ(0, a2dp_write_index);
+
+  /* The PCM ring continues where the last write ended. */
+  frames = 100;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(4000, area->channels[0].buf - a2dpio->encoder->pcm);
+
+  iodev->close_dev(iodev);
+  EXPECT_EQ((void*)NULL, a2dpio->encoder);
+  a2dp_iodev_destroy(iodev);
+  close(sock[0]);
+  close(sock[1]);
+}
+
+TEST_F(A2dpIodev, EncoderThreadFlushesBuiltPackets) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  struct a2dp_io* a2dpio;
+  uint8_t packet[A2DP_BUF_SIZE_BYTES];
+  unsigned frames;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  cras_bt_transport_fd_ret = sock[0];
+  cras_system_get_a2dp_encoder_thread_enabled_ret = true;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  ASSERT_NE((void*)NULL, a2dpio->encoder);
+  ASSERT_EQ(896, iodev->min_buffer_level);
+
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  frames = 4000;
+  iodev->get_buffer(iodev, &area, &frames);
+  ASSERT_EQ(4000, frames);
+  EXPECT_EQ(0, iodev->put_buffer(iodev, 4000));
+
+  /* The encoder fills the ring with four packets of 896 frames. */
+  for (int i = 0; i < 1000; i++) {
+    if (__atomic_load_n(&a2dpio->encoder->packets_built, __ATOMIC_ACQUIRE) ==
+        4)
+      break;
+    usleep(1000);
+  }
+  ASSERT_EQ(4, __atomic_load_n(&a2dpio->encoder->packets_built,
+                               __ATOMIC_ACQUIRE));
+
+  /* Late enough for any number of packets. 3104 - 896 frames are left
+   * behind the second packet, more than the 896 + 896 to keep, after the
+   * third only 1312. */
+  time_now.tv_sec = 1;
+  write_callback(write_callback_data, POLLOUT);
+  EXPECT_EQ(2, a2dpio->encoder->packets_sent);
+  EXPECT_EQ(896, recv(sock[1], packet, sizeof(packet), MSG_DONTWAIT));
+  EXPECT_EQ(896, recv(sock[1], packet, sizeof(packet), MSG_DONTWAIT));
+
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+  close(sock[0]);
+  close(sock[1]);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -616,7 +737,7 @@ int cras_bt_transport_release(struct cras_bt_transport* transport,
 }
 
 int cras_bt_transport_fd(const struct cras_bt_transport* transport) {
-  return 0;
+  return cras_bt_transport_fd_ret;
 }
 
 const char* cras_bt_transport_object_path(
@@ -768,6 +889,35 @@ int a2dp_write(struct a2dp_info* a2dp, int stream_fd, size_t link_mtu) {
   return samples;
 }
 
+int a2dp_take_packet(struct a2dp_info* a2dp,
+                     uint8_t* packet,
+                     size_t* size,
+                     size_t link_mtu) {
+  int samples;
+  if (a2dp->a2dp_buf_used + a2dp->frame_length <= link_mtu)
+    return 0;
+
+  memcpy(packet, a2dp->a2dp_buf, a2dp->a2dp_buf_used);
+  *size = a2dp->a2dp_buf_used;
+  samples = a2dp->samples;
+  a2dp->samples = 0;
+  a2dp->a2dp_buf_used = 0;
+  return samples;
+}
+
+bool cras_system_get_a2dp_encoder_thread_enabled() {
+  return cras_system_get_a2dp_encoder_thread_enabled_ret;
+}
+
+int cras_set_rt_scheduling(int rt_lim) {
+  return 0;
+}
+
+int cras_set_thread_priority(int priority) {
+  cras_set_thread_priority_called++;
+  return 0;
+}
+
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   *tp = time_now;
   return 0;
@@ -800,6 +950,13 @@ struct audio_thread* cras_iodev_list_get_audio_thread() {
 }
 // From audio_thread
 struct audio_thread_event_log* atlog;
+struct audio_thread_tracer* attrace;
+int attrace_writers;
+void audio_thread_trace_data(const struct timespec* now,
+                             enum AUDIO_THREAD_LOG_EVENTS event,
+                             uint32_t data1,
+                             uint32_t data2,
+                             uint32_t data3) {}
 
 void audio_thread_add_events_callback(int fd,
                                       thread_callback cb,
@@ -3,7 +3,9 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
 
 extern "C" {
 #include "cras_apm_list.h"
@@ -21,13 +23,16 @@ extern "C" {
 namespace {
 
 static void* stream_ptr = reinterpret_cast<void*>(0x123);
+static void* stream_ptr2 = reinterpret_cast<void*>(0x234);
 static void* dev_ptr = reinterpret_cast<void*>(0x345);
 static void* dev_ptr2 = reinterpret_cast<void*>(0x678);
 static struct cras_apm_list* list;
 static struct cras_audio_area fake_audio_area;
 static unsigned int dsp_util_interleave_frames;
 static unsigned int webrtc_apm_process_stream_f_called;
+static int webrtc_apm_process_stream_f_stall;
 static unsigned int webrtc_apm_process_reverse_stream_f_called;
+static float* webrtc_apm_process_reverse_stream_f_data;
 static device_enabled_callback_t device_enabled_callback_val;
 static struct ext_dsp_module* ext_dsp_module_value;
 static struct cras_ionode fake_node;
@@ -36,6 +41,9 @@ static int webrtc_apm_create_called;
 static bool cras_iodev_is_aec_use_case_ret;
 static dictionary* webrtc_apm_create_aec_ini_val = NULL;
 static dictionary* webrtc_apm_create_apm_ini_val = NULL;
+static bool cras_system_get_apm_sharing_enabled_ret = false;
+static bool cras_system_get_apm_worker_enabled_ret = false;
+static unsigned int cras_set_thread_priority_called;
 
 TEST(ApmList, ApmListCreate) {
   list = cras_apm_list_create(stream_ptr, 0);
@@ -195,21 +203,24 @@ TEST(ApmList, ApmProcessForwardBuffer) {
   EXPECT_EQ(480, dsp_util_interleave_frames);
   EXPECT_EQ(480, area->frames);
 
-  /* Put some processed frames. Another apm_list process will not call
-   * into webrtc_apm because the processed buffer is not yet empty.
+  /* Put some processed frames. The processed buffer holds four chunks,
+   * so apm_list process calls into webrtc_apm until the stream is that
+   * far behind reading.
    */
   cras_apm_list_put_processed(apm, 200);
-  float_buffer_reset(buf);
-  float_buffer_written(buf, 500);
-  cras_apm_list_process(apm, buf, 0);
-  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  for (unsigned int i = 0; i < 4; i++) {
+    float_buffer_reset(buf);
+    float_buffer_written(buf, 480);
+    cras_apm_list_process(apm, buf, 0);
+  }
+  EXPECT_EQ(4, webrtc_apm_process_stream_f_called);
 
   /* Put another 280 processed frames, so it's now ready for webrtc_apm
    * to process another chunk of 480 frames (10ms) data.
    */
   cras_apm_list_put_processed(apm, 280);
   cras_apm_list_process(apm, buf, 0);
-  EXPECT_EQ(2, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(5, webrtc_apm_process_stream_f_called);
 
   float_buffer_destroy(&buf);
   cras_apm_list_destroy(list);
@@ -264,6 +275,111 @@ TEST(ApmList, ApmProcessReverseData) {
   ext_dsp_module_value->run(ext_dsp_module_value, 250);
   EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
 
+  cras_apm_list_stop_apm(list, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ApmProcessReverseDataCopy) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+  struct cras_iodev fake_iodev;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  fake_iodev.direction = CRAS_STREAM_OUTPUT;
+  device_enabled_callback_val = NULL;
+  ext_dsp_module_value = NULL;
+  webrtc_apm_process_reverse_stream_f_called = 0;
+
+  cras_apm_list_init("");
+  device_enabled_callback_val(&fake_iodev, NULL);
+  ASSERT_NE((void*)NULL, ext_dsp_module_value);
+
+  buf = float_buffer_create(1200, 2);
+  float_buffer_written(buf, 1200);
+  nread = 1200;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (int i = 0; i < buf->num_channels; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 1200, 2, 48000);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  /* Blocks are analyzed from a copy, the DSP output that is played stays
+   * untouched. */
+  ext_dsp_module_value->run(ext_dsp_module_value, 1200);
+  EXPECT_EQ(2, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_TRUE(webrtc_apm_process_reverse_stream_f_data < rp[0] ||
+              webrtc_apm_process_reverse_stream_f_data >= rp[0] + 1200);
+  EXPECT_EQ(0, rp[0][0]);
+  EXPECT_EQ(0, rp[0][480]);
+
+  /* The 240 frames left over are completed by the next run. */
+  ext_dsp_module_value->run(ext_dsp_module_value, 240);
+  EXPECT_EQ(3, webrtc_apm_process_reverse_stream_f_called);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+static void* RunReverse(void* arg) {
+  for (int i = 0; i < 1000; i++)
+    ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  return NULL;
+}
+
+TEST(ApmList, ApmReverseOnOutputThread) {
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+  struct cras_iodev fake_iodev;
+  pthread_t thread;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  fake_iodev.direction = CRAS_STREAM_OUTPUT;
+  device_enabled_callback_val = NULL;
+  ext_dsp_module_value = NULL;
+
+  cras_apm_list_init("");
+  device_enabled_callback_val(&fake_iodev, NULL);
+  ASSERT_NE((void*)NULL, ext_dsp_module_value);
+
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  nread = 480;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (int i = 0; i < buf->num_channels; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 480, 2, 48000);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+
+  /* With per-device audio threads, the echo reference runs on another
+   * thread than the capture device starting and stopping its APMs. */
+  ASSERT_EQ(0, pthread_create(&thread, NULL, RunReverse, NULL));
+  for (int i = 0; i < 1000; i++) {
+    cras_apm_list_start_apm(list, dev_ptr);
+    cras_apm_list_stop_apm(list, dev_ptr);
+  }
+  pthread_join(thread, NULL);
+  EXPECT_EQ((void*)NULL, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
+
   float_buffer_destroy(&buf);
   cras_apm_list_destroy(list);
   cras_apm_list_deinit();
@@ -295,7 +411,290 @@ TEST(ApmList, StreamAddToAlreadyOpenedDev) {
   cras_apm_list_deinit();
 }
 
+TEST(ApmList, ShareApmAcrossStreams) {
+  struct cras_audio_format fmt;
+  struct cras_apm *apm1, *apm2, *apm3;
+  struct cras_apm_list *list2, *list3;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  cras_apm_list_init("");
+  cras_system_get_apm_sharing_enabled_ret = true;
+  webrtc_apm_create_called = 0;
+  webrtc_apm_process_stream_f_called = 0;
+  webrtc_apm_process_reverse_stream_f_called = 0;
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+  apm1 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm2 = cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1);
+  EXPECT_EQ(1, webrtc_apm_create_called);
+  EXPECT_NE(apm1, apm2);
+
+  // A different device gets its own APM.
+  list3 = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm3 = cras_apm_list_add_apm(list3, dev_ptr2, &fmt, 1);
+  EXPECT_EQ(2, webrtc_apm_create_called);
+  EXPECT_NE(apm1, apm3);
+  cras_apm_list_destroy(list3);
+
+  cras_apm_list_start_apm(list, dev_ptr);
+  cras_apm_list_start_apm(list2, dev_ptr);
+
+  // Only the first stream feeds input, the second moves along with it.
+  buf = float_buffer_create(500, 2);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  EXPECT_EQ(0, cras_apm_list_process(apm2, buf, 480));
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+
+  // Both streams read the same processed block.
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm2)->frames);
+  cras_apm_list_put_processed(apm1, 480);
+  EXPECT_EQ(0, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm2)->frames);
+
+  // The next blocks don't wait for the second stream to read.
+  for (unsigned int i = 0; i < 3; i++) {
+    float_buffer_reset(buf);
+    float_buffer_written(buf, 480);
+    EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+    EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+    cras_apm_list_put_processed(apm1, 480);
+  }
+  EXPECT_EQ(4, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(1920, cras_apm_list_get_processed(apm2)->frames);
+  cras_apm_list_put_processed(apm2, 200);
+
+  // Once the buffer is full the second stream drops the oldest data it
+  // hasn't read to make room.
+  float_buffer_reset(buf);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  EXPECT_EQ(5, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(1440, cras_apm_list_get_processed(apm2)->frames);
+  cras_apm_list_put_processed(apm1, 480);
+  cras_apm_list_put_processed(apm2, 1440);
+
+  // The reverse stream is analyzed once for both streams.
+  device_enabled_callback_val(&fake_iodev, NULL);
+  nread = 500;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (unsigned int i = 0; i < buf->num_channels; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+  ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  ext_dsp_module_value->run(ext_dsp_module_value, 10);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
+
+  // The second stream takes over feeding where the first one stopped,
+  // the 300 frames already passed aren't passed again.
+  float_buffer_reset(buf);
+  float_buffer_written(buf, 500);
+  EXPECT_EQ(300, cras_apm_list_process(apm1, buf, 200));
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_remove_apm(list, dev_ptr);
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  EXPECT_EQ(6, webrtc_apm_process_stream_f_called);
+
+  cras_apm_list_stop_apm(list2, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_destroy(list2);
+  cras_apm_list_deinit();
+  cras_system_get_apm_sharing_enabled_ret = false;
+}
+
+TEST(ApmList, NoSharingByDefault) {
+  struct cras_audio_format fmt;
+  struct cras_apm_list* list2;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  cras_apm_list_init("");
+  webrtc_apm_create_called = 0;
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+  cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1);
+  EXPECT_EQ(2, webrtc_apm_create_called);
+
+  cras_apm_list_destroy(list);
+  cras_apm_list_destroy(list2);
+  cras_apm_list_deinit();
+}
+
+/* Waits up to a second for the APM worker to bump |counter| to |val|. */
+static unsigned int wait_for_worker(unsigned int* counter, unsigned int val) {
+  for (int i = 0; i < 1000; i++) {
+    if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) >= val)
+      break;
+    usleep(1000);
+  }
+  return __atomic_load_n(counter, __ATOMIC_ACQUIRE);
+}
+
+TEST(ApmList, ApmWorkerProcessing) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct cras_audio_area* area;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+  struct cras_iodev fake_iodev;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  fake_iodev.direction = CRAS_STREAM_OUTPUT;
+  device_enabled_callback_val = NULL;
+  ext_dsp_module_value = NULL;
+  webrtc_apm_process_stream_f_called = 0;
+  webrtc_apm_process_reverse_stream_f_called = 0;
+  dsp_util_interleave_frames = 0;
+  cras_set_thread_priority_called = 0;
+  cras_system_get_apm_worker_enabled_ret = true;
+
+  cras_apm_list_init("");
+  device_enabled_callback_val(&fake_iodev, NULL);
+  ASSERT_NE((void*)NULL, ext_dsp_module_value);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  /* Processed blocks come back one 10ms block late. */
+  EXPECT_EQ(480, cras_apm_list_get_delay_frames(apm));
+
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  EXPECT_EQ(1, wait_for_worker(&webrtc_apm_process_stream_f_called, 1));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(0, area->frames);
+  EXPECT_EQ(0, dsp_util_interleave_frames);
+
+  /* The next block releases the first one. */
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+  EXPECT_EQ(480, dsp_util_interleave_frames);
+  EXPECT_EQ(2, wait_for_worker(&webrtc_apm_process_stream_f_called, 2));
+
+  /* Reverse blocks are analyzed by the worker too. */
+  nread = 480;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (int i = 0; i < buf->num_channels; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+  ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  EXPECT_EQ(1, wait_for_worker(&webrtc_apm_process_reverse_stream_f_called,
+                               1));
+
+  /* The worker takes over the ring of a new configuration. */
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+  ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  EXPECT_EQ(2, wait_for_worker(&webrtc_apm_process_reverse_stream_f_called,
+                               2));
+
+  /* The worker runs at real time priority. */
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+  cras_system_get_apm_worker_enabled_ret = false;
+}
+
+TEST(ApmList, ApmWorkerCatchesUpAfterLateBlock) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct cras_audio_area* area;
+  struct float_buffer* buf;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  webrtc_apm_process_stream_f_called = 0;
+  cras_system_get_apm_worker_enabled_ret = true;
+
+  cras_apm_list_init("");
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  EXPECT_EQ(1, wait_for_worker(&webrtc_apm_process_stream_f_called, 1));
+  usleep(10000);
+
+  /* The worker stalls on the second block, the third one finds it late. */
+  __atomic_store_n(&webrtc_apm_process_stream_f_stall, 1, __ATOMIC_RELEASE);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+  cras_apm_list_put_processed(apm, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(0, area->frames);
+
+  __atomic_store_n(&webrtc_apm_process_stream_f_stall, 0, __ATOMIC_RELEASE);
+  EXPECT_EQ(3, wait_for_worker(&webrtc_apm_process_stream_f_called, 3));
+  usleep(10000);
+
+  /* Both blocks held back come out with the fourth one, the output is one
+   * block behind the input again. */
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(960, area->frames);
+  EXPECT_EQ(480, cras_apm_list_get_delay_frames(apm));
+  cras_apm_list_put_processed(apm, 960);
+
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  EXPECT_EQ(5, wait_for_worker(&webrtc_apm_process_stream_f_called, 5));
+  usleep(10000);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+  cras_system_get_apm_worker_enabled_ret = false;
+}
+
 extern "C" {
+bool cras_system_get_apm_sharing_enabled() {
+  return cras_system_get_apm_sharing_enabled_ret;
+}
+bool cras_system_get_apm_worker_enabled() {
+  return cras_system_get_apm_worker_enabled_ret;
+}
+int cras_set_rt_scheduling(int rt_lim) {
+  return 0;
+}
+int cras_set_thread_priority(int priority) {
+  cras_set_thread_priority_called++;
+  return 0;
+}
 int cras_iodev_list_set_device_enabled_callback(
     device_enabled_callback_t enabled_cb,
     device_disabled_callback_t disabled_cb,
@@ -356,7 +755,10 @@ int webrtc_apm_process_stream_f(webrtc_apm ptr,
                                 int num_channels,
                                 int rate,
                                 float* const* data) {
-  webrtc_apm_process_stream_f_called++;
+  while (__atomic_load_n(&webrtc_apm_process_stream_f_stall, __ATOMIC_ACQUIRE))
+    usleep(100);
+  __atomic_add_fetch(&webrtc_apm_process_stream_f_called, 1,
+                     __ATOMIC_RELEASE);
   return 0;
 }
 
@@ -364,7 +766,11 @@ int webrtc_apm_process_reverse_stream_f(webrtc_apm ptr,
                                         int num_channels,
                                         int rate,
                                         float* const* data) {
-  webrtc_apm_process_reverse_stream_f_called++;
+  webrtc_apm_process_reverse_stream_f_data = data[0];
+  // Processing modifies the data in place.
+  data[0][0] = 1.0f;
+  __atomic_add_fetch(&webrtc_apm_process_reverse_stream_f_called, 1,
+                     __ATOMIC_RELEASE);
   return 0;
 }
 int webrtc_apm_aec_dump(webrtc_apm ptr,
@@ -10,6 +10,8 @@ extern "C" {
 }
 
 #include <gtest/gtest.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <map>
 
@@ -36,6 +38,11 @@ static unsigned int cras_iodev_put_output_buffer_nframes;
 static unsigned int cras_iodev_fill_odev_zeros_frames;
 static int dev_stream_playback_frames_ret;
 static int dev_stream_mix_called;
+static unsigned int dev_stream_mix_max_frames;
+static int cras_rstream_check_low_watermark_called;
+static int cras_rstream_record_underrun_called;
+static unsigned int cras_rstream_record_underrun_frames;
+static unsigned int cras_iodev_stream_written_frames;
 static unsigned int dev_stream_update_next_wake_time_called;
 static unsigned int dev_stream_request_playback_samples_called;
 static unsigned int cras_iodev_prepare_output_before_write_samples_called;
@@ -59,6 +66,8 @@ static std::map<const struct dev_stream*, struct timespec>
     dev_stream_wake_time_val;
 static int cras_device_monitor_set_device_mute_state_called;
 static int cras_iodev_is_zero_volume_ret;
+// Set by the wake latency stress test, which runs real audio threads.
+static bool stress_running;
 
 void ResetGlobalStubData() {
   cras_rstream_dev_offset_called = 0;
@@ -84,6 +93,11 @@ void ResetGlobalStubData() {
   cras_iodev_frames_to_play_in_sleep_called = 0;
   dev_stream_playback_frames_ret = 0;
   dev_stream_mix_called = 0;
+  dev_stream_mix_max_frames = UINT_MAX;
+  cras_rstream_check_low_watermark_called = 0;
+  cras_rstream_record_underrun_called = 0;
+  cras_rstream_record_underrun_frames = 0;
+  cras_iodev_stream_written_frames = 0;
   dev_stream_request_playback_samples_called = 0;
   dev_stream_update_next_wake_time_called = 0;
   cras_iodev_prepare_output_before_write_samples_called = 0;
@@ -654,6 +668,52 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
   TearDownRstream(&rstream3);
 }
 
+TEST_F(StreamDeviceSuite, AddDisconnectStreamsInBatch) {
+  struct cras_iodev iodev, iodev2;
+  struct cras_iodev* iodevs[] = {&iodev, &iodev2};
+  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream* rstreams[] = {&rstream, &rstream2, &rstream3};
+  struct dev_stream* dev_stream;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream3, CRAS_STREAM_OUTPUT);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_open_dev(thread_, &iodev2);
+
+  // All three streams are attached to both devices.
+  EXPECT_EQ(0, thread_add_streams(thread_, rstreams, 3, iodevs, 2));
+  dev_stream = iodev.streams;
+  EXPECT_EQ(&rstream, dev_stream->stream);
+  EXPECT_EQ(&rstream2, dev_stream->next->stream);
+  EXPECT_EQ(&rstream3, dev_stream->next->next->stream);
+  dev_stream = iodev2.streams;
+  EXPECT_EQ(&rstream, dev_stream->stream);
+  EXPECT_EQ(&rstream3, dev_stream->next->next->stream);
+
+  // Detach two of them from the second device only.
+  EXPECT_EQ(0, thread_disconnect_streams(thread_, rstreams, 2, &iodevs[1],
+                                         1));
+  dev_stream = iodev2.streams;
+  EXPECT_EQ(&rstream3, dev_stream->stream);
+  EXPECT_EQ(NULL, dev_stream->next);
+  EXPECT_EQ(&rstream, iodev.streams->stream);
+
+  // Detach everything from all devices.
+  EXPECT_EQ(0, thread_disconnect_streams(thread_, rstreams, 3, NULL, 0));
+  EXPECT_EQ(NULL, iodev.streams);
+  EXPECT_EQ(NULL, iodev2.streams);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev2.info.idx);
+  TearDownRstream(&rstream);
+  TearDownRstream(&rstream2);
+  TearDownRstream(&rstream3);
+}
+
 TEST_F(StreamDeviceSuite, FetchStreams) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct open_dev* adev;
@@ -708,6 +768,36 @@ TEST_F(StreamDeviceSuite, FetchStreams) {
   TearDownRstream(&rstream);
 }
 
+TEST_F(StreamDeviceSuite, FetchPullStream) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct open_dev* adev;
+  struct cras_rstream rstream;
+
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.flags = PULL_MODE;
+  ResetGlobalStubData();
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+
+  // Pull streams are never asked for data, only checked against the low
+  // watermark, and don't start before the client queued something.
+  dev_io_playback_fetch(adev);
+  EXPECT_EQ(0, dev_stream_request_playback_samples_called);
+  EXPECT_EQ(1, cras_rstream_check_low_watermark_called);
+  EXPECT_EQ(0, cras_iodev_start_stream_called);
+
+  rstream.shm->header->write_offset[0] = 100 * 4;
+  dev_io_playback_fetch(adev);
+  EXPECT_EQ(0, dev_stream_request_playback_samples_called);
+  EXPECT_EQ(2, cras_rstream_check_low_watermark_called);
+  EXPECT_EQ(1, cras_iodev_start_stream_called);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream);
+}
+
 TEST_F(StreamDeviceSuite, WriteOutputSamplesPrepareOutputFailed) {
   struct cras_iodev iodev;
   struct open_dev* adev;
@@ -877,6 +967,84 @@ TEST_F(StreamDeviceSuite, MixOutputSamples) {
   TearDownRstream(&rstream2);
 }
 
+TEST_F(StreamDeviceSuite, PullStreamUnderrun) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.flags = PULL_MODE;
+  rstream.master_dev.dev_id = iodev.info.idx;
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  dev_stream_set_running(iodev.streams);
+
+  // A pull stream running low is padded up to the minimum callback level
+  // instead of holding the device back.
+  dev_stream_playback_frames_ret = 100;
+  dev_stream_mix_max_frames = 100;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(1, dev_stream_mix_called);
+  EXPECT_EQ(1, cras_rstream_record_underrun_called);
+  EXPECT_EQ(FIRST_CB_LEVEL - 100, cras_rstream_record_underrun_frames);
+
+  // With enough queued it is mixed like any other stream.
+  dev_stream_playback_frames_ret = 1000;
+  dev_stream_mix_max_frames = 1000;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(1, cras_rstream_record_underrun_called);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream);
+}
+
+TEST_F(StreamDeviceSuite, PullStreamUnderrunTwoDevices) {
+  struct cras_iodev iodev1, iodev2;
+  struct cras_iodev* iodevs[] = {&iodev1, &iodev2};
+  struct cras_rstream rstream;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+  SetupDevice(&iodev1, CRAS_STREAM_OUTPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.flags = PULL_MODE;
+  rstream.master_dev.dev_id = iodev1.info.idx;
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+  thread_add_open_dev(thread_, &iodev1);
+  thread_add_open_dev(thread_, &iodev2);
+  thread_add_stream(thread_, &rstream, iodevs, 2);
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  dev_stream_set_running(iodev1.streams);
+  dev_stream_set_running(iodev2.streams);
+
+  // Each device mixes the 100 queued frames and plays silence after them.
+  // The silence only moves the device position, the stream's underrun is
+  // counted once.
+  dev_stream_playback_frames_ret = 100;
+  dev_stream_mix_max_frames = 100;
+  DL_FOREACH (thread_->open_devs[CRAS_STREAM_OUTPUT], adev)
+    write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev,
+                         nullptr);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(2 * FIRST_CB_LEVEL, cras_iodev_stream_written_frames);
+  EXPECT_EQ(1, cras_rstream_record_underrun_called);
+  EXPECT_EQ(FIRST_CB_LEVEL - 100, cras_rstream_record_underrun_frames);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev1.info.idx);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev2.info.idx);
+  TearDownRstream(&rstream);
+}
+
 TEST_F(StreamDeviceSuite, DoPlaybackNoStream) {
   struct cras_iodev iodev;
 
@@ -1004,8 +1172,10 @@ TEST(AudioThreadStreams, DrainStream) {
 }
 
 TEST(BusyloopDetectSuite, CheckerTest) {
+  char log_name[] = "/ATlog-busyloop-test";
   continuous_zero_sleep_count = 0;
   cras_audio_thread_event_busyloop_called = 0;
+  atlog = audio_thread_event_log_init(log_name);
   timespec wait_ts;
   wait_ts.tv_sec = 0;
   wait_ts.tv_nsec = 0;
@@ -1024,6 +1194,329 @@ TEST(BusyloopDetectSuite, CheckerTest) {
   check_busyloop(&wait_ts);
   EXPECT_EQ(continuous_zero_sleep_count, 0);
   EXPECT_EQ(cras_audio_thread_event_busyloop_called, 1);
+  EXPECT_EQ(1, audio_thread_event_log_timing(atlog)->busyloops);
+
+  audio_thread_event_log_deinit(atlog, log_name);
+  atlog = NULL;
+}
+
+TEST(AudioThreadTrace, LosslessRing) {
+  char log_name[] = "/ATlog-trace-test";
+  struct audio_thread_trace* ring;
+  int owner;
+  size_t size;
+  unsigned int i;
+  int fd;
+
+  atlog = audio_thread_event_log_init(log_name);
+  fd = audio_thread_event_log_start_trace(&owner, 1);
+  ASSERT_LE(0, fd);
+  EXPECT_EQ(-EBUSY, audio_thread_event_log_start_trace(&owner, 1));
+
+  // The ring is rounded up to the smallest size.
+  size = sizeof(*ring) +
+         ATLOG_TRACE_MIN_EVENTS * sizeof(struct audio_thread_trace_event);
+  ring = (struct audio_thread_trace*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(MAP_FAILED, ring);
+  EXPECT_EQ(ATLOG_TRACE_MIN_EVENTS, ring->len);
+
+  // Events past a full ring are dropped, not overwritten.
+  for (i = 0; i < ATLOG_TRACE_MIN_EVENTS + 10; i++)
+    audio_thread_event_log_data(atlog, AUDIO_THREAD_FILL_AUDIO, i, 0, 0);
+  EXPECT_EQ(10, ring->dropped);
+  EXPECT_EQ(1, ring->events[0].seq);
+  EXPECT_EQ(0, ring->events[0].data1);
+  EXPECT_EQ(AUDIO_THREAD_FILL_AUDIO, ring->events[0].tag);
+  EXPECT_EQ(ATLOG_TRACE_MIN_EVENTS - 1,
+            ring->events[ATLOG_TRACE_MIN_EVENTS - 1].data1);
+
+  // Consuming one event makes room for the next.
+  ring->read_pos = 1;
+  audio_thread_event_log_data(atlog, AUDIO_THREAD_WAKE, 42, 0, 0);
+  EXPECT_EQ(ATLOG_TRACE_MIN_EVENTS + 1, ring->events[0].seq);
+  EXPECT_EQ(42, ring->events[0].data1);
+  EXPECT_EQ(10, ring->dropped);
+
+  EXPECT_EQ(-EINVAL, audio_thread_event_log_stop_trace(NULL));
+  EXPECT_EQ(0, audio_thread_event_log_stop_trace(&owner));
+  EXPECT_EQ((void*)NULL, attrace);
+  munmap(ring, size);
+
+  audio_thread_event_log_deinit(atlog, log_name);
+  atlog = NULL;
+}
+
+TEST(AudioThreadTiming, HistogramBuckets) {
+  unsigned int i;
+
+  // Small values get a bucket each, then 8 buckets per power of two.
+  EXPECT_EQ(7, audio_thread_hist_bucket(7));
+  EXPECT_EQ(8, audio_thread_hist_bucket(8));
+  EXPECT_EQ(15, audio_thread_hist_bucket(15));
+  EXPECT_EQ(16, audio_thread_hist_bucket(16));
+  EXPECT_EQ(16, audio_thread_hist_bucket(17));
+  EXPECT_EQ(17, audio_thread_hist_bucket(18));
+  EXPECT_EQ(AUDIO_THREAD_HIST_BUCKETS - 1,
+            audio_thread_hist_bucket(0xffffffffULL));
+  EXPECT_EQ(AUDIO_THREAD_HIST_BUCKETS - 1,
+            audio_thread_hist_bucket(1ULL << 40));
+
+  for (i = 1; i < AUDIO_THREAD_HIST_BUCKETS; i++) {
+    uint64_t min = audio_thread_hist_bucket_min(i);
+
+    EXPECT_EQ(i, audio_thread_hist_bucket(min));
+    EXPECT_EQ(i - 1, audio_thread_hist_bucket(min - 1));
+  }
+}
+
+TEST(AudioThreadTiming, HistogramPercentile) {
+  struct audio_thread_hist hist;
+  unsigned int i;
+
+  memset(&hist, 0, sizeof(hist));
+  EXPECT_EQ(0, audio_thread_hist_percentile(&hist, 50.0));
+
+  // 990 wakes 100us late, 10 wakes 5ms late.
+  for (i = 0; i < 990; i++)
+    audio_thread_hist_add(&hist, 100000);
+  for (i = 0; i < 10; i++)
+    audio_thread_hist_add(&hist, 5000000);
+
+  EXPECT_EQ(1000, hist.count);
+  EXPECT_EQ(5000000, hist.max_ns);
+  EXPECT_EQ(990 * 100000ULL + 10 * 5000000ULL, hist.sum_ns);
+
+  // Percentiles are bounded by the top of their bucket, within 1/8.
+  EXPECT_LE(100000, audio_thread_hist_percentile(&hist, 50.0));
+  EXPECT_GT(112500, audio_thread_hist_percentile(&hist, 50.0));
+  EXPECT_GT(112500, audio_thread_hist_percentile(&hist, 99.0));
+  EXPECT_EQ(5000000, audio_thread_hist_percentile(&hist, 99.9));
+  EXPECT_EQ(5000000, audio_thread_hist_percentile(&hist, 100.0));
+}
+
+static int epoll_callback_called;
+
+static int EpollCallback(void* data, int revents) {
+  int* fd = static_cast<int*>(data);
+  char c;
+
+  if (revents & POLLIN) {
+    EXPECT_EQ(1, read(*fd, &c, 1));
+  }
+  __atomic_add_fetch(&epoll_callback_called, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static bool WaitCallbackCalled(int times) {
+  struct timespec poll_ts = {0, 1000000};
+  int i;
+
+  for (i = 0; i < 1000; i++) {
+    if (__atomic_load_n(&epoll_callback_called, __ATOMIC_RELAXED) >= times)
+      return true;
+    nanosleep(&poll_ts, NULL);
+  }
+  return false;
+}
+
+TEST(AudioThreadEpoll, CallbackOnReadyFd) {
+  struct audio_thread* thread;
+  struct timespec idle_ts = {0, 20000000};
+  int fds[2];
+
+  epoll_callback_called = 0;
+  ASSERT_EQ(0, pipe(fds));
+  thread = audio_thread_create();
+  ASSERT_NE((void*)NULL, thread);
+  ASSERT_EQ(0, audio_thread_start(thread));
+
+  audio_thread_add_events_callback(fds[0], EpollCallback, &fds[0], POLLIN);
+  ASSERT_EQ(1, write(fds[1], "a", 1));
+  EXPECT_TRUE(WaitCallbackCalled(1));
+
+  // A disabled callback is not polled until it is enabled again.
+  audio_thread_enable_callback(fds[0], 0);
+  ASSERT_EQ(1, write(fds[1], "b", 1));
+  nanosleep(&idle_ts, NULL);
+  EXPECT_EQ(1, __atomic_load_n(&epoll_callback_called, __ATOMIC_RELAXED));
+  audio_thread_enable_callback(fds[0], 1);
+  EXPECT_TRUE(WaitCallbackCalled(2));
+
+  audio_thread_rm_callback_sync(thread, fds[0]);
+  ASSERT_EQ(1, write(fds[1], "c", 1));
+  nanosleep(&idle_ts, NULL);
+  EXPECT_EQ(2, __atomic_load_n(&epoll_callback_called, __ATOMIC_RELAXED));
+
+  audio_thread_destroy(thread);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static unsigned int cmd_done_called;
+static int cmd_done_rc;
+
+static void CmdDone(struct audio_thread* thread,
+                    struct audio_thread_msg* msg,
+                    int rc,
+                    void* data) {
+  cmd_done_called++;
+  cmd_done_rc = rc;
+}
+
+TEST(AudioThreadCmdRing, AsyncCommandsCompleteInOrder) {
+  struct audio_thread* thread;
+  struct audio_thread_dev_start_ramp_msg msg;
+  const unsigned int num_cmds = AUDIO_THREAD_CMD_RING_SIZE * 3;
+  unsigned int i;
+
+  cmd_done_called = 0;
+  cmd_done_rc = 0;
+  thread = audio_thread_create();
+  ASSERT_NE((void*)NULL, thread);
+  ASSERT_EQ(0, audio_thread_start(thread));
+
+  // More commands than the ring holds, the oldest are retired to make room.
+  init_device_start_ramp_msg(&msg, AUDIO_THREAD_DEV_START_RAMP, 123,
+                             CRAS_IODEV_RAMP_REQUEST_UP_UNMUTE);
+  for (i = 0; i < num_cmds; i++)
+    ASSERT_EQ(0, audio_thread_post_message_async(thread, &msg.header,
+                                                 CmdDone, NULL));
+  EXPECT_GE(cmd_done_called, num_cmds - AUDIO_THREAD_CMD_RING_SIZE);
+
+  // A synchronous command is handled after all the queued ones.
+  cras_iodev iodev;
+  memset(&iodev, 0, sizeof(iodev));
+  EXPECT_EQ(0, audio_thread_is_dev_open(thread, &iodev));
+  EXPECT_EQ(num_cmds, cmd_done_called);
+  EXPECT_EQ(-EINVAL, cmd_done_rc);
+  EXPECT_EQ(thread->cmds->queued, thread->cmds->retired);
+
+  audio_thread_destroy(thread);
+}
+
+// Wakes several output devices every 10ms from real audio threads, with a
+// thread per device, and measures how late each device is woken up. One of
+// the devices is slow to service, which must not delay the others.
+static const unsigned int kStressDevices = 4;
+static const unsigned int kStressWakes = 50;
+static const unsigned int kStressSleepFrames = 480;
+static const long kStressSlowDevNs = 5000000;
+
+struct StressDevice {
+  struct cras_iodev iodev;
+  struct timespec expected_wake;
+  uint64_t total_late_ns;
+  unsigned int wakes;
+};
+
+static StressDevice stress_devs[kStressDevices];
+static struct cras_audio_format stress_format;
+
+static int StressFramesQueued(const cras_iodev* iodev,
+                              struct timespec* tstamp) {
+  struct timespec slow = {0, kStressSlowDevNs};
+
+  if (iodev == &stress_devs[0].iodev)
+    nanosleep(&slow, NULL);
+  clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+  // A full buffer leaves nothing to write, only the wake up is measured.
+  return iodev->buffer_size;
+}
+
+static int StressDelayFrames(const cras_iodev* iodev) {
+  return 0;
+}
+
+unsigned int StressFramesToPlayInSleep(struct cras_iodev* odev,
+                                       unsigned int* hw_level,
+                                       struct timespec* hw_tstamp) {
+  StressDevice* sdev = (StressDevice*)odev;
+  struct timespec now, late;
+  uint64_t late_ns;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  if (timespec_is_nonzero(&sdev->expected_wake) &&
+      timespec_after(&now, &sdev->expected_wake)) {
+    subtract_timespecs(&now, &sdev->expected_wake, &late);
+    late_ns = late.tv_sec * 1000000000ULL + late.tv_nsec;
+    sdev->total_late_ns += late_ns;
+    __atomic_add_fetch(&sdev->wakes, 1, __ATOMIC_RELAXED);
+  }
+
+  *hw_level = kStressSleepFrames;
+  *hw_tstamp = now;
+  cras_frames_to_time(kStressSleepFrames, 48000, &late);
+  sdev->expected_wake = now;
+  add_timespecs(&sdev->expected_wake, &late);
+  return kStressSleepFrames;
+}
+
+static void RunWakeLatencyStress(unsigned int num_threads) {
+  struct audio_thread* threads[kStressDevices];
+  struct audio_thread* thread;
+  struct timespec poll = {0, 10000000};
+  bool done;
+  unsigned int i;
+
+  memset(stress_devs, 0, sizeof(stress_devs));
+  stress_format.format = SND_PCM_FORMAT_S16_LE;
+  stress_format.frame_rate = 48000;
+  stress_format.num_channels = 2;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  stress_running = true;
+
+  for (i = 0; i < num_threads; i++) {
+    threads[i] = audio_thread_create();
+    ASSERT_NE((void*)NULL, threads[i]);
+    ASSERT_EQ(0, audio_thread_start(threads[i]));
+  }
+  for (i = 0; i < kStressDevices; i++) {
+    struct cras_iodev* iodev = &stress_devs[i].iodev;
+
+    iodev->info.idx = i + 1;
+    iodev->direction = CRAS_STREAM_OUTPUT;
+    iodev->frames_queued = StressFramesQueued;
+    iodev->delay_frames = StressDelayFrames;
+    iodev->format = &stress_format;
+    iodev->buffer_size = BUFFER_SIZE;
+    iodev->min_cb_level = FIRST_CB_LEVEL;
+    iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+    audio_thread_add_open_dev(threads[i % num_threads], iodev);
+  }
+
+  do {
+    nanosleep(&poll, NULL);
+    done = true;
+    for (i = 0; i < kStressDevices; i++)
+      done = done && __atomic_load_n(&stress_devs[i].wakes,
+                                     __ATOMIC_RELAXED) >= kStressWakes;
+  } while (!done);
+
+  for (i = 0; i < kStressDevices; i++) {
+    thread = threads[i % num_threads];
+    audio_thread_rm_open_dev(thread, CRAS_STREAM_OUTPUT,
+                             stress_devs[i].iodev.info.idx);
+  }
+  for (i = 0; i < num_threads; i++)
+    audio_thread_destroy(threads[i]);
+  stress_running = false;
+}
+
+TEST(AudioThreadStress, WakeLatencyPerDeviceThreads) {
+  unsigned int i;
+
+  RunWakeLatencyStress(kStressDevices);
+
+  // On a shared thread every device would be late by the time the slow one
+  // takes, on their own threads the others stay well below it.
+  for (i = 1; i < kStressDevices; i++)
+    EXPECT_GT(kStressSlowDevNs / 2,
+              stress_devs[i].total_late_ns / stress_devs[i].wakes)
+        << "device " << i;
+  ResetGlobalStubData();
 }
 
 extern "C" {
@@ -1101,7 +1594,9 @@ int dev_stream_attached_devs(const struct dev_stream* dev_stream) {
 
 void cras_iodev_stream_written(struct cras_iodev* iodev,
                                struct dev_stream* stream,
-                               unsigned int nwritten) {}
+                               unsigned int nwritten) {
+  cras_iodev_stream_written_frames += nwritten;
+}
 
 int cras_iodev_update_rate(struct cras_iodev* iodev,
                            unsigned int level,
@@ -1123,6 +1618,17 @@ int cras_iodev_put_output_buffer(struct cras_iodev* iodev,
   return 0;
 }
 
+int cras_iodev_put_output_mix_bus(struct cras_iodev* iodev,
+                                  struct mix_bus* bus,
+                                  uint8_t* frames,
+                                  unsigned int nframes,
+                                  int* non_empty,
+                                  struct cras_fmt_conv* output_converter) {
+  cras_iodev_put_output_buffer_called++;
+  cras_iodev_put_output_buffer_nframes = nframes;
+  return 0;
+}
+
 int cras_iodev_get_input_buffer(struct cras_iodev* iodev, unsigned* frames) {
   return 0;
 }
@@ -1186,6 +1692,17 @@ int cras_rstream_is_pending_reply(const struct cras_rstream* stream) {
   return cras_rstream_is_pending_reply_ret;
 }
 
+int cras_rstream_check_low_watermark(struct cras_rstream* stream) {
+  cras_rstream_check_low_watermark_called++;
+  return 0;
+}
+
+void cras_rstream_record_underrun(struct cras_rstream* stream,
+                                  unsigned int frames) {
+  cras_rstream_record_underrun_called++;
+  cras_rstream_record_underrun_frames += frames;
+}
+
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
   return 1.0f;
 }
@@ -1198,12 +1715,24 @@ int cras_set_thread_priority(int priority) {
   return 0;
 }
 
+int cras_system_add_select_fd(int fd,
+                              void (*callback)(void* data, int revents),
+                              void* callback_data,
+                              int events) {
+  return 0;
+}
+
 void cras_system_rm_select_fd(int fd) {}
 
+bool cras_system_get_float_mix_bus_enabled() {
+  return false;
+}
+
 unsigned int dev_stream_capture(struct dev_stream* dev_stream,
                                 const struct cras_audio_area* area,
                                 unsigned int area_offset,
-                                float software_gain_scaler) {
+                                float software_gain_scaler,
+                                struct dev_stream_capture_cache* cache) {
   return 0;
 }
 
@@ -1225,6 +1754,7 @@ struct dev_stream* dev_stream_create(struct cras_rstream* stream,
                                      struct timespec* cb_ts) {
   struct dev_stream* out = static_cast<dev_stream*>(calloc(1, sizeof(*out)));
   out->stream = stream;
+  out->dev_id = dev_id;
   init_cb_ts_ = *cb_ts;
   return out;
 }
@@ -1238,7 +1768,16 @@ int dev_stream_mix(struct dev_stream* dev_stream,
                    uint8_t* dst,
                    unsigned int num_to_write) {
   dev_stream_mix_called++;
-  return num_to_write;
+  return MIN(num_to_write, dev_stream_mix_max_frames);
+}
+
+int dev_stream_mix_bus(struct dev_stream* dev_stream,
+                       const struct cras_audio_format* fmt,
+                       struct mix_bus* bus,
+                       unsigned int offset,
+                       unsigned int num_to_write) {
+  dev_stream_mix_called++;
+  return MIN(num_to_write, dev_stream_mix_max_frames);
 }
 
 int dev_stream_playback_frames(const struct dev_stream* dev_stream) {
@@ -1331,6 +1870,8 @@ float cras_iodev_get_software_gain_scaler(const struct cras_iodev* iodev) {
 unsigned int cras_iodev_frames_to_play_in_sleep(struct cras_iodev* odev,
                                                 unsigned int* hw_level,
                                                 struct timespec* hw_tstamp) {
+  if (stress_running)
+    return StressFramesToPlayInSleep(odev, hw_level, hw_tstamp);
   *hw_level = cras_iodev_frames_queued(odev, hw_tstamp);
   cras_iodev_frames_to_play_in_sleep_called++;
   return 0;
@@ -1380,6 +1921,10 @@ unsigned int cras_iodev_get_num_severe_underruns(
 void cras_iodev_update_highest_hw_level(struct cras_iodev* iodev,
                                         unsigned int hw_level) {}
 
+void cras_iodev_stage_time_add(struct cras_iodev* iodev,
+                               enum CRAS_OUTPUT_STAGE stage,
+                               struct timespec* start) {}
+
 int cras_iodev_start_ramp(struct cras_iodev* odev,
                           enum CRAS_IODEV_RAMP_REQUEST request) {
   cras_iodev_start_ramp_odev = odev;
@@ -1414,6 +1959,8 @@ int cras_iodev_drop_frames_by_time(struct cras_iodev* iodev,
 
 //  From librt.
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  if (stress_running)
+    return syscall(SYS_clock_gettime, clk_id, tp);
   *tp = clock_gettime_retspec;
   return 0;
 }
@@ -1449,6 +1996,12 @@ float input_data_get_software_gain_scaler(struct input_data* data,
                                           struct cras_rstream* stream) {
   return 1.0;
 }
+
+unsigned int input_data_get_delay_frames(struct input_data* data,
+                                         struct cras_rstream* stream,
+                                         unsigned int dev_rate) {
+  return 0;
+}
 }  // extern "C"
 
 int main(int argc, char** argv) {
@@ -56,6 +56,11 @@ static size_t cras_observer_set_ops_called;
 static size_t cras_observer_ops_are_empty_called;
 static struct cras_observer_ops cras_observer_ops_are_empty_empty_ops;
 static size_t cras_observer_remove_called;
+static int start_trace_return;
+static void* start_trace_owner;
+static unsigned int start_trace_num_events;
+static unsigned int stop_trace_called;
+static void* stop_trace_owner;
 
 void ResetStubData() {
   cras_rstream_create_return = 0;
@@ -94,6 +99,11 @@ void ResetStubData() {
   memset(&cras_observer_ops_are_empty_empty_ops, 0,
          sizeof(cras_observer_ops_are_empty_empty_ops));
   cras_observer_remove_called = 0;
+  start_trace_return = 0;
+  start_trace_owner = NULL;
+  start_trace_num_events = 0;
+  stop_trace_called = 0;
+  stop_trace_owner = NULL;
 }
 
 namespace {
@@ -433,6 +443,35 @@ TEST_F(RClientMessagesSuite, DumpSnapshots) {
   EXPECT_EQ(1, cras_system_state_dump_snapshots_called);
 }
 
+TEST_F(RClientMessagesSuite, SetAtlogTrace) {
+  struct cras_set_atlog_trace msg;
+  struct cras_client_atlog_trace_ready out_msg;
+  int rc;
+
+  start_trace_return = -EBUSY;
+  cras_fill_set_atlog_trace(&msg, 4096);
+  rc =
+      rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(rclient_, start_trace_owner);
+  EXPECT_EQ(4096, start_trace_num_events);
+  ASSERT_EQ(sizeof(out_msg), read(pipe_fds_[0], &out_msg, sizeof(out_msg)));
+  EXPECT_EQ(CRAS_CLIENT_ATLOG_TRACE_READY, out_msg.header.id);
+  EXPECT_EQ(-EBUSY, out_msg.err);
+
+  cras_fill_set_atlog_trace(&msg, 0);
+  rc =
+      rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, stop_trace_called);
+  EXPECT_EQ(rclient_, stop_trace_owner);
+
+  // The trace of a client is stopped when it goes away.
+  rclient_->ops->destroy(rclient_);
+  EXPECT_EQ(2, stop_trace_called);
+  rclient_ = cras_control_rclient_create(pipe_fds_[1], 1);
+}
+
 void RClientMessagesSuite::RegisterNotification(
     enum CRAS_CLIENT_MESSAGE_ID msg_id,
     void* callback,
@@ -759,6 +798,18 @@ int audio_thread_event_log_shm_fd() {
   return -1;
 }
 
+int audio_thread_event_log_start_trace(void* owner, unsigned int num_events) {
+  start_trace_owner = owner;
+  start_trace_num_events = num_events;
+  return start_trace_return;
+}
+
+int audio_thread_event_log_stop_trace(void* owner) {
+  stop_trace_called++;
+  stop_trace_owner = owner;
+  return 0;
+}
+
 #ifdef HAVE_WEBRTC_APM
 void cras_apm_list_reload_aec_config() {}
 #endif
@@ -65,6 +65,8 @@ class CrasClientTestSuite : public testing::Test {
     client_.server_fd_state = CRAS_SOCKET_STATE_CONNECTED;
     memset(&stream_, 0, sizeof(stream_));
     stream_.id = FIRST_STREAM_ID;
+    stream_.wake_fd = -1;
+    stream_.client = &client_;
 
     struct cras_stream_params* config =
         static_cast<cras_stream_params*>(calloc(1, sizeof(*config)));
@@ -166,6 +168,217 @@ TEST_F(CrasClientTestSuite, HandleCaptureDataReady) {
   EXPECT_EQ(0, shm->header->read_buf_idx);
 }
 
+int playback_samples_ready(cras_client* client,
+                           cras_stream_id_t stream_id,
+                           uint8_t* samples,
+                           size_t frames,
+                           const timespec* sample_ts,
+                           void* arg) {
+  samples_ready_called++;
+  samples_ready_frames_value = frames;
+  return frames;
+}
+
+TEST_F(CrasClientTestSuite, HandlePlaybackRequestShmWakeup) {
+  struct cras_audio_shm* shm;
+  struct audio_message msg;
+  uint64_t count;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  shm = InitShm();
+  stream_.shm = shm;
+  stream_.config->aud_cb = playback_samples_ready;
+  stream_.config->unified_cb = 0;
+  stream_.thread.state = CRAS_THREAD_RUNNING;
+  stream_.wake_fd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_LE(0, stream_.wake_fd);
+
+  // A request published by the server before the client connected.
+  cras_shm_wake_request(shm, AUDIO_MESSAGE_REQUEST_DATA, 240);
+  EXPECT_EQ(1, shm->header->wake.futex);
+  ASSERT_EQ(sizeof(msg), wait_for_shm_request(&stream_, &msg));
+  EXPECT_EQ(AUDIO_MESSAGE_REQUEST_DATA, msg.id);
+  EXPECT_EQ(240, msg.frames);
+  EXPECT_EQ(0, shm->header->wake.client_waiting);
+
+  EXPECT_EQ(0, handle_playback_request(&stream_, msg.frames));
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(240, samples_ready_frames_value);
+  EXPECT_EQ(1, shm->header->wake.reply_seq);
+  EXPECT_EQ(240, shm->header->wake.reply_frames);
+  EXPECT_EQ(0, shm->header->wake.reply_error);
+  EXPECT_EQ(sizeof(count), read(stream_.wake_fd, &count, sizeof(count)));
+  EXPECT_EQ(1, count);
+
+  // Stopping the thread bumps the futex, and the thread doesn't wait.
+  stream_.thread.state = CRAS_THREAD_STOP;
+  cras_shm_wake_client(shm, 1);
+  EXPECT_EQ(2, shm->header->wake.futex);
+  EXPECT_EQ(0, wait_for_shm_request(&stream_, &msg));
+}
+
+static struct cras_stream_spans begin_spans;
+static int begin_rc;
+
+// Renders |frames| frames through the begin/commit API, committing them in
+// two parts, with each sample set to its frame index.
+int playback_begin_commit(cras_client* client,
+                          cras_stream_id_t stream_id,
+                          uint8_t* samples,
+                          size_t frames,
+                          const timespec* sample_ts,
+                          void* arg) {
+  struct cras_stream_spans spans;
+  uint32_t index = 0;
+  unsigned int i, j;
+
+  samples_ready_called++;
+  samples_ready_frames_value = frames;
+  begin_rc = cras_client_playback_begin(client, stream_id, 1000, &begin_spans);
+  for (i = 0; i < 2; i++)
+    for (j = 0; j < begin_spans.frames[i]; j++)
+      ((uint32_t*)begin_spans.buf[i])[j] = index++;
+  EXPECT_EQ(0, cras_client_playback_commit(client, stream_id, 60));
+  EXPECT_EQ(40, cras_client_playback_begin(client, stream_id, 1000, &spans));
+  EXPECT_EQ(0, cras_client_playback_commit(client, stream_id, 40));
+  EXPECT_EQ(-EINVAL, cras_client_playback_commit(client, stream_id, 1));
+  // Input functions don't apply to an output stream.
+  EXPECT_EQ(-EINVAL, cras_client_capture_begin(client, stream_id, 1, &spans));
+  return 0;
+}
+
+TEST_F(CrasClientTestSuite, PlaybackBeginCommitRingWrap) {
+  struct cras_audio_shm* shm;
+  struct cras_stream_spans spans;
+  uint32_t* samples;
+  unsigned int i;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  shm_writable_frames_ = 128;
+  shm = InitShm();
+  stream_.shm = shm;
+  samples = static_cast<uint32_t*>(calloc(1, shm->samples_info.length));
+  shm->samples = reinterpret_cast<uint8_t*>(samples);
+  ASSERT_EQ(0, cras_shm_set_ring(shm, 256));
+  shm->header->ring.read = 206;
+  shm->header->ring.write = 206;
+  stream_.config->aud_cb = playback_begin_commit;
+  stream_.config->unified_cb = 0;
+  stream_.wake_fd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_LE(0, stream_.wake_fd);
+
+  EXPECT_EQ(-EINVAL, cras_client_playback_begin(&client_, stream_.id, 1,
+                                                &spans));
+
+  // The callback buffer stops at the end of the ring, the spans don't.
+  EXPECT_EQ(0, handle_playback_request(&stream_, 100));
+  EXPECT_EQ(50, samples_ready_frames_value);
+  EXPECT_EQ(100, begin_rc);
+  EXPECT_EQ(reinterpret_cast<uint8_t*>(samples + 206), begin_spans.buf[0]);
+  EXPECT_EQ(50, begin_spans.frames[0]);
+  EXPECT_EQ(reinterpret_cast<uint8_t*>(samples), begin_spans.buf[1]);
+  EXPECT_EQ(50, begin_spans.frames[1]);
+  EXPECT_EQ(306, shm->header->ring.write);
+  EXPECT_EQ(100, shm->header->wake.reply_frames);
+  for (i = 0; i < 100; i++)
+    EXPECT_EQ(i, samples[(206 + i) % 256]);
+
+  EXPECT_EQ(-EINVAL, cras_client_playback_commit(&client_, stream_.id, 1));
+  syscall(SYS_close, stream_.wake_fd);
+  free(samples);
+}
+
+TEST_F(CrasClientTestSuite, PullStreamWriteAnyThread) {
+  struct cras_audio_shm* shm;
+  struct cras_stream_spans spans;
+  unsigned int underruns, frames;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  stream_.flags = PULL_MODE;
+  shm_writable_frames_ = 128;
+  shm = InitShm();
+  stream_.shm = shm;
+  shm->samples = static_cast<uint8_t*>(calloc(1, shm->samples_info.length));
+  ASSERT_EQ(0, cras_shm_set_ring(shm, 256));
+  shm->header->ring.read = 206;
+  shm->header->ring.write = 206;
+  stream_.config->aud_cb = playback_samples_ready;
+  stream_.config->unified_cb = 0;
+  stream_.aud_fd = -1;
+  DL_APPEND(client_.streams, &stream_);
+
+  // Not writable before the server accepted pull mode.
+  EXPECT_EQ(-EINVAL,
+            cras_client_playback_begin(&client_, stream_.id, 10, &spans));
+  stream_.pull = true;
+
+  EXPECT_EQ(256,
+            cras_client_playback_begin(&client_, stream_.id, 1000, &spans));
+  EXPECT_EQ(shm->samples + 206 * 4, spans.buf[0]);
+  EXPECT_EQ(50, spans.frames[0]);
+  EXPECT_EQ(shm->samples, spans.buf[1]);
+  EXPECT_EQ(206, spans.frames[1]);
+  EXPECT_EQ(0, cras_client_playback_commit(&client_, stream_.id, 176));
+  EXPECT_EQ(382, shm->header->ring.write);
+  EXPECT_EQ(-EINVAL, cras_client_playback_commit(&client_, stream_.id, 100));
+
+  EXPECT_EQ(0, cras_client_set_stream_low_watermark(&client_, stream_.id, 64));
+  EXPECT_EQ(64, shm->header->ring.low_watermark);
+  shm->header->ring.underruns = 2;
+  shm->header->ring.underrun_frames = 960;
+  EXPECT_EQ(0, cras_client_get_stream_underruns(&client_, stream_.id,
+                                                &underruns, &frames));
+  EXPECT_EQ(2, underruns);
+  EXPECT_EQ(960, frames);
+
+  // A low watermark notification calls back without replying.
+  EXPECT_EQ(0, handle_playback_request(&stream_, 80));
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(80, samples_ready_frames_value);
+  EXPECT_EQ(462, shm->header->ring.write);
+
+  DL_DELETE(client_.streams, &stream_);
+  free(shm->samples);
+}
+
+int capture_begin_commit(cras_client* client,
+                         cras_stream_id_t stream_id,
+                         uint8_t* samples,
+                         size_t frames,
+                         const timespec* sample_ts,
+                         void* arg) {
+  samples_ready_called++;
+  begin_rc = cras_client_capture_begin(client, stream_id, 100, &begin_spans);
+  EXPECT_EQ(0, cras_client_capture_commit(client, stream_id, 100));
+  // The return value is ignored once frames are committed.
+  return 1;
+}
+
+TEST_F(CrasClientTestSuite, CaptureBeginCommit) {
+  struct cras_audio_shm* shm;
+
+  stream_.direction = CRAS_STREAM_INPUT;
+  shm_writable_frames_ = 480;
+  shm = InitShm();
+  stream_.shm = shm;
+  stream_.config->cb_threshold = 480;
+  stream_.config->aud_cb = capture_begin_commit;
+  stream_.config->unified_cb = 0;
+  stream_.wake_fd = eventfd(0, EFD_NONBLOCK);
+  ASSERT_LE(0, stream_.wake_fd);
+
+  shm->header->write_offset[0] = 480 * 4;
+  handle_capture_data_ready(&stream_, 480);
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(100, begin_rc);
+  EXPECT_EQ(cras_shm_buff_for_idx(shm, 0), begin_spans.buf[0]);
+  EXPECT_EQ(100, begin_spans.frames[0]);
+  EXPECT_EQ(0, begin_spans.frames[1]);
+  EXPECT_EQ(0, shm->header->read_buf_idx);
+  EXPECT_EQ(100 * 4, shm->header->read_offset[0]);
+  syscall(SYS_close, stream_.wake_fd);
+}
+
 void CrasClientTestSuite::StreamConnected(CRAS_STREAM_DIRECTION direction) {
   struct cras_client_stream_connected msg;
   int shm_fds[2] = {0, 1};
@@ -203,6 +416,31 @@ TEST_F(CrasClientTestSuite, InputStreamConnected) {
 
 TEST_F(CrasClientTestSuite, OutputStreamConnected) {
   StreamConnected(CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(-1, stream_.wake_fd);
+}
+
+TEST_F(CrasClientTestSuite, OutputStreamConnectedShmWakeup) {
+  struct cras_client_stream_connected msg;
+  int stream_fds[3] = {0, 1, 2};
+  struct cras_audio_shm_header* header;
+  struct cras_audio_format server_format;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  set_audio_format(&server_format, SND_PCM_FORMAT_S16_LE, 48000, 2);
+  header = (struct cras_audio_shm_header*)calloc(1, sizeof(*header));
+  header->config.frame_bytes = 4;
+  header->config.used_size = shm_writable_frames_ * 4;
+  mmap_return_value = header;
+
+  cras_fill_client_stream_connected(&msg, 0, stream_.id, &server_format, 600,
+                                    0);
+  stream_connected(&stream_, &msg, stream_fds, 3);
+
+  EXPECT_EQ(CRAS_THREAD_RUNNING, stream_.thread.state);
+  // The shm fds are closed, the eventfd is kept for replies.
+  EXPECT_EQ(2, close_called);
+  EXPECT_EQ(2, stream_.wake_fd);
+  EXPECT_EQ(0, stream_.wake_seq);
 }
 
 void CrasClientTestSuite::StreamConnectedFail(CRAS_STREAM_DIRECTION direction) {
@@ -302,6 +540,87 @@ TEST_F(CrasClientTestSuite, AddAndRemoveStream) {
   EXPECT_EQ(NULL, stream_from_id(&client_, stream_id));
 }
 
+static cras_stream_id_t serviced_ids[4];
+static unsigned int num_serviced;
+
+int record_playback_stream(cras_client* client,
+                           cras_stream_id_t stream_id,
+                           uint8_t* samples,
+                           size_t frames,
+                           const timespec* sample_ts,
+                           void* arg) {
+  serviced_ids[num_serviced++] = stream_id;
+  return frames;
+}
+
+TEST_F(CrasClientTestSuite, SharedAudioThreadDeadlineOrder) {
+  struct client_stream* streams[2];
+  struct audio_message msg;
+  struct epoll_event ev;
+  int socks[2][2];
+  unsigned int i;
+
+  EXPECT_EQ(0, cras_client_set_shared_audio_thread(&client_, 1));
+  client_.server_fd_state = CRAS_SOCKET_STATE_DISCONNECTED;
+  client_.aud_epoll_fd = epoll_create1(0);
+  ASSERT_LE(0, client_.aud_epoll_fd);
+  num_serviced = 0;
+
+  for (i = 0; i < 2; i++) {
+    streams[i] = (struct client_stream*)calloc(1, sizeof(*streams[i]));
+    streams[i]->id = FIRST_STREAM_ID + i;
+    streams[i]->direction = CRAS_STREAM_OUTPUT;
+    streams[i]->client = &client_;
+    streams[i]->wake_fds[0] = -1;
+    streams[i]->wake_fd = -1;
+    streams[i]->config =
+        (struct cras_stream_params*)calloc(1, sizeof(*streams[i]->config));
+    streams[i]->config->cb_threshold = 64;
+    streams[i]->config->aud_cb = record_playback_stream;
+    streams[i]->shm = InitShm();
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, socks[i]));
+    streams[i]->aud_fd = socks[i][0];
+    DL_APPEND(client_.streams, streams[i]);
+    ASSERT_EQ(0, shared_aud_thread_watch(&client_, streams[i]));
+  }
+  EXPECT_EQ(-EBUSY, cras_client_set_shared_audio_thread(&client_, 0));
+
+  // The second stream has to be played first.
+  streams[0]->shm->header->ts.tv_sec = 2;
+  streams[1]->shm->header->ts.tv_sec = 1;
+  msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  msg.frames = 64;
+  msg.error = 0;
+  for (i = 0; i < 2; i++)
+    ASSERT_EQ(sizeof(msg), write(socks[i][1], &msg, sizeof(msg)));
+
+  EXPECT_EQ(0, shared_aud_thread_wait(&client_));
+  ASSERT_EQ(2, num_serviced);
+  EXPECT_EQ(FIRST_STREAM_ID + 1, serviced_ids[0]);
+  EXPECT_EQ(FIRST_STREAM_ID, serviced_ids[1]);
+  // Each stream replied on its own socket.
+  for (i = 0; i < 2; i++) {
+    ASSERT_EQ(sizeof(msg), read(socks[i][1], &msg, sizeof(msg)));
+    EXPECT_EQ(AUDIO_MESSAGE_DATA_READY, msg.id);
+    EXPECT_EQ(64, msg.frames);
+  }
+
+  // A removed stream isn't waited on anymore.
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, FIRST_STREAM_ID));
+  EXPECT_EQ(NULL, stream_from_id(&client_, FIRST_STREAM_ID));
+  msg.id = AUDIO_MESSAGE_REQUEST_DATA;
+  ASSERT_EQ(sizeof(msg), write(socks[0][1], &msg, sizeof(msg)));
+  EXPECT_EQ(0, epoll_wait(client_.aud_epoll_fd, &ev, 1, 0));
+
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, FIRST_STREAM_ID + 1));
+  for (i = 0; i < 2; i++) {
+    // close() is stubbed out.
+    syscall(SYS_close, socks[i][0]);
+    syscall(SYS_close, socks[i][1]);
+  }
+  syscall(SYS_close, client_.aud_epoll_fd);
+}
+
 TEST_F(CrasClientTestSuite, SetOutputStreamVolume) {
   cras_stream_id_t stream_id;
 
@@ -334,6 +653,45 @@ TEST_F(CrasClientTestSuite, SetInputStreamVolume) {
   EXPECT_EQ(0.6f, cras_shm_get_volume_scaler(stream_.shm));
 }
 
+TEST_F(CrasClientTestSuite, ReadAtlogTrace) {
+  const unsigned int len = 8;
+  struct audio_thread_trace_event buf[len];
+  struct audio_thread_trace* ring;
+  uint64_t dropped;
+  unsigned int i;
+
+  ring = static_cast<struct audio_thread_trace*>(
+      calloc(1, sizeof(*ring) + len * sizeof(ring->events[0])));
+  ring->len = len;
+  ring->dropped = 3;
+  client_.attrace = ring;
+
+  // Five events published, the one after them is still being written.
+  for (i = 0; i < 6; i++) {
+    ring->events[i].seq = i + 1;
+    ring->events[i].data1 = i;
+  }
+  ring->events[5].seq = 0;
+  EXPECT_EQ(2, cras_client_read_atlog_trace(&client_, buf, 2, &dropped));
+  EXPECT_EQ(3, dropped);
+  EXPECT_EQ(1, buf[1].data1);
+  EXPECT_EQ(3, cras_client_read_atlog_trace(&client_, buf, len, NULL));
+  EXPECT_EQ(4, buf[2].data1);
+  EXPECT_EQ(5, ring->read_pos);
+
+  // Slots left from the previous lap are not read again.
+  for (i = 5; i < 10; i++) {
+    ring->events[i % len].seq = i + 1;
+    ring->events[i % len].data1 = i;
+  }
+  EXPECT_EQ(5, cras_client_read_atlog_trace(&client_, buf, len, NULL));
+  EXPECT_EQ(9, buf[4].data1);
+  EXPECT_EQ(0, cras_client_read_atlog_trace(&client_, buf, len, NULL));
+
+  client_.attrace = NULL;
+  free(ring);
+}
+
 TEST(CrasClientTest, InitStreamVolume) {
   cras_stream_id_t stream_id;
   struct cras_stream_params config;
@@ -19,6 +19,13 @@ extern "C" {
 #include "utlist.h"
 
 struct audio_thread_event_log* atlog;
+struct audio_thread_tracer* attrace;
+int attrace_writers;
+void audio_thread_trace_data(const struct timespec* now,
+                             enum AUDIO_THREAD_LOG_EVENTS event,
+                             uint32_t data1,
+                             uint32_t data2,
+                             uint32_t data3) {}
 }
 
 #include "dev_io_stubs.h"
@@ -215,6 +222,12 @@ float input_data_get_software_gain_scaler(struct input_data* data,
   return input_data_get_software_gain_scaler_val;
 }
 
+unsigned int input_data_get_delay_frames(struct input_data* data,
+                                         struct cras_rstream* stream,
+                                         unsigned int dev_rate) {
+  return 0;
+}
+
 int cras_audio_thread_event_drop_samples() {
   return 0;
 }
@@ -235,6 +248,14 @@ int dev_stream_mix(struct dev_stream* dev_stream,
                    unsigned int num_to_write) {
   return 0;
 }
+
+int dev_stream_mix_bus(struct dev_stream* dev_stream,
+                       const struct cras_audio_format* fmt,
+                       struct mix_bus* bus,
+                       unsigned int offset,
+                       unsigned int num_to_write) {
+  return 0;
+}
 void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              unsigned int dev_rate,
                              double dev_rate_ratio,
@@ -259,7 +280,8 @@ void dev_stream_set_delay(const struct dev_stream* dev_stream,
 unsigned int dev_stream_capture(struct dev_stream* dev_stream,
                                 const struct cras_audio_area* area,
                                 unsigned int area_offset,
-                                float software_gain_scaler) {
+                                float software_gain_scaler,
+                                struct dev_stream_capture_cache* cache) {
   dev_stream_capture_software_gain_scaler_val = software_gain_scaler;
   return 0;
 }
@@ -9,6 +9,7 @@ extern "C" {
 #include "audio_thread_log.h"
 #include "byte_buffer.h"
 #include "cras_audio_area.h"
+#include "cras_fmt_conv.h"
 #include "cras_rstream.h"
 #include "cras_shm.h"
 #include "cras_types.h"
@@ -19,6 +20,13 @@ namespace {
 
 extern "C" {
 struct audio_thread_event_log* atlog;
+struct audio_thread_tracer* attrace;
+int attrace_writers;
+void audio_thread_trace_data(const struct timespec* now,
+                             enum AUDIO_THREAD_LOG_EVENTS event,
+                             uint32_t data1,
+                             uint32_t data2,
+                             uint32_t data3) {}
 // For audio_thread_log.h use.
 int atlog_rw_shm_fd;
 int atlog_ro_shm_fd;
@@ -63,7 +71,7 @@ struct cras_audio_area_copy_call {
 
 struct fmt_conv_call {
   struct cras_fmt_conv* conv;
-  uint8_t* in_buf;
+  const uint8_t* in_buf;
   uint8_t* out_buf;
   size_t in_frames;
   size_t out_frames;
@@ -92,6 +100,9 @@ static struct cras_audio_format in_fmt;
 static struct cras_audio_format out_fmt;
 static struct cras_audio_area_copy_call copy_area_call;
 static struct fmt_conv_call conv_frames_call;
+static int conv_frames_called;
+static int cras_fmt_conv_same_chain_val;
+static int cras_fmt_conv_reset_called;
 static int cras_audio_area_create_num_channels_val;
 static int cras_fmt_conversion_needed_val;
 static int cras_fmt_conv_set_linear_resample_rates_called;
@@ -148,6 +159,9 @@ class CreateSuite : public testing::Test {
 
     memset(&copy_area_call, 0xff, sizeof(copy_area_call));
     memset(&conv_frames_call, 0xff, sizeof(conv_frames_call));
+    conv_frames_called = 0;
+    cras_fmt_conv_same_chain_val = 0;
+    cras_fmt_conv_reset_called = 0;
 
     ASSERT_FALSE(asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0);
     /* To avoid un-used variable warning. */
@@ -250,7 +264,7 @@ class CreateSuite : public testing::Test {
 TEST_F(CreateSuite, CaptureNoSRC) {
   float software_gain_scaler = 10;
 
-  dev_stream_capture(&devstr, area, 0, software_gain_scaler);
+  dev_stream_capture(&devstr, area, 0, software_gain_scaler, NULL);
 
   EXPECT_EQ(stream_area, copy_area_call.dst);
   EXPECT_EQ(0, copy_area_call.dst_offset);
@@ -265,7 +279,7 @@ TEST_F(CreateSuite, CaptureSRCSmallConverterBuffer) {
   int nread;
 
   SetUpFmtConv(44100, 32000, kBufferFrames / 4);
-  nread = dev_stream_capture(&devstr, area, 0, software_gain_scaler);
+  nread = dev_stream_capture(&devstr, area, 0, software_gain_scaler, NULL);
 
   // |nread| is bound by small converter buffer size (kBufferFrames / 4)
   conv_buf_avail_at_input_rate = cras_frames_at_rate(
@@ -297,7 +311,7 @@ TEST_F(CreateSuite, CaptureSRCLargeConverterBuffer) {
   int nread;
 
   SetUpFmtConv(44100, 32000, kBufferFrames * 2);
-  nread = dev_stream_capture(&devstr, area, 0, software_gain_scaler);
+  nread = dev_stream_capture(&devstr, area, 0, software_gain_scaler, NULL);
 
   // Available frames at stream side is bound by cb_threshold, which
   // equals to kBufferFrames / 2.
@@ -326,6 +340,163 @@ TEST_F(CreateSuite, CaptureSRCLargeConverterBuffer) {
   byte_buffer_destroy(&devstr.conv_buffer);
 }
 
+TEST_F(CreateSuite, CaptureSRCSharedConversion) {
+  struct dev_stream_capture_cache cache;
+  struct dev_stream other;
+  unsigned int bytes;
+  int nread, other_read;
+
+  SetUpFmtConv(44100, 32000, kBufferFrames * 2);
+  devstr.dev_id = 1;
+  rstream_.master_dev.dev_id = 1;
+  cras_fmt_conv_same_chain_val = 1;
+  cache.num_groups = 0;
+
+  nread = dev_stream_capture(&devstr, area, 0, 10, &cache);
+  EXPECT_EQ(1, conv_frames_called);
+  ASSERT_EQ(1, cache.num_groups);
+  EXPECT_EQ(&devstr, cache.groups[0].leader);
+  bytes = cache.groups[0].bytes;
+  EXPECT_EQ(cras_frames_at_rate(in_fmt.frame_rate, nread, out_fmt.frame_rate),
+            bytes / 4);
+  memset(devstr.conv_buffer->bytes, 0x5a, bytes);
+
+  // A second stream of the same chain copies the converted samples and only
+  // applies its own gain.
+  memset(&other, 0, sizeof(other));
+  other.stream = &rstream_;
+  other.dev_id = 1;
+  other.conv = (struct cras_fmt_conv*)0xbeef;
+  other.conv_buffer = byte_buffer_create(kBufferFrames * 2 * 4);
+  other.conv_area = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + 2 * sizeof(*area->channels));
+  other_read = dev_stream_capture(&other, area, 0, 0.5, &cache);
+  EXPECT_EQ(nread, other_read);
+  EXPECT_EQ(1, conv_frames_called);
+  EXPECT_EQ(1, cache.num_groups);
+  EXPECT_EQ(&devstr, other.capture_leader);
+  EXPECT_EQ(&other, devstr.capture_followers);
+  EXPECT_EQ(0, memcmp(devstr.conv_buffer->bytes, other.conv_buffer->bytes,
+                      bytes));
+  EXPECT_EQ(other.conv_area, copy_area_call.src);
+  EXPECT_EQ(0.5, copy_area_call.software_gain_scaler);
+
+  // A stream that follows the rate of another master converts on its own,
+  // from a reset converter.
+  rstream_.master_dev.dev_id = 2;
+  dev_stream_capture(&other, area, 0, 0.5, &cache);
+  EXPECT_EQ(2, conv_frames_called);
+  EXPECT_EQ(1, cache.num_groups);
+  EXPECT_EQ(1, cras_fmt_conv_reset_called);
+  EXPECT_EQ(NULL, other.capture_leader);
+  EXPECT_EQ(NULL, devstr.capture_followers);
+
+  free(other.conv_area);
+  byte_buffer_destroy(&other.conv_buffer);
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, CaptureSRCSharedConversionKeepsGroup) {
+  struct dev_stream_capture_cache cache;
+  struct dev_stream other;
+  unsigned int avail;
+  unsigned int i;
+
+  SetUpFmtConv(44100, 32000, kBufferFrames * 2);
+  devstr.dev_id = 1;
+  rstream_.master_dev.dev_id = 1;
+  cras_fmt_conv_same_chain_val = 1;
+
+  memset(&other, 0, sizeof(other));
+  other.stream = &rstream_;
+  other.dev_id = 1;
+  other.conv = (struct cras_fmt_conv*)0xbeef;
+  other.conv_buffer = byte_buffer_create(kBufferFrames * 2 * 4);
+  other.conv_area = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + 2 * sizeof(*area->channels));
+
+  // Only the leader's converter runs, read after read, and the follower
+  // stays in the group.
+  area->frames = 20;
+  for (i = 1; i <= 4; i++) {
+    cache.num_groups = 0;
+    dev_stream_capture(&devstr, area, 0, 1, &cache);
+    dev_stream_capture(&other, area, 0, 1, &cache);
+    EXPECT_EQ(i, conv_frames_called);
+    EXPECT_EQ((struct cras_fmt_conv*)0xdead, conv_frames_call.conv);
+    EXPECT_EQ(&devstr, other.capture_leader);
+    EXPECT_EQ(0, cras_fmt_conv_reset_called);
+  }
+
+  // The group only reads what the fullest conv_buffer can take.
+  devstr.capture_followers = NULL;
+  avail = dev_stream_capture_avail(&devstr);
+  devstr.capture_followers = &other;
+  buf_increment_write(other.conv_buffer, 100 * 4);
+  EXPECT_GT(avail, dev_stream_capture_avail(&devstr));
+  EXPECT_EQ(dev_stream_capture_avail(&other),
+            dev_stream_capture_avail(&devstr));
+
+  // A stream that starts capturing on its own doesn't join later.
+  cache.num_groups = 0;
+  devstr.capture_followers = NULL;
+  other.capture_leader = NULL;
+  dev_stream_capture(&devstr, area, 0, 1, &cache);
+  dev_stream_capture(&other, area, 0, 1, &cache);
+  EXPECT_EQ(NULL, other.capture_leader);
+  EXPECT_EQ(6, conv_frames_called);
+
+  free(other.conv_area);
+  byte_buffer_destroy(&other.conv_buffer);
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, CaptureSRCSharedConversionPromote) {
+  struct dev_stream_capture_cache cache;
+  struct cras_audio_area* conv_area;
+  struct dev_stream* leader;
+  struct dev_stream other;
+
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.master_dev.dev_id = 1;
+  cras_fmt_conv_same_chain_val = 1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 32000;
+  config_format_converter_conv = (struct cras_fmt_conv*)0xdead;
+  cras_fmt_conversion_needed_val = 1;
+  leader = dev_stream_create(&rstream_, 1, &fmt_s16le_44_1, (void*)0x55,
+                             &cb_ts);
+  ASSERT_NE((void*)NULL, leader);
+  leader->conv_area = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + 2 * sizeof(*area->channels));
+  conv_area = leader->conv_area;
+
+  memset(&other, 0, sizeof(other));
+  other.stream = &rstream_;
+  other.dev_id = 1;
+  other.conv = (struct cras_fmt_conv*)0xbeef;
+  other.conv_buffer = byte_buffer_create(kBufferFrames * 2 * 4);
+  other.conv_area = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + 2 * sizeof(*area->channels));
+
+  cache.num_groups = 0;
+  dev_stream_capture(leader, area, 0, 1, &cache);
+  dev_stream_capture(&other, area, 0, 1, &cache);
+  EXPECT_EQ(leader, other.capture_leader);
+
+  // The follower takes over the converter that kept running.
+  dev_stream_destroy(leader);
+  EXPECT_EQ(NULL, other.capture_leader);
+  EXPECT_EQ((struct cras_fmt_conv*)0xdead, other.conv);
+  EXPECT_EQ(0, cras_fmt_conv_reset_called);
+
+  free(conv_area);
+  free(other.conv_area);
+  byte_buffer_destroy(&other.conv_buffer);
+}
+
 TEST_F(CreateSuite, CreateSRC44to48) {
   struct dev_stream* dev_stream;
 
@@ -1178,6 +1349,8 @@ void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr){};
 
 int config_format_converter(struct cras_fmt_conv** conv,
                             enum CRAS_STREAM_DIRECTION dir,
+                            enum CRAS_STREAM_TYPE stream_type,
+                            enum CRAS_RESAMPLER_BACKEND backend,
                             const struct cras_audio_format* from,
                             const struct cras_audio_format* to,
                             unsigned int frames) {
@@ -1188,14 +1361,19 @@ int config_format_converter(struct cras_fmt_conv** conv,
   return 0;
 }
 
-void cras_fmt_conv_destroy(struct cras_fmt_conv* conv) {}
+void cras_fmt_conv_destroy(struct cras_fmt_conv** conv) {}
+
+void cras_fmt_conv_pool_put(struct cras_fmt_conv** conv) {
+  *conv = NULL;
+}
 
 size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv* conv,
-                                    uint8_t* in_buf,
+                                    const uint8_t* in_buf,
                                     uint8_t* out_buf,
                                     unsigned int* in_frames,
-                                    unsigned int out_frames) {
+                                    size_t out_frames) {
   unsigned int ret;
+  conv_frames_called++;
   conv_frames_call.conv = conv;
   conv_frames_call.in_buf = in_buf;
   conv_frames_call.out_buf = out_buf;
@@ -1279,6 +1457,15 @@ int cras_fmt_conversion_needed(const struct cras_fmt_conv* conv) {
   return cras_fmt_conversion_needed_val;
 }
 
+int cras_fmt_conv_same_chain(const struct cras_fmt_conv* a,
+                             const struct cras_fmt_conv* b) {
+  return cras_fmt_conv_same_chain_val;
+}
+
+void cras_fmt_conv_reset(struct cras_fmt_conv* conv) {
+  cras_fmt_conv_reset_called++;
+}
+
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv* conv,
                                              float from,
                                              float to) {
@@ -1301,6 +1488,10 @@ int cras_server_metrics_missed_cb_event(const struct cras_rstream* stream) {
   return 0;
 }
 
+bool cras_system_get_polyphase_resampler_enabled() {
+  return false;
+}
+
 //  From librt.
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   tp->tv_sec = clock_gettime_retspec.tv_sec;
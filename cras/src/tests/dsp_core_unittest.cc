@@ -8,6 +8,7 @@
 #include "crossover.h"
 #include "crossover2.h"
 #include "drc.h"
+#include "dsp_ops.h"
 #include "dsp_util.h"
 #include "eq.h"
 #include "eq2.h"
@@ -425,6 +426,172 @@ TEST(DrcTest, All) {
   free(data_right);
 }
 
+/* Compares the DSP kernels of each instruction set against the C ones. */
+class DspOpsTest : public testing::Test {
+ protected:
+  static const int kFrames = 1021;
+
+  virtual void SetUp() {
+    unsigned int seed = 1;
+
+    for (int i = 0; i < kFrames; i++) {
+      input_[0][i] = (float)rand_r(&seed) / RAND_MAX * 2 - 1;
+      input_[1][i] = (float)rand_r(&seed) / RAND_MAX * 2 - 1;
+    }
+  }
+
+  static void ExpectNear(const float* expected,
+                         const float* actual,
+                         int count,
+                         float tolerance,
+                         const char* what) {
+    for (int i = 0; i < count; i++)
+      ASSERT_NEAR(expected[i], actual[i], tolerance) << what << " " << i;
+  }
+
+  void CompareEq2(const struct dsp_ops* ops) {
+    struct biquad expected_bq[MAX_BIQUADS_PER_EQ2][2];
+    struct biquad actual_bq[MAX_BIQUADS_PER_EQ2][2];
+    float expected[2][kFrames], actual[2][kFrames];
+    int n, i, j;
+
+    /* Every grouping of the biquads, and blocks shorter than the
+     * pipeline of the wide kernels. */
+    for (n = 1; n <= MAX_BIQUADS_PER_EQ2; n++) {
+      for (i = 0; i < n; i++)
+        for (j = 0; j < 2; j++)
+          biquad_set(&expected_bq[i][j], BQ_PEAKING,
+                     0.01 + 0.05 * i + 0.02 * j, 2, 6);
+      memcpy(actual_bq, expected_bq, sizeof(expected_bq));
+      memcpy(expected, input_, sizeof(expected));
+      memcpy(actual, input_, sizeof(actual));
+
+      dsp_kernels.eq2_process(expected_bq, n, expected[0], expected[1], 2);
+      ops->eq2_process(actual_bq, n, actual[0], actual[1], 2);
+      dsp_kernels.eq2_process(expected_bq, n, expected[0] + 2,
+                              expected[1] + 2, kFrames - 2);
+      ops->eq2_process(actual_bq, n, actual[0] + 2, actual[1] + 2,
+                       kFrames - 2);
+      ExpectNear(expected[0], actual[0], kFrames, 1e-4, "eq2 left");
+      ExpectNear(expected[1], actual[1], kFrames, 1e-4, "eq2 right");
+    }
+  }
+
+  void CompareCrossover2(const struct dsp_ops* ops) {
+    struct crossover2 expected_xo2, actual_xo2;
+    float expected[4][kFrames], actual[4][kFrames];
+
+    crossover2_init(&expected_xo2, 0.1, 0.5);
+    actual_xo2 = expected_xo2;
+    memcpy(expected, input_, sizeof(input_));
+    memcpy(actual, input_, sizeof(input_));
+
+    dsp_kernels.lr42_split(&expected_xo2.lp[0], &expected_xo2.hp[0], kFrames,
+                           expected[0], expected[1], expected[2],
+                           expected[3]);
+    ops->lr42_split(&actual_xo2.lp[0], &actual_xo2.hp[0], kFrames, actual[0],
+                    actual[1], actual[2], actual[3]);
+    dsp_kernels.lr42_merge(&expected_xo2.lp[1], &expected_xo2.hp[1], kFrames,
+                           expected[0], expected[1]);
+    ops->lr42_merge(&actual_xo2.lp[1], &actual_xo2.hp[1], kFrames, actual[0],
+                    actual[1]);
+    for (int i = 0; i < 4; i++)
+      ExpectNear(expected[i], actual[i], kFrames, 1e-4, "crossover2");
+  }
+
+  void CompareDrc(const struct dsp_ops* ops) {
+    float expected[2][DIVISION_FRAMES], actual[2][DIVISION_FRAMES];
+    struct drc_kernel expected_dk, actual_dk;
+    /* Attack and release. */
+    const float rates[] = {0.9, 1.001};
+
+    ops->max_abs_division(actual[0], input_[0], input_[1]);
+    for (int i = 0; i < DIVISION_FRAMES; i++)
+      ASSERT_EQ(std::max(fabsf(input_[0][i]), fabsf(input_[1][i])),
+                actual[0][i]);
+
+    for (float rate : rates) {
+      memset(&expected_dk, 0, sizeof(expected_dk));
+      expected_dk.master_linear_gain = 2;
+      expected_dk.envelope_rate = rate;
+      expected_dk.scaled_desired_gain = 0.25;
+      expected_dk.compressor_gain = 0.9;
+      actual_dk = expected_dk;
+      memcpy(expected[0], input_[0], sizeof(expected[0]));
+      memcpy(expected[1], input_[1], sizeof(expected[1]));
+      memcpy(actual, expected, sizeof(actual));
+      expected_dk.pre_delay_buffers[0] = expected[0];
+      expected_dk.pre_delay_buffers[1] = expected[1];
+      actual_dk.pre_delay_buffers[0] = actual[0];
+      actual_dk.pre_delay_buffers[1] = actual[1];
+
+      dsp_kernels.dk_compress_output(&expected_dk);
+      ops->dk_compress_output(&actual_dk);
+      ExpectNear(expected[0], actual[0], DIVISION_FRAMES, 1e-5, "drc left");
+      ExpectNear(expected[1], actual[1], DIVISION_FRAMES, 1e-5, "drc right");
+      EXPECT_NEAR(expected_dk.compressor_gain, actual_dk.compressor_gain,
+                  1e-5);
+    }
+  }
+
+  void CompareInterleave(const struct dsp_ops* ops) {
+    int16_t samples[kFrames * 2], expected[kFrames * 2];
+    float planes[2][kFrames];
+    unsigned int seed = 2;
+    int i;
+
+    for (i = 0; i < kFrames * 2; i++)
+      samples[i] = rand_r(&seed);
+
+    if (ops->deinterleave_stereo) {
+      ops->deinterleave_stereo(samples, planes[0], planes[1], kFrames);
+      for (i = 0; i < kFrames; i++) {
+        ASSERT_EQ(samples[2 * i] / 32768.0f, planes[0][i]);
+        ASSERT_EQ(samples[2 * i + 1] / 32768.0f, planes[1][i]);
+      }
+    }
+
+    if (ops->interleave_stereo) {
+      /* Half way between two values rounds either way. */
+      for (i = 0; i < kFrames * 2; i++)
+        expected[i] = lrintf(input_[i % 2][i / 2] * 32768.0f);
+      ops->interleave_stereo(input_[0], input_[1], samples, kFrames);
+      for (i = 0; i < kFrames * 2; i++)
+        ASSERT_NEAR(expected[i], samples[i], 1) << i;
+    }
+  }
+
+  void CompareOps(const struct dsp_ops* ops) {
+    CompareEq2(ops);
+    CompareCrossover2(ops);
+    CompareDrc(ops);
+    CompareInterleave(ops);
+  }
+
+  float input_[2][kFrames];
+};
+
+TEST_F(DspOpsTest, MatchCImplementation) {
+  dsp_enable_flush_denormal_to_zero();
+  CompareOps(&dsp_kernels);
+#if defined HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    CompareOps(&dsp_kernels_sse42);
+#endif
+#if defined HAVE_AVX
+  if (__builtin_cpu_supports("avx"))
+    CompareOps(&dsp_kernels_avx);
+#endif
+#if defined HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    CompareOps(&dsp_kernels_avx2);
+#endif
+#if defined HAVE_FMA
+  if (__builtin_cpu_supports("fma"))
+    CompareOps(&dsp_kernels_fma);
+#endif
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -676,6 +676,130 @@ TEST(FormatConverterOpsTest, ConvertChannelsS16LE) {
   }
 }
 
+// Test S32_LE to float and back, precision is limited by the float mantissa.
+TEST(FormatConverterOpsTest, ConvertS32LEToFloatAndBack) {
+  const size_t frames = 4096;
+  const size_t ch = 2;
+
+  S32LEPtr src = CreateS32LE(frames * ch);
+  FloatPtr tmp = CreateFloat(frames * ch);
+  S32LEPtr dst = CreateS32LE(frames * ch);
+
+  convert_s32le_to_f32((uint8_t*)src.get(), frames * ch, (uint8_t*)tmp.get());
+  convert_f32_to_s32le((uint8_t*)tmp.get(), frames * ch, (uint8_t*)dst.get());
+
+  for (size_t i = 0; i < frames * ch; ++i) {
+    EXPECT_LE(-1.0f, tmp[i]);
+    EXPECT_GT(1.0f, tmp[i]);
+    EXPECT_NEAR(src[i], dst[i], 128);
+  }
+}
+
+// Test S16_LE to float and back, which is lossless.
+TEST(FormatConverterOpsTest, ConvertS16LEToFloatAndBack) {
+  const size_t frames = 4096;
+  const size_t ch = 2;
+
+  S16LEPtr src = CreateS16LE(frames * ch);
+  FloatPtr tmp = CreateFloat(frames * ch);
+  S16LEPtr dst = CreateS16LE(frames * ch);
+
+  convert_s16le_to_f32((uint8_t*)src.get(), frames * ch, (uint8_t*)tmp.get());
+  convert_f32_to_s16le((uint8_t*)tmp.get(), frames * ch, (uint8_t*)dst.get());
+
+  for (size_t i = 0; i < frames * ch; ++i)
+    EXPECT_EQ(src[i], dst[i]);
+}
+
+// Test S24_LE and S24_3LE to float and back, which is lossless.
+TEST(FormatConverterOpsTest, ConvertS24ToFloatAndBack) {
+  const size_t frames = 4096;
+  const size_t ch = 2;
+
+  S24LEPtr src = CreateS24LE(frames * ch);
+  FloatPtr tmp = CreateFloat(frames * ch);
+  S243LEPtr packed = CreateS243LE(frames * ch);
+  S24LEPtr dst = CreateS24LE(frames * ch);
+
+  convert_s24le_to_f32((uint8_t*)src.get(), frames * ch, (uint8_t*)tmp.get());
+  convert_f32_to_s243le((uint8_t*)tmp.get(), frames * ch, packed.get());
+  convert_s243le_to_f32(packed.get(), frames * ch, (uint8_t*)tmp.get());
+  convert_f32_to_s24le((uint8_t*)tmp.get(), frames * ch, (uint8_t*)dst.get());
+
+  for (size_t i = 0; i < frames * ch; ++i) {
+    int32_t exp = (int32_t)((uint32_t)src[i] << 8) >> 8;
+    EXPECT_EQ(exp, dst[i]);
+  }
+}
+
+// Test float to integer clipping.
+TEST(FormatConverterOpsTest, ConvertFloatClip) {
+  float src[4] = {2.0f, -2.0f, 1.0f, -1.0f};
+  int32_t dst[4];
+  int16_t dst16[4];
+  uint8_t dst_u8[4];
+
+  convert_f32_to_s32le((uint8_t*)src, 4, (uint8_t*)dst);
+  EXPECT_EQ(INT_MAX, dst[0]);
+  EXPECT_EQ(INT_MIN, dst[1]);
+  EXPECT_EQ(INT_MAX, dst[2]);
+  EXPECT_EQ(INT_MIN, dst[3]);
+
+  convert_f32_to_s24le((uint8_t*)src, 4, (uint8_t*)dst);
+  EXPECT_EQ(0x7fffff, dst[0]);
+  EXPECT_EQ(-0x800000, dst[1]);
+
+  convert_f32_to_s16le((uint8_t*)src, 4, (uint8_t*)dst16);
+  EXPECT_EQ(INT16_MAX, dst16[0]);
+  EXPECT_EQ(INT16_MIN, dst16[1]);
+
+  convert_f32_to_u8((uint8_t*)src, 4, dst_u8);
+  EXPECT_EQ(0xff, dst_u8[0]);
+  EXPECT_EQ(0, dst_u8[1]);
+}
+
+// Test Stereo to Mono conversion.  Float, no clipping.
+TEST(FormatConverterOpsTest, StereoToMonoFloat) {
+  const size_t frames = 4096;
+  const size_t in_ch = 2;
+  const size_t out_ch = 1;
+
+  FloatPtr src = CreateFloat(frames * in_ch);
+  FloatPtr dst = CreateFloat(frames * out_ch);
+
+  size_t ret =
+      f32_stereo_to_mono((uint8_t*)src.get(), frames, (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  for (size_t i = 0; i < frames; ++i)
+    EXPECT_FLOAT_EQ(src[i * 2] + src[i * 2 + 1], dst[i]);
+}
+
+// Test channel conversion with a coefficient matrix.  Float.
+TEST(FormatConverterOpsTest, ConvertChannelsFloat) {
+  const size_t frames = 4096;
+  const size_t in_ch = 3;
+  const size_t out_ch = 2;
+  float coef[out_ch][in_ch] = {{0.5f, 0.0f, 0.25f}, {0.0f, 1.5f, 0.25f}};
+  float* mtx[out_ch] = {coef[0], coef[1]};
+
+  FloatPtr src = CreateFloat(frames * in_ch);
+  FloatPtr dst = CreateFloat(frames * out_ch);
+
+  size_t ret = f32_convert_channels(mtx, in_ch, out_ch, (uint8_t*)src.get(),
+                                    frames, (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  for (size_t fr = 0; fr < frames; ++fr) {
+    for (size_t i = 0; i < out_ch; ++i) {
+      float exp = 0;
+      for (size_t k = 0; k < in_ch; ++k)
+        exp += coef[i][k] * src[fr * in_ch + k];
+      EXPECT_FLOAT_EQ(exp, dst[fr * out_ch + i]);
+    }
+  }
+}
+
 extern "C" {}  // extern "C"
 
 int main(int argc, char** argv) {
@@ -0,0 +1,255 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+#include "cras_audio_format.h"
+#include "cras_fmt_conv.h"
+#include "cras_fmt_conv_pool.h"
+}
+
+namespace {
+
+static const size_t kMaxFrames = 1024;
+static unsigned int hit_rate_reports;
+static unsigned int hit_rate_value;
+
+class FmtConvPoolTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    cras_fmt_conv_pool_drain();
+    cras_fmt_conv_pool_reset_stats();
+    hit_rate_reports = 0;
+    SetFormat(&in_fmt_, SND_PCM_FORMAT_S16_LE, 44100, 2);
+    SetFormat(&out_fmt_, SND_PCM_FORMAT_S16_LE, 48000, 2);
+  }
+
+  virtual void TearDown() { cras_fmt_conv_pool_drain(); }
+
+  static void SetFormat(struct cras_audio_format* fmt,
+                        snd_pcm_format_t format,
+                        size_t rate,
+                        size_t num_channels) {
+    unsigned int i;
+
+    fmt->format = format;
+    fmt->frame_rate = rate;
+    fmt->num_channels = num_channels;
+    for (i = 0; i < CRAS_CH_MAX; i++)
+      fmt->channel_layout[i] = i < num_channels ? i : -1;
+  }
+
+  struct cras_fmt_conv* Get(size_t max_frames,
+                            enum CRAS_RESAMPLER_BACKEND backend) {
+    return cras_fmt_conv_pool_get(&in_fmt_, &out_fmt_, max_frames, 0, backend,
+                                  CRAS_RESAMPLER_QUALITY_MEDIUM);
+  }
+
+  struct cras_audio_format in_fmt_;
+  struct cras_audio_format out_fmt_;
+};
+
+TEST_F(FmtConvPoolTestSuite, ReuseReturnedConverter) {
+  struct cras_fmt_conv_pool_stats stats;
+  struct cras_fmt_conv *conv, *first;
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  ASSERT_NE((void*)NULL, conv);
+  first = conv;
+  cras_fmt_conv_pool_put(&conv);
+  EXPECT_EQ((void*)NULL, conv);
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  EXPECT_EQ(first, conv);
+
+  cras_fmt_conv_pool_get_stats(&stats);
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_EQ(0, stats.evictions);
+  cras_fmt_conv_destroy(&conv);
+}
+
+TEST_F(FmtConvPoolTestSuite, KeyedByFormatAndLayout) {
+  struct cras_fmt_conv_pool_stats stats;
+  struct cras_fmt_conv *conv, *other;
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  ASSERT_NE((void*)NULL, conv);
+  cras_fmt_conv_pool_put(&conv);
+
+  // Same channel count, swapped layout.
+  out_fmt_.channel_layout[CRAS_CH_FL] = 1;
+  out_fmt_.channel_layout[CRAS_CH_FR] = 0;
+  other = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  ASSERT_NE((void*)NULL, other);
+  cras_fmt_conv_destroy(&other);
+  SetFormat(&out_fmt_, SND_PCM_FORMAT_S16_LE, 48000, 2);
+
+  SetFormat(&in_fmt_, SND_PCM_FORMAT_S32_LE, 44100, 2);
+  other = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  ASSERT_NE((void*)NULL, other);
+  cras_fmt_conv_destroy(&other);
+  SetFormat(&in_fmt_, SND_PCM_FORMAT_S16_LE, 44100, 2);
+
+  other = Get(kMaxFrames, CRAS_RESAMPLER_POLYPHASE);
+  ASSERT_NE((void*)NULL, other);
+  cras_fmt_conv_destroy(&other);
+
+  cras_fmt_conv_pool_get_stats(&stats);
+  EXPECT_EQ(0, stats.hits);
+  EXPECT_EQ(4, stats.misses);
+}
+
+TEST_F(FmtConvPoolTestSuite, LargerConverterMatches) {
+  struct cras_fmt_conv *conv, *first;
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  ASSERT_NE((void*)NULL, conv);
+  first = conv;
+  cras_fmt_conv_pool_put(&conv);
+
+  conv = Get(kMaxFrames * 2, CRAS_RESAMPLER_SPEEX);
+  EXPECT_NE(first, conv);
+  cras_fmt_conv_destroy(&conv);
+
+  conv = Get(kMaxFrames / 2, CRAS_RESAMPLER_SPEEX);
+  EXPECT_EQ(first, conv);
+  cras_fmt_conv_destroy(&conv);
+}
+
+TEST_F(FmtConvPoolTestSuite, EvictLeastRecentlyReturned) {
+  struct cras_fmt_conv_pool_stats stats;
+  struct cras_fmt_conv* convs[CRAS_FMT_CONV_POOL_SIZE + 1];
+  struct cras_fmt_conv* conv;
+  unsigned int i;
+
+  for (i = 0; i <= CRAS_FMT_CONV_POOL_SIZE; i++) {
+    in_fmt_.frame_rate = 8000 + i;
+    convs[i] = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+    ASSERT_NE((void*)NULL, convs[i]);
+  }
+  for (i = 0; i <= CRAS_FMT_CONV_POOL_SIZE; i++)
+    cras_fmt_conv_pool_put(&convs[i]);
+
+  cras_fmt_conv_pool_get_stats(&stats);
+  EXPECT_EQ(1, stats.evictions);
+
+  in_fmt_.frame_rate = 8000;
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  cras_fmt_conv_destroy(&conv);
+  in_fmt_.frame_rate = 8000 + CRAS_FMT_CONV_POOL_SIZE;
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  cras_fmt_conv_destroy(&conv);
+
+  cras_fmt_conv_pool_get_stats(&stats);
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(CRAS_FMT_CONV_POOL_SIZE + 2, stats.misses);
+}
+
+// A converter from the pool produces the same output as a new one.
+TEST_F(FmtConvPoolTestSuite, ResetPolyphaseState) {
+  struct cras_fmt_conv *fresh, *conv;
+  int16_t in_buf[kMaxFrames * 2];
+  int16_t fresh_out[kMaxFrames * 2];
+  int16_t pooled_out[kMaxFrames * 2];
+  unsigned int in_frames;
+  size_t fresh_frames, pooled_frames;
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * 2; i++)
+    in_buf[i] = (i * 577) % 20000 - 10000;
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_POLYPHASE);
+  ASSERT_NE((void*)NULL, conv);
+  cras_fmt_conv_set_linear_resample_rates(conv, 48000, 48010);
+  in_frames = 256;
+  cras_fmt_conv_convert_frames(conv, (uint8_t*)in_buf, (uint8_t*)pooled_out,
+                               &in_frames, kMaxFrames);
+  cras_fmt_conv_pool_put(&conv);
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_POLYPHASE);
+  fresh = cras_fmt_conv_create_resampler(&in_fmt_, &out_fmt_, kMaxFrames, 0,
+                                         CRAS_RESAMPLER_POLYPHASE,
+                                         CRAS_RESAMPLER_QUALITY_MEDIUM);
+  ASSERT_NE((void*)NULL, fresh);
+
+  in_frames = 512;
+  fresh_frames =
+      cras_fmt_conv_convert_frames(fresh, (uint8_t*)in_buf,
+                                   (uint8_t*)fresh_out, &in_frames, kMaxFrames);
+  in_frames = 512;
+  pooled_frames = cras_fmt_conv_convert_frames(
+      conv, (uint8_t*)in_buf, (uint8_t*)pooled_out, &in_frames, kMaxFrames);
+  ASSERT_EQ(fresh_frames, pooled_frames);
+  EXPECT_EQ(0, memcmp(fresh_out, pooled_out, fresh_frames * 4));
+
+  cras_fmt_conv_destroy(&fresh);
+  cras_fmt_conv_destroy(&conv);
+}
+
+TEST_F(FmtConvPoolTestSuite, ConfigFormatConverterUsesPool) {
+  struct cras_fmt_conv_pool_stats stats;
+  struct cras_fmt_conv *conv, *first;
+
+  ASSERT_EQ(0, config_format_converter(&conv, CRAS_STREAM_OUTPUT,
+                                       CRAS_STREAM_TYPE_DEFAULT,
+                                       CRAS_RESAMPLER_SPEEX, &in_fmt_,
+                                       &out_fmt_, kMaxFrames));
+  first = conv;
+  cras_fmt_conv_pool_put(&conv);
+  ASSERT_EQ(0, config_format_converter(&conv, CRAS_STREAM_OUTPUT,
+                                       CRAS_STREAM_TYPE_DEFAULT,
+                                       CRAS_RESAMPLER_SPEEX, &in_fmt_,
+                                       &out_fmt_, kMaxFrames));
+  EXPECT_EQ(first, conv);
+
+  // Voice streams get a lower resampler quality tier.
+  cras_fmt_conv_pool_put(&conv);
+  ASSERT_EQ(0, config_format_converter(&conv, CRAS_STREAM_OUTPUT,
+                                       CRAS_STREAM_TYPE_VOICE_COMMUNICATION,
+                                       CRAS_RESAMPLER_SPEEX, &in_fmt_,
+                                       &out_fmt_, kMaxFrames));
+  EXPECT_NE(first, conv);
+  cras_fmt_conv_destroy(&conv);
+
+  cras_fmt_conv_pool_get_stats(&stats);
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+}
+
+TEST_F(FmtConvPoolTestSuite, ReportHitRate) {
+  struct cras_fmt_conv* conv;
+  unsigned int i;
+
+  // One miss to fill the pool, then hits only.
+  for (i = 0; i < 99; i++) {
+    conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+    ASSERT_NE((void*)NULL, conv);
+    cras_fmt_conv_pool_put(&conv);
+  }
+  EXPECT_EQ(0, hit_rate_reports);
+
+  conv = Get(kMaxFrames, CRAS_RESAMPLER_SPEEX);
+  cras_fmt_conv_pool_put(&conv);
+  EXPECT_EQ(1, hit_rate_reports);
+  EXPECT_EQ(99, hit_rate_value);
+}
+
+}  // namespace
+
+extern "C" {
+int cras_server_metrics_fmt_conv_pool_hit_rate(unsigned percent) {
+  hit_rate_reports++;
+  hit_rate_value = percent;
+  return 0;
+}
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
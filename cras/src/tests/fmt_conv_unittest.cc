@@ -3,7 +3,9 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <math.h>
 #include <sys/param.h>
+#include <time.h>
 
 extern "C" {
 #include "cras_fmt_conv.h"
@@ -702,6 +704,45 @@ TEST(FormatConverterTest, ConvertS32LEToS16LE) {
   free(out_buff);
 }
 
+// Test S24_LE mono to S32_LE stereo runs without an S16 intermediate.
+TEST(FormatConverterTest, ConvertS24LEToS32LEMonoToStereo) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int32_t* in_buff;
+  int32_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S24_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    int32_t exp = (int32_t)((uint32_t)in_buff[i] << 8);
+    EXPECT_EQ(exp, out_buff[i * 2]);
+    EXPECT_EQ(exp, out_buff[i * 2 + 1]);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 24 to 16 bit conversion.
 TEST(FormatConverterTest, ConvertS24LEToS16LE) {
   struct cras_fmt_conv* c;
@@ -1520,7 +1561,8 @@ TEST(FormatConverterTest, ConfigConverter) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, CRAS_STREAM_TYPE_DEFAULT,
+                          CRAS_RESAMPLER_SPEEX, &in_fmt, &out_fmt, 4096);
   ASSERT_NE(c, (void*)NULL);
 
   cras_fmt_conv_destroy(&c);
@@ -1546,7 +1588,8 @@ TEST(FormatConverterTest, ConfigConverterNoNeed) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, CRAS_STREAM_TYPE_DEFAULT,
+                          CRAS_RESAMPLER_SPEEX, &in_fmt, &out_fmt, 4096);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
   cras_fmt_conv_destroy(&c);
@@ -1574,12 +1617,297 @@ TEST(FormatConverterTest, ConfigConverterNoNeedForInput) {
     out_fmt.channel_layout[i] = kmic_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_INPUT, CRAS_STREAM_TYPE_DEFAULT,
+                          CRAS_RESAMPLER_SPEEX, &in_fmt, &out_fmt, 4096);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
   cras_fmt_conv_destroy(&c);
 }
 
+// Returns the THD+N in dB of channel |ch| of interleaved S16_LE |samples|,
+// compared to the sine of |freq| cycles per frame that fits them best.
+static double ThdNS16(const int16_t* samples,
+                      size_t frames,
+                      size_t num_channels,
+                      size_t ch,
+                      double freq) {
+  double ss = 0, sc = 0, cc = 0, xs = 0, xc = 0;
+  double a, b, det, x, fit, err = 0, sig = 0;
+  size_t i;
+
+  for (i = 0; i < frames; i++) {
+    double s = sin(2 * M_PI * freq * i);
+    double c = cos(2 * M_PI * freq * i);
+    x = samples[i * num_channels + ch];
+    ss += s * s;
+    sc += s * c;
+    cc += c * c;
+    xs += x * s;
+    xc += x * c;
+  }
+  det = ss * cc - sc * sc;
+  a = (xs * cc - xc * sc) / det;
+  b = (xc * ss - xs * sc) / det;
+  for (i = 0; i < frames; i++) {
+    x = samples[i * num_channels + ch];
+    fit = a * sin(2 * M_PI * freq * i) + b * cos(2 * M_PI * freq * i);
+    err += (x - fit) * (x - fit);
+    sig += fit * fit;
+  }
+  return 10 * log10(err / sig);
+}
+
+// Resamples a 997 Hz stereo sine with the polyphase backend and returns the
+// THD+N of the output. Fills |out_total| with the number of frames produced.
+static double PolyphaseSineThdN(size_t in_rate,
+                                size_t out_rate,
+                                enum CRAS_RESAMPLER_QUALITY quality,
+                                float drift,
+                                size_t* out_total) {
+  const size_t kBlockFrames = 480;
+  const size_t kNumBlocks = 100;
+  const size_t kSkipFrames = 2048;
+  const double kFreq = 997.0;
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  int16_t* in_buf;
+  int16_t* out_buf;
+  size_t in_pos = 0, out_pos = 0, out_size, i;
+  unsigned int in_frames;
+  double thdn;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = in_rate;
+  out_fmt.frame_rate = out_rate;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create_resampler(&in_fmt, &out_fmt, kBlockFrames * 4, 0,
+                                     CRAS_RESAMPLER_POLYPHASE, quality);
+  EXPECT_NE(c, (void*)NULL);
+  if (drift != 1.0f)
+    cras_fmt_conv_set_linear_resample_rates(c, out_rate, out_rate * drift);
+
+  in_buf = (int16_t*)malloc(kBlockFrames * kNumBlocks * 4);
+  out_size = kBlockFrames * kNumBlocks * out_rate / in_rate * 2;
+  out_buf = (int16_t*)malloc(out_size * 4);
+  for (i = 0; i < kBlockFrames * kNumBlocks; i++) {
+    in_buf[i * 2] = 16384 * sin(2 * M_PI * kFreq * i / in_rate);
+    in_buf[i * 2 + 1] = in_buf[i * 2];
+  }
+
+  while (in_pos < kBlockFrames * kNumBlocks) {
+    in_frames = MIN(kBlockFrames, kBlockFrames * kNumBlocks - in_pos);
+    out_pos += cras_fmt_conv_convert_frames(
+        c, (uint8_t*)(in_buf + in_pos * 2), (uint8_t*)(out_buf + out_pos * 2),
+        &in_frames, MIN(kBlockFrames * 4, out_size - out_pos));
+    in_pos += in_frames;
+  }
+
+  thdn = ThdNS16(out_buf + kSkipFrames * 2, out_pos - kSkipFrames, 2, 0,
+                 kFreq / (out_rate * drift));
+  *out_total = out_pos;
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buf);
+  free(out_buf);
+  return thdn;
+}
+
+TEST(FormatConverterTest, PolyphaseThdN) {
+  size_t out_total;
+
+  EXPECT_GT(-60, PolyphaseSineThdN(44100, 48000, CRAS_RESAMPLER_QUALITY_LOW,
+                                   1.0f, &out_total));
+  EXPECT_GT(-80, PolyphaseSineThdN(44100, 48000,
+                                   CRAS_RESAMPLER_QUALITY_MEDIUM, 1.0f,
+                                   &out_total));
+  EXPECT_GT(-85, PolyphaseSineThdN(48000, 16000, CRAS_RESAMPLER_QUALITY_HIGH,
+                                   1.0f, &out_total));
+  EXPECT_GT(-85, PolyphaseSineThdN(16000, 48000, CRAS_RESAMPLER_QUALITY_HIGH,
+                                   1.0f, &out_total));
+}
+
+// The drift from the rate estimator is applied in the same pass as the
+// nominal ratio, without going through the linear resampler.
+TEST(FormatConverterTest, PolyphaseDriftSinglePass) {
+  size_t out_total, out_nominal;
+
+  PolyphaseSineThdN(44100, 48000, CRAS_RESAMPLER_QUALITY_MEDIUM, 1.0f,
+                    &out_nominal);
+  EXPECT_GT(-80, PolyphaseSineThdN(44100, 48000,
+                                   CRAS_RESAMPLER_QUALITY_MEDIUM, 1.002f,
+                                   &out_total));
+  EXPECT_NEAR(out_nominal * 1.002, out_total, 2);
+}
+
+TEST(FormatConverterTest, PolyphaseFramesMapping) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  int32_t* in_buf;
+  int32_t* out_buf;
+  unsigned int in_frames;
+  size_t out_frames, needed;
+  int i;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S32_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 16000;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = mono_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create_resampler(&in_fmt, &out_fmt, 4096, 0,
+                                     CRAS_RESAMPLER_POLYPHASE,
+                                     CRAS_RESAMPLER_QUALITY_MEDIUM);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(1, cras_fmt_conversion_needed(c));
+
+  in_buf = (int32_t*)ralloc(1024 * 4);
+  out_buf = (int32_t*)ralloc(4096 * 4);
+
+  // The frames mapping accounts for the history kept by the filter.
+  needed = cras_fmt_conv_out_frames_to_in(c, 480);
+  in_frames = needed;
+  out_frames = cras_fmt_conv_convert_frames(c, (uint8_t*)in_buf,
+                                            (uint8_t*)out_buf, &in_frames, 480);
+  EXPECT_EQ(480, out_frames);
+  EXPECT_EQ(needed, in_frames);
+
+  out_frames = cras_fmt_conv_in_frames_to_out(c, 160);
+  in_frames = 160;
+  EXPECT_EQ(out_frames, cras_fmt_conv_convert_frames(
+                            c, (uint8_t*)in_buf, (uint8_t*)out_buf,
+                            &in_frames, 4096));
+  EXPECT_EQ(160, in_frames);
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buf);
+  free(out_buf);
+}
+
+// The in to out mapping must never promise more frames than the converter
+// produces, whatever position the filter is at.
+TEST(FormatConverterTest, PolyphaseInToOutNeverOvercounts) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  int16_t* in_buf;
+  int16_t* out_buf;
+  unsigned int in_frames;
+  size_t expected;
+  int i;
+
+  ResetStub();
+  in_fmt.format = out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create_resampler(&in_fmt, &out_fmt, 4096, 0,
+                                     CRAS_RESAMPLER_POLYPHASE,
+                                     CRAS_RESAMPLER_QUALITY_MEDIUM);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buf = (int16_t*)ralloc(512 * 4);
+  out_buf = (int16_t*)ralloc(4096 * 4);
+
+  for (i = 1; i < 512; i += 37) {
+    expected = cras_fmt_conv_in_frames_to_out(c, i);
+    in_frames = i;
+    EXPECT_EQ(expected, cras_fmt_conv_convert_frames(
+                            c, (uint8_t*)in_buf, (uint8_t*)out_buf,
+                            &in_frames, 4096));
+    EXPECT_EQ(i, in_frames);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buf);
+  free(out_buf);
+}
+
+// Every polyphase tier has to keep up with real time.
+TEST(FormatConverterTest, PolyphaseThroughput) {
+  const size_t kBlockFrames = 441;
+  const size_t kNumBlocks = 1000;
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  int16_t* in_buf;
+  int16_t* out_buf;
+  unsigned int in_frames;
+  size_t i, blk, out_total;
+  struct timespec start, end;
+  double elapsed;
+  int q;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+  in_buf = (int16_t*)ralloc(kBlockFrames * 4);
+  out_buf = (int16_t*)malloc(kBlockFrames * 2 * 4);
+
+  for (q = 0; q < CRAS_RESAMPLER_NUM_QUALITY; q++) {
+    c = cras_fmt_conv_create_resampler(
+        &in_fmt, &out_fmt, kBlockFrames * 2, 0, CRAS_RESAMPLER_POLYPHASE,
+        (enum CRAS_RESAMPLER_QUALITY)q);
+    ASSERT_NE(c, (void*)NULL);
+    out_total = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (blk = 0; blk < kNumBlocks; blk++) {
+      in_frames = kBlockFrames;
+      out_total += cras_fmt_conv_convert_frames(
+          c, (uint8_t*)in_buf, (uint8_t*)out_buf, &in_frames,
+          kBlockFrames * 2);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+    EXPECT_LT(0, out_total);
+    EXPECT_LT(1.0, out_total / 48000.0 / elapsed) << "quality " << q;
+    cras_fmt_conv_destroy(&c);
+  }
+
+  free(in_buf);
+  free(out_buf);
+}
+
+TEST(FormatConverterTest, ResamplerQualityForStreamType) {
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_MEDIUM,
+            cras_fmt_conv_stream_type_quality(CRAS_STREAM_TYPE_DEFAULT));
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_MEDIUM,
+            cras_fmt_conv_stream_type_quality(CRAS_STREAM_TYPE_MULTIMEDIA));
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_LOW,
+            cras_fmt_conv_stream_type_quality(
+                CRAS_STREAM_TYPE_VOICE_COMMUNICATION));
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_HIGH,
+            cras_fmt_conv_stream_type_quality(CRAS_STREAM_TYPE_PRO_AUDIO));
+}
+
 TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
   float coeff[4] = {0.5, 0.5, 0.26, 0.73};
   struct cras_fmt_conv* conv;
@@ -1702,4 +2030,10 @@ unsigned int linear_resampler_resample(struct linear_resampler* lr,
 }
 
 void linear_resampler_destroy(struct linear_resampler* lr) {}
+
+void linear_resampler_set_float(struct linear_resampler* lr, int is_float) {}
+
+int cras_server_metrics_fmt_conv_pool_hit_rate(unsigned percent) {
+  return 0;
+}
 }  // extern "C"
@@ -20,6 +20,8 @@ namespace {
 static struct cras_audio_area apm_area;
 static unsigned int cras_apm_list_process_offset_val;
 static unsigned int cras_apm_list_process_called;
+static int cras_apm_list_process_ret;
+static unsigned int cras_apm_list_stop_apm_called;
 static struct cras_apm* cras_apm_list_get_active_ret = NULL;
 static bool cras_apm_list_get_use_tuned_settings_val;
 #endif  // HAVE_WEBRTC_APM
@@ -36,6 +38,8 @@ TEST(InputData, GetForInputStream) {
 
 #ifdef HAVE_WEBRTC_APM
   cras_apm_list_process_called = 0;
+  cras_apm_list_process_ret = 0;
+  cras_apm_list_stop_apm_called = 0;
 #endif  // HAVE_WEBRTC_APM
   stream.stream_id = 111;
 
@@ -70,6 +74,14 @@ TEST(InputData, GetForInputStream) {
   EXPECT_EQ(1, cras_apm_list_process_called);
   EXPECT_EQ(2048, cras_apm_list_process_offset_val);
   EXPECT_EQ(0, offset);
+
+  // A failing APM is stopped and the stream reads the device data.
+  cras_apm_list_process_ret = -EINVAL;
+  input_data_get_for_stream(data, &stream, offsets, &area, &offset);
+  EXPECT_EQ(1, cras_apm_list_stop_apm_called);
+  EXPECT_EQ(&dev_area, area);
+  EXPECT_EQ(600, offset);
+  cras_apm_list_get_active_ret = NULL;
 #else
   // Without the APM, the offset shouldn't be changed.
   EXPECT_EQ(600, offset);
@@ -123,17 +135,25 @@ int cras_apm_list_process(struct cras_apm* apm,
                           unsigned int offset) {
   cras_apm_list_process_called++;
   cras_apm_list_process_offset_val = offset;
-  return 0;
+  return cras_apm_list_process_ret;
 }
 
 struct cras_audio_area* cras_apm_list_get_processed(struct cras_apm* apm) {
   return &apm_area;
 }
-void cras_apm_list_remove_apm(struct cras_apm_list* list, void* dev_ptr) {}
+void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr) {
+  cras_apm_list_stop_apm_called++;
+}
 void cras_apm_list_put_processed(struct cras_apm* apm, unsigned int frames) {}
 bool cras_apm_list_get_use_tuned_settings(struct cras_apm* apm) {
   return cras_apm_list_get_use_tuned_settings_val;
 }
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm* apm) {
+  return 0;
+}
+struct cras_audio_format* cras_apm_list_get_format(struct cras_apm* apm) {
+  return NULL;
+}
 #endif  // HAVE_WEBRTC_APM
 
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
@@ -40,6 +40,12 @@ static int audio_thread_add_open_dev_called;
 static int audio_thread_rm_open_dev_called;
 static int audio_thread_is_dev_open_ret;
 static struct audio_thread thread;
+static struct audio_thread dev_threads[4];
+static int audio_thread_create_called;
+static int audio_thread_destroy_called;
+static std::vector<struct audio_thread*> audio_thread_add_stream_threads;
+static std::vector<struct audio_thread*> audio_thread_set_callback_owner_vals;
+static bool per_device_threads_enabled;
 static struct cras_iodev loopback_input;
 static int cras_iodev_close_called;
 static struct cras_iodev* cras_iodev_close_dev;
@@ -67,6 +73,7 @@ static struct cras_rstream* audio_thread_add_stream_stream;
 static struct cras_iodev* audio_thread_add_stream_dev;
 static struct cras_iodev* audio_thread_disconnect_stream_dev;
 static int audio_thread_add_stream_called;
+static int audio_thread_add_streams_called;
 static unsigned update_active_node_called;
 static struct cras_iodev* update_active_node_iodev_val[5];
 static unsigned update_active_node_node_idx_val[5];
@@ -91,6 +98,7 @@ static enum CRAS_IODEV_RAMP_REQUEST audio_thread_dev_start_ramp_req;
 static std::map<int, bool> stream_list_has_pinned_stream_ret;
 static struct cras_rstream* audio_thread_disconnect_stream_stream;
 static int audio_thread_disconnect_stream_called;
+static int audio_thread_disconnect_streams_called;
 static struct cras_iodev fake_sco_in_dev, fake_sco_out_dev;
 static struct cras_ionode fake_sco_in_node, fake_sco_out_node;
 
@@ -118,7 +126,13 @@ class IoDevTestSuite : public testing::Test {
     cras_tm_cancel_timer_called = 0;
 
     audio_thread_disconnect_stream_called = 0;
+    audio_thread_disconnect_streams_called = 0;
     audio_thread_disconnect_stream_stream = NULL;
+    audio_thread_create_called = 0;
+    audio_thread_destroy_called = 0;
+    audio_thread_add_stream_threads.clear();
+    audio_thread_set_callback_owner_vals.clear();
+    per_device_threads_enabled = false;
     audio_thread_is_dev_open_ret = 0;
     stream_list_has_pinned_stream_ret.clear();
 
@@ -203,6 +217,7 @@ class IoDevTestSuite : public testing::Test {
     audio_thread_add_open_dev_called = 0;
     audio_thread_set_active_dev_called = 0;
     audio_thread_add_stream_called = 0;
+    audio_thread_add_streams_called = 0;
     update_active_node_called = 0;
     cras_observer_add_called = 0;
     cras_observer_remove_called = 0;
@@ -289,13 +304,14 @@ TEST_F(IoDevTestSuite, InitSetup) {
 /* Check that the suspend alert from cras_system will trigger suspend
  * and resume call of all iodevs. */
 TEST_F(IoDevTestSuite, SetSuspendResume) {
-  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream rstream, rstream2, rstream3, rstream4;
   struct cras_rstream* stream_list = NULL;
   int rc;
 
   memset(&rstream, 0, sizeof(rstream));
   memset(&rstream2, 0, sizeof(rstream2));
   memset(&rstream3, 0, sizeof(rstream3));
+  memset(&rstream4, 0, sizeof(rstream4));
 
   cras_iodev_list_init();
 
@@ -336,14 +352,29 @@ TEST_F(IoDevTestSuite, SetSuspendResume) {
   stream_add_cb(&rstream3);
   EXPECT_EQ(0, audio_thread_add_stream_called);
 
+  /* Hotword streams are not attached to the default devices on resume. */
+  rstream4.flags = HOTWORD_STREAM;
+  DL_APPEND(stream_list, &rstream4);
+
   audio_thread_add_open_dev_called = 0;
   audio_thread_add_stream_called = 0;
+  audio_thread_add_streams_called = 0;
   stream_list_get_ret = stream_list;
   observer_ops->suspend_changed(NULL, 0);
   EXPECT_EQ(1, audio_thread_add_open_dev_called);
   EXPECT_EQ(2, audio_thread_add_stream_called);
+  // Both streams are added to the device with a single message.
+  EXPECT_EQ(1, audio_thread_add_streams_called);
   EXPECT_EQ(&rstream3, audio_thread_add_stream_stream);
 
+  audio_thread_disconnect_stream_called = 0;
+  audio_thread_disconnect_streams_called = 0;
+  observer_ops->suspend_changed(NULL, 1);
+  // Unpinned hotword streams are still detached on suspend.
+  EXPECT_EQ(3, audio_thread_disconnect_stream_called);
+  EXPECT_EQ(1, audio_thread_disconnect_streams_called);
+  observer_ops->suspend_changed(NULL, 0);
+
   cras_iodev_list_deinit();
   EXPECT_EQ(3, cras_observer_notify_active_node_called);
 }
@@ -1495,6 +1526,50 @@ TEST_F(IoDevTestSuite, AddRemovePinnedStream) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, PerDeviceThreads) {
+  struct cras_rstream rstream;
+
+  per_device_threads_enabled = true;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d2_.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d2_));
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d2_.info.idx, 0));
+
+  // Each device is opened in its own thread, and the stream is added to both
+  // of them.
+  memset(&rstream, 0, sizeof(rstream));
+  audio_thread_add_stream_called = 0;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(3, audio_thread_create_called);
+  ASSERT_EQ(2, audio_thread_add_stream_called);
+  EXPECT_EQ(&dev_threads[0], audio_thread_add_stream_threads[0]);
+  EXPECT_EQ(&dev_threads[1], audio_thread_add_stream_threads[1]);
+
+  // Callbacks added while opening go to the thread of the device.
+  ASSERT_EQ(4, audio_thread_set_callback_owner_vals.size());
+  EXPECT_EQ(&dev_threads[0], audio_thread_set_callback_owner_vals[0]);
+  EXPECT_EQ(NULL, audio_thread_set_callback_owner_vals[1]);
+  EXPECT_EQ(&dev_threads[1], audio_thread_set_callback_owner_vals[2]);
+
+  // Draining asks the shared thread and both device threads.
+  audio_thread_drain_stream_called = 0;
+  EXPECT_EQ(0, stream_rm_cb(&rstream));
+  EXPECT_EQ(3, audio_thread_drain_stream_called);
+
+  // Closing a device stops its thread.
+  cras_iodev_list_disable_dev(&d2_, false);
+  EXPECT_EQ(1, audio_thread_destroy_called);
+
+  cras_iodev_list_deinit();
+  EXPECT_EQ(3, audio_thread_destroy_called);
+}
+
 TEST_F(IoDevTestSuite, SuspendResumePinnedStream) {
   struct cras_rstream rstream;
 
@@ -1672,19 +1747,32 @@ struct cras_server_state* cras_system_state_update_begin() {
 
 void cras_system_state_update_complete() {}
 
+bool cras_system_get_per_device_threads_enabled() {
+  return per_device_threads_enabled;
+}
+
 int cras_system_get_mute() {
   return system_get_mute_return;
 }
 
 struct audio_thread* audio_thread_create() {
-  return &thread;
+  // The first thread is the shared one created at init.
+  if (audio_thread_create_called++ == 0)
+    return &thread;
+  return &dev_threads[(audio_thread_create_called - 2) % 4];
 }
 
 int audio_thread_start(struct audio_thread* thread) {
   return 0;
 }
 
-void audio_thread_destroy(struct audio_thread* thread) {}
+void audio_thread_destroy(struct audio_thread* thread) {
+  audio_thread_destroy_called++;
+}
+
+void audio_thread_set_callback_owner(struct audio_thread* thread) {
+  audio_thread_set_callback_owner_vals.push_back(thread);
+}
 
 int audio_thread_set_active_dev(struct audio_thread* thread,
                                 struct cras_iodev* dev) {
@@ -1717,22 +1805,36 @@ int audio_thread_is_dev_open(struct audio_thread* thread,
   return audio_thread_is_dev_open_ret;
 }
 
-int audio_thread_add_stream(struct audio_thread* thread,
-                            struct cras_rstream* stream,
-                            struct cras_iodev** devs,
-                            unsigned int num_devs) {
-  audio_thread_add_stream_called++;
-  audio_thread_add_stream_stream = stream;
-  audio_thread_add_stream_dev = (num_devs ? devs[0] : NULL);
+int audio_thread_add_streams(struct audio_thread* thread,
+                             struct cras_rstream** streams,
+                             unsigned int num_streams,
+                             struct cras_iodev** devs,
+                             unsigned int num_devs) {
+  unsigned int i;
+
+  audio_thread_add_streams_called++;
+  for (i = 0; i < num_streams; i++) {
+    audio_thread_add_stream_called++;
+    audio_thread_add_stream_threads.push_back(thread);
+    audio_thread_add_stream_stream = streams[i];
+    audio_thread_add_stream_dev = (num_devs ? devs[0] : NULL);
+  }
   return 0;
 }
 
-int audio_thread_disconnect_stream(struct audio_thread* thread,
-                                   struct cras_rstream* stream,
-                                   struct cras_iodev* iodev) {
-  audio_thread_disconnect_stream_called++;
-  audio_thread_disconnect_stream_stream = stream;
-  audio_thread_disconnect_stream_dev = iodev;
+int audio_thread_disconnect_streams(struct audio_thread* thread,
+                                    struct cras_rstream** streams,
+                                    unsigned int num_streams,
+                                    struct cras_iodev** devs,
+                                    unsigned int num_devs) {
+  unsigned int i;
+
+  audio_thread_disconnect_streams_called++;
+  for (i = 0; i < num_streams; i++) {
+    audio_thread_disconnect_stream_called++;
+    audio_thread_disconnect_stream_stream = streams[i];
+    audio_thread_disconnect_stream_dev = (num_devs ? devs[0] : NULL);
+  }
   return 0;
 }
 
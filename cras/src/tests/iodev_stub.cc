@@ -116,6 +116,15 @@ int cras_iodev_put_output_buffer(struct cras_iodev* iodev,
   return 0;
 }
 
+int cras_iodev_put_output_mix_bus(struct cras_iodev* iodev,
+                                  struct mix_bus* bus,
+                                  uint8_t* frames,
+                                  unsigned int nframes,
+                                  int* non_empty,
+                                  struct cras_fmt_conv* output_converter) {
+  return 0;
+}
+
 int cras_iodev_get_input_buffer(struct cras_iodev* iodev, unsigned* frames) {
   return 0;
 }
@@ -180,6 +189,10 @@ unsigned int cras_iodev_frames_to_play_in_sleep(struct cras_iodev* odev,
 void cras_iodev_update_highest_hw_level(struct cras_iodev* iodev,
                                         unsigned int hw_level) {}
 
+void cras_iodev_stage_time_add(struct cras_iodev* iodev,
+                               enum CRAS_OUTPUT_STAGE stage,
+                               struct timespec* start) {}
+
 void cras_iodev_start_stream(struct cras_iodev* iodev,
                              struct dev_stream* stream) {}
 
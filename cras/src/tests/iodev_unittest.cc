@@ -13,6 +13,7 @@ extern "C" {
 #include "cras_rstream.h"
 #include "dev_stream.h"
 #include "input_data.h"
+#include "mix_bus.h"
 #include "utlist.h"
 
 // Mock software volume scalers.
@@ -55,7 +56,7 @@ static int cras_dsp_pipeline_get_delay_called;
 static int cras_dsp_pipeline_apply_called;
 static int cras_dsp_pipeline_set_sink_ext_module_called;
 static int cras_dsp_pipeline_apply_sample_count;
-static unsigned int cras_mix_mute_count;
+static int cras_dsp_pipeline_apply_return;
 static unsigned int cras_dsp_num_input_channels_return;
 static unsigned int cras_dsp_num_output_channels_return;
 struct cras_dsp_context* cras_dsp_context_new_return;
@@ -63,9 +64,8 @@ static unsigned int cras_dsp_load_dummy_pipeline_called;
 static unsigned int rate_estimator_add_frames_num_frames;
 static unsigned int rate_estimator_add_frames_called;
 static int cras_system_get_mute_return;
-static snd_pcm_format_t cras_scale_buffer_fmt;
-static float cras_scale_buffer_scaler;
-static int cras_scale_buffer_called;
+static int cras_scale_buffer_check_called;
+static int cras_scale_buffer_check_non_empty;
 static unsigned int pre_dsp_hook_called;
 static const uint8_t* pre_dsp_hook_frames;
 static void* pre_dsp_hook_cb_data;
@@ -81,6 +81,8 @@ static int no_stream_called;
 static int no_stream_enable;
 // This will be used extensively in cras_iodev.
 struct audio_thread_event_log* atlog;
+struct audio_thread_tracer* attrace;
+int attrace_writers;
 static unsigned int simple_no_stream_called;
 static int simple_no_stream_enable;
 static int dev_stream_playback_frames_ret;
@@ -99,13 +101,13 @@ static cras_ramp_cb cras_ramp_start_cb;
 static void* cras_ramp_start_cb_data;
 static int cras_device_monitor_set_device_mute_state_called;
 unsigned int cras_device_monitor_set_device_mute_state_dev_idx;
-static snd_pcm_format_t cras_scale_buffer_increment_fmt;
-static uint8_t* cras_scale_buffer_increment_buff;
-static unsigned int cras_scale_buffer_increment_frame;
-static float cras_scale_buffer_increment_scaler;
-static float cras_scale_buffer_increment_increment;
-static float cras_scale_buffer_increment_target;
-static int cras_scale_buffer_increment_channel;
+static snd_pcm_format_t cras_scale_buffer_check_fmt;
+static uint8_t* cras_scale_buffer_check_buff;
+static unsigned int cras_scale_buffer_check_frame;
+static float cras_scale_buffer_check_scaler;
+static float cras_scale_buffer_check_increment;
+static float cras_scale_buffer_check_target;
+static int cras_scale_buffer_check_channel;
 static struct cras_audio_format audio_fmt;
 static int buffer_share_add_id_called;
 static int buffer_share_get_new_write_point_ret;
@@ -143,6 +145,7 @@ void ResetStubData() {
   cras_dsp_pipeline_apply_called = 0;
   cras_dsp_pipeline_set_sink_ext_module_called = 0;
   cras_dsp_pipeline_apply_sample_count = 0;
+  cras_dsp_pipeline_apply_return = 0;
   cras_dsp_num_input_channels_return = 2;
   cras_dsp_num_output_channels_return = 2;
   cras_dsp_context_new_return = NULL;
@@ -151,7 +154,6 @@ void ResetStubData() {
   rate_estimator_add_frames_called = 0;
   cras_system_get_mute_return = 0;
   cras_system_get_volume_return = 100;
-  cras_mix_mute_count = 0;
   pre_dsp_hook_called = 0;
   pre_dsp_hook_frames = NULL;
   post_dsp_hook_called = 0;
@@ -193,14 +195,15 @@ void ResetStubData() {
   cras_ramp_update_ramped_frames_num_frames = 0;
   cras_device_monitor_set_device_mute_state_called = 0;
   cras_device_monitor_set_device_mute_state_dev_idx = 0;
-  cras_scale_buffer_called = 0;
-  cras_scale_buffer_increment_fmt = SND_PCM_FORMAT_UNKNOWN;
-  cras_scale_buffer_increment_buff = NULL;
-  cras_scale_buffer_increment_frame = 0;
-  cras_scale_buffer_increment_scaler = 0;
-  cras_scale_buffer_increment_increment = 0;
-  cras_scale_buffer_increment_target = 0.0;
-  cras_scale_buffer_increment_channel = 0;
+  cras_scale_buffer_check_called = 0;
+  cras_scale_buffer_check_non_empty = 0;
+  cras_scale_buffer_check_fmt = SND_PCM_FORMAT_UNKNOWN;
+  cras_scale_buffer_check_buff = NULL;
+  cras_scale_buffer_check_frame = 0;
+  cras_scale_buffer_check_scaler = 0;
+  cras_scale_buffer_check_increment = 0;
+  cras_scale_buffer_check_target = 0.0;
+  cras_scale_buffer_check_channel = 0;
   audio_fmt.format = SND_PCM_FORMAT_S16_LE;
   audio_fmt.frame_rate = 48000;
   audio_fmt.num_channels = 2;
@@ -561,7 +564,8 @@ TEST(IoDevPutOutputBuffer, SystemMuted) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(20, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_increment);
   EXPECT_EQ(20, put_buffer_nframes);
   EXPECT_EQ(20, rate_estimator_add_frames_num_frames);
 }
@@ -624,7 +628,8 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMute) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(20, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_increment);
   EXPECT_EQ(20, put_buffer_nframes);
   EXPECT_EQ(20, rate_estimator_add_frames_num_frames);
 }
@@ -655,18 +660,20 @@ TEST(IoDevPutOutputBuffer, SystemMutedWithRamp) {
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
   // Output should be muted.
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(20, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_increment);
   EXPECT_EQ(20, put_buffer_nframes);
   EXPECT_EQ(20, rate_estimator_add_frames_num_frames);
 
   // Test for the case where ramping is not done yet.
   ResetStubData();
   cras_ramp_get_current_action_ret.type = CRAS_RAMP_ACTION_PARTIAL;
+  cras_ramp_get_current_action_ret.scaler = 0.5;
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
 
   // Output should not be muted.
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.5, cras_scale_buffer_check_scaler);
   // Ramped frames should be increased by 20.
   EXPECT_EQ(20, cras_ramp_update_ramped_frames_num_frames);
   EXPECT_EQ(20, put_buffer_nframes);
@@ -704,18 +711,20 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMuteWithRamp) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(20, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_increment);
   EXPECT_EQ(20, put_buffer_nframes);
   EXPECT_EQ(20, rate_estimator_add_frames_num_frames);
 
   // Test for the case where ramping is not done yet.
   ResetStubData();
   cras_ramp_get_current_action_ret.type = CRAS_RAMP_ACTION_PARTIAL;
+  cras_ramp_get_current_action_ret.scaler = 0.5;
   rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
 
   // Output should not be muted.
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(0.5, cras_scale_buffer_check_scaler);
   // Ramped frames should be increased by 20.
   EXPECT_EQ(20, cras_ramp_update_ramped_frames_num_frames);
   EXPECT_EQ(20, put_buffer_nframes);
@@ -746,7 +755,7 @@ TEST(IoDevPutOutputBuffer, NoDSP) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 22, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_check_scaler);
   EXPECT_EQ(22, put_buffer_nframes);
   EXPECT_EQ(22, rate_estimator_add_frames_num_frames);
 }
@@ -783,7 +792,7 @@ TEST(IoDevPutOutputBuffer, DSP) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
+  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_check_scaler);
   EXPECT_EQ(1, pre_dsp_hook_called);
   EXPECT_EQ(frames, pre_dsp_hook_frames);
   EXPECT_EQ((void*)0x1234, pre_dsp_hook_cb_data);
@@ -795,6 +804,111 @@ TEST(IoDevPutOutputBuffer, DSP) {
   EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
 }
 
+TEST(IoDevPutOutputBuffer, StageTimes) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct cras_iodev_stage_stats* stats = &iodev.stage_stats;
+  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  struct cras_loopback post_dsp;
+  unsigned int i;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  post_dsp.type = LOOPBACK_POST_DSP;
+  post_dsp.hook_data = post_dsp_hook;
+  post_dsp.hook_control = loopback_hook_control;
+  post_dsp.cb_data = (void*)0x5678;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+
+  EXPECT_EQ(0, cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, NULL));
+  EXPECT_EQ(0, cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, NULL));
+  EXPECT_EQ(2, stats->num_blocks);
+
+  // Stages that didn't run aren't charged: no silence check or remix.
+  EXPECT_EQ(0, stats->total_ns[CRAS_OUTPUT_STAGE_MIX]);
+  EXPECT_EQ(0, stats->total_ns[CRAS_OUTPUT_STAGE_FMT_CONV]);
+  for (i = 0; i < CRAS_NUM_OUTPUT_STAGES; i++) {
+    EXPECT_LE(stats->max_ns[i], stats->total_ns[i]);
+    EXPECT_GE(stats->max_ns[i] * 2, stats->total_ns[i]);
+  }
+}
+
+TEST(IoDevPutOutputBuffer, StageTimesFlushedOnDspError) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct cras_iodev_stage_stats* stats = &iodev.stage_stats;
+  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  struct cras_loopback pre_dsp;
+  unsigned int i;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+  cras_dsp_pipeline_apply_return = -EINVAL;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  pre_dsp.type = LOOPBACK_POST_MIX_PRE_DSP;
+  pre_dsp.hook_data = pre_dsp_hook;
+  pre_dsp.hook_control = loopback_hook_control;
+  pre_dsp.cb_data = (void*)0x1234;
+  DL_APPEND(iodev.loopbacks, &pre_dsp);
+
+  EXPECT_EQ(-EINVAL,
+            cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, NULL));
+  EXPECT_EQ(0, put_buffer_nframes);
+
+  // The failed block is accounted, nothing is left for the next one.
+  EXPECT_EQ(1, stats->num_blocks);
+  for (i = 0; i < CRAS_NUM_OUTPUT_STAGES; i++) {
+    EXPECT_EQ(0, stats->block_ns[i]);
+    EXPECT_EQ(stats->max_ns[i], stats->total_ns[i]);
+  }
+}
+
+TEST(IoDevPutOutputBuffer, NonEmptyCheckedWithVolume) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  int non_empty = 0;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  cras_system_get_mute_return = 1;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+
+  // Muting and the check share a pass, which sees the samples unmuted.
+  cras_scale_buffer_check_non_empty = 1;
+  EXPECT_EQ(0, cras_iodev_put_output_buffer(&iodev, frames, 20, &non_empty,
+                                            nullptr));
+  EXPECT_EQ(1, cras_scale_buffer_check_called);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_scaler);
+  EXPECT_EQ(1, non_empty);
+
+  non_empty = 0;
+  cras_scale_buffer_check_non_empty = 0;
+  EXPECT_EQ(0, cras_iodev_put_output_buffer(&iodev, frames, 20, &non_empty,
+                                            nullptr));
+  EXPECT_EQ(0, non_empty);
+}
+
 TEST(IoDevPutOutputBuffer, SoftVol) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
@@ -817,11 +931,10 @@ TEST(IoDevPutOutputBuffer, SoftVol) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 53, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
   EXPECT_EQ(53, put_buffer_nframes);
   EXPECT_EQ(53, rate_estimator_add_frames_num_frames);
-  EXPECT_EQ(softvol_scalers[13], cras_scale_buffer_scaler);
-  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_scale_buffer_fmt);
+  EXPECT_EQ(softvol_scalers[13], cras_scale_buffer_check_scaler);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_scale_buffer_check_fmt);
 }
 
 TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
@@ -857,11 +970,10 @@ TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, n_frames, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
-  EXPECT_EQ(softvol_scalers[volume], cras_scale_buffer_scaler);
-  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_scale_buffer_fmt);
+  EXPECT_EQ(softvol_scalers[volume], cras_scale_buffer_check_scaler);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_scale_buffer_check_fmt);
 
   ResetStubData();
   // Assume ramping is not done.
@@ -875,25 +987,22 @@ TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, n_frames, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
-  // cras_scale_buffer is not called.
-  EXPECT_EQ(0, cras_scale_buffer_called);
-
-  // Verify the arguments passed to cras_scale_buffer_increment.
-  EXPECT_EQ(fmt.format, cras_scale_buffer_increment_fmt);
-  EXPECT_EQ(frames, cras_scale_buffer_increment_buff);
-  EXPECT_EQ(n_frames, cras_scale_buffer_increment_frame);
+
+  // Verify the arguments passed to cras_scale_buffer_check.
+  EXPECT_EQ(fmt.format, cras_scale_buffer_check_fmt);
+  EXPECT_EQ(frames, cras_scale_buffer_check_buff);
+  EXPECT_EQ(n_frames, cras_scale_buffer_check_frame);
   // Initial scaler will be product of software volume scaler and
   // ramp scaler.
   EXPECT_FLOAT_EQ(softvol_scalers[volume] * ramp_scaler,
-                  cras_scale_buffer_increment_scaler);
+                  cras_scale_buffer_check_scaler);
   // Increment scaler will be product of software volume scaler and
   // ramp increment.
   EXPECT_FLOAT_EQ(softvol_scalers[volume] * increment,
-                  cras_scale_buffer_increment_increment);
+                  cras_scale_buffer_check_increment);
   EXPECT_FLOAT_EQ(softvol_scalers[volume] * target,
-                  cras_scale_buffer_increment_target);
-  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_increment_channel);
+                  cras_scale_buffer_check_target);
+  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_check_channel);
 
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
@@ -927,9 +1036,9 @@ TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, n_frames, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
-  // cras_scale_buffer is not called.
-  EXPECT_EQ(0, cras_scale_buffer_called);
+  // Full volume, nothing to scale.
+  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_scale_buffer_check_increment);
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
 
@@ -942,18 +1051,15 @@ TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, n_frames, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
-  // cras_scale_buffer is not called.
-  EXPECT_EQ(0, cras_scale_buffer_called);
-
-  // Verify the arguments passed to cras_scale_buffer_increment.
-  EXPECT_EQ(fmt.format, cras_scale_buffer_increment_fmt);
-  EXPECT_EQ(frames, cras_scale_buffer_increment_buff);
-  EXPECT_EQ(n_frames, cras_scale_buffer_increment_frame);
-  EXPECT_FLOAT_EQ(ramp_scaler, cras_scale_buffer_increment_scaler);
-  EXPECT_FLOAT_EQ(increment, cras_scale_buffer_increment_increment);
-  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_increment_target);
-  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_increment_channel);
+
+  // Verify the arguments passed to cras_scale_buffer_check.
+  EXPECT_EQ(fmt.format, cras_scale_buffer_check_fmt);
+  EXPECT_EQ(frames, cras_scale_buffer_check_buff);
+  EXPECT_EQ(n_frames, cras_scale_buffer_check_frame);
+  EXPECT_FLOAT_EQ(ramp_scaler, cras_scale_buffer_check_scaler);
+  EXPECT_FLOAT_EQ(increment, cras_scale_buffer_check_increment);
+  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_check_target);
+  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_check_channel);
 
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
@@ -981,10 +1087,97 @@ TEST(IoDevPutOutputBuffer, Scale32Bit) {
 
   rc = cras_iodev_put_output_buffer(&iodev, frames, 53, NULL, nullptr);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(0, cras_mix_mute_count);
   EXPECT_EQ(53, put_buffer_nframes);
   EXPECT_EQ(53, rate_estimator_add_frames_num_frames);
-  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, cras_scale_buffer_fmt);
+  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, cras_scale_buffer_check_fmt);
+  EXPECT_FLOAT_EQ(softvol_scalers[13], cras_scale_buffer_check_scaler);
+}
+
+TEST(IoDevPutOutputBuffer, MixBusSoftVol) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct mix_bus* bus;
+  int32_t frames[2 * 16];
+  unsigned int i;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.software_volume_needed = 1;
+
+  cras_system_get_volume_return = 13;
+  softvol_scalers[13] = 0.5;
+
+  fmt.format = SND_PCM_FORMAT_S32_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.rate_est = reinterpret_cast<struct rate_estimator*>(0xdeadbeef);
+
+  for (i = 0; i < 2 * 16; i++)
+    frames[i] = 0x10000000;
+  bus = mix_bus_create(2, 16);
+  mix_bus_add(bus, 0, SND_PCM_FORMAT_S32_LE, (uint8_t*)frames, 16, 1.0f);
+
+  rc = cras_iodev_put_output_mix_bus(&iodev, bus, (uint8_t*)frames, 16, NULL,
+                                     nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(16, put_buffer_nframes);
+  EXPECT_EQ(16, rate_estimator_add_frames_num_frames);
+  // Scaling runs on the bus, not on the quantized samples.
+  EXPECT_EQ(0, cras_scale_buffer_check_called);
+  for (i = 0; i < 2 * 16; i++)
+    EXPECT_EQ(0x08000000, frames[i]);
+
+  mix_bus_destroy(bus);
+}
+
+TEST(IoDevPutOutputBuffer, MixBusDSP) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct mix_bus* bus;
+  int16_t frames[2 * 32];
+  int rc;
+  struct cras_loopback pre_dsp;
+  struct cras_loopback post_dsp;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.rate_est = reinterpret_cast<struct rate_estimator*>(0xdeadbeef);
+  pre_dsp.type = LOOPBACK_POST_MIX_PRE_DSP;
+  pre_dsp.hook_data = pre_dsp_hook;
+  pre_dsp.hook_control = loopback_hook_control;
+  pre_dsp.cb_data = (void*)0x1234;
+  DL_APPEND(iodev.loopbacks, &pre_dsp);
+  post_dsp.type = LOOPBACK_POST_DSP;
+  post_dsp.hook_data = post_dsp_hook;
+  post_dsp.hook_control = loopback_hook_control;
+  post_dsp.cb_data = (void*)0x5678;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+
+  bus = mix_bus_create(2, 32);
+  mix_bus_zero(bus, 0, 32);
+
+  rc = cras_iodev_put_output_mix_bus(&iodev, bus, (uint8_t*)frames, 32, NULL,
+                                     nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, pre_dsp_hook_called);
+  EXPECT_EQ((uint8_t*)frames, pre_dsp_hook_frames);
+  EXPECT_EQ(1, post_dsp_hook_called);
+  EXPECT_EQ(32, put_buffer_nframes);
+  EXPECT_EQ(32, cras_dsp_pipeline_apply_sample_count);
+  EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
+
+  mix_bus_destroy(bus);
 }
 
 // frames queued/avail tests
@@ -2490,7 +2683,24 @@ int cras_dsp_pipeline_apply(struct pipeline* pipeline,
                             unsigned int frames) {
   cras_dsp_pipeline_apply_called++;
   cras_dsp_pipeline_apply_sample_count = frames;
-  return 0;
+  return cras_dsp_pipeline_apply_return;
+}
+
+int cras_dsp_pipeline_apply_float(struct pipeline* pipeline,
+                                  float** planes,
+                                  unsigned int num_channels,
+                                  unsigned int frames) {
+  cras_dsp_pipeline_apply_called++;
+  cras_dsp_pipeline_apply_sample_count = frames;
+  return cras_dsp_pipeline_apply_return;
+}
+
+int cras_dsp_pipeline_get_num_input_channels(struct pipeline* pipeline) {
+  return 2;
+}
+
+int cras_dsp_pipeline_get_num_output_channels(struct pipeline* pipeline) {
+  return 2;
 }
 
 void cras_dsp_pipeline_add_statistic(struct pipeline* pipeline,
@@ -2515,6 +2725,12 @@ int audio_thread_post_message(struct audio_thread* thread,
   return 0;
 }
 
+void audio_thread_trace_data(const struct timespec* now,
+                             enum AUDIO_THREAD_LOG_EVENTS event,
+                             uint32_t data1,
+                             uint32_t data2,
+                             uint32_t data3) {}
+
 void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
                                  cras_node_id_t node_id) {
   select_node_called++;
@@ -2573,33 +2789,27 @@ int cras_system_get_capture_mute() {
   return 0;
 }
 
-void cras_scale_buffer(snd_pcm_format_t fmt,
-                       uint8_t* buffer,
-                       unsigned int count,
-                       float scaler) {
-  cras_scale_buffer_called++;
-  cras_scale_buffer_fmt = fmt;
-  cras_scale_buffer_scaler = scaler;
-}
-
-void cras_scale_buffer_increment(snd_pcm_format_t fmt,
-                                 uint8_t* buff,
-                                 unsigned int frame,
-                                 float scaler,
-                                 float increment,
-                                 float target,
-                                 int channel) {
-  cras_scale_buffer_increment_fmt = fmt;
-  cras_scale_buffer_increment_buff = buff;
-  cras_scale_buffer_increment_frame = frame;
-  cras_scale_buffer_increment_scaler = scaler;
-  cras_scale_buffer_increment_increment = increment;
-  cras_scale_buffer_increment_target = target;
-  cras_scale_buffer_increment_channel = channel;
+void cras_scale_buffer_check(snd_pcm_format_t fmt,
+                             uint8_t* buff,
+                             unsigned int frame,
+                             float scaler,
+                             float increment,
+                             float target,
+                             int channel,
+                             int* is_non_empty) {
+  cras_scale_buffer_check_called++;
+  cras_scale_buffer_check_fmt = fmt;
+  cras_scale_buffer_check_buff = buff;
+  cras_scale_buffer_check_frame = frame;
+  cras_scale_buffer_check_scaler = scaler;
+  cras_scale_buffer_check_increment = increment;
+  cras_scale_buffer_check_target = target;
+  cras_scale_buffer_check_channel = channel;
+  if (is_non_empty && cras_scale_buffer_check_non_empty)
+    *is_non_empty = 1;
 }
 
 size_t cras_mix_mute_buffer(uint8_t* dst, size_t frame_bytes, size_t count) {
-  cras_mix_mute_count = count;
   return count;
 }
 
@@ -4,8 +4,11 @@
 
 #include <gtest/gtest.h>
 #include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/param.h>
+#include <time.h>
 
 extern "C" {
 #include "linear_resampler.h"
@@ -214,6 +217,165 @@ void cras_mix_add_scale_stride(int fmt,
 
 }  //  extern "C"
 
+TEST(LinearResampler, ResampleFloat) {
+  int i, rc;
+  unsigned int count;
+  float* in = (float*)in_buf;
+  float* out = (float*)out_buf;
+  struct linear_resampler* lr;
+
+  memset(in_buf, 0, BUF_SIZE);
+  memset(out_buf, 0, BUF_SIZE);
+  for (i = 0; i < 100; i++) {
+    in[i * 2] = i * 0.001f;
+    in[i * 2 + 1] = -i * 0.002f;
+  }
+
+  lr = linear_resampler_create(2, 8, 48000, 96000);
+  linear_resampler_set_float(lr, 1);
+
+  count = 20;
+  rc = linear_resampler_resample(lr, in_buf, &count, out_buf, 100);
+  EXPECT_EQ(39, rc);
+  EXPECT_EQ(20, count);
+
+  /* Every other output frame falls between two input frames. */
+  for (i = 0; i < 19; i++) {
+    EXPECT_FLOAT_EQ(in[i * 2], out[i * 4]);
+    EXPECT_FLOAT_EQ(in[i * 2 + 1], out[i * 4 + 1]);
+    EXPECT_FLOAT_EQ((in[i * 2] + in[i * 2 + 2]) / 2, out[i * 4 + 2]);
+    EXPECT_FLOAT_EQ((in[i * 2 + 1] + in[i * 2 + 3]) / 2, out[i * 4 + 3]);
+  }
+  linear_resampler_destroy(lr);
+}
+
+// Returns the THD+N in dB of channel |ch| of interleaved float |samples|,
+// compared to the sine of |freq| cycles per frame that fits them best.
+static double ThdNFloat(const float* samples,
+                        size_t frames,
+                        size_t num_channels,
+                        size_t ch,
+                        double freq) {
+  double ss = 0, sc = 0, cc = 0, xs = 0, xc = 0;
+  double a, b, det, x, fit, err = 0, sig = 0;
+  size_t i;
+
+  for (i = 0; i < frames; i++) {
+    double s = sin(2 * M_PI * freq * i);
+    double c = cos(2 * M_PI * freq * i);
+    x = samples[i * num_channels + ch];
+    ss += s * s;
+    sc += s * c;
+    cc += c * c;
+    xs += x * s;
+    xc += x * c;
+  }
+  det = ss * cc - sc * sc;
+  a = (xs * cc - xc * sc) / det;
+  b = (xc * ss - xs * sc) / det;
+  for (i = 0; i < frames; i++) {
+    x = samples[i * num_channels + ch];
+    fit = a * sin(2 * M_PI * freq * i) + b * cos(2 * M_PI * freq * i);
+    err += (x - fit) * (x - fit);
+    sig += fit * fit;
+  }
+  return 10 * log10(err / sig);
+}
+
+// Resamples |in| in blocks of |block| frames, the way fmt_conv feeds the
+// linear resampler, and returns the number of output frames.
+static size_t ResampleBlocks(struct linear_resampler* lr,
+                             const float* in,
+                             size_t in_total,
+                             float* out,
+                             size_t out_size,
+                             size_t block) {
+  size_t in_pos = 0, out_pos = 0;
+  unsigned int count;
+
+  while (in_pos < in_total && out_pos < out_size) {
+    count = MIN(block, in_total - in_pos);
+    out_pos += linear_resampler_resample(
+        lr, (uint8_t*)(in + in_pos * 2), &count, (uint8_t*)(out + out_pos * 2),
+        MIN(block * 2, out_size - out_pos));
+    in_pos += count;
+  }
+  return out_pos;
+}
+
+// THD+N of the drift correction on a 997 Hz sine, the rate estimator
+// typically asks for adjustments below 0.5%.
+TEST(LinearResampler, DriftCorrectionThdN) {
+  const size_t kFrames = 48000;
+  const double kFreq = 997.0;
+  float* in = (float*)malloc(kFrames * 2 * sizeof(float));
+  float* out = (float*)malloc(kFrames * 2 * 2 * sizeof(float));
+  struct linear_resampler* lr;
+  size_t i, out_frames;
+  double thdn;
+
+  for (i = 0; i < kFrames; i++) {
+    in[i * 2] = 0.5 * sin(2 * M_PI * kFreq * i / 48000);
+    in[i * 2 + 1] = in[i * 2];
+  }
+
+  lr = linear_resampler_create(2, 8, 48000, 48096);
+  linear_resampler_set_float(lr, 1);
+  out_frames = ResampleBlocks(lr, in, kFrames, out, kFrames * 2, 480);
+  EXPECT_NEAR(kFrames * 48096 / 48000, out_frames, 2);
+
+  thdn = ThdNFloat(out, out_frames, 2, 0, kFreq / 48096);
+  printf("linear resampler drift THD+N: %.1f dB\n", thdn);
+  EXPECT_GT(-40, thdn);
+
+  linear_resampler_destroy(lr);
+  free(in);
+  free(out);
+}
+
+// The drift correction pass has to keep up with real time.
+TEST(LinearResampler, Throughput) {
+  const size_t kFrames = 48000;
+  const size_t kRuns = 20;
+  float* in = (float*)calloc(kFrames * 2, sizeof(float));
+  float* out = (float*)malloc(kFrames * 2 * 2 * sizeof(float));
+  int16_t* in16 = (int16_t*)in;
+  int16_t* out16 = (int16_t*)out;
+  struct linear_resampler* lr;
+  struct timespec start, end;
+  size_t run, out_total = 0;
+  unsigned int count;
+  double elapsed;
+
+  lr = linear_resampler_create(2, 8, 48000, 48096);
+  linear_resampler_set_float(lr, 1);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (run = 0; run < kRuns; run++)
+    out_total += ResampleBlocks(lr, in, kFrames, out, kFrames * 2, 480);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+  EXPECT_LT(0, out_total);
+  EXPECT_LT(1.0, out_total / 48000.0 / elapsed);
+  linear_resampler_destroy(lr);
+
+  lr = linear_resampler_create(2, 4, 48000, 48096);
+  out_total = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (run = 0; run < kRuns; run++) {
+    count = kFrames;
+    out_total += linear_resampler_resample(lr, (uint8_t*)in16, &count,
+                                           (uint8_t*)out16, kFrames * 2);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+  EXPECT_LT(0, out_total);
+  EXPECT_LT(1.0, out_total / 48000.0 / elapsed);
+  linear_resampler_destroy(lr);
+
+  free(in);
+  free(out);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -26,6 +26,12 @@ int cras_server_metrics_longest_fetch_delay(unsigned delay_msec) {
   return 0;
 }
 
+int cras_server_metrics_output_stage_time(enum CRAS_OUTPUT_STAGE stage,
+                                          unsigned avg_ns,
+                                          unsigned max_ns) {
+  return 0;
+}
+
 int cras_server_metrics_missed_cb_event(const struct cras_rstream* stream) {
   return 0;
 }
@@ -50,6 +56,10 @@ int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio) {
   return 0;
 }
 
+int cras_server_metrics_fmt_conv_pool_hit_rate(unsigned percent) {
+  return 0;
+}
+
 int cras_server_metrics_busyloop(struct timespec* ts, unsigned count) {
   return 0;
 }
@@ -0,0 +1,203 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+extern "C" {
+#include "mix_bus.h"
+}
+
+namespace {
+
+static const unsigned int kNumChannels = 2;
+static const unsigned int kMaxFrames = 64;
+
+class MixBusTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    bus_ = mix_bus_create(kNumChannels, kMaxFrames);
+    ASSERT_NE((void*)NULL, bus_);
+  }
+
+  virtual void TearDown() { mix_bus_destroy(bus_); }
+
+  struct mix_bus* bus_;
+};
+
+TEST(MixBus, CreateInvalid) {
+  EXPECT_EQ((void*)NULL, mix_bus_create(0, kMaxFrames));
+  EXPECT_EQ((void*)NULL, mix_bus_create(kNumChannels, 0));
+}
+
+TEST(MixBus, FormatSupported) {
+  EXPECT_TRUE(mix_bus_format_supported(SND_PCM_FORMAT_S16_LE));
+  EXPECT_TRUE(mix_bus_format_supported(SND_PCM_FORMAT_S24_LE));
+  EXPECT_TRUE(mix_bus_format_supported(SND_PCM_FORMAT_S32_LE));
+  EXPECT_TRUE(mix_bus_format_supported(SND_PCM_FORMAT_S24_3LE));
+  EXPECT_FALSE(mix_bus_format_supported(SND_PCM_FORMAT_U8));
+}
+
+TEST_F(MixBusTestSuite, AddAndQuantizeS32) {
+  int32_t src[kMaxFrames * kNumChannels];
+  int32_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = (int32_t)(i * 0x10000) - 0x400000;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S32_LE, (uint8_t*)src, kMaxFrames, 1.0);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst, kMaxFrames);
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ(src[i], dst[i]);
+}
+
+TEST_F(MixBusTestSuite, MixTwoStreamsS16) {
+  int16_t src1[kMaxFrames * kNumChannels];
+  int16_t src2[kMaxFrames * kNumChannels];
+  int16_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++) {
+    src1[i] = 1000;
+    src2[i] = -300;
+  }
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S16_LE, (uint8_t*)src1, kMaxFrames, 1.0);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S16_LE, (uint8_t*)src2, kMaxFrames, 0.5);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, kMaxFrames);
+
+  // Dither adds at most one LSB.
+  for (i = 0; i < kMaxFrames * kNumChannels; i++) {
+    EXPECT_LE(849, dst[i]);
+    EXPECT_GE(851, dst[i]);
+  }
+}
+
+TEST_F(MixBusTestSuite, SilenceStaysSilent) {
+  int16_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  EXPECT_FALSE(mix_bus_is_non_empty(bus_, kMaxFrames));
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, kMaxFrames);
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ(0, dst[i]);
+}
+
+TEST_F(MixBusTestSuite, QuantizeClips) {
+  int16_t src[kMaxFrames * kNumChannels];
+  int16_t dst[kMaxFrames * kNumChannels];
+  int32_t dst32[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = (i & 1) ? INT16_MIN : INT16_MAX;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S16_LE, (uint8_t*)src, kMaxFrames, 1.0);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S16_LE, (uint8_t*)src, kMaxFrames, 1.0);
+  EXPECT_TRUE(mix_bus_is_non_empty(bus_, kMaxFrames));
+
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, kMaxFrames);
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ((i & 1) ? INT16_MIN : INT16_MAX, dst[i]);
+
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst32, kMaxFrames);
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ((i & 1) ? INT32_MIN : INT32_MAX, dst32[i]);
+}
+
+TEST_F(MixBusTestSuite, QuantizeS32Rounds) {
+  int32_t src[kMaxFrames * kNumChannels];
+  int32_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = (i & 1) ? -3 : 3;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S32_LE, (uint8_t*)src, kMaxFrames, 1.0f);
+  mix_bus_scale(bus_, kMaxFrames, 0.5);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst, kMaxFrames);
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ((i & 1) ? -2 : 2, dst[i]);
+}
+
+TEST_F(MixBusTestSuite, S24Formats) {
+  int32_t src[kMaxFrames * kNumChannels];
+  int32_t dst[kMaxFrames * kNumChannels];
+  uint8_t packed[kMaxFrames * kNumChannels * 3];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = (i & 1) ? -0x123456 : 0x123456;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S24_LE, (uint8_t*)src, kMaxFrames, 1.0f);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S24_3LE, packed, kMaxFrames);
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S24_3LE, packed, kMaxFrames, 1.0f);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S24_LE, (uint8_t*)dst, kMaxFrames);
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    EXPECT_EQ(src[i], dst[i]);
+}
+
+TEST_F(MixBusTestSuite, ScaleIncrement) {
+  int32_t src[kMaxFrames * kNumChannels];
+  int32_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = 0x1000000;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S32_LE, (uint8_t*)src, kMaxFrames, 1.0f);
+  mix_bus_scale_increment(bus_, kMaxFrames, 0.0, 0.25, 0.5);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst, kMaxFrames);
+
+  EXPECT_EQ(0, dst[0]);
+  EXPECT_EQ(0, dst[1]);
+  EXPECT_EQ(0x400000, dst[2]);
+  EXPECT_EQ(0x400000, dst[3]);
+  for (i = 2; i < kMaxFrames; i++) {
+    EXPECT_EQ(0x800000, dst[i * 2]);
+    EXPECT_EQ(0x800000, dst[i * 2 + 1]);
+  }
+
+  mix_bus_scale(bus_, kMaxFrames, 0.5);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst, kMaxFrames);
+  EXPECT_EQ(0x400000, dst[kMaxFrames * 2 - 1]);
+}
+
+TEST_F(MixBusTestSuite, ConsumeKeepsQueuedFrames) {
+  int32_t src[kMaxFrames * kNumChannels];
+  int32_t dst[kMaxFrames * kNumChannels];
+  unsigned int i;
+
+  for (i = 0; i < kMaxFrames * kNumChannels; i++)
+    src[i] = (i / kNumChannels) * 0x10000;
+
+  mix_bus_zero(bus_, 0, kMaxFrames);
+  mix_bus_add(bus_, 0, SND_PCM_FORMAT_S32_LE, (uint8_t*)src, kMaxFrames, 1.0f);
+
+  // 10 frames written, 30 frames mixed so far.
+  mix_bus_consume(bus_, 10, 30);
+  mix_bus_quantize(bus_, SND_PCM_FORMAT_S32_LE, (uint8_t*)dst, 20);
+  for (i = 0; i < 20; i++) {
+    EXPECT_EQ((int32_t)((i + 10) * 0x10000), dst[i * 2]);
+    EXPECT_EQ((int32_t)((i + 10) * 0x10000), dst[i * 2 + 1]);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,6 +7,7 @@
 
 extern "C" {
 #include "cras_mix.h"
+#include "cras_mix_ops.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 }
@@ -80,6 +81,29 @@ class MixTestSuiteS16_LE : public testing::Test {
     EXPECT_EQ(0, memcmp(compare_buffer_, mix_buffer_, kBufferFrames * 4));
   }
 
+  // Mixes the left channel of interleaved stereo into another one.
+  void TestScaleStrideStereo(float scaler) {
+    _SetupBuffer();
+    for (size_t i = 0; i < kBufferFrames * 2; i += 2) {
+      int32_t tmp;
+      if (need_to_scale(scaler))
+        tmp = mix_buffer_[i] + src_buffer_[i] * scaler;
+      else
+        tmp = mix_buffer_[i] + src_buffer_[i];
+      if (tmp > INT16_MAX)
+        tmp = INT16_MAX;
+      else if (tmp < INT16_MIN)
+        tmp = INT16_MIN;
+      compare_buffer_[i] = tmp;
+    }
+
+    cras_mix_add_scale_stride(fmt_, (uint8_t*)mix_buffer_,
+                              (uint8_t*)src_buffer_, kBufferFrames, 4, 4,
+                              scaler);
+
+    EXPECT_EQ(0, memcmp(compare_buffer_, mix_buffer_, kBufferFrames * 4));
+  }
+
   void ScaleIncrement(float start_scaler, float increment, float target) {
     float scaler = start_scaler;
     for (size_t i = 0; i < kBufferFrames * 2; i++) {
@@ -314,12 +338,54 @@ TEST_F(MixTestSuiteS16_LE, ScaleHalfVolume) {
   EXPECT_EQ(0, memcmp(compare_buffer_, src_buffer_, kBufferFrames * 4));
 }
 
+TEST_F(MixTestSuiteS16_LE, ScaleCheck) {
+  int non_empty = 0;
+
+  for (size_t i = 0; i < kBufferFrames * 2; i++)
+    compare_buffer_[i] = src_buffer_[i] * 0.5;
+  cras_scale_buffer_check(fmt_, (uint8_t*)src_buffer_, kBufferFrames, 0.5, 0,
+                          0.5, kNumChannels, &non_empty);
+  EXPECT_EQ(0, memcmp(compare_buffer_, src_buffer_, kBufferFrames * 4));
+  EXPECT_EQ(1, non_empty);
+
+  // Muting a silent buffer leaves the flag alone.
+  memset(src_buffer_, 0, kBufferFrames * 4);
+  non_empty = 0;
+  cras_scale_buffer_check(fmt_, (uint8_t*)src_buffer_, kBufferFrames, 0, 0,
+                          1.0, kNumChannels, &non_empty);
+  EXPECT_EQ(0, non_empty);
+
+  // Muting reports what was there before.
+  src_buffer_[kBufferFrames * 2 - 1] = 1;
+  cras_scale_buffer_check(fmt_, (uint8_t*)src_buffer_, kBufferFrames, 0, 0,
+                          1.0, kNumChannels, &non_empty);
+  EXPECT_EQ(1, non_empty);
+  EXPECT_EQ(0, src_buffer_[kBufferFrames * 2 - 1]);
+}
+
+TEST_F(MixTestSuiteS16_LE, ScaleCheckRamp) {
+  int non_empty = 0;
+
+  _SetupBuffer();
+  ScaleIncrement(0.5, 0.0001, 1.0);
+  cras_scale_buffer_check(fmt_, (uint8_t*)mix_buffer_, kBufferFrames, 0.5,
+                          0.0001, 1.0, kNumChannels, &non_empty);
+  EXPECT_EQ(0, memcmp(compare_buffer_, mix_buffer_, kBufferFrames * 4));
+  EXPECT_EQ(1, non_empty);
+}
+
 TEST_F(MixTestSuiteS16_LE, StrideCopy) {
   TestScaleStride(1.0);
   TestScaleStride(100);
   TestScaleStride(0.5);
 }
 
+TEST_F(MixTestSuiteS16_LE, StrideCopyStereo) {
+  TestScaleStrideStereo(1.0);
+  TestScaleStrideStereo(100);
+  TestScaleStrideStereo(0.5);
+}
+
 class MixTestSuiteS24_LE : public testing::Test {
  protected:
   virtual void SetUp() {
@@ -1260,6 +1326,205 @@ TEST_F(MixTestSuiteS24_3LE, StrideCopy) {
   TestScaleStride(0.1);
 }
 
+TEST(MixFirTest, InterpolateTwoFilters) {
+  // Not a multiple of the SIMD width to cover the scalar tail.
+  const unsigned int kTaps = 37;
+  float src[kTaps], coef0[kTaps], coef1[kTaps];
+  float exp0 = 0.0f, exp1 = 0.0f;
+  unsigned int i;
+
+  for (i = 0; i < kTaps; i++) {
+    src[i] = (float)i / kTaps - 0.5f;
+    coef0[i] = 1.0f / (i + 1);
+    coef1[i] = (i & 1) ? -0.25f : 0.5f;
+    exp0 += src[i] * coef0[i];
+    exp1 += src[i] * coef1[i];
+  }
+
+  EXPECT_NEAR(exp0, cras_mix_fir_interp_f32(src, coef0, coef1, 0.0f, kTaps),
+              1e-5);
+  EXPECT_NEAR(exp1, cras_mix_fir_interp_f32(src, coef0, coef1, 1.0f, kTaps),
+              1e-5);
+  EXPECT_NEAR(exp0 * 0.75f + exp1 * 0.25f,
+              cras_mix_fir_interp_f32(src, coef0, coef1, 0.25f, kTaps), 1e-5);
+}
+
+// Checks the SIMD variants built in against the C implementation.
+class MixOpsVariantTest : public testing::Test {
+ protected:
+  // Not a multiple of the SIMD width to cover the scalar tails.
+  static const unsigned int kFrames = 1021;
+  static const unsigned int kMaxChannels = 6;
+
+  virtual void SetUp() {
+    const size_t bytes = kFrames * kMaxChannels * 4;
+
+    src_ = (uint8_t*)malloc(bytes);
+    expected_ = (uint8_t*)malloc(bytes);
+    actual_ = (uint8_t*)malloc(bytes);
+    seed_ = 0x1234567;
+  }
+
+  virtual void TearDown() {
+    free(src_);
+    free(expected_);
+    free(actual_);
+  }
+
+  void Fill(uint8_t* buf, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++)
+      buf[i] = rand_r(&seed_);
+  }
+
+  static unsigned int SampleBytes(snd_pcm_format_t fmt) {
+    switch (fmt) {
+      case SND_PCM_FORMAT_S16_LE:
+        return 2;
+      case SND_PCM_FORMAT_S24_3LE:
+        return 3;
+      default:
+        return 4;
+    }
+  }
+
+  static int32_t Sample(snd_pcm_format_t fmt, const uint8_t* buf, size_t i) {
+    switch (fmt) {
+      case SND_PCM_FORMAT_S16_LE:
+        return ((const int16_t*)buf)[i];
+      case SND_PCM_FORMAT_S24_3LE:
+        return (int32_t)((uint32_t)buf[i * 3] << 8 |
+                         (uint32_t)buf[i * 3 + 1] << 16 |
+                         (uint32_t)buf[i * 3 + 2] << 24) >>
+               8;
+      default:
+        return ((const int32_t*)buf)[i];
+    }
+  }
+
+  // Fused multiply-add variants may round the float math differently, by up
+  // to a float ULP at full scale, which is more than one LSB for S32.
+  void ExpectNear(snd_pcm_format_t fmt, size_t samples, const char* what) {
+    int64_t tolerance = fmt == SND_PCM_FORMAT_S32_LE ? 256 : 1;
+
+    for (size_t i = 0; i < samples; i++) {
+      int64_t e = Sample(fmt, expected_, i);
+      int64_t a = Sample(fmt, actual_, i);
+      ASSERT_LE(llabs(e - a), tolerance)
+          << what << " format " << fmt << " sample " << i;
+    }
+  }
+
+  void CompareOps(const struct cras_mix_ops* ops) {
+    static const snd_pcm_format_t kFormats[] = {
+        SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S32_LE,
+        SND_PCM_FORMAT_S24_3LE};
+    static const unsigned int kChannels[] = {1, 2, 6};
+    static const float kScalers[] = {1.0f, 0.5f, 0.1f, 100.0f};
+
+    for (snd_pcm_format_t fmt : kFormats) {
+      unsigned int sample_bytes = SampleBytes(fmt);
+
+      for (unsigned int ch : kChannels) {
+        size_t samples = kFrames * ch;
+        size_t bytes = samples * sample_bytes;
+
+        for (float scaler : kScalers) {
+          if (scaler <= 1.0f) {
+            Fill(src_, bytes);
+            Fill(expected_, bytes);
+            memcpy(actual_, expected_, bytes);
+            mixer_ops.add(fmt, expected_, src_, samples, 1, 0, scaler);
+            ops->add(fmt, actual_, src_, samples, 1, 0, scaler);
+            ExpectNear(fmt, samples, "add");
+
+            mixer_ops.add(fmt, expected_, src_, samples, 0, 0, scaler);
+            ops->add(fmt, actual_, src_, samples, 0, 0, scaler);
+            ExpectNear(fmt, samples, "copy");
+
+            mixer_ops.scale_buffer(fmt, expected_, samples, scaler);
+            ops->scale_buffer(fmt, actual_, samples, scaler);
+            ExpectNear(fmt, samples, "scale");
+
+            mixer_ops.scale_buffer_increment(fmt, expected_, samples, scaler,
+                                             -0.001f, 0.1f, ch);
+            ops->scale_buffer_increment(fmt, actual_, samples, scaler,
+                                        -0.001f, 0.1f, ch);
+            ExpectNear(fmt, samples, "scale increment");
+
+            mixer_ops.scale_buffer(fmt, expected_, samples, scaler);
+            EXPECT_EQ(1, ops->scale_buffer_check(fmt, actual_, samples,
+                                                 scaler, 0.0f, 1.0f, ch, 1));
+            ExpectNear(fmt, samples, "scale check");
+
+            // A single non-zero byte, in the vector body or the tail.
+            for (size_t pos : {bytes / 2, bytes - 1}) {
+              memset(actual_, 0, bytes);
+              EXPECT_EQ(0, ops->scale_buffer_check(fmt, actual_, samples,
+                                                   scaler, 0.0f, 1.0f, ch, 1));
+              actual_[pos] = 0x40;
+              EXPECT_EQ(1, ops->scale_buffer_check(fmt, actual_, samples,
+                                                   scaler, 0.0f, 1.0f, ch, 1))
+                  << "format " << fmt << " byte " << pos;
+            }
+          }
+
+          // One channel of |src| into every channel of |dst|.
+          Fill(src_, kFrames * sample_bytes);
+          Fill(expected_, bytes);
+          memcpy(actual_, expected_, bytes);
+          for (unsigned int c = 0; c < ch; c++) {
+            mixer_ops.add_scale_stride(fmt, expected_ + c * sample_bytes,
+                                       src_, kFrames, ch * sample_bytes,
+                                       sample_bytes, scaler);
+            ops->add_scale_stride(fmt, actual_ + c * sample_bytes, src_,
+                                  kFrames, ch * sample_bytes, sample_bytes,
+                                  scaler);
+          }
+          ExpectNear(fmt, samples, "stride");
+        }
+      }
+    }
+  }
+
+  uint8_t* src_;
+  uint8_t* expected_;
+  uint8_t* actual_;
+  unsigned int seed_;
+};
+
+TEST_F(MixOpsVariantTest, MatchCImplementation) {
+#if defined HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    CompareOps(&mixer_ops_sse42);
+#endif
+#if defined HAVE_AVX
+  if (__builtin_cpu_supports("avx"))
+    CompareOps(&mixer_ops_avx);
+#endif
+#if defined HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    CompareOps(&mixer_ops_avx2);
+#endif
+#if defined HAVE_FMA
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    CompareOps(&mixer_ops_fma);
+#endif
+  CompareOps(&mixer_ops);
+}
+
+// Narrow formats only check their own bytes, not past the end of |buff|.
+TEST(MixOpsScaleCheck, U8OnlyChecksItsSamples) {
+  uint8_t buf[64];
+
+  memset(buf, 0, sizeof(buf));
+  memset(buf + 16, 0x40, sizeof(buf) - 16);
+  EXPECT_EQ(0, mixer_ops.scale_buffer_check(SND_PCM_FORMAT_U8, buf, 16, 1.0f,
+                                            0.0f, 1.0f, 1, 1));
+  buf[15] = 0x40;
+  EXPECT_EQ(1, mixer_ops.scale_buffer_check(SND_PCM_FORMAT_U8, buf, 16, 1.0f,
+                                            0.0f, 1.0f, 1, 1));
+}
+
 /* Stubs */
 extern "C" {}  // extern "C"
 
@@ -113,6 +113,13 @@ int cras_rstream_is_pending_reply(const struct cras_rstream* rstream) {
   return 0;
 }
 
+int cras_rstream_check_low_watermark(struct cras_rstream* stream) {
+  return 0;
+}
+
+void cras_rstream_record_underrun(struct cras_rstream* stream,
+                                  unsigned int frames) {}
+
 int cras_rstream_flush_old_audio_messages(struct cras_rstream* rstream) {
   return 0;
 }
@@ -343,6 +343,189 @@ TEST_F(RstreamTestSuite, InputStreamFlushMessages) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, OutputStreamShmWakeup) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  struct timespec ts;
+  uint32_t frames;
+  int rc;
+
+  config_.flags = SHM_WAKEUP;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  ASSERT_LE(0, cras_rstream_get_wake_fd(s));
+  EXPECT_EQ(cras_rstream_get_wake_fd(s), cras_rstream_get_reply_fd(s));
+  shm = cras_rstream_shm(s);
+
+  // The request goes to shm, not to the socket.
+  rc = cras_rstream_request_audio(s, &ts);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(1, shm->header->wake.request_seq);
+  EXPECT_EQ(AUDIO_MESSAGE_REQUEST_DATA, shm->header->wake.request_id);
+  EXPECT_EQ(config_.cb_threshold, shm->header->wake.request_frames);
+  EXPECT_EQ(0, cras_shm_wake_get_reply(shm, &frames));
+
+  // No reply yet.
+  cras_rstream_flush_old_audio_messages(s);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+
+  // Client replies that data is ready.
+  cras_shm_wake_reply(shm, 1, 10, 0);
+  cras_rstream_flush_old_audio_messages(s);
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(1, cras_shm_wake_get_reply(shm, &frames));
+  EXPECT_EQ(10, frames);
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, ShmAreasAreSealed) {
+  struct cras_rstream* s;
+  int header_fd, samples_fd;
+  int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+  ASSERT_EQ(0, cras_rstream_create(&config_, &s));
+  ASSERT_EQ(0, cras_rstream_get_shm_fds(s, &header_fd, &samples_fd));
+  EXPECT_EQ(seals, fcntl(header_fd, F_GET_SEALS) & seals);
+  EXPECT_EQ(seals, fcntl(samples_fd, F_GET_SEALS) & seals);
+  EXPECT_EQ(-1, ftruncate(samples_fd, 0));
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, OutputStreamShmRing) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  uint8_t* buf;
+  size_t frames;
+  int rc;
+
+  config_.flags = SHM_RING;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(SHM_RING, s->flags);
+  shm = cras_rstream_shm(s);
+  EXPECT_EQ(CRAS_SHM_LAYOUT_RING, shm->header->layout);
+  EXPECT_EQ(8192, shm->header->ring.size);
+
+  // The client queues ahead, the server reads part of it.
+  shm->header->ring.write = 3000;
+  buf = cras_rstream_get_readable_frames(s, 100, &frames);
+  EXPECT_EQ(shm->samples + 100 * 4, buf);
+  EXPECT_EQ(2900, frames);
+  cras_rstream_destroy(s);
+
+  // Capture keeps the double buffer.
+  config_.direction = CRAS_STREAM_INPUT;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(0, s->flags & SHM_RING);
+  EXPECT_EQ(CRAS_SHM_LAYOUT_DOUBLE_BUFFER,
+            cras_rstream_shm(s)->header->layout);
+  cras_rstream_destroy(s);
+}
+
+// The ring is the largest power of two that fits in the samples area.
+TEST_F(RstreamTestSuite, OutputStreamShmRingPowerOfTwo) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.flags = SHM_RING;
+  config_.buffer_frames = 3000;
+  config_.cb_threshold = 1500;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(SHM_RING, s->flags);
+  EXPECT_EQ(4096, cras_rstream_shm(s)->header->ring.size);
+  EXPECT_EQ(4096, cras_rstream_shm(s)->ring_frames);
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, PullModeLowWatermark) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  struct audio_message msg;
+  int rc;
+
+  config_.flags = PULL_MODE | SHM_RING | SHM_WAKEUP;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(PULL_MODE | SHM_RING, s->flags);
+  EXPECT_EQ(-1, s->wake_fd);
+  shm = cras_rstream_shm(s);
+  EXPECT_EQ(2048, shm->header->ring.low_watermark);
+
+  // Notified once when the ring drops to the watermark, never pending a
+  // reply.
+  shm->header->ring.write = 3000;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  shm->header->ring.read = 1000;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+  ASSERT_EQ(sizeof(msg), read(client_fd_, &msg, sizeof(msg)));
+  EXPECT_EQ(AUDIO_MESSAGE_REQUEST_DATA, msg.id);
+  EXPECT_EQ(8192 - 2000, msg.frames);
+
+  // Rearmed once refilled above it.
+  shm->header->ring.write = 5000;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  shm->header->ring.read = 4000;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  ASSERT_EQ(sizeof(msg), read(client_fd_, &msg, sizeof(msg)));
+  EXPECT_EQ(8192 - 1000, msg.frames);
+
+  // A zero watermark disables the notification.
+  shm->header->ring.low_watermark = 0;
+  shm->header->ring.read = 5000;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  s->low_watermark_notified = 0;
+  EXPECT_EQ(0, cras_rstream_check_low_watermark(s));
+  EXPECT_EQ(-1, recv(client_fd_, &msg, sizeof(msg), MSG_DONTWAIT));
+
+  cras_rstream_record_underrun(s, 480);
+  EXPECT_EQ(1, shm->header->ring.underruns);
+  EXPECT_EQ(480, shm->header->ring.underrun_frames);
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, PullModeNeedsRing) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.flags = PULL_MODE;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(0, s->flags);
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, InputStreamShmWakeupError) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  uint32_t frames;
+  int rc;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.flags = SHM_WAKEUP;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  shm = cras_rstream_shm(s);
+
+  rc = cras_rstream_audio_ready(s, 10);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(AUDIO_MESSAGE_DATA_READY, shm->header->wake.request_id);
+  EXPECT_EQ(10, shm->header->wake.request_frames);
+
+  // An error reply also clears the pending reply.
+  cras_shm_wake_reply(shm, 1, 0, -EPIPE);
+  EXPECT_EQ(-EPIPE, cras_shm_wake_get_reply(shm, &frames));
+  cras_rstream_flush_old_audio_messages(s);
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+
+  cras_rstream_destroy(s);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
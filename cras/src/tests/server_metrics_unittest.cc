@@ -132,6 +132,21 @@ TEST(ServerMetricsTestSuite, SetMetricHighestHardwareLevel) {
   EXPECT_EQ(sent_msgs[0].data.value, hw_level);
 }
 
+TEST(ServerMetricsTestSuite, SetMetricsOutputStageTime) {
+  ResetStubData();
+
+  cras_server_metrics_output_stage_time(CRAS_OUTPUT_STAGE_DSP, 12000, 80000);
+
+  EXPECT_EQ(sent_msgs.size(), 1);
+  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
+  EXPECT_EQ(sent_msgs[0].header.length,
+            sizeof(struct cras_server_metrics_message));
+  EXPECT_EQ(sent_msgs[0].metrics_type, OUTPUT_STAGE_TIME);
+  EXPECT_EQ(sent_msgs[0].data.stage_data.stage, CRAS_OUTPUT_STAGE_DSP);
+  EXPECT_EQ(sent_msgs[0].data.stage_data.avg_ns, 12000);
+  EXPECT_EQ(sent_msgs[0].data.stage_data.max_ns, 80000);
+}
+
 TEST(ServerMetricsTestSuite, SetMetricsLongestFetchDelay) {
   ResetStubData();
   unsigned int delay = 100;
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <stdio.h>
 
 extern "C" {
@@ -564,6 +565,181 @@ TEST_F(ShmTestSuite, GetCheckedWriteOffset) {
   }
 }
 
+// Sleeps in the futex until a request shows up, like the client audio thread.
+static void* WaitForRequest(void* arg) {
+  struct cras_audio_shm* shm = static_cast<struct cras_audio_shm*>(arg);
+  uint32_t seq = 0, id, frames, futex;
+  int rc = 0;
+
+  while (!rc) {
+    futex = cras_shm_wake_begin_wait(shm);
+    rc = cras_shm_wake_next_request(shm, &seq, &id, &frames);
+    if (!rc)
+      cras_shm_wake_wait(shm, futex);
+    cras_shm_wake_end_wait(shm);
+  }
+  cras_shm_wake_reply(shm, seq, frames, 0);
+  return NULL;
+}
+
+TEST_F(ShmTestSuite, WakeRequestReply) {
+  pthread_t tid;
+  uint32_t frames;
+
+  // Nobody is waiting, the request is picked up on the next check.
+  cras_shm_wake_request(&shm_, 1, 100);
+  EXPECT_EQ(1, shm_.header->wake.futex);
+  EXPECT_EQ(0, cras_shm_wake_get_reply(&shm_, &frames));
+  ASSERT_EQ(0, pthread_create(&tid, NULL, WaitForRequest, &shm_));
+  ASSERT_EQ(0, pthread_join(tid, NULL));
+  EXPECT_EQ(1, cras_shm_wake_get_reply(&shm_, &frames));
+  EXPECT_EQ(100, frames);
+
+  // The thread is most likely asleep when the next request comes.
+  shm_.header->wake.request_seq = 0;
+  shm_.header->wake.reply_seq = 0;
+  ASSERT_EQ(0, pthread_create(&tid, NULL, WaitForRequest, &shm_));
+  usleep(10000);
+  cras_shm_wake_request(&shm_, 1, 200);
+  ASSERT_EQ(0, pthread_join(tid, NULL));
+  EXPECT_EQ(1, cras_shm_wake_get_reply(&shm_, &frames));
+  EXPECT_EQ(200, frames);
+  EXPECT_EQ(0, shm_.header->wake.client_waiting);
+}
+
+// A ring is written and read in arbitrary amounts, wrapping at its end.
+TEST_F(ShmTestSuite, RingWriteReadWrap) {
+  ASSERT_EQ(0, cras_shm_set_ring(&shm_, 512));
+  EXPECT_EQ(CRAS_SHM_LAYOUT_RING, shm_.header->layout);
+  EXPECT_EQ(512, shm_.header->ring.size);
+  EXPECT_EQ(1, cras_shm_is_buffer_available(&shm_));
+  EXPECT_EQ(512, cras_shm_get_num_writeable(&shm_));
+
+  // Writes ahead of the reader don't need a buffer swap.
+  EXPECT_EQ(shm_.samples, cras_shm_get_write_buffer_base(&shm_));
+  cras_shm_buffer_written_start(&shm_, 200);
+  EXPECT_EQ(shm_.samples + 800, cras_shm_get_write_buffer_base(&shm_));
+  cras_shm_buffer_written_start(&shm_, 200);
+  EXPECT_EQ(400, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(0, cras_shm_is_buffer_available(&shm_));
+  EXPECT_EQ(112, cras_shm_get_num_writeable(&shm_));
+
+  // Partial reads.
+  buf_ = cras_shm_get_readable_frames(&shm_, 10, &frames_);
+  EXPECT_EQ(shm_.samples + 40, buf_);
+  EXPECT_EQ(390, frames_);
+  cras_shm_buffer_read(&shm_, 350);
+  EXPECT_EQ(50, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(1, cras_shm_is_buffer_available(&shm_));
+
+  // Only the frames up to the end of the ring are contiguous.
+  EXPECT_EQ(112, cras_shm_get_num_writeable(&shm_));
+  cras_shm_buffer_written_start(&shm_, 112);
+  EXPECT_EQ(shm_.samples, cras_shm_get_write_buffer_base(&shm_));
+  EXPECT_EQ(350, cras_shm_get_num_writeable(&shm_));
+  cras_shm_buffer_written_start(&shm_, 100);
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 1400, buf_);
+  EXPECT_EQ(162, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 162, &frames_);
+  EXPECT_EQ(shm_.samples, buf_);
+  EXPECT_EQ(100, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 262, &frames_);
+  EXPECT_EQ(NULL, buf_);
+  EXPECT_EQ(0, frames_);
+
+  // Reads can't go past the writer.
+  cras_shm_buffer_read(&shm_, 1000);
+  EXPECT_EQ(0, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(shm_.header->ring.write, shm_.header->ring.read);
+
+  // The legacy fields are left alone.
+  EXPECT_EQ(0, shm_.header->write_offset[0]);
+  EXPECT_EQ(0, shm_.header->write_buf_idx);
+  EXPECT_EQ(0, shm_.header->read_buf_idx);
+}
+
+// The counters are free running and keep working when they wrap, the
+// positions in the ring carry on from where they were.
+TEST_F(ShmTestSuite, RingCounterWrap) {
+  ASSERT_EQ(0, cras_shm_set_ring(&shm_, 512));
+  shm_.header->ring.read = UINT32_MAX - 10;
+  shm_.header->ring.write = UINT32_MAX - 10;
+  EXPECT_EQ(shm_.samples + 501 * 4, cras_shm_get_write_buffer_base(&shm_));
+  EXPECT_EQ(11, cras_shm_get_num_writeable(&shm_));
+  cras_shm_buffer_written_start(&shm_, 11);
+  EXPECT_EQ(shm_.samples, cras_shm_get_write_buffer_base(&shm_));
+  cras_shm_buffer_written_start(&shm_, 89);
+  EXPECT_EQ(89, shm_.header->ring.write);
+  EXPECT_EQ(shm_.samples + 89 * 4, cras_shm_get_write_buffer_base(&shm_));
+  EXPECT_EQ(100, cras_shm_get_frames(&shm_));
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 501 * 4, buf_);
+  EXPECT_EQ(11, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 11, &frames_);
+  EXPECT_EQ(shm_.samples, buf_);
+  EXPECT_EQ(89, frames_);
+
+  cras_shm_buffer_read(&shm_, 60);
+  EXPECT_EQ(40, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(49, shm_.header->ring.read);
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 49 * 4, buf_);
+  EXPECT_EQ(40, frames_);
+}
+
+// Counters from a misbehaving client never point outside the ring.
+TEST_F(ShmTestSuite, RingCorruptCounters) {
+  ASSERT_EQ(0, cras_shm_set_ring(&shm_, 512));
+  shm_.header->ring.write = 12345;
+  EXPECT_EQ(512, cras_shm_get_frames(&shm_));
+  buf_ = cras_shm_get_readable_frames(&shm_, 511, &frames_);
+  EXPECT_EQ(shm_.samples + 511 * 4, buf_);
+  EXPECT_EQ(1, frames_);
+
+  // The size in the header is only used by the client.
+  shm_.header->ring.size = 100000;
+  shm_.header->ring.read = 511;
+  buf_ = cras_shm_get_readable_frames(&shm_, 10, &frames_);
+  EXPECT_EQ(shm_.samples + 9 * 4, buf_);
+  EXPECT_EQ(502, frames_);
+}
+
+TEST_F(ShmTestSuite, RingSetupAndCopyConfig) {
+  struct cras_audio_shm client;
+
+  EXPECT_EQ(-EINVAL, cras_shm_set_ring(&shm_, 0));
+  EXPECT_EQ(-EINVAL, cras_shm_set_ring(&shm_, 513));
+  EXPECT_EQ(-EINVAL, cras_shm_set_ring(&shm_, 500));
+  EXPECT_EQ(CRAS_SHM_LAYOUT_DOUBLE_BUFFER, shm_.header->layout);
+
+  // A client of a double buffer stays on the double buffer.
+  memset(&client, 0, sizeof(client));
+  client.header = shm_.header;
+  client.samples_info.length = 2048;
+  cras_shm_copy_shared_config(&client);
+  EXPECT_EQ(0, cras_shm_is_ring(&client));
+  EXPECT_EQ(1024, client.config.used_size);
+
+  ASSERT_EQ(0, cras_shm_set_ring(&shm_, 512));
+  cras_shm_copy_shared_config(&client);
+  EXPECT_EQ(1, cras_shm_is_ring(&client));
+  EXPECT_EQ(512, client.ring_frames);
+
+  // A ring larger than the samples area is ignored.
+  client.samples_info.length = 1024;
+  cras_shm_copy_shared_config(&client);
+  EXPECT_EQ(0, cras_shm_is_ring(&client));
+
+  // So is a ring that isn't a power of two.
+  client.samples_info.length = 2048;
+  shm_.header->ring.size = 500;
+  cras_shm_copy_shared_config(&client);
+  EXPECT_EQ(0, cras_shm_is_ring(&client));
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
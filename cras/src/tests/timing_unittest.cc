@@ -20,6 +20,13 @@ extern "C" {
 #include "utlist.h"
 
 struct audio_thread_event_log* atlog;
+struct audio_thread_tracer* attrace;
+int attrace_writers;
+void audio_thread_trace_data(const struct timespec* now,
+                             enum AUDIO_THREAD_LOG_EVENTS event,
+                             uint32_t data1,
+                             uint32_t data2,
+                             uint32_t data3) {}
 }
 
 #include "dev_io_stubs.h"
@@ -1168,6 +1175,12 @@ float input_data_get_software_gain_scaler(struct input_data* data,
   return 1.0;
 }
 
+unsigned int input_data_get_delay_frames(struct input_data* data,
+                                         struct cras_rstream* stream,
+                                         unsigned int dev_rate) {
+  return 0;
+}
+
 struct cras_audio_format* cras_rstream_post_processing_format(
     const struct cras_rstream* stream,
     void* dev_ptr) {
@@ -1182,6 +1195,9 @@ void* buffer_share_get_data(const struct buffer_share* mix, unsigned int id) {
 };
 void cras_apm_list_start_apm(struct cras_apm_list* list, void* dev_ptr){};
 void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr){};
+bool cras_system_get_polyphase_resampler_enabled() {
+  return false;
+}
 }  // extern "C"
 
 }  //  namespace
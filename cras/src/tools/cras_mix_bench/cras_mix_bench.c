@@ -0,0 +1,197 @@
+/* Copyright 2026 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Times every cras_mix_ops variant built in and supported by this CPU, for
+ * each sample format and a few channel counts.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cras_mix_ops.h"
+
+/* Constant for converting time to nanoseconds. */
+#define BILLION 1000000000LL
+/* Frames processed per call, the size of a typical audio thread block. */
+#define FRAMES 480
+/* Number of calls timed for each operation. */
+#define ITERATIONS 20000
+/* Upper bound of the channel counts below. */
+#define MAX_CHANNELS 8
+
+struct variant {
+	const char *name;
+	const struct cras_mix_ops *ops;
+	int supported;
+};
+
+static const snd_pcm_format_t formats[] = {
+	SND_PCM_FORMAT_S16_LE,
+	SND_PCM_FORMAT_S24_LE,
+	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S24_3LE,
+};
+
+static const unsigned int channels[] = { 1, 2, 6, 8 };
+
+static uint8_t src[FRAMES * MAX_CHANNELS * 4];
+static uint8_t dst[FRAMES * MAX_CHANNELS * 4];
+
+static unsigned int format_bytes(snd_pcm_format_t fmt)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return 2;
+	case SND_PCM_FORMAT_S24_3LE:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+static const char *format_name(snd_pcm_format_t fmt)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return "S16_LE";
+	case SND_PCM_FORMAT_S24_LE:
+		return "S24_LE";
+	case SND_PCM_FORMAT_S32_LE:
+		return "S32_LE";
+	case SND_PCM_FORMAT_S24_3LE:
+		return "S24_3LE";
+	default:
+		return "?";
+	}
+}
+
+static void fill_random(uint8_t *buf, size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; i++)
+		buf[i] = rand() & 0xff;
+}
+
+static int64_t elapsed_ns(const struct timespec *start,
+			  const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * BILLION +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+enum bench_op {
+	BENCH_ADD,
+	BENCH_ADD_SCALED,
+	BENCH_SCALE,
+	BENCH_SCALE_INC,
+	BENCH_SCALE_CHECK,
+	BENCH_STRIDE,
+	BENCH_NUM_OPS,
+};
+
+static const char *op_names[BENCH_NUM_OPS] = {
+	"add", "add_scaled", "scale", "scale_inc", "scale_chk", "stride",
+};
+
+/* Returns the average time of one call, in nanoseconds. */
+static double run_op(const struct cras_mix_ops *ops, enum bench_op op,
+		     snd_pcm_format_t fmt, unsigned int num_channels)
+{
+	unsigned int count = FRAMES * num_channels;
+	unsigned int frame_bytes = format_bytes(fmt) * num_channels;
+	struct timespec start, end;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ITERATIONS; i++) {
+		switch (op) {
+		case BENCH_ADD:
+			ops->add(fmt, dst, src, count, 1, 0, 1.0f);
+			break;
+		case BENCH_ADD_SCALED:
+			ops->add(fmt, dst, src, count, 1, 0, 0.5f);
+			break;
+		case BENCH_SCALE:
+			ops->scale_buffer(fmt, dst, count, 0.999f);
+			break;
+		case BENCH_SCALE_INC:
+			ops->scale_buffer_increment(fmt, dst, count, 0.5f,
+						    0.0001f, 1.0f,
+						    num_channels);
+			break;
+		case BENCH_SCALE_CHECK:
+			ops->scale_buffer_check(fmt, dst, count, 0.999f, 0.0f,
+						1.0f, num_channels, 1);
+			break;
+		case BENCH_STRIDE:
+			/* Mix the first source channel into every channel
+			 * of the destination, like the channel remix does. */
+			ops->add_scale_stride(fmt, dst, src, FRAMES,
+					      frame_bytes, frame_bytes, 0.5f);
+			break;
+		default:
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (double)elapsed_ns(&start, &end) / ITERATIONS;
+}
+
+int main(int argc, char **argv)
+{
+	struct variant variants[] = {
+		{ "c", &mixer_ops, 1 },
+#if defined HAVE_SSE42
+		{ "sse42", &mixer_ops_sse42,
+		  __builtin_cpu_supports("sse4.2") },
+#endif
+#if defined HAVE_AVX
+		{ "avx", &mixer_ops_avx, __builtin_cpu_supports("avx") },
+#endif
+#if defined HAVE_AVX2
+		{ "avx2", &mixer_ops_avx2, __builtin_cpu_supports("avx2") },
+#endif
+#if defined HAVE_FMA
+		{ "fma", &mixer_ops_fma, __builtin_cpu_supports("fma") },
+#endif
+	};
+	unsigned int num_variants = sizeof(variants) / sizeof(variants[0]);
+	unsigned int f, c, op, v;
+	double base;
+	double ns;
+
+	srand(1);
+	fill_random(src, sizeof(src));
+
+	printf("%-8s %2s %-10s %-6s %10s %8s\n", "format", "ch", "op",
+	       "ops", "ns/call", "speedup");
+	for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+		for (c = 0; c < sizeof(channels) / sizeof(channels[0]); c++) {
+			for (op = 0; op < BENCH_NUM_OPS; op++) {
+				base = 0.0;
+				for (v = 0; v < num_variants; v++) {
+					if (!variants[v].supported)
+						continue;
+					fill_random(dst, sizeof(dst));
+					ns = run_op(variants[v].ops, op,
+						    formats[f], channels[c]);
+					if (v == 0)
+						base = ns;
+					printf("%-8s %2u %-10s %-6s %10.1f "
+					       "%7.2fx\n",
+					       format_name(formats[f]),
+					       channels[c], op_names[op],
+					       variants[v].name, ns, base / ns);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
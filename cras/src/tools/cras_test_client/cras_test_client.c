@@ -10,6 +10,7 @@
 #include <limits.h>
 #include <math.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -71,6 +72,34 @@ static const struct timespec follow_atlog_sleep_ts = {
 	0, 50 * 1000 * 1000 /* 50 ms. */
 };
 
+/* Default size of the atlog trace ring, 32MB of events. */
+#define ATLOG_TRACE_EVENTS (1 << 20)
+/* Events moved from the trace ring to the file at once. */
+#define ATLOG_TRACE_READ_EVENTS 4096
+
+/* Header of the binary atlog trace files, followed by struct
+ * audio_thread_trace_event records. A record tagged AUDIO_THREAD_TRACE_DROPPED
+ * tells that data1 events were dropped before it. Convert the files with
+ * tools/atlog_trace_to_json.py.
+ *    magic - "CRASATRC".
+ *    version - Version of the format, 1.
+ *    event_size - Size of each record.
+ *    realtime_offset_ns - CLOCK_REALTIME minus CLOCK_MONOTONIC_RAW when the
+ *        trace started.
+ */
+struct __attribute__((__packed__)) atlog_trace_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+	int64_t realtime_offset_ns;
+};
+
+static volatile sig_atomic_t atlog_trace_stop;
+static int atlog_trace_err;
+
+/* Interval between two prints of the audio thread timing statistics. */
+static const struct timespec follow_timing_sleep_ts = { 1, 0 };
+
 /* Conditional so the client thread can signal that main should exit. */
 static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
@@ -680,12 +709,33 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		printf("%-30s dev:%u frames:%u\n", "DEV_DROP_FRAMES", data1,
 		       data2);
 		break;
+	case AUDIO_THREAD_STREAMS_ADDED:
+		printf("%-30s num_streams:%u num_devs:%u\n", "STREAMS_ADDED",
+		       data1, data2);
+		break;
 	default:
 		printf("%-30s tag:%u\n", "UNKNOWN", tag);
 		break;
 	}
 }
 
+/* Prints the average and longest time per block of the output stages. */
+static void print_output_stage_times(const struct audio_dev_debug_info *di)
+{
+	uint64_t blocks = di->num_output_blocks;
+	int i;
+
+	if (di->direction != CRAS_STREAM_OUTPUT || !blocks)
+		return;
+
+	printf("output_blocks: %llu\n", (unsigned long long)blocks);
+	for (i = 0; i < CRAS_NUM_OUTPUT_STAGES; i++)
+		printf("%s: avg %.1f us max %.1f us\n",
+		       cras_output_stage_str(i),
+		       di->stage_total_ns[i] / 1000.0 / blocks,
+		       di->stage_max_ns[i] / 1000.0);
+}
+
 static void print_audio_debug_info(const struct audio_debug_info *info)
 {
 	time_t sec_offset;
@@ -731,6 +781,7 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 		       (unsigned int)info->devs[i].longest_wake_sec,
 		       (unsigned int)info->devs[i].longest_wake_nsec,
 		       info->devs[i].software_gain_scaler);
+		print_output_stage_times(&info->devs[i]);
 		printf("\n");
 	}
 
@@ -1490,6 +1541,153 @@ fail:
 	printf("Failed to get audio thread log.\n");
 }
 
+static void show_timing_hist(const char *name,
+			     const struct audio_thread_hist *hist)
+{
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	unsigned int i;
+
+	printf("%-12s %10llu", name, (unsigned long long)hist->count);
+	for (i = 0; i < ARRAY_SIZE(percentiles); i++)
+		printf(" %9.1f",
+		       audio_thread_hist_percentile(hist, percentiles[i]) /
+			       1000.0);
+	printf(" %9.1f\n", hist->max_ns / 1000.0);
+}
+
+static void cras_show_continuous_timing(struct cras_client *client)
+{
+	struct audio_thread_timing timing;
+	struct timespec wait_time;
+	int rc;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+	cras_client_get_atlog_access(client, unlock_main_thread);
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	rc = pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+
+	if (rc)
+		goto fail;
+
+	setlinebuf(stdout);
+
+	while (cras_client_get_audio_thread_timing(client, &timing) == 0) {
+		printf("%-12s %10s %9s %9s %9s %9s %9s\n", "(us)", "count",
+		       "p50", "p90", "p99", "p99.9", "max");
+		show_timing_hist("wake_jitter", &timing.wake_jitter);
+		show_timing_hist("run_cpu", &timing.run_cpu);
+		show_timing_hist("run_wall", &timing.run_wall);
+		printf("busyloops %llu\n\n",
+		       (unsigned long long)timing.busyloops);
+		nanosleep(&follow_timing_sleep_ts, NULL);
+	}
+fail:
+	printf("Failed to get audio thread timing.\n");
+}
+
+static void atlog_trace_started(struct cras_client *client, int err)
+{
+	atlog_trace_err = err;
+	unlock_main_thread(client);
+}
+
+static void atlog_trace_sigint(int sig)
+{
+	atlog_trace_stop = 1;
+}
+
+/* Streams every audio thread event to |filename| until interrupted. */
+static void cras_atlog_trace(struct cras_client *client, const char *filename)
+{
+	struct audio_thread_trace_event *events;
+	struct atlog_trace_file_header header;
+	struct audio_thread_trace_event drop;
+	struct timespec wait_time, now;
+	uint64_t written = 0, dropped, last_dropped = 0;
+	time_t sec_offset;
+	int32_t nsec_offset;
+	FILE *f;
+	int len, rc;
+
+	f = fopen(filename, "wb");
+	if (!f) {
+		printf("Failed to open %s: %s\n", filename, strerror(errno));
+		return;
+	}
+	events = (struct audio_thread_trace_event *)calloc(
+		ATLOG_TRACE_READ_EVENTS, sizeof(*events));
+	if (!events)
+		goto close_file;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client); /* To synchronize data. */
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	rc = cras_client_start_atlog_trace(client, ATLOG_TRACE_EVENTS,
+					   atlog_trace_started);
+	if (rc == 0)
+		rc = pthread_cond_timedwait(&done_cond, &done_mutex,
+					    &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+	if (rc == 0)
+		rc = atlog_trace_err;
+	if (rc) {
+		printf("Failed to start audio thread trace: %d\n", rc);
+		goto free_events;
+	}
+
+	fill_time_offset(&sec_offset, &nsec_offset);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "CRASATRC", sizeof(header.magic));
+	header.version = 1;
+	header.event_size = sizeof(struct audio_thread_trace_event);
+	header.realtime_offset_ns = sec_offset * 1000000000LL + nsec_offset;
+	fwrite(&header, sizeof(header), 1, f);
+
+	signal(SIGINT, atlog_trace_sigint);
+	printf("Tracing to %s, Ctrl-C to stop.\n", filename);
+	while (!atlog_trace_stop) {
+		len = cras_client_read_atlog_trace(
+			client, events, ATLOG_TRACE_READ_EVENTS, &dropped);
+		if (len < 0)
+			break;
+		if (dropped != last_dropped) {
+			clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+			memset(&drop, 0, sizeof(drop));
+			drop.nsec = now.tv_sec * 1000000000ULL + now.tv_nsec;
+			drop.tag = AUDIO_THREAD_TRACE_DROPPED;
+			drop.data1 = dropped - last_dropped;
+			fwrite(&drop, sizeof(drop), 1, f);
+			last_dropped = dropped;
+		}
+		if (fwrite(events, sizeof(*events), len, f) != (size_t)len) {
+			printf("Failed to write %s\n", filename);
+			break;
+		}
+		written += len;
+		if (len < ATLOG_TRACE_READ_EVENTS)
+			nanosleep(&follow_atlog_sleep_ts, NULL);
+	}
+	signal(SIGINT, SIG_DFL);
+	cras_client_stop_atlog_trace(client);
+	printf("Wrote %" PRIu64 " events, %" PRIu64 " dropped.\n", written,
+	       last_dropped);
+
+free_events:
+	free(events);
+close_file:
+	fclose(f);
+}
+
 // clang-format off
 static struct option long_options[] = {
 	{"show_latency",        no_argument,            &show_latency, 1},
@@ -1549,6 +1747,8 @@ static struct option long_options[] = {
 	{"connection_type",     required_argument,      0, 'K'},
 	{"loopback_file",       required_argument,      0, 'L'},
 	{"mute_loop_test",      required_argument,      0, 'M'},
+	{"follow_timing",       no_argument,            0, 'N'},
+	{"atlog_trace",         required_argument,      0, 'O'},
 	{"playback_file",       required_argument,      0, 'P'},
 	{"stream_type",         required_argument,      0, 'T'},
 	{0, 0, 0, 0}
@@ -1567,6 +1767,9 @@ static void show_usage()
 	       "list\n");
 	printf("--add_test_dev <type> - "
 	       "Add a test iodev.\n");
+	printf("--atlog_trace <name> - "
+	       "Streams every audio thread event to a binary file until "
+	       "interrupted.\n");
 	printf("--block_size <N> - "
 	       "The number for frames per callback(dictates latency).\n");
 	printf("--capture_file <name> - "
@@ -1603,6 +1806,9 @@ static void show_usage()
 	       "Seconds to record or playback.\n");
 	printf("--follow_atlog - "
 	       "Continuously dumps audio thread event log.\n");
+	printf("--follow_timing - "
+	       "Continuously prints audio thread wake up jitter and run time "
+	       "percentiles.\n");
 	printf("--format <name> - "
 	       "The sample format. Either ");
 	for (i = 0; supported_formats[i].name; ++i)
@@ -2086,6 +2292,12 @@ int main(int argc, char **argv)
 		case 'J':
 			cras_show_continuous_atlog(client);
 			break;
+		case 'N':
+			cras_show_continuous_timing(client);
+			break;
+		case 'O':
+			cras_atlog_trace(client, optarg);
+			break;
 		case 'K':
 			new_conn_type = atoi(optarg);
 			if (cras_validate_connection_type(new_conn_type)) {
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# Copyright 2020 The Chromium OS Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+
+"""Converts an audio thread trace recorded with cras_test_client --atlog_trace
+to the Chrome trace event JSON format, viewable in chrome://tracing or
+Perfetto.
+
+Each event becomes an instant event on the thread that logged it, with its
+data and CPU as arguments. The time between a WAKE and the next SLEEP of a
+thread is shown as an "awake" slice.
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct('<8sIIq')
+EVENT = struct.Struct('<IIQIIIHBB')
+MAGIC = b'CRASATRC'
+DROPPED_TAG = 0xff
+
+
+def ReadEventNames(types_header):
+  """Returns the names of enum AUDIO_THREAD_LOG_EVENTS, by value."""
+  with open(types_header) as f:
+    text = f.read()
+  match = re.search(r'enum AUDIO_THREAD_LOG_EVENTS \{(.*?)\};', text, re.S)
+  if not match:
+    sys.exit('AUDIO_THREAD_LOG_EVENTS not found in %s' % types_header)
+  names = re.findall(r'AUDIO_THREAD_(\w+),', match.group(1))
+  return dict(enumerate(names))
+
+
+def ReadEvents(path):
+  """Yields the records of a trace file as tuples of EVENT fields."""
+  with open(path, 'rb') as f:
+    magic, version, event_size, _ = HEADER.unpack(f.read(HEADER.size))
+    if magic != MAGIC or version != 1 or event_size != EVENT.size:
+      sys.exit('%s is not an atlog trace' % path)
+    while True:
+      data = f.read(EVENT.size)
+      if len(data) < EVENT.size:
+        return
+      yield EVENT.unpack(data)
+
+
+def Convert(path, names):
+  trace = []
+  awake = {}
+  for _, tid, nsec, data1, data2, data3, cpu, tag, _ in ReadEvents(path):
+    ts = nsec / 1000.0
+    if tag == DROPPED_TAG:
+      trace.append({'name': 'DROPPED', 'ph': 'i', 's': 'g', 'ts': ts,
+                    'pid': 0, 'tid': 0, 'args': {'events': data1}})
+      # The matching SLEEP may be lost.
+      awake.clear()
+      continue
+
+    name = names.get(tag, 'TAG_%d' % tag)
+    trace.append({'name': name, 'ph': 'i', 's': 't', 'ts': ts, 'pid': 0,
+                  'tid': tid, 'args': {'data1': data1, 'data2': data2,
+                                       'data3': data3, 'cpu': cpu}})
+    if name == 'WAKE':
+      awake[tid] = ts
+    elif name == 'SLEEP' and tid in awake:
+      start = awake.pop(tid)
+      trace.append({'name': 'awake', 'ph': 'X', 'ts': start,
+                    'dur': ts - start, 'pid': 0, 'tid': tid})
+
+  trace.append({'name': 'process_name', 'ph': 'M', 'pid': 0,
+                'args': {'name': 'cras audio threads'}})
+  return {'traceEvents': trace, 'displayTimeUnit': 'ns'}
+
+
+def main():
+  default_header = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                '..', 'src', 'common', 'cras_types.h')
+  parser = argparse.ArgumentParser(description=__doc__)
+  parser.add_argument('trace', help='binary trace from --atlog_trace')
+  parser.add_argument('output', help='JSON file to write')
+  parser.add_argument('--types_header', default=default_header,
+                      help='cras_types.h, for the event names')
+  args = parser.parse_args()
+
+  names = ReadEventNames(args.types_header)
+  with open(args.output, 'w') as f:
+    json.dump(Convert(args.trace, names), f)
+
+
+if __name__ == '__main__':
+  main()